@@ -0,0 +1,161 @@
+// Throughput of a StorageClient under fan-in: many callers, standing in for
+// actors, each keeping a few small gets and sets in flight against a loopback
+// server over the client's single connection. Runs without batching, then with
+// a few batch windows, and reports operations per second, requests per frame
+// and median latency, and multi_get throughput.
+//
+// Usage: batching_bench [operations per caller] [callers] [depth]
+
+#include "frame_session.h"
+#include "storage_client.h"
+#include "storage_protocol.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+namespace {
+
+void accept_forever(tcp::acceptor &acceptor, const FrameSession::Handler &handler) {
+    acceptor.async_accept([&acceptor, &handler](const boost::system::error_code &ec, tcp::socket socket) {
+        if (!ec) {
+            std::make_shared<FrameSession>(std::move(socket), handler)->start();
+            accept_forever(acceptor, handler);
+        }
+    });
+}
+
+// Answers gets with a fixed 100-byte value and acknowledges everything else,
+// so the client and the framing are what is measured
+Future<Message> serve(Opcode opcode, std::string_view payload) {
+    MessageView request(payload);
+    (void) request.bytes(0);
+    if (opcode == Opcode::Get) {
+        return make_ready_future(encode_get_response(std::string(100, 'v')));
+    }
+    return make_ready_future(Message());
+}
+
+std::string key_of(size_t i) {
+    return "user:" + std::to_string(i % 100'000);
+}
+
+void run(ConnectionPool &pool, std::chrono::microseconds window, size_t operations, size_t callers, size_t depth) {
+    StorageClient::Options options;
+    options.batch_window = window;
+    StorageClient client(pool, options);
+    client.get(key_of(0)).get();
+
+    std::vector<std::vector<double>> latencies(callers);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t c = 0; c < callers; c++) {
+        threads.emplace_back([&, c] {
+            std::minstd_rand random(static_cast<uint32_t>(c + 1));
+            std::vector<Future<Void>> window;
+            latencies[c].reserve(operations / depth + 1);
+            for (size_t done = 0; done < operations;) {
+                auto issued = std::chrono::steady_clock::now();
+                window.clear();
+                for (size_t i = 0; i < depth && done < operations; i++, done++) {
+                    std::string key = key_of(random());
+                    if (random() % 4 == 0) {
+                        window.push_back(client.set(std::move(key), std::string(100, 'v')));
+                    } else {
+                        window.push_back(client.get(std::move(key)).then(
+                                [](const std::optional<std::string> &) {}));
+                    }
+                }
+                for (auto &operation: window) {
+                    operation.get();
+                }
+                std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - issued;
+                latencies[c].push_back(elapsed.count());
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> all;
+    for (auto &samples: latencies) {
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    std::nth_element(all.begin(), all.begin() + static_cast<std::ptrdiff_t>(all.size() / 2), all.end());
+    double per_frame = 1.0;
+    if (const RequestBatcher *batcher = client.batcher()) {
+        per_frame = static_cast<double>(batcher->requests()) / static_cast<double>(batcher->frames());
+    }
+    char label[32];
+    std::snprintf(label, sizeof(label), window.count() == 0 ? "unbatched" : "window %lld us",
+                  static_cast<long long>(window.count()));
+    std::printf("%-16s %12.0f %14.1f %14.1f\n", label,
+                static_cast<double>(operations * callers) / elapsed.count(), per_frame, all[all.size() / 2]);
+    client.close().get();
+}
+
+// Reads keys in groups of `group` with multi_get from one caller.
+void run_multi_get(ConnectionPool &pool, std::chrono::microseconds window, size_t operations, size_t group) {
+    StorageClient::Options options;
+    options.batch_window = window;
+    StorageClient client(pool, options);
+    client.get(key_of(0)).get();
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t done = 0; done < operations; done += group) {
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < group; i++) {
+            keys.push_back(key_of(done + i));
+        }
+        client.multi_get(std::move(keys)).get();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    char label[32];
+    std::snprintf(label, sizeof(label), window.count() == 0 ? "unbatched" : "window %lld us",
+                  static_cast<long long>(window.count()));
+    std::printf("%-16s %12.0f\n", label, static_cast<double>(operations / group * group) / elapsed.count());
+    client.close().get();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t operations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20'000;
+    size_t callers = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16;
+    size_t depth = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 4;
+
+    boost::asio::io_context server_context;
+    boost::asio::io_context client_context;
+    auto server_work = boost::asio::make_work_guard(server_context);
+    auto client_work = boost::asio::make_work_guard(client_context);
+    FrameSession::Handler handler = serve;
+    tcp::acceptor acceptor(server_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    accept_forever(acceptor, handler);
+    std::thread server_thread([&server_context] { server_context.run(); });
+    std::thread client_thread([&client_context] { client_context.run(); });
+
+    {
+        ConnectionPool pool(client_context, {acceptor.local_endpoint()}, 0, 2);
+        std::printf("%zu callers, %zu operations in flight each\n", callers, depth);
+        std::printf("%-16s %12s %14s %14s\n", "", "ops/s", "requests/frame", "p50 us/window");
+        for (long long window: {0, 20, 100, 500}) {
+            run(pool, std::chrono::microseconds(window), operations, callers, depth);
+        }
+        std::printf("\nmulti_get of 32 keys, 1 caller\n%-16s %12s\n", "", "keys/s");
+        for (long long window: {0, 100}) {
+            run_multi_get(pool, std::chrono::microseconds(window), operations * 4, 32);
+        }
+    }
+
+    client_work.reset();
+    client_context.stop();
+    client_thread.join();
+    server_work.reset();
+    server_context.stop();
+    server_thread.join();
+    return 0;
+}
@@ -0,0 +1,82 @@
+// Latency of getting a usable socket: ConnectionPool::checkout() of a warm
+// connection against opening a fresh TCP connection per request, which is
+// what get_connection() used to do. A loopback acceptor runs in-process.
+//
+// Usage: connection_pool_bench [checkouts]
+
+#include "connection_pool.h"
+#include "histogram.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+void accept_forever(tcp::acceptor &acceptor, std::vector<std::unique_ptr<tcp::socket>> &accepted) {
+    acceptor.async_accept([&acceptor, &accepted](const boost::system::error_code &ec, tcp::socket socket) {
+        if (!ec) {
+            accepted.push_back(std::make_unique<tcp::socket>(std::move(socket)));
+            accept_forever(acceptor, accepted);
+        }
+    });
+}
+
+// Prints the percentiles of latencies, recorded in nanoseconds, in microseconds.
+void report(const char *name, const Histogram &latencies) {
+    auto micros = [](uint64_t nanos) { return static_cast<double>(nanos) / 1e3; };
+    std::printf("%-22s %10.2f %10.2f %10.2f %10.2f\n", name, micros(latencies.percentile(50)),
+                micros(latencies.percentile(99)), micros(latencies.percentile(99.9)), micros(latencies.max()));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t checkouts = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100'000;
+
+    boost::asio::io_context io_context;
+    auto work = boost::asio::make_work_guard(io_context);
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    std::vector<std::unique_ptr<tcp::socket>> accepted;
+    accept_forever(acceptor, accepted);
+    std::thread io_thread([&io_context] { io_context.run(); });
+
+    std::vector<tcp::endpoint> endpoints = {acceptor.local_endpoint()};
+    Histogram pooled;
+    {
+        ConnectionPool pool(io_context, endpoints, 4, 4);
+        {
+            // Wait until the pool is warm
+            std::vector<ConnectionPool::Lease> warm;
+            for (int i = 0; i < 4; i++) {
+                warm.push_back(pool.checkout().get());
+            }
+        }
+        for (size_t i = 0; i < checkouts; i++) {
+            auto start = std::chrono::steady_clock::now();
+            ConnectionPool::Lease lease = pool.checkout().get();
+            std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+            pooled.record(static_cast<uint64_t>(elapsed.count()));
+        }
+    }
+
+    Histogram fresh;
+    size_t connects = std::min<size_t>(checkouts, 2'000);
+    for (size_t i = 0; i < connects; i++) {
+        auto start = std::chrono::steady_clock::now();
+        tcp::socket socket(io_context);
+        socket.connect(endpoints.front());
+        std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+        fresh.record(static_cast<uint64_t>(elapsed.count()));
+    }
+
+    std::printf("%-22s %10s %10s %10s %10s\n", "usable socket (us)", "p50", "p99", "p99.9", "max");
+    report("pooled checkout", pooled);
+    report("connect per request", fresh);
+
+    work.reset();
+    io_context.stop();
+    io_thread.join();
+    return 0;
+}
@@ -0,0 +1,177 @@
+// Request latency through ConnectionPool under each endpoint selection
+// strategy when one of three in-process echo servers is slow. Round-robin
+// keeps sending a third of the traffic to the slow server; least-outstanding
+// and power-of-two-choices shift load towards the fast ones.
+//
+// Usage: endpoint_selection_bench [requests per client] [slow server delay in us]
+
+#include "connection_pool.h"
+#include "histogram.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+constexpr size_t kMessageSize = 16;
+
+// Echoes fixed-size messages back, after a delay if one is configured.
+class EchoServer {
+public:
+    EchoServer(boost::asio::io_context &io_context, std::chrono::microseconds delay)
+            : m_acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+              m_delay(delay) {
+        accept();
+    }
+
+    tcp::endpoint endpoint() const {
+        return m_acceptor.local_endpoint();
+    }
+
+private:
+    struct Session : std::enable_shared_from_this<Session> {
+        Session(tcp::socket socket, std::chrono::microseconds delay)
+                : socket(std::move(socket)), timer(this->socket.get_executor()), delay(delay) {}
+
+        void read() {
+            boost::asio::async_read(socket, boost::asio::buffer(buffer),
+                                    [self = shared_from_this()](const boost::system::error_code &ec, size_t) {
+                                        if (ec) {
+                                            return;
+                                        }
+                                        if (self->delay.count() == 0) {
+                                            self->write();
+                                            return;
+                                        }
+                                        self->timer.expires_after(self->delay);
+                                        self->timer.async_wait([self](const boost::system::error_code &) {
+                                            self->write();
+                                        });
+                                    });
+        }
+
+        void write() {
+            boost::asio::async_write(socket, boost::asio::buffer(buffer),
+                                     [self = shared_from_this()](const boost::system::error_code &ec, size_t) {
+                                         if (!ec) {
+                                             self->read();
+                                         }
+                                     });
+        }
+
+        tcp::socket socket;
+        boost::asio::steady_timer timer;
+        std::chrono::microseconds delay;
+        std::array<char, kMessageSize> buffer{};
+    };
+
+    void accept() {
+        m_acceptor.async_accept([this](const boost::system::error_code &ec, tcp::socket socket) {
+            if (!ec) {
+                socket.set_option(tcp::no_delay(true));
+                std::make_shared<Session>(std::move(socket), m_delay)->read();
+                accept();
+            }
+        });
+    }
+
+    tcp::acceptor m_acceptor;
+    std::chrono::microseconds m_delay;
+};
+
+// Prints the percentiles of latencies, recorded in nanoseconds, in
+// microseconds, and the share of requests that went to the last endpoint.
+void report(const char *name, const Histogram &latencies, const std::vector<size_t> &per_endpoint) {
+    auto micros = [](uint64_t nanos) { return static_cast<double>(nanos) / 1e3; };
+    double total = 0;
+    for (size_t count: per_endpoint) {
+        total += static_cast<double>(count);
+    }
+    std::printf("%-22s %10.1f %10.1f %10.1f %10.1f %9.1f%%\n", name, micros(latencies.percentile(50)),
+                micros(latencies.percentile(99)), micros(latencies.percentile(99.9)), micros(latencies.max()),
+                100.0 * static_cast<double>(per_endpoint.back()) / total);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t requests = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5'000;
+    std::chrono::microseconds delay(argc > 2 ? std::strtoll(argv[2], nullptr, 10) : 2'000);
+    constexpr size_t kClients = 8;
+
+    // Servers and the pool run on separate io_contexts so slow responses do
+    // not hold up connection handling on the client side
+    boost::asio::io_context server_context;
+    boost::asio::io_context client_context;
+    auto server_work = boost::asio::make_work_guard(server_context);
+    auto client_work = boost::asio::make_work_guard(client_context);
+    std::vector<std::unique_ptr<EchoServer>> servers;
+    servers.push_back(std::make_unique<EchoServer>(server_context, std::chrono::microseconds(0)));
+    servers.push_back(std::make_unique<EchoServer>(server_context, std::chrono::microseconds(0)));
+    servers.push_back(std::make_unique<EchoServer>(server_context, delay));
+    std::vector<tcp::endpoint> endpoints;
+    for (auto &server: servers) {
+        endpoints.push_back(server->endpoint());
+    }
+    std::thread server_thread([&server_context] { server_context.run(); });
+    std::thread client_thread([&client_context] { client_context.run(); });
+
+    std::printf("%-22s %10s %10s %10s %10s %10s\n", "request latency (us)", "p50", "p99", "p99.9", "max", "slow share");
+    const std::pair<const char *, SelectionStrategy> strategies[] = {
+            {"round robin",            SelectionStrategy::RoundRobin},
+            {"least outstanding",      SelectionStrategy::LeastOutstanding},
+            {"power of two choices",   SelectionStrategy::PowerOfTwoChoices},
+    };
+    for (const auto &[name, strategy]: strategies) {
+        ConnectionPool pool(client_context, endpoints, kClients, kClients, strategy);
+        std::vector<Histogram> latencies(kClients);
+        std::vector<std::vector<size_t>> counts(kClients, std::vector<size_t>(endpoints.size()));
+        std::vector<std::thread> clients;
+        for (size_t c = 0; c < kClients; c++) {
+            clients.emplace_back([&pool, &latencies, &counts, requests, c] {
+                std::array<char, kMessageSize> buffer{};
+                for (size_t i = 0; i < requests; i++) {
+                    auto start = std::chrono::steady_clock::now();
+                    ConnectionPool::Lease lease = pool.checkout().get();
+                    boost::system::error_code ec;
+                    boost::asio::write(lease.socket(), boost::asio::buffer(buffer), ec);
+                    if (!ec) {
+                        boost::asio::read(lease.socket(), boost::asio::buffer(buffer), ec);
+                    }
+                    if (ec) {
+                        lease.invalidate();
+                    }
+                    size_t index = std::find(pool.endpoints().begin(), pool.endpoints().end(), lease.endpoint()) -
+                                   pool.endpoints().begin();
+                    lease.release();
+                    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+                    latencies[c].record(static_cast<uint64_t>(elapsed.count()));
+                    counts[c][index]++;
+                }
+            });
+        }
+        for (auto &client: clients) {
+            client.join();
+        }
+        Histogram all;
+        std::vector<size_t> per_endpoint(endpoints.size());
+        for (size_t c = 0; c < kClients; c++) {
+            all.merge(latencies[c]);
+            for (size_t e = 0; e < endpoints.size(); e++) {
+                per_endpoint[e] += counts[c][e];
+            }
+        }
+        report(name, all, per_endpoint);
+    }
+
+    client_work.reset();
+    client_context.stop();
+    client_thread.join();
+    server_work.reset();
+    server_context.stop();
+    server_thread.join();
+    return 0;
+}
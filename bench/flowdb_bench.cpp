@@ -0,0 +1,720 @@
+// Regression suite for the pieces the server is built from, with results as
+// JSON on stdout so runs can be diffed between commits:
+//
+//   thread_pool.submit      tasks per second submitted from outside the pool
+//   thread_pool.wakeup      submit() to the task starting, on an idle pool
+//   actor.round_trip        tell() to another actor and back
+//   actor.round_trip.traced the same with event tracing on
+//   actor.round_trip.cores  the same between actors on two pinned cores in
+//                           thread-per-core mode
+//   actor.overload          tell() to a slow actor from every thread at once,
+//                           held back by a bounded mailbox
+//   future.wakeup           set_value() to a thread blocked in get() waking
+//   connection_pool.checkout  checkout() of an idle socket to the lease
+//   metrics.record          cost of a runtime counter update and latency
+//                           sample, from every thread at once, and of a snapshot
+//   trace.emit              cost of recording a trace event, from every thread
+//                           at once, and of dumping the rings as JSON
+//   ycsb.<a|b|c>.closed     YCSB workloads A (50% updates), B (5%) and C
+//                           (reads only) over zipfian keys, against an
+//                           in-process server: clients that each wait for
+//                           their operation before issuing the next
+//   ycsb.<a|b|c>.open       the same at half the closed-loop throughput, on a
+//                           fixed schedule; latency counts from when an
+//                           operation was due, so a stall is charged to every
+//                           operation it delayed
+//
+// Latencies are in nanoseconds, as HDR histogram percentiles (histogram.h).
+// Progress goes to stderr.
+//
+// Usage: flowdb_bench [seconds per benchmark] [name prefix...]
+
+#include "connection_pool.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "runtime.h"
+#include "server.h"
+#include "storage.h"
+#include "storage_client.h"
+#include "storage_service.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t nanos_since(Clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+int64_t now_nanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct Result {
+    std::string name;
+    std::vector<std::pair<std::string, double>> values;
+    // Named latency histograms, in nanoseconds
+    std::vector<std::pair<std::string, Histogram>> latencies;
+};
+
+struct Settings {
+    std::chrono::duration<double> duration;
+    size_t threads;
+};
+
+void print_latency(const Histogram &histogram) {
+    std::printf("{\"count\": %llu, \"min\": %llu, \"mean\": %.1f", static_cast<unsigned long long>(histogram.count()),
+                static_cast<unsigned long long>(histogram.min()), histogram.mean());
+    for (const auto &[label, percent]: {std::pair{"p50", 50.0}, {"p90", 90.0}, {"p99", 99.0}, {"p99.9", 99.9},
+                                        {"p99.99", 99.99}}) {
+        std::printf(", \"%s\": %llu", label, static_cast<unsigned long long>(histogram.percentile(percent)));
+    }
+    std::printf(", \"max\": %llu}", static_cast<unsigned long long>(histogram.max()));
+}
+
+void print_results(const Settings &settings, const std::vector<Result> &results) {
+    std::printf("{\n  \"suite\": \"flowdb_bench\",\n  \"seconds\": %g,\n  \"threads\": %zu,\n  \"results\": [",
+                settings.duration.count(), settings.threads);
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        std::printf("%s\n    {\"name\": \"%s\"", i == 0 ? "" : ",", result.name.c_str());
+        for (const auto &[key, value]: result.values) {
+            std::printf(", \"%s\": %.6g", key.c_str(), value);
+        }
+        for (const auto &[key, histogram]: result.latencies) {
+            std::printf(",\n     \"%s\": ", key.c_str());
+            print_latency(histogram);
+        }
+        std::printf("}");
+    }
+    std::printf("\n  ]\n}\n");
+}
+
+// Runtime
+
+Result thread_pool_submit(const Settings &settings) {
+    constexpr size_t kRound = 100'000;
+    ThreadPool pool(settings.threads);
+    std::atomic<size_t> completed{0};
+    size_t submitted = 0;
+    auto start = Clock::now();
+    while (Clock::now() - start < settings.duration) {
+        for (size_t i = 0; i < kRound; i++) {
+            pool.submit([&completed] { completed.fetch_add(1, std::memory_order_relaxed); });
+        }
+        submitted += kRound;
+        while (completed.load(std::memory_order_relaxed) < submitted) {
+            std::this_thread::yield();
+        }
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    return {"thread_pool.submit", {{"operations", static_cast<double>(submitted)},
+                                   {"ops_per_second", static_cast<double>(submitted) / elapsed.count()}}, {}};
+}
+
+Result thread_pool_wakeup(const Settings &settings) {
+    ThreadPool pool(settings.threads);
+    Histogram latency;
+    std::atomic<int64_t> started{0};
+    auto start = Clock::now();
+    while (Clock::now() - start < settings.duration) {
+        started.store(0, std::memory_order_relaxed);
+        int64_t submitted = now_nanos();
+        pool.submit([&started] {
+            started.store(now_nanos(), std::memory_order_release);
+            started.notify_one();
+        });
+        started.wait(0, std::memory_order_acquire);
+        latency.record(static_cast<uint64_t>(started.load(std::memory_order_acquire) - submitted));
+    }
+    return {"thread_pool.wakeup", {}, {{"latency_ns", latency}}};
+}
+
+struct Ball {
+    int64_t sent;
+};
+
+// Returns every ball to its peer; the server of a rally times the round trips
+// until the deadline.
+class Player : public Actor<Player, Ball> {
+public:
+    Player *peer = nullptr;
+    bool serving = false;
+    Clock::time_point deadline;
+    Histogram round_trips;
+    Promise<Void> done;
+
+    void handle(Ball &ball) {
+        if (!serving) {
+            peer->tell(ball);
+            return;
+        }
+        if (ball.sent != 0) {
+            round_trips.record(static_cast<uint64_t>(now_nanos() - ball.sent));
+        }
+        if (Clock::now() < deadline) {
+            peer->tell(Ball{now_nanos()});
+        } else {
+            done.set_value();
+        }
+    }
+};
+
+// Times round trips between two actors until the deadline.
+Result rally(const char *name, Runtime &runtime, Player &server, Player &receiver, const Settings &settings) {
+    server.peer = &receiver;
+    receiver.peer = &server;
+    server.serving = true;
+    server.deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(settings.duration);
+    auto done = server.done.get_future();
+    server.tell(Ball{0});
+    done.get();
+    Result result{name, {}, {{"latency_ns", server.round_trips}}};
+    runtime.stop();
+    return result;
+}
+
+Result actor_round_trip(const Settings &settings) {
+    Runtime runtime(settings.threads);
+    auto server = runtime.create_actor<Player>();
+    auto receiver = runtime.create_actor<Player>();
+    return rally("actor.round_trip", runtime, *server, *receiver, settings);
+}
+
+Result actor_round_trip_cores(const Settings &settings) {
+    Runtime runtime(Runtime::Options{std::max<size_t>(settings.threads, 2), true});
+    auto server = runtime.create_actor_on<Player>(0);
+    auto receiver = runtime.create_actor_on<Player>(1);
+    return rally("actor.round_trip.cores", runtime, *server, *receiver, settings);
+}
+
+Result actor_round_trip_traced(const Settings &settings) {
+    Trace::start();
+    Result result = actor_round_trip(settings);
+    Trace::stop();
+    result.name = "actor.round_trip.traced";
+    return result;
+}
+
+struct Job {
+    int64_t sent;
+};
+
+// Spends a fixed time on every job and times each from its tell().
+class Consumer : public Actor<Consumer, Job> {
+public:
+    static constexpr int64_t kJobNanos = 2000;
+
+    Histogram latency;
+    std::atomic<size_t> handled{0};
+
+    void handle(Job &job) {
+        int64_t now = now_nanos();
+        int64_t until = now + kJobNanos;
+        while (now < until) {
+            now = now_nanos();
+        }
+        latency.record(static_cast<uint64_t>(now - job.sent));
+        handled.fetch_add(1, std::memory_order_release);
+    }
+};
+
+// Producers outrun the consumer many times over. Its mailbox blocks them once
+// it holds kCapacity jobs, so a job waits for at most that many before it,
+// however long the overload lasts, where an unbounded mailbox would grow, and
+// the latency with it, until memory ran out.
+Result actor_overload(const Settings &settings) {
+    constexpr size_t kCapacity = 1024;
+    Runtime runtime(settings.threads);
+    auto consumer = runtime.create_actor<Consumer>();
+    consumer->set_mailbox_capacity(kCapacity, ActorBase::Overflow::Block);
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> sent{0};
+    std::vector<std::thread> producers;
+    auto start = Clock::now();
+    for (size_t t = 0; t < settings.threads; t++) {
+        producers.emplace_back([&consumer, &stopping, &sent] {
+            while (!stopping.load(std::memory_order_relaxed)) {
+                consumer->tell(Job{now_nanos()});
+                sent.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    std::this_thread::sleep_for(settings.duration);
+    stopping.store(true, std::memory_order_relaxed);
+    for (auto &producer: producers) {
+        producer.join();
+    }
+    while (consumer->handled.load(std::memory_order_acquire) < sent.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    auto handled = static_cast<double>(sent.load(std::memory_order_relaxed));
+    Result result{"actor.overload", {{"operations", handled}, {"ops_per_second", handled / elapsed.count()}},
+                  {{"latency_ns", consumer->latency}}};
+    runtime.stop();
+    return result;
+}
+
+// A thread takes over each promise and sets it a little later, once the owner
+// of the future is likely blocked in get(), to the time of the set.
+Result future_wakeup(const Settings &settings) {
+    std::atomic<Promise<int64_t> *> slot{nullptr};
+    std::atomic<bool> stopping{false};
+    std::thread setter([&slot, &stopping] {
+        while (true) {
+            slot.wait(nullptr, std::memory_order_acquire);
+            std::unique_ptr<Promise<int64_t>> promise(slot.exchange(nullptr, std::memory_order_acq_rel));
+            if (stopping.load(std::memory_order_acquire)) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+            promise->set_value(now_nanos());
+        }
+    });
+    Histogram latency;
+    auto start = Clock::now();
+    while (Clock::now() - start < settings.duration) {
+        auto *promise = new Promise<int64_t>();
+        auto future = promise->get_future();
+        slot.store(promise, std::memory_order_release);
+        slot.notify_one();
+        int64_t set = future.get();
+        latency.record(static_cast<uint64_t>(now_nanos() - set));
+    }
+    stopping.store(true, std::memory_order_release);
+    slot.store(new Promise<int64_t>(), std::memory_order_release);
+    slot.notify_one();
+    setter.join();
+    return {"future.wakeup", {}, {{"latency_ns", latency}}};
+}
+
+// Every thread updates a counter and records a latency in a tight loop, which
+// scales only if the updates share nothing; a snapshot is then taken with
+// those threads' shards live.
+Result metrics_record(const Settings &settings) {
+    constexpr size_t kRound = 1'000'000;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> released{false};
+    std::atomic<size_t> rounds{0};
+    std::atomic<size_t> running{settings.threads};
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < settings.threads; t++) {
+        threads.emplace_back([&stopping, &released, &rounds, &running] {
+            while (!stopping.load(std::memory_order_relaxed)) {
+                for (size_t i = 0; i < kRound; i++) {
+                    Metrics::add(Metrics::Counter::PoolTasksRun);
+                    Metrics::record(Metrics::Latency::PoolTask, i & 0xFFFF);
+                }
+                rounds.fetch_add(1, std::memory_order_relaxed);
+            }
+            // Stay alive, and registered, until the snapshot is taken
+            running.fetch_sub(1);
+            while (!released.load()) {
+                std::this_thread::yield();
+            }
+        });
+    }
+    std::this_thread::sleep_for(settings.duration);
+    stopping.store(true);
+    while (running.load() != 0) {
+        std::this_thread::yield();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    auto snapshot_start = Clock::now();
+    MetricsSnapshot snapshot = Metrics::snapshot();
+    double snapshot_ns = static_cast<double>(nanos_since(snapshot_start));
+    released.store(true);
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    double updates = static_cast<double>(rounds.load() * kRound);
+    return {"metrics.record",
+            {{"updates_per_second", updates / elapsed.count()},
+             {"ns_per_update_per_thread", elapsed.count() * 1e9 * static_cast<double>(settings.threads) / updates},
+             {"snapshot_ns", snapshot_ns},
+             {"snapshot_threads", static_cast<double>(snapshot.threads.size())}},
+            {}};
+}
+
+// Every thread records events in a tight loop, wrapping its ring many times;
+// the rings are then dumped with those threads' events in them.
+Result trace_emit(const Settings &settings) {
+    constexpr size_t kRound = 1'000'000;
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> rounds{0};
+    Trace::start();
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < settings.threads; t++) {
+        threads.emplace_back([&stopping, &rounds] {
+            while (!stopping.load(std::memory_order_relaxed)) {
+                for (size_t i = 0; i < kRound; i++) {
+                    Trace::emit(Trace::Event::Send, nullptr, i, i);
+                }
+                rounds.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    std::this_thread::sleep_for(settings.duration);
+    stopping.store(true);
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    Trace::stop();
+    auto dump_start = Clock::now();
+    std::string json = Trace::chrome_json();
+    double dump_ns = static_cast<double>(nanos_since(dump_start));
+    double events = static_cast<double>(rounds.load() * kRound);
+    return {"trace.emit",
+            {{"events_per_second", events / elapsed.count()},
+             {"ns_per_event_per_thread", elapsed.count() * 1e9 * static_cast<double>(settings.threads) / events},
+             {"dump_ns", dump_ns},
+             {"dump_bytes", static_cast<double>(json.size())}},
+            {}};
+}
+
+// Networking
+
+void accept_forever(tcp::acceptor &acceptor, std::vector<tcp::socket> &accepted) {
+    acceptor.async_accept([&acceptor, &accepted](const boost::system::error_code &ec, tcp::socket socket) {
+        if (!ec) {
+            accepted.push_back(std::move(socket));
+            accept_forever(acceptor, accepted);
+        }
+    });
+}
+
+Result connection_pool_checkout(const Settings &settings) {
+    boost::asio::io_context server_context;
+    boost::asio::io_context client_context;
+    auto server_work = boost::asio::make_work_guard(server_context);
+    auto client_work = boost::asio::make_work_guard(client_context);
+    tcp::acceptor acceptor(server_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    std::vector<tcp::socket> accepted;
+    accept_forever(acceptor, accepted);
+    std::thread server_thread([&server_context] { server_context.run(); });
+    std::thread client_thread([&client_context] { client_context.run(); });
+
+    Histogram latency;
+    {
+        ConnectionPool pool(client_context, {acceptor.local_endpoint()}, 1, 4);
+        pool.checkout().get();
+        auto start = Clock::now();
+        while (Clock::now() - start < settings.duration) {
+            auto checkout_start = Clock::now();
+            auto checkout = pool.checkout();
+            checkout.get();
+            latency.record(nanos_since(checkout_start));
+        }
+    }
+
+    client_work.reset();
+    client_context.stop();
+    client_thread.join();
+    server_work.reset();
+    server_context.stop();
+    server_thread.join();
+    return {"connection_pool.checkout", {}, {{"latency_ns", latency}}};
+}
+
+// YCSB
+
+constexpr size_t kRecords = 100'000;
+constexpr size_t kValueSize = 100;
+
+// YCSB's zipfian generator (Gray et al., "Quickly generating billion-record
+// synthetic databases"), with the popular items scattered over the key space
+// by a hash as in YCSB's ScrambledZipfianGenerator.
+class ZipfianKeys {
+public:
+    explicit ZipfianKeys(uint64_t items, double theta = 0.99)
+            : m_items(items), m_theta(theta), m_zeta_n(zeta(items, theta)), m_alpha(1.0 / (1.0 - theta)),
+              m_eta((1.0 - std::pow(2.0 / static_cast<double>(items), 1.0 - theta)) /
+                    (1.0 - zeta(2, theta) / m_zeta_n)) {}
+
+    template<typename Random>
+    uint64_t next(Random &random) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        double uz = u * m_zeta_n;
+        uint64_t rank;
+        if (uz < 1.0) {
+            rank = 0;
+        } else if (uz < 1.0 + std::pow(0.5, m_theta)) {
+            rank = 1;
+        } else {
+            rank = static_cast<uint64_t>(static_cast<double>(m_items) * std::pow(m_eta * u - m_eta + 1.0, m_alpha));
+        }
+        return fnv1a(std::min(rank, m_items - 1)) % m_items;
+    }
+
+private:
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++) {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+
+    static uint64_t fnv1a(uint64_t value) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (int i = 0; i < 8; i++) {
+            hash = (hash ^ (value & 0xff)) * 0x100000001b3ull;
+            value >>= 8;
+        }
+        return hash;
+    }
+
+    uint64_t m_items;
+    double m_theta;
+    double m_zeta_n;
+    double m_alpha;
+    double m_eta;
+};
+
+std::string record_key(uint64_t index) {
+    char key[32];
+    std::snprintf(key, sizeof(key), "user%012llu", static_cast<unsigned long long>(index));
+    return key;
+}
+
+struct Workload {
+    const char *name;
+    // Percentage of operations that are updates rather than reads
+    unsigned update_percent;
+};
+
+// A storage server on a loopback port with a client connected to it, loaded
+// with kRecords records.
+class Cluster {
+public:
+    explicit Cluster(size_t threads)
+            : m_server({tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)}, threads,
+                       [this](size_t) { return make_storage_handler(m_storage); }),
+              m_runtime(threads), m_work(boost::asio::make_work_guard(m_io_context)) {
+        m_storage = m_runtime.create_actor<StorageActor>();
+        m_server.start();
+        m_io_thread = std::thread([this] { m_io_context.run(); });
+        m_pool = std::make_unique<ConnectionPool>(m_io_context, m_server.endpoints(), 1, 4);
+        m_client = std::make_unique<StorageClient>(*m_pool);
+
+        std::vector<KeyValue> batch;
+        for (uint64_t i = 0; i < kRecords; i++) {
+            batch.push_back({record_key(i), std::string(kValueSize, 'v')});
+            if (batch.size() == 1000 || i + 1 == kRecords) {
+                m_client->multi_set(std::move(batch)).get();
+                batch.clear();
+            }
+        }
+    }
+
+    ~Cluster() {
+        m_client->close().get();
+        m_client.reset();
+        m_pool.reset();
+        m_work.reset();
+        m_io_context.stop();
+        m_io_thread.join();
+        m_server.stop();
+        m_runtime.stop();
+    }
+
+    StorageClient &client() {
+        return *m_client;
+    }
+
+private:
+    // The server outlives the runtime, as in remote_endpoint
+    Server m_server;
+    Runtime m_runtime;
+    std::shared_ptr<StorageActor> m_storage;
+    boost::asio::io_context m_io_context;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_work;
+    std::thread m_io_thread;
+    std::unique_ptr<ConnectionPool> m_pool;
+    std::unique_ptr<StorageClient> m_client;
+};
+
+Result ycsb_closed(const Settings &settings, StorageClient &client, const Workload &workload, size_t clients) {
+    std::vector<Histogram> reads(clients);
+    std::vector<Histogram> updates(clients);
+    ZipfianKeys keys(kRecords);
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (size_t c = 0; c < clients; c++) {
+        threads.emplace_back([&, c] {
+            std::mt19937_64 random(c + 1);
+            while (Clock::now() - start < settings.duration) {
+                std::string key = record_key(keys.next(random));
+                auto issued = Clock::now();
+                if (random() % 100 < workload.update_percent) {
+                    client.set(std::move(key), std::string(kValueSize, 'u')).get();
+                    updates[c].record(nanos_since(issued));
+                } else {
+                    client.get(std::move(key)).get();
+                    reads[c].record(nanos_since(issued));
+                }
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    Histogram read;
+    Histogram update;
+    Histogram all;
+    for (size_t c = 0; c < clients; c++) {
+        read.merge(reads[c]);
+        update.merge(updates[c]);
+    }
+    all.merge(read);
+    all.merge(update);
+    Result result{std::string("ycsb.") + workload.name + ".closed",
+                  {{"clients", static_cast<double>(clients)},
+                   {"operations", static_cast<double>(all.count())},
+                   {"ops_per_second", static_cast<double>(all.count()) / elapsed.count()}},
+                  {{"latency_ns", all}, {"read_latency_ns", read}}};
+    if (update.count() > 0) {
+        result.latencies.emplace_back("update_latency_ns", update);
+    }
+    return result;
+}
+
+// Issues operations at a fixed rate from one thread, whatever the latency of
+// earlier ones. Each is timed from the moment it was due rather than the
+// moment it was sent, so falling behind shows up in the latencies.
+Result ycsb_open(const Settings &settings, StorageClient &client, const Workload &workload, double rate) {
+    struct Recorder {
+        std::mutex mutex;
+        Histogram read;
+        Histogram update;
+        std::atomic<size_t> outstanding{0};
+    } recorder;
+    ZipfianKeys keys(kRecords);
+    std::mt19937_64 random(42);
+    auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    auto start = Clock::now();
+    auto due = start;
+    size_t issued = 0;
+    while (due - start < settings.duration) {
+        std::this_thread::sleep_until(due);
+        // Catch up on every operation that fell due while asleep
+        for (auto now = Clock::now(); due <= now && due - start < settings.duration; due += interval) {
+            std::string key = record_key(keys.next(random));
+            bool update = random() % 100 < workload.update_percent;
+            recorder.outstanding.fetch_add(1, std::memory_order_relaxed);
+            issued++;
+            auto record = [&recorder, update, due] {
+                uint64_t latency = nanos_since(due);
+                {
+                    std::unique_lock<std::mutex> lock(recorder.mutex);
+                    (update ? recorder.update : recorder.read).record(latency);
+                }
+                recorder.outstanding.fetch_sub(1, std::memory_order_release);
+            };
+            if (update) {
+                client.set(std::move(key), std::string(kValueSize, 'u')).on_ready(record);
+            } else {
+                client.get(std::move(key)).on_ready(record);
+            }
+        }
+    }
+    while (recorder.outstanding.load(std::memory_order_acquire) > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    std::unique_lock<std::mutex> lock(recorder.mutex);
+    Histogram all;
+    all.merge(recorder.read);
+    all.merge(recorder.update);
+    Result result{std::string("ycsb.") + workload.name + ".open",
+                  {{"target_ops_per_second", rate},
+                   {"operations", static_cast<double>(issued)},
+                   {"ops_per_second", static_cast<double>(issued) / elapsed.count()}},
+                  {{"latency_ns", all}, {"read_latency_ns", recorder.read}}};
+    if (recorder.update.count() > 0) {
+        result.latencies.emplace_back("update_latency_ns", recorder.update);
+    }
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Settings settings{std::chrono::duration<double>(argc > 1 ? std::strtod(argv[1], nullptr) : 2.0),
+                      std::max(1u, std::thread::hardware_concurrency())};
+    std::vector<std::string> prefixes(argv + std::min(argc, 2), argv + argc);
+    auto selected = [&prefixes](const std::string &name) {
+        return prefixes.empty() || std::any_of(prefixes.begin(), prefixes.end(), [&name](const std::string &prefix) {
+            return name.compare(0, prefix.size(), prefix) == 0;
+        });
+    };
+
+    std::vector<Result> results;
+    std::vector<std::pair<std::string, std::function<Result(const Settings &)>>> micro = {
+            {"thread_pool.submit",       thread_pool_submit},
+            {"thread_pool.wakeup",       thread_pool_wakeup},
+            {"actor.round_trip",         actor_round_trip},
+            {"actor.round_trip.traced",  actor_round_trip_traced},
+            {"actor.round_trip.cores",   actor_round_trip_cores},
+            {"actor.overload",           actor_overload},
+            {"future.wakeup",            future_wakeup},
+            {"connection_pool.checkout", connection_pool_checkout},
+            {"metrics.record",           metrics_record},
+            {"trace.emit",               trace_emit},
+    };
+    for (const auto &[name, run]: micro) {
+        if (selected(name)) {
+            std::fprintf(stderr, "%s\n", name.c_str());
+            results.push_back(run(settings));
+        }
+    }
+
+    const Workload workloads[] = {{"a", 50}, {"b", 5}, {"c", 0}};
+    bool any_ycsb = std::any_of(std::begin(workloads), std::end(workloads), [&selected](const Workload &workload) {
+        std::string name = std::string("ycsb.") + workload.name;
+        return selected(name + ".closed") || selected(name + ".open");
+    });
+    if (any_ycsb) {
+        std::fprintf(stderr, "ycsb: loading %zu records\n", kRecords);
+        Cluster cluster(settings.threads);
+        for (const Workload &workload: workloads) {
+            std::string name = std::string("ycsb.") + workload.name;
+            double throughput = 0;
+            if (selected(name + ".closed") || selected(name + ".open")) {
+                std::fprintf(stderr, "%s.closed\n", name.c_str());
+                Result closed = ycsb_closed(settings, cluster.client(), workload, 16);
+                throughput = closed.values.back().second;
+                if (selected(name + ".closed")) {
+                    results.push_back(std::move(closed));
+                }
+            }
+            if (selected(name + ".open") && throughput > 0) {
+                std::fprintf(stderr, "%s.open\n", name.c_str());
+                results.push_back(ycsb_open(settings, cluster.client(), workload, throughput / 2));
+            }
+        }
+    }
+
+    print_results(settings, results);
+    return 0;
+}
@@ -0,0 +1,142 @@
+// Closed-loop load generator for remote_endpoint. Opens a number of
+// multiplexed connections spread over the server's endpoints, keeps a fixed
+// number of echo requests in flight on each, and reports throughput and
+// latency percentiles.
+//
+// Usage: load_generator [seconds] [connections] [depth] [payload bytes] [threads]
+
+#include "connection_pool.h"
+#include "multiplexed_connection.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+// One connection's share of the load. Its callbacks all run on the
+// connection's strand, so the samples need no locking.
+struct Stream {
+    std::shared_ptr<MultiplexedConnection> connection;
+    std::vector<double> samples;
+    size_t errors = 0;
+};
+
+void issue(Stream &stream, const std::string &payload, const std::atomic<bool> &done, std::atomic<size_t> &active) {
+    auto start = std::chrono::steady_clock::now();
+    auto reply = stream.connection->request(Opcode::Echo, payload);
+    reply.on_ready([&stream, &payload, &done, &active, start, reply] {
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        bool failed = false;
+        try {
+            reply.get();
+            stream.samples.push_back(elapsed.count());
+        } catch (const std::exception &) {
+            stream.errors++;
+            failed = true;
+        }
+        // A failed connection fails every request at once; stop rather than spin
+        if (failed || done.load(std::memory_order_relaxed)) {
+            active.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        issue(stream, payload, done, active);
+    });
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? std::strtod(argv[1], nullptr) : 5;
+    size_t connections = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 8;
+    size_t depth = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 32;
+    size_t payload_size = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 64;
+    size_t threads = argc > 5 ? std::strtoull(argv[5], nullptr, 10) : std::max(1u, std::thread::hardware_concurrency());
+
+    boost::asio::io_context io_context(static_cast<int>(threads));
+    auto work = boost::asio::make_work_guard(io_context);
+    std::vector<std::thread> io_threads;
+    for (size_t i = 0; i < threads; i++) {
+        io_threads.emplace_back([&io_context] { io_context.run(); });
+    }
+    // Lets the io threads run out of work and joins them on every way out
+    struct Joiner {
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> &work;
+        std::vector<std::thread> &threads;
+
+        ~Joiner() {
+            work.reset();
+            for (auto &thread: threads) {
+                thread.join();
+            }
+        }
+    } joiner{work, io_threads};
+
+    std::vector<tcp::endpoint> endpoints = {
+            tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 8000),
+            tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 8001),
+            tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 8002)
+    };
+    std::string payload(payload_size, 'x');
+    std::atomic<bool> done{false};
+    std::atomic<size_t> active{0};
+    std::vector<Stream> streams(connections);
+    size_t errors = 0;
+    std::chrono::duration<double> elapsed{};
+    {
+        ConnectionPool pool(io_context, endpoints, 0, static_cast<int>(connections), SelectionStrategy::RoundRobin);
+        try {
+            for (auto &stream: streams) {
+                stream.connection = std::make_shared<MultiplexedConnection>(pool.checkout().get());
+                stream.connection->start();
+            }
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "Cannot connect: %s\n", e.what());
+            // Started connections keep reading until closed
+            for (auto &stream: streams) {
+                if (stream.connection) {
+                    stream.connection->close().get();
+                }
+            }
+            return 1;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto &stream: streams) {
+            for (size_t i = 0; i < depth; i++) {
+                active.fetch_add(1, std::memory_order_relaxed);
+                issue(stream, payload, done, active);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        done.store(true, std::memory_order_relaxed);
+        while (active.load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+        elapsed = std::chrono::steady_clock::now() - start;
+        for (auto &stream: streams) {
+            stream.connection->close().get();
+        }
+    }
+
+    std::vector<double> samples;
+    for (auto &stream: streams) {
+        samples.insert(samples.end(), stream.samples.begin(), stream.samples.end());
+        errors += stream.errors;
+    }
+    if (samples.empty()) {
+        std::fprintf(stderr, "No successful requests\n");
+        return 1;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto at = [&samples](double q) {
+        return samples[std::min(samples.size() - 1, static_cast<size_t>(q * static_cast<double>(samples.size())))];
+    };
+    std::printf("%zu connections x %zu in flight, %zu-byte payloads, %zu client threads\n", connections, depth,
+                payload_size, threads);
+    std::printf("requests/s %12.0f   errors %zu\n", static_cast<double>(samples.size()) / elapsed.count(), errors);
+    std::printf("latency us  p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", at(0.5), at(0.99), at(0.999), samples.back());
+    return errors == 0 ? 0 : 1;
+}
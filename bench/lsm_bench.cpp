@@ -0,0 +1,139 @@
+// Write amplification, point lookup latency for present and missing keys,
+// range scans and compaction throughput of the LSM tree. Keys are YCSB-style
+// and inserted in random order; flushes and compactions run in the background
+// on a thread pool while the keys are loaded.
+//
+// Usage: lsm_bench [keys] [value bytes] [directory] [threads]
+
+#include "lsm.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t kKeySize = 16;
+
+std::string_view key_at(const std::vector<char> &keys, uint64_t id) {
+    return {keys.data() + id * kKeySize, kKeySize};
+}
+
+template<typename F>
+double ns_per_op(size_t ops, F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(ops);
+}
+
+void print_levels(const LsmTree::Metrics &metrics) {
+    std::printf("%-28s", "tables per level");
+    for (size_t level = 0; level < LsmTree::kLevels; level++) {
+        std::printf(" L%zu=%zu (%.1f MB)", level, metrics.level_tables[level],
+                    static_cast<double>(metrics.level_bytes[level]) / 1e6);
+    }
+    std::printf("\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+    size_t value_size = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100;
+    std::string directory = argc > 3 ? argv[3] : "lsm_bench.db";
+    size_t threads = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : std::thread::hardware_concurrency();
+
+    std::vector<char> keys(count * kKeySize);
+    for (size_t i = 0; i < count; i++) {
+        char key[32];
+        std::snprintf(key, sizeof(key), "user%012zu", i % 1'000'000'000'000);
+        std::memcpy(keys.data() + i * kKeySize, key, kKeySize);
+    }
+    std::vector<uint64_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937_64 random(42);
+    std::shuffle(order.begin(), order.end(), random);
+    std::string value(value_size, 'v');
+
+    std::filesystem::remove_all(directory);
+    ThreadPool pool(threads);
+    bool ok = true;
+    {
+        LsmTree tree(directory, pool);
+        double insert = ns_per_op(count, [&] {
+            for (uint64_t id: order) {
+                tree.set(key_at(keys, id), value);
+            }
+        });
+        auto settle_start = std::chrono::steady_clock::now();
+        tree.flush();
+        tree.wait_for_background();
+        std::chrono::duration<double> settle = std::chrono::steady_clock::now() - settle_start;
+        LsmTree::Metrics loaded = tree.metrics();
+
+        std::shuffle(order.begin(), order.end(), random);
+        size_t found = 0;
+        std::string out;
+        double lookup = ns_per_op(count, [&] {
+            for (uint64_t id: order) {
+                found += tree.get(key_at(keys, id), out) ? 1 : 0;
+            }
+        });
+
+        // Keys that sort between existing ones, so only the bloom filters can
+        // rule them out without reading a block
+        LsmTree::Metrics before_miss = tree.metrics();
+        std::string missing_key;
+        size_t false_hits = 0;
+        double miss = ns_per_op(count, [&] {
+            for (uint64_t id: order) {
+                missing_key.assign(key_at(keys, id));
+                missing_key.push_back('!');
+                false_hits += tree.get(missing_key, out) ? 1 : 0;
+            }
+        });
+        LsmTree::Metrics after_miss = tree.metrics();
+
+        constexpr size_t kScans = 10'000;
+        constexpr size_t kScanLength = 100;
+        std::vector<KeyValue> scanned;
+        size_t scanned_keys = 0;
+        double scan = ns_per_op(kScans * kScanLength, [&] {
+            for (size_t i = 0; i < kScans; i++) {
+                scanned.clear();
+                scanned_keys += tree.range(key_at(keys, order[i % count]), "\xff", kScanLength, scanned);
+            }
+        });
+
+        uint64_t probes = after_miss.table_probes - before_miss.table_probes;
+        uint64_t rejections = after_miss.bloom_rejections - before_miss.bloom_rejections;
+        std::printf("%zu keys, %zu-byte keys, %zu-byte values, %zu threads\n", count, kKeySize, value_size,
+                    pool.size());
+        std::printf("%-28s %10.1f ns/op\n", "insert (random order)", insert);
+        std::printf("%-28s %10.2f s\n", "flush + compaction backlog", settle.count());
+        std::printf("%-28s %10.2f\n", "write amplification", loaded.write_amplification());
+        std::printf("%-28s %10.1f MB/s (%lu compactions, %lu trivial moves)\n", "compaction throughput",
+                    loaded.compaction_throughput() / 1e6, loaded.compactions, loaded.trivial_moves);
+        print_levels(loaded);
+        std::printf("%-28s %10.1f ns/op\n", "point lookup (hit)", lookup);
+        std::printf("%-28s %10.1f ns/op\n", "point lookup (miss)", miss);
+        std::printf("%-28s %10.1f%% of %lu table probes\n", "bloom filter rejections",
+                    probes == 0 ? 0.0 : 100.0 * static_cast<double>(rejections) / static_cast<double>(probes), probes);
+        std::printf("%-28s %10.1f ns/key\n", "range scan (100 keys)", scan);
+        if (found != count || false_hits != 0 || scanned_keys == 0) {
+            std::fprintf(stderr, "Inconsistent results: found %zu of %zu, %zu false hits\n", found, count,
+                         false_hits);
+            ok = false;
+        }
+    }
+    std::filesystem::remove_all(directory);
+    return ok ? 0 : 1;
+}
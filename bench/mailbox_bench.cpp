@@ -0,0 +1,138 @@
+// Messages/s through the lock-free Mailbox against the mutex + condition
+// variable queue that Actor<T> used before, with 1, 4 and 16 producers.
+//
+// Usage: mailbox_bench [messages_per_producer]
+
+#include "mailbox.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// The mailbox Actor<T> used before: one lock and one notify per message, and
+// the consumer unlocks and relocks around every message.
+class LockedMailbox {
+public:
+    void push(uint64_t value) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_queue.push(value);
+        m_cv.notify_one();
+    }
+
+    uint64_t consume(size_t count) {
+        uint64_t sum = 0;
+        size_t received = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (received < count) {
+            m_cv.wait(lock, [this] { return !m_queue.empty(); });
+            while (!m_queue.empty()) {
+                uint64_t value = m_queue.front();
+                m_queue.pop();
+                lock.unlock();
+                sum += value;
+                received++;
+                lock.lock();
+            }
+        }
+        return sum;
+    }
+
+private:
+    std::queue<uint64_t> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+class LockFreeMailbox {
+public:
+    void push(uint64_t value) {
+        if (m_mailbox.push(new Message(value))) {
+            // Only the push that found the consumer parked wakes it
+            m_wakeup.store(1, std::memory_order_release);
+            m_wakeup.notify_one();
+        }
+    }
+
+    uint64_t consume(size_t count) {
+        uint64_t sum = 0;
+        size_t received = 0;
+        while (received < count) {
+            // The mailbox starts idle, so the consumer only runs after a wakeup
+            m_wakeup.wait(0, std::memory_order_acquire);
+            m_wakeup.store(0, std::memory_order_relaxed);
+            while (true) {
+                MailboxNode *node = m_mailbox.take_all();
+                if (node == nullptr) {
+                    if (m_mailbox.try_idle()) {
+                        break;
+                    }
+                    continue;
+                }
+                while (node != nullptr) {
+                    auto *message = static_cast<Message *>(node);
+                    node = node->next;
+                    sum += message->value;
+                    received++;
+                    delete message;
+                }
+            }
+        }
+        return sum;
+    }
+
+private:
+    struct Message : MailboxNode {
+        explicit Message(uint64_t value) : value(value) {}
+
+        uint64_t value;
+    };
+
+    Mailbox m_mailbox;
+    std::atomic<uint32_t> m_wakeup{0};
+};
+
+template<typename Box>
+double run(size_t producers, size_t per_producer) {
+    Box box;
+    size_t total = producers * per_producer;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; p++) {
+        threads.emplace_back([&box, per_producer] {
+            for (size_t i = 0; i < per_producer; i++) {
+                box.push(i);
+            }
+        });
+    }
+    uint64_t sum = box.consume(total);
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (sum != producers * (per_producer * (per_producer - 1) / 2)) {
+        std::fprintf(stderr, "checksum mismatch\n");
+        std::exit(1);
+    }
+    return static_cast<double>(total) / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t per_producer = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+
+    std::printf("%-10s %18s %18s\n", "producers", "locked (msg/s)", "lock-free (msg/s)");
+    for (size_t producers: {1, 4, 16}) {
+        std::printf("%-10zu %18.0f %18.0f\n", producers,
+                    run<LockedMailbox>(producers, per_producer),
+                    run<LockFreeMailbox>(producers, per_producer));
+    }
+    return 0;
+}
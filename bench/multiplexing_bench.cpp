@@ -0,0 +1,97 @@
+// Echo throughput over a loopback FrameSession server: one request per round
+// trip, as the old unframed client did, against many requests pipelined over
+// a few multiplexed connections.
+//
+// Usage: multiplexing_bench [requests] [connections] [depth]
+
+#include "frame_session.h"
+#include "multiplexed_connection.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+void accept_forever(tcp::acceptor &acceptor, const FrameSession::Handler &handler) {
+    acceptor.async_accept([&acceptor, &handler](const boost::system::error_code &ec, tcp::socket socket) {
+        if (!ec) {
+            std::make_shared<FrameSession>(std::move(socket), handler)->start();
+            accept_forever(acceptor, handler);
+        }
+    });
+}
+
+// Issues `requests` echo requests spread over the connections, keeping up to
+// `depth` in flight on each, and returns requests per second.
+double run(ConnectionPool &pool, size_t requests, size_t connections, size_t depth) {
+    std::vector<std::shared_ptr<MultiplexedConnection>> open;
+    for (size_t i = 0; i < connections; i++) {
+        open.push_back(std::make_shared<MultiplexedConnection>(pool.checkout().get()));
+        open.back()->start();
+    }
+    std::string payload(64, 'x');
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (size_t c = 0; c < connections; c++) {
+        clients.emplace_back([&, c] {
+            size_t share = requests / connections;
+            std::vector<Future<BufferSlice>> window;
+            for (size_t sent = 0; sent < share;) {
+                window.clear();
+                for (size_t i = 0; i < depth && sent < share; i++, sent++) {
+                    window.push_back(open[c]->request(Opcode::Echo, payload));
+                }
+                for (auto &reply: window) {
+                    reply.get();
+                }
+            }
+        });
+    }
+    for (auto &client: clients) {
+        client.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    for (auto &connection: open) {
+        connection->close().get();
+    }
+    return static_cast<double>(requests / connections * connections) / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t requests = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200'000;
+    size_t connections = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2;
+    size_t depth = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 64;
+
+    boost::asio::io_context server_context;
+    boost::asio::io_context client_context;
+    auto server_work = boost::asio::make_work_guard(server_context);
+    auto client_work = boost::asio::make_work_guard(client_context);
+    FrameSession::Handler handler = [](Opcode, std::string_view payload) {
+        return make_ready_future(Message(std::string(payload)));
+    };
+    tcp::acceptor acceptor(server_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    accept_forever(acceptor, handler);
+    std::thread server_thread([&server_context] { server_context.run(); });
+    std::thread client_thread([&client_context] { client_context.run(); });
+
+    {
+        ConnectionPool pool(client_context, {acceptor.local_endpoint()}, 0, connections);
+        size_t serial = std::min<size_t>(requests, 20'000);
+        std::printf("%-34s %12s\n", "echo", "requests/s");
+        std::printf("%-34s %12.0f\n", "1 connection, 1 in flight", run(pool, serial, 1, 1));
+        char label[64];
+        std::snprintf(label, sizeof(label), "%zu connections, %zu in flight each", connections, depth);
+        std::printf("%-34s %12.0f\n", label, run(pool, requests, connections, depth));
+    }
+
+    client_work.reset();
+    client_context.stop();
+    client_thread.join();
+    server_work.reset();
+    server_context.stop();
+    server_thread.join();
+    return 0;
+}
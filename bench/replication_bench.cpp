@@ -0,0 +1,123 @@
+// Tail latency of reads from a replicated cluster, with and without hedging,
+// and latency of quorum writes. Start the servers first, as replicas of each
+// other, with one of them slowed down by an injected delay:
+//
+//   remote_endpoint 2 - - 0/3/3 &
+//   remote_endpoint 2 - - 1/3/3 &
+//   remote_endpoint 2 - - 2/3/3 20:0.05 &
+//
+// Every read then has a one in three chance of landing on the slow server,
+// which holds back 5% of its responses for 20 ms.
+//
+// Usage: replication_bench [servers] [keys] [reads per client] [clients]
+
+#include "connection_pool.h"
+#include "histogram.h"
+#include "storage_client.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+
+namespace {
+
+std::string key_of(size_t i) {
+    // Spread keys over the whole key space so every shard gets its share
+    std::string key = std::to_string(i * 2654435761u % 1'000'003);
+    key.insert(key.begin(), static_cast<char>(i * 131 % 256));
+    return key;
+}
+
+// Prints the percentiles of latencies, recorded in nanoseconds, in microseconds.
+void report(const char *name, const Histogram &latencies) {
+    auto micros = [](uint64_t nanos) { return static_cast<double>(nanos) / 1e3; };
+    std::printf("%-22s %10.1f %10.1f %10.1f %10.1f", name, micros(latencies.percentile(50)),
+                micros(latencies.percentile(99)), micros(latencies.percentile(99.9)), micros(latencies.max()));
+}
+
+// Runs clients closed loops of reads of random keys, and returns their
+// latencies in nanoseconds.
+Histogram read_loop(StorageClient &client, size_t keys, size_t reads, size_t clients) {
+    std::vector<Histogram> latencies(clients);
+    std::vector<std::thread> threads;
+    for (size_t c = 0; c < clients; c++) {
+        threads.emplace_back([&client, &latencies, keys, reads, c] {
+            std::minstd_rand random(static_cast<uint32_t>(c + 1));
+            for (size_t i = 0; i < reads; i++) {
+                auto start = std::chrono::steady_clock::now();
+                client.get(key_of(random() % keys)).get();
+                std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+                latencies[c].record(static_cast<uint64_t>(elapsed.count()));
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    Histogram all;
+    for (const auto &histogram: latencies) {
+        all.merge(histogram);
+    }
+    return all;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t servers = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 3;
+    size_t keys = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10'000;
+    size_t reads = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 20'000;
+    size_t clients = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 8;
+
+    boost::asio::io_context io_context;
+    auto work = boost::asio::make_work_guard(io_context);
+    std::vector<tcp::endpoint> endpoints;
+    for (size_t i = 0; i < servers; i++) {
+        endpoints.emplace_back(boost::asio::ip::address_v4::loopback(), static_cast<uint16_t>(8000 + i));
+    }
+    ConnectionPool pool(io_context, endpoints, 1, 4);
+    std::thread io_thread([&io_context] { io_context.run(); });
+
+    std::printf("%-22s %10s %10s %10s %10s  (us)\n", "", "p50", "p99", "p99.9", "max");
+    {
+        StorageClient client(pool);
+        client.refresh().get();
+        Histogram latencies;
+        for (size_t i = 0; i < keys; i++) {
+            auto start = std::chrono::steady_clock::now();
+            client.set(key_of(i), std::string(100, 'v')).get();
+            std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+            latencies.record(static_cast<uint64_t>(elapsed.count()));
+        }
+        report("quorum write", latencies);
+        std::printf("\n");
+        client.close().get();
+    }
+
+    for (bool hedge: {false, true}) {
+        StorageClient::Options options;
+        options.hedge_reads = hedge;
+        StorageClient client(pool, options);
+        client.refresh().get();
+        // Warm up the connections and the latency estimate
+        read_loop(client, keys, 1'000, clients);
+        uint64_t hedged_before = client.hedged_reads();
+        auto latencies = read_loop(client, keys, reads, clients);
+        report(hedge ? "hedged read" : "read", latencies);
+        if (hedge) {
+            std::printf("  %.2f%% hedged after %lld us", 100.0 * static_cast<double>(client.hedged_reads() - hedged_before)
+                                                         / static_cast<double>(latencies.count()),
+                        static_cast<long long>(client.hedge_delay().count()));
+        }
+        std::printf("\n");
+        client.close().get();
+    }
+
+    work.reset();
+    io_context.stop();
+    io_thread.join();
+    return 0;
+}
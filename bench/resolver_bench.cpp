@@ -0,0 +1,184 @@
+// Commit throughput of optimistic transactions through the resolver, for a
+// YCSB-style read-modify-write workload: every transaction reads two keys at
+// its read version, writes both and commits. Clients are closed loops that
+// start a new transaction as soon as the previous one commits or aborts.
+//
+// Keys are drawn uniformly from a large key space (uncontended) or from a
+// Zipfian distribution over a small one (contended), where many transactions
+// read keys that a transaction in the same or an earlier batch wrote and so
+// abort. The resolver checks a whole mailbox drain at once; the batch column
+// is the average number of transactions it resolved per commit version.
+//
+// Usage: resolver_bench [seconds per run] [threads]
+
+#include "resolver.h"
+#include "runtime.h"
+#include "transaction.h"
+#include "versioned_storage.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// YCSB's Zipfian generator: item i is drawn with probability proportional to
+// 1 / (i + 1)^theta. With theta = 0 every item is equally likely.
+class KeyChooser {
+public:
+    KeyChooser(uint64_t items, double theta) : m_items(items), m_theta(theta) {
+        if (theta > 0) {
+            for (uint64_t i = 1; i <= items; i++) {
+                m_zeta += 1.0 / std::pow(static_cast<double>(i), theta);
+            }
+            double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+            m_alpha = 1.0 / (1.0 - theta);
+            m_eta = (1.0 - std::pow(2.0 / static_cast<double>(items), 1.0 - theta)) / (1.0 - zeta2 / m_zeta);
+        }
+    }
+
+    uint64_t next(std::mt19937_64 &random) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        if (m_theta == 0) {
+            return static_cast<uint64_t>(u * static_cast<double>(m_items)) % m_items;
+        }
+        double uz = u * m_zeta;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, m_theta)) {
+            return 1;
+        }
+        auto item = static_cast<uint64_t>(static_cast<double>(m_items) * std::pow(m_eta * u - m_eta + 1.0, m_alpha));
+        return std::min(item, m_items - 1);
+    }
+
+private:
+    uint64_t m_items;
+    double m_theta;
+    double m_zeta = 0;
+    double m_alpha = 0;
+    double m_eta = 0;
+};
+
+struct Run {
+    std::shared_ptr<VersionedStorage> storage;
+    std::shared_ptr<Resolver> resolver;
+    const KeyChooser *keys = nullptr;
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> active{0};
+    std::atomic<uint64_t> commits{0};
+    std::atomic<uint64_t> aborts{0};
+    std::atomic<bool> failed{false};
+};
+
+struct Client {
+    std::mt19937_64 random;
+    std::unique_ptr<Transaction> transaction;
+};
+
+std::string key_name(uint64_t item) {
+    char buffer[32];
+    int size = std::snprintf(buffer, sizeof(buffer), "user%012llu", static_cast<unsigned long long>(item));
+    return {buffer, static_cast<size_t>(size)};
+}
+
+void issue(Run &run, Client &client) {
+    if (run.stopping.load(std::memory_order_relaxed)) {
+        run.active.fetch_sub(1);
+        return;
+    }
+    client.transaction = std::make_unique<Transaction>(run.storage, run.resolver);
+    std::string first = key_name(run.keys->next(client.random));
+    std::string second = key_name(run.keys->next(client.random));
+    std::vector<Future<std::optional<std::string>>> reads;
+    reads.push_back(client.transaction->get(first));
+    reads.push_back(client.transaction->get(second));
+    Future<Version> commit = when_all(std::move(reads)).then(
+            [&client, first, second](const std::vector<std::optional<std::string>> &values) {
+                auto increment = [](const std::optional<std::string> &value) {
+                    return std::to_string((value ? std::strtoull(value->c_str(), nullptr, 10) : 0) + 1);
+                };
+                client.transaction->set(first, increment(values[0]));
+                client.transaction->set(second, increment(values[1]));
+                return client.transaction->commit();
+            });
+    commit.on_ready([&run, &client, commit] {
+        try {
+            commit.get();
+            run.commits.fetch_add(1, std::memory_order_relaxed);
+        } catch (const TransactionFailed &) {
+            run.aborts.fetch_add(1, std::memory_order_relaxed);
+        } catch (...) {
+            run.failed.store(true);
+            run.active.fetch_sub(1);
+            return;
+        }
+        issue(run, client);
+    });
+}
+
+bool measure(const char *workload, const KeyChooser &keys, size_t clients, double seconds, size_t threads) {
+    Runtime runtime(threads);
+    Run run;
+    run.storage = runtime.create_actor<VersionedStorage>();
+    run.resolver = runtime.create_actor<Resolver>(run.storage);
+    run.keys = &keys;
+
+    std::vector<Client> state(clients);
+    for (size_t i = 0; i < clients; i++) {
+        state[i].random.seed(i + 1);
+    }
+    run.active = clients;
+    auto start = Clock::now();
+    for (auto &client: state) {
+        issue(run, client);
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    run.stopping = true;
+    while (run.active.load() > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    Resolver::Stats stats = run.resolver->stats();
+    auto commits = static_cast<double>(run.commits.load());
+    auto aborts = static_cast<double>(run.aborts.load());
+    std::printf("%12s %8zu %12.0f %12.0f %8.1f%% %8.1f %10llu\n", workload, clients, commits / elapsed.count(),
+                aborts / elapsed.count(), commits + aborts > 0 ? 100.0 * aborts / (commits + aborts) : 0.0,
+                stats.batches ? static_cast<double>(stats.committed + stats.conflicts + stats.too_old) /
+                                static_cast<double>(stats.batches) : 0.0,
+                static_cast<unsigned long long>(stats.history_size));
+    runtime.stop();
+    return !run.failed.load();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? std::strtod(argv[1], nullptr) : 2.0;
+    size_t threads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+
+    KeyChooser uniform(1'000'000, 0.0);
+    KeyChooser zipfian(1'000, 0.99);
+
+    std::printf("%12s %8s %12s %12s %9s %8s %10s\n", "workload", "clients", "commits/s", "aborts/s", "aborted",
+                "batch", "history");
+    bool ok = true;
+    for (size_t clients: {1, 16, 64, 256}) {
+        ok &= measure("uniform", uniform, clients, seconds, threads);
+    }
+    for (size_t clients: {1, 16, 64, 256}) {
+        ok &= measure("zipfian", zipfian, clients, seconds, threads);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+// Cost of the request path's serialization: the flat message format with
+// gathered frame writes, against the varint length-prefixed payloads that
+// storage requests used before, which were encoded into a string and then
+// copied again into the connection's output buffer.
+//
+// For Set requests and Get responses of several value sizes, reports encode
+// and decode time per operation, and the bytes copied per request between the
+// caller's strings and the socket (encode plus queueing the frame) and between
+// the receive buffer and the decoder (before the value is handed out).
+//
+// Usage: serialization_bench [iterations]
+
+#include "codec.h"
+#include "frame.h"
+#include "frame_queue.h"
+#include "message.h"
+#include "storage_protocol.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+// Keeps the optimizer from discarding a result
+volatile size_t g_sink;
+
+std::string varint_set(std::string_view key, std::string_view value) {
+    std::string payload;
+    put_bytes(payload, key);
+    put_bytes(payload, value);
+    return payload;
+}
+
+std::string varint_get_response(const std::optional<std::string> &value) {
+    std::string response(1, value ? 1 : 0);
+    if (value) {
+        response.append(*value);
+    }
+    return response;
+}
+
+template<typename F>
+double ns_per_op(size_t iterations, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        f();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(iterations);
+}
+
+void row(const char *request, size_t value_size, const char *format, double encode, double decode,
+         size_t send_copied, size_t receive_copied) {
+    std::printf("%-13s %8zu  %-8s %10.1f %10.1f %12zu %12zu\n", request, value_size, format, encode, decode,
+                send_copied, receive_copied);
+}
+
+void bench_set(size_t iterations, size_t value_size) {
+    std::string key = "user:0000012345";
+    std::string value(value_size, 'v');
+
+    // Before: encode into a string, copy it into the output buffer; the
+    // server decodes the payload in place and copies into the actor message
+    std::string output;
+    size_t varint_copied = 0;
+    double varint_encode = ns_per_op(iterations, [&] {
+        std::string payload = varint_set(key, value);
+        output.clear();
+        append_frame(output, Opcode::Set, 0, 1, payload);
+        varint_copied = payload.size() + output.size();
+        g_sink = output.size();
+    });
+    std::string varint_payload = varint_set(key, value);
+    double varint_decode = ns_per_op(iterations, [&] {
+        Decoder decoder(varint_payload);
+        g_sink = decoder.bytes().size() + decoder.bytes().size();
+    });
+    row("Set request", value_size, "varint", varint_encode, varint_decode, varint_copied, 0);
+
+    // After: the builder takes the value over and the queue references it.
+    // The caller's strings are copied outside the timed region, as
+    // StorageClient::set takes them by value
+    FrameQueue queue;
+    size_t flat_copied = 0;
+    double flat_encode = ns_per_op(iterations, [&, copy = std::string()]() mutable {
+        copy = value;
+        Message message = encode_set(key, std::move(copy));
+        queue.clear();
+        queue.push(Opcode::Set, 0, 1, message);
+        flat_copied = message.copied() + queue.copied();
+        g_sink = queue.size();
+    });
+    // The value copy made for the builder is part of the loop; subtract it
+    double copy_only = ns_per_op(iterations, [&, copy = std::string()]() mutable {
+        copy = value;
+        g_sink = copy.size();
+    });
+    std::string flat_payload = encode_set(key, value).flatten();
+    double flat_decode = ns_per_op(iterations, [&] {
+        MessageView message(flat_payload);
+        g_sink = message.bytes(0).size() + message.bytes(1).size();
+    });
+    row("Set request", value_size, "flat", std::max(0.0, flat_encode - copy_only), flat_decode, flat_copied, 0);
+}
+
+void bench_get_response(size_t iterations, size_t value_size) {
+    std::string stored(value_size, 'v');
+
+    // Before: the actor's value was encoded into a response string, copied
+    // into the output buffer, and on the client copied out of the receive
+    // buffer into a string before being decoded
+    std::string output;
+    size_t varint_copied = 0;
+    double varint_encode = ns_per_op(iterations, [&] {
+        std::optional<std::string> value = stored;
+        std::string response = varint_get_response(value);
+        output.clear();
+        append_frame(output, Opcode::Get, FrameHeader::kResponse, 1, response);
+        varint_copied = response.size() + output.size();
+        g_sink = output.size();
+    });
+    std::string varint_payload = varint_get_response(stored);
+    double varint_decode = ns_per_op(iterations, [&] {
+        std::string received(varint_payload);
+        g_sink = received.size() > 1 ? received.size() - 1 : 0;
+    });
+    // Both formats start from a copy of the stored value; leave it out
+    double copy_only = ns_per_op(iterations, [&] {
+        std::optional<std::string> value = stored;
+        g_sink = value->size();
+    });
+    row("Get response", value_size, "varint", std::max(0.0, varint_encode - copy_only), varint_decode,
+        varint_copied, varint_payload.size());
+
+    // After: the actor moves the value it read into the message, and the
+    // client reads it in place from the retained receive buffer
+    FrameQueue queue;
+    size_t flat_copied = 0;
+    double flat_encode = ns_per_op(iterations, [&] {
+        std::optional<std::string> value = stored;
+        Message message = encode_get_response(std::move(value));
+        queue.clear();
+        queue.push(Opcode::Get, FrameHeader::kResponse, 1, message);
+        flat_copied = message.copied() + queue.copied();
+        g_sink = queue.size();
+    });
+    std::string flat_payload = encode_get_response(stored).flatten();
+    double flat_decode = ns_per_op(iterations, [&] {
+        MessageView message(flat_payload);
+        g_sink = message.size() == 1 ? message.bytes(0).size() : 0;
+    });
+    row("Get response", value_size, "flat", std::max(0.0, flat_encode - copy_only), flat_decode, flat_copied, 0);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200'000;
+
+    std::printf("%-13s %8s  %-8s %10s %10s %12s %12s\n", "", "value", "format", "encode ns", "decode ns",
+                "send copied", "recv copied");
+    for (size_t value_size: {16, 256, 4096, 65536}) {
+        size_t n = value_size >= 4096 ? iterations / 10 : iterations;
+        bench_set(n, value_size);
+        bench_get_response(n, value_size);
+    }
+    return 0;
+}
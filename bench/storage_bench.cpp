@@ -0,0 +1,106 @@
+// Point lookups, range scans and memory overhead of the storage engine's
+// ordered index at a given number of keys. Keys are YCSB-style ("user" and a
+// zero-padded number), so neighbouring keys share long prefixes; they are
+// inserted and looked up in random order.
+//
+// Usage: storage_bench [keys] [value bytes]
+
+#include "btree.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t kKeySize = 16;
+
+std::string_view key_at(const std::vector<char> &keys, uint64_t id) {
+    return {keys.data() + id * kKeySize, kKeySize};
+}
+
+template<typename F>
+double ns_per_op(size_t ops, F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(ops);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+    size_t value_size = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 8;
+
+    std::vector<char> keys(count * kKeySize);
+    for (size_t i = 0; i < count; i++) {
+        char key[32];
+        std::snprintf(key, sizeof(key), "user%012zu", i % 1'000'000'000'000);
+        std::memcpy(keys.data() + i * kKeySize, key, kKeySize);
+    }
+    std::vector<uint64_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937_64 random(42);
+    std::shuffle(order.begin(), order.end(), random);
+    std::string value(value_size, 'v');
+
+    BTree tree;
+    double insert = ns_per_op(count, [&] {
+        for (uint64_t id: order) {
+            tree.set(key_at(keys, id), value);
+        }
+    });
+
+    std::shuffle(order.begin(), order.end(), random);
+    size_t found = 0;
+    std::string out;
+    double lookup = ns_per_op(count, [&] {
+        for (uint64_t id: order) {
+            found += tree.get(key_at(keys, id), out) ? 1 : 0;
+        }
+    });
+
+    // Keys that sort between existing ones, so every probe reaches a leaf
+    std::string missing_key;
+    double miss = ns_per_op(count, [&] {
+        for (uint64_t id: order) {
+            missing_key.assign(key_at(keys, id));
+            missing_key.push_back('!');
+            found += tree.get(missing_key, out) ? 1 : 0;
+        }
+    });
+
+    constexpr size_t kScans = 100'000;
+    constexpr size_t kScanLength = 100;
+    std::vector<KeyValue> scanned;
+    size_t scanned_keys = 0;
+    double scan = ns_per_op(kScans * kScanLength, [&] {
+        for (size_t i = 0; i < kScans; i++) {
+            scanned.clear();
+            std::string_view begin = key_at(keys, order[i % count]);
+            scanned_keys += tree.range(begin, "\xff", kScanLength, scanned);
+        }
+    });
+
+    size_t payload = count * (kKeySize + value_size);
+    size_t memory = tree.memory_usage();
+    std::printf("%zu keys, %zu-byte keys, %zu-byte values\n", count, kKeySize, value_size);
+    std::printf("%-28s %10.1f ns/op\n", "insert (random order)", insert);
+    std::printf("%-28s %10.1f ns/op\n", "point lookup (hit)", lookup);
+    std::printf("%-28s %10.1f ns/op\n", "point lookup (miss)", miss);
+    std::printf("%-28s %10.1f ns/key\n", "range scan (100 keys)", scan);
+    std::printf("%-28s %10.1f bytes/key\n", "memory", static_cast<double>(memory) / static_cast<double>(count));
+    std::printf("%-28s %10.1f bytes/key\n", "overhead beyond key+value",
+                (static_cast<double>(memory) - static_cast<double>(payload)) / static_cast<double>(count));
+    if (found != count || tree.size() != count || scanned_keys == 0) {
+        std::fprintf(stderr, "Inconsistent results: found %zu of %zu\n", found, count);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+// Task throughput of the work-stealing ThreadPool against the previous
+// single-lock pool, as the number of worker threads grows.
+//
+// Usage: thread_pool_bench [tasks_per_run]
+
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <queue>
+#include <string>
+
+namespace {
+
+// The ThreadPool that runtime.h shipped before the work-stealing scheduler:
+// one mutex, one condition variable and one shared queue.
+class LockedThreadPool {
+public:
+    explicit LockedThreadPool(size_t num_threads) {
+        for (size_t i = 0; i < num_threads; i++) {
+            m_threads.emplace_back([this] {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        m_cv.wait(lock, [this] { return !m_tasks.empty() || m_done; });
+                        if (m_done && m_tasks.empty()) {
+                            return;
+                        }
+                        task = std::move(m_tasks.front());
+                        m_tasks.pop();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    ~LockedThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done = true;
+        }
+        m_cv.notify_all();
+        for (auto &thread: m_threads) {
+            thread.join();
+        }
+    }
+
+    template<typename F>
+    void submit(F &&f) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_tasks.emplace(std::forward<F>(f));
+        }
+        m_cv.notify_one();
+    }
+
+private:
+    std::vector<std::thread> m_threads;
+    std::queue<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_done = false;
+};
+
+void wait_for(const std::atomic<size_t> &counter, size_t target) {
+    while (counter.load(std::memory_order_acquire) < target) {
+        std::this_thread::yield();
+    }
+}
+
+// Every task is submitted by the benchmark thread.
+template<typename Pool>
+double external_submit(size_t threads, size_t tasks) {
+    Pool pool(threads);
+    std::atomic<size_t> done{0};
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < tasks; i++) {
+        pool.submit([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+    }
+    wait_for(done, tasks);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(tasks) / elapsed.count();
+}
+
+// Tasks spawn their own children, as actors and continuations do.
+template<typename Pool>
+void spawn_tree(Pool &pool, std::atomic<size_t> &done, int depth) {
+    if (depth > 0) {
+        pool.submit([&pool, &done, depth] { spawn_tree(pool, done, depth - 1); });
+        pool.submit([&pool, &done, depth] { spawn_tree(pool, done, depth - 1); });
+    }
+    done.fetch_add(1, std::memory_order_relaxed);
+}
+
+template<typename Pool>
+double fan_out(size_t threads, size_t tasks) {
+    int depth = 1;
+    while ((size_t{2} << depth) - 1 < tasks) {
+        depth++;
+    }
+    size_t total = (size_t{2} << depth) - 1;
+    Pool pool(threads);
+    std::atomic<size_t> done{0};
+    auto start = std::chrono::steady_clock::now();
+    pool.submit([&pool, &done, depth] { spawn_tree(pool, done, depth); });
+    wait_for(done, total);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(total) / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t tasks = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<size_t> thread_counts;
+    for (size_t n = 1; n < max_threads; n *= 2) {
+        thread_counts.push_back(n);
+    }
+    thread_counts.push_back(max_threads);
+
+    std::printf("%-8s %-16s %18s %18s\n", "threads", "workload", "locked (tasks/s)", "stealing (tasks/s)");
+    for (size_t threads: thread_counts) {
+        std::printf("%-8zu %-16s %18.0f %18.0f\n", threads, "external_submit",
+                    external_submit<LockedThreadPool>(threads, tasks),
+                    external_submit<ThreadPool>(threads, tasks));
+        std::printf("%-8zu %-16s %18.0f %18.0f\n", threads, "fan_out",
+                    fan_out<LockedThreadPool>(threads, tasks),
+                    fan_out<ThreadPool>(threads, tasks));
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+// Commit throughput and latency of the write-ahead log against the number of
+// concurrent writers, which is what determines the size of commit groups.
+// Every writer is a closed loop: it appends a record, waits until the record
+// is durable and appends the next. Each level runs twice, with the adaptive
+// batching window and with the window disabled (pure group commit).
+//
+// Usage: wal_bench [log path] [seconds per run] [record bytes]
+
+#include "runtime.h"
+#include "wal.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Writer {
+    std::vector<uint32_t> latencies_us;
+};
+
+struct Run {
+    std::shared_ptr<WriteAheadLog> log;
+    std::string record;
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> active{0};
+    std::atomic<bool> failed{false};
+};
+
+void issue(Run &run, Writer &writer) {
+    if (run.stopping.load(std::memory_order_relaxed)) {
+        run.active.fetch_sub(1);
+        return;
+    }
+    auto start = Clock::now();
+    Future<uint64_t> commit = run.log->append(run.record);
+    commit.on_ready([&run, &writer, start, commit] {
+        try {
+            commit.get();
+        } catch (...) {
+            run.failed.store(true);
+            run.active.fetch_sub(1);
+            return;
+        }
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+        writer.latencies_us.push_back(static_cast<uint32_t>(latency.count()));
+        issue(run, writer);
+    });
+}
+
+bool measure(const std::string &path, double seconds, size_t record_size, size_t writers,
+             std::chrono::microseconds max_window) {
+    std::remove(path.c_str());
+    Runtime runtime(1);
+    WriteAheadLog::Options options;
+    options.max_window = max_window;
+    Run run;
+    run.log = runtime.create_actor<WriteAheadLog>(path, options);
+    run.record.assign(record_size, 'r');
+
+    std::vector<Writer> state(writers);
+    run.active = writers;
+    auto start = Clock::now();
+    for (auto &writer: state) {
+        issue(run, writer);
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    run.stopping = true;
+    while (run.active.load() > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    std::vector<uint32_t> latencies;
+    for (auto &writer: state) {
+        latencies.insert(latencies.end(), writer.latencies_us.begin(), writer.latencies_us.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        return latencies.empty() ? 0 : latencies[static_cast<size_t>(p * static_cast<double>(latencies.size() - 1))];
+    };
+    WriteAheadLog::Stats stats = run.log->stats();
+    std::printf("%8zu %10s %12.0f %10.1f %10u %10u %10u %10.0f\n", writers, max_window.count() > 0 ? "adaptive" : "none",
+                static_cast<double>(latencies.size()) / elapsed.count(),
+                stats.groups ? static_cast<double>(stats.records) / static_cast<double>(stats.groups) : 0.0,
+                percentile(0.5), percentile(0.99), percentile(0.999),
+                std::chrono::duration<double, std::micro>(stats.window).count());
+    run.log.reset();
+    runtime.stop();
+    return !run.failed.load();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string path = argc > 1 ? argv[1] : "wal_bench.log";
+    double seconds = argc > 2 ? std::strtod(argv[2], nullptr) : 2.0;
+    size_t record_size = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 128;
+
+    std::printf("%8s %10s %12s %10s %10s %10s %10s %10s\n", "writers", "window", "commits/s", "group",
+                "p50 us", "p99 us", "p99.9 us", "window us");
+    bool ok = true;
+    for (size_t writers: {1, 4, 16, 64, 256}) {
+        ok &= measure(path, seconds, record_size, writers, WriteAheadLog::Options().max_window);
+        ok &= measure(path, seconds, record_size, writers, std::chrono::microseconds(0));
+    }
+    std::remove(path.c_str());
+    return ok ? 0 : 1;
+}
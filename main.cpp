@@ -1,49 +1,232 @@
 #include <boost/asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "connection_pool.h"
+#include "delay_injector.h"
+#include "local_shards.h"
+#include "lsm.h"
+#include "metrics.h"
+#include "runtime.h"
+#include "server.h"
+#include "shard_coordinator.h"
+#include "stats_endpoint.h"
+#include "storage_client.h"
+#include "storage_service.h"
+#include "trace.h"
+#include "wal.h"
 
 using boost::asio::ip::tcp;
 
-int main() {
-    boost::asio::io_context io_context;
+int main(int argc, char **argv) {
+    // "4c" rather than "4" runs thread-per-core: four pinned cores, each
+    // serving connections and owning a slice of the data on the same thread
+    char *threads_end = nullptr;
+    size_t threads = argc > 1 ? std::strtoull(argv[1], &threads_end, 10) : std::thread::hardware_concurrency();
+    bool thread_per_core = argc > 1 && *threads_end == 'c';
 
-    // Create endpoints
+    // Block the shutdown signals before any thread starts, so only sigwait() sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    // Create endpoints. On its own, the server listens on ports 8000-8002 and
+    // serves every key. As server i of a cluster of n ("i/n"), it listens on
+    // port 8000 + i and serves the i-th of n equal slices of the key space;
+    // every server starts from the same map, so clients can ask any of them.
+    // With r replicas ("i/n/r"), slice j is served by servers j to j + r - 1
+    // (wrapping around), so each server holds r slices
+    const char *usage = "Usage: remote_endpoint [threads | cores'c'] [log path | -] [data dir | -] "
+                        "[index/count[/replicas] | -] [delay ms[:probability]]";
+    auto address = boost::asio::ip::address::from_string("127.0.0.1");
     std::vector<tcp::endpoint> endpoints;
-    endpoints.emplace_back(boost::asio::ip::address::from_string("127.0.0.1"), 8000);
-    endpoints.emplace_back(boost::asio::ip::address::from_string("127.0.0.1"), 8001);
-    endpoints.emplace_back(boost::asio::ip::address::from_string("127.0.0.1"), 8002);
-
-    // Create acceptors for each endpoint
-    std::vector<tcp::acceptor> acceptors;
-    acceptors.reserve(endpoints.size());
-    for (const auto &endpoint: endpoints) {
-        acceptors.emplace_back(io_context, endpoint);
-    }
-    while (true) {
-        // Wait for a connection on any of the acceptors
-
-        tcp::socket socket(io_context);
-        boost::asio::ip::tcp::acceptor *acceptor = nullptr;
-        for (auto &a: acceptors) {
-            if (a.is_open()) {
-                try {
-                    a.accept(socket);
-                    acceptor = &a;
-                    break;
-                } catch (const boost::system::system_error &e) {
-                    // Ignore errors and try the next acceptor
-                }
+    // Every endpoint of the cluster, this server's included
+    std::vector<tcp::endpoint> cluster;
+    ShardMap shard_map;
+    size_t index = 0;
+    size_t servers = 1;
+    if (argc > 4 && std::string_view(argv[4]) != "-") {
+        char *end = nullptr;
+        index = std::strtoull(argv[4], &end, 10);
+        size_t count = *end == '/' ? std::strtoull(end + 1, &end, 10) : 0;
+        size_t replicas = *end == '/' ? std::strtoull(end + 1, &end, 10) : 1;
+        if (count == 0 || count > 256 || index >= count || replicas == 0 || replicas > count) {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+        std::vector<std::vector<tcp::endpoint>> teams(count);
+        for (size_t i = 0; i < count; i++) {
+            for (size_t k = 0; k < replicas; k++) {
+                teams[i].emplace_back(address, static_cast<uint16_t>(8000 + (i + k) % count));
             }
         }
+        shard_map = ShardMap::uniform(teams);
+        servers = count;
+        for (size_t i = 0; i < count; i++) {
+            cluster.emplace_back(address, static_cast<uint16_t>(8000 + i));
+        }
+        endpoints.push_back(cluster[index]);
+    } else {
+        for (uint16_t port: {8000, 8001, 8002}) {
+            endpoints.emplace_back(address, port);
+        }
+        shard_map = ShardMap(endpoints);
+        cluster = endpoints;
+    }
+    auto shards = std::make_shared<LocalShards>(shard_map, endpoints);
 
-        if (acceptor) {
-            char buffer[1024];
-            size_t bytes_transferred = socket.read_some(boost::asio::buffer(buffer));
-            std::cout << "Received " << bytes_transferred << " bytes: " << buffer << std::endl;
+    // With a delay, that fraction of responses (all by default) is held back
+    // for that many milliseconds, to test clients against a slow replica
+    std::unique_ptr<DelayInjector> delay;
+    if (argc > 5) {
+        char *end = nullptr;
+        double milliseconds = std::strtod(argv[5], &end);
+        double probability = *end == ':' ? std::strtod(end + 1, &end) : 1.0;
+        if (milliseconds < 0 || probability < 0 || probability > 1) {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+        delay = std::make_unique<DelayInjector>(
+                std::chrono::microseconds(static_cast<int64_t>(milliseconds * 1000)), probability);
+    }
 
-            std::string message = "Hello, client!";
-            boost::asio::write(socket, boost::asio::buffer(message));
+    std::vector<std::shared_ptr<StorageActor>> storage;
+    ShardMap partitions;
+    auto handler_factory = [&storage, &partitions, &shards, &delay](size_t) {
+        auto handler = make_storage_handler(storage, partitions, shards);
+        return delay ? delay->wrap(std::move(handler)) : handler;
+    };
+    // The server outlives the runtime, so replies from actors that are still
+    // running at shutdown find its io_contexts intact
+    std::optional<Server> server;
+    if (!thread_per_core) {
+        server.emplace(endpoints, threads, handler_factory);
+    }
 
-            socket.close();
+    Runtime runtime(Runtime::Options{threads, thread_per_core});
+    // On cores, the server's shards are the runtime's cores instead, which it
+    // stops using in server->stop() below
+    if (thread_per_core) {
+        server.emplace(endpoints, *runtime.cores(), handler_factory);
+    }
+    // With a log path, writes are made durable in a write-ahead log that is
+    // replayed on startup; without one ("-" or nothing) they are only as
+    // durable as the store. With a data directory (not "-") the store is an
+    // LSM tree on disk, otherwise it lives in memory
+    std::string log_path = argc > 2 && std::string_view(argv[2]) != "-" ? argv[2] : "";
+    std::string data_directory = argc > 3 && std::string_view(argv[3]) != "-" ? argv[3] : "";
+    auto open_storage = [&runtime, &log_path, &data_directory](size_t core, const std::string &suffix) {
+        std::shared_ptr<WriteAheadLog> log;
+        if (!log_path.empty()) {
+            log = runtime.create_actor_on<WriteAheadLog>(core, log_path + suffix);
+        }
+        std::unique_ptr<OrderedStore> store;
+        if (!data_directory.empty()) {
+            store = std::make_unique<LsmTree>(data_directory + suffix, runtime.thread_pool());
+        } else {
+            store = std::make_unique<BTree>();
         }
+        return runtime.create_actor_on<StorageActor>(core, std::move(store), std::move(log));
+    };
+    if (!thread_per_core) {
+        // Every shard decodes requests on its own thread and hands them to
+        // the one storage actor, which owns the data
+        storage.push_back(open_storage(0, ""));
+    } else {
+        // Every core owns the data of its own slices of the key space, with
+        // its own storage actor, log and store, so a request for a key the
+        // core serving the connection owns never leaves it, and one for
+        // another core's key crosses to it over that core's lane. There are
+        // as many slices per core as servers in the cluster (at most 256 in
+        // all), so that each core holds part of this server's share of the
+        // keys. The log and data directory of core i end in "-core<i>": a
+        // server must restart with the same number of cores to find its data
+        size_t cores = runtime.cores()->size();
+        std::vector<std::vector<tcp::endpoint>> slices(std::min<size_t>(256, cores * servers));
+        partitions = ShardMap::uniform(slices);
+        for (size_t core = 0; core < cores; core++) {
+            storage.push_back(open_storage(core, "-core" + std::to_string(core)));
+        }
+    }
+    // Each connection keeps at most FrameSession::Options::max_in_flight
+    // requests pending and stops reading past that. The mailbox bound, which
+    // only many connections together reach, stops the connections that find
+    // it full from reading too, until the actor has caught up, rather than
+    // queue requests behind seconds of work
+    for (const auto &actor: storage) {
+        actor->set_mailbox_capacity(16384, ActorBase::Overflow::Fail);
+    }
+    server->start();
+    std::cout << "Serving on " << server->shards() << (thread_per_core ? " cores" : " threads") << std::endl;
+
+    // Server 0 also coordinates the cluster: it alone changes the shard map,
+    // splitting the shards that servers report busy, and installs every new
+    // map on all of them. It reaches the servers, itself included, as a client
+    // would, on a thread of its own
+    boost::asio::io_context coordination;
+    auto coordination_work = boost::asio::make_work_guard(coordination);
+    std::optional<ConnectionPool> coordination_pool;
+    std::optional<StorageClient> coordination_client;
+    std::optional<ShardCoordinator> coordinator;
+    std::thread coordination_thread;
+    if (index == 0) {
+        coordination_pool.emplace(coordination, cluster, 0, 1);
+        StorageClient::Options client_options;
+        client_options.hedge_reads = false;
+        coordination_client.emplace(*coordination_pool, client_options);
+        coordinator.emplace(coordination, *coordination_client, shard_map);
+        coordinator->start();
+        coordination_thread = std::thread([&coordination] { coordination.run(); });
+    }
+
+    // Runtime metrics, in plain text, 1000 ports above the first listening
+    // one. /trace/start and /trace/stop switch event tracing on and off, and
+    // /trace downloads the events for chrome://tracing or Perfetto. They are
+    // an aid, not part of the service: if the port is taken, the server runs
+    // without them
+    std::optional<StatsEndpoint> stats;
+    try {
+        stats.emplace(tcp::endpoint(address, static_cast<uint16_t>(endpoints.front().port() + 1000)),
+                      [&runtime](std::string_view path) -> std::string {
+                          if (path == "/trace/start") {
+                              Trace::start();
+                              return "Tracing\n";
+                          }
+                          if (path == "/trace/stop") {
+                              Trace::stop();
+                              return "Stopped tracing\n";
+                          }
+                          if (path == "/trace") {
+                              return Trace::chrome_json();
+                          }
+                          return render_metrics(Metrics::snapshot(), runtime.actor_stats());
+                      });
+        std::cout << "Metrics on http://" << stats->endpoint() << "/" << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << "Metrics disabled: " << e.what() << std::endl;
+    }
+
+    // Run until interrupted
+    int signal = 0;
+    sigwait(&signals, &signal);
+
+    if (coordinator) {
+        coordinator->stop();
+        coordination_client->close().get();
+        coordination.stop();
+        coordination_thread.join();
     }
-}
\ No newline at end of file
+    server->stop();
+    runtime.stop();
+    return 0;
+}
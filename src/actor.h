@@ -1,80 +1,502 @@
 #ifndef FLOWDB_ACTOR_H
 #define FLOWDB_ACTOR_H
 
-#include <queue>
-#include <mutex>
-#include <condition_variable>
 #include <memory>
 #include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <typeinfo>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "core_set.h"
 #include "future.h"
+#include "mailbox.h"
+#include "metrics.h"
+#include "recycling_allocator.h"
+#include "thread_pool.h"
+#include "trace.h"
 
-class ActorBase {
+// Thrown by tell() and ask() when the actor's mailbox is bounded and full and
+// its overflow policy does not wait for room.
+class MailboxFull : public std::runtime_error {
 public:
-    virtual ~ActorBase() = default;
+    MailboxFull() : std::runtime_error("Mailbox full") {}
+};
+
+// Actors are not bound to a thread. An actor with pending messages is scheduled
+// on its executor as a Runnable, drains at most kBatchSize messages and then
+// gives the thread back, so the number of actors is bounded by memory rather
+// than by the number of threads. The executor is the runtime's ThreadPool, or
+// in thread-per-core mode the one core the actor was placed on.
+//
+// A mailbox is unbounded unless given a capacity, in which case a sender that
+// finds it full either fails at once with MailboxFull or, off the runtime's
+// threads, blocks until there is room, as the actor's Overflow policy says.
+// Senders that must neither fail nor block wait on ready() instead, or call
+// try_tell(). Coroutine continuations queued by resume() are never counted
+// against the capacity: they belong to work the actor has already accepted.
+class ActorBase : public Runnable, public std::enable_shared_from_this<ActorBase> {
+public:
+    // Maximum number of messages processed per scheduling slot
+    static constexpr size_t kBatchSize = 64;
+
+    // What tell() does when the mailbox is full
+    enum class Overflow {
+        // Throw MailboxFull without sending
+        Fail,
+        // Wait for room. A sender on a pool worker or a core fails instead,
+        // whether it is an actor, a task or an io handler: blocking the thread
+        // could stall the actor it waits for, which may need that thread.
+        Block,
+    };
+
+    ~ActorBase() override = default;
 
     virtual void stop() = 0;
 
-    virtual void run() = 0;
+    // Processes a bounded batch of pending messages.
+    void run() override = 0;
+
+    // Binds the actor to the executor that runs its message handlers.
+    void attach(Executor &executor) {
+        m_executor = &executor;
+    }
+
+    // Queues a suspended coroutine to be resumed by this actor's message loop.
+    virtual void resume(std::coroutine_handle<> handle) = 0;
+
+    // Bounds the messages waiting in the mailbox; a capacity of 0, the
+    // default, leaves it unbounded. Call before the actor receives messages.
+    void set_mailbox_capacity(size_t capacity, Overflow overflow = Overflow::Fail) {
+        m_capacity = capacity;
+        m_overflow = overflow;
+    }
+
+    [[nodiscard]] size_t mailbox_capacity() const {
+        return m_capacity;
+    }
+
+    // Completes once the mailbox has room for a message: at once if it has
+    // room now or is unbounded. Room is not reserved, so a sender that loses
+    // the race to another one finds the mailbox full again.
+    Future<Void> ready() {
+        if (m_capacity == 0) {
+            return make_ready_future(Void{});
+        }
+        std::unique_lock<std::mutex> lock(m_ready_mutex);
+        m_ready_waiting.fetch_add(1, std::memory_order_seq_cst);
+        if (m_depth.load(std::memory_order_seq_cst) < m_capacity || m_stopped.load(std::memory_order_relaxed)) {
+            m_ready_waiting.fetch_sub(1, std::memory_order_relaxed);
+            return make_ready_future(Void{});
+        }
+        return m_ready_promises.emplace_back().get_future();
+    }
+
+    // The actor whose messages the calling thread is processing, if any.
+    static ActorBase *current() {
+        return t_current;
+    }
+
+    // The actor's counters as of its last run; type and id are left to the
+    // runtime, which knows them. Safe to call from any thread.
+    [[nodiscard]] ActorStats stats() const {
+        ActorStats stats;
+        stats.processed = m_processed.load(std::memory_order_relaxed);
+        stats.runs = m_runs.load(std::memory_order_relaxed);
+        stats.queue_nanos = m_queue_nanos.load(std::memory_order_relaxed);
+        stats.queue_samples = m_queue_samples.load(std::memory_order_relaxed);
+        stats.backlog = m_backlog.load(std::memory_order_relaxed);
+        stats.peak_backlog = m_peak_backlog.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+protected:
+    // Claims room in the mailbox for one message. False if it is full.
+    bool try_reserve() {
+        if (m_capacity == 0) {
+            return true;
+        }
+        size_t depth = m_depth.load(std::memory_order_relaxed);
+        do {
+            if (depth >= m_capacity) {
+                Metrics::add(Metrics::Counter::ActorMailboxFull);
+                return false;
+            }
+        } while (!m_depth.compare_exchange_weak(depth, depth + 1, std::memory_order_relaxed));
+        return true;
+    }
+
+    // Claims room for one message, applying the overflow policy.
+    //
+    // @throws MailboxFull if the mailbox is full and the sender cannot wait.
+    void reserve() {
+        while (!try_reserve()) {
+            // A stopped actor drops what it is sent, over capacity or not
+            if (m_stopped.load(std::memory_order_acquire)) {
+                m_depth.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            if (m_overflow == Overflow::Fail || current() != nullptr || ThreadPool::on_worker() ||
+                CoreSet::on_core()) {
+                throw MailboxFull();
+            }
+            ready().get();
+        }
+    }
+
+    // Gives back the room of messages taken from the mailbox, processed or
+    // dropped, and wakes the senders waiting in ready(). Both sides order the
+    // depth against the waiter count with seq_cst, so either the sender sees
+    // the room or the actor sees the sender.
+    void release(size_t count) {
+        if (m_capacity == 0 || count == 0) {
+            return;
+        }
+        m_depth.fetch_sub(count, std::memory_order_seq_cst);
+        if (m_ready_waiting.load(std::memory_order_seq_cst) != 0) {
+            wake_senders();
+        }
+    }
+
+    // Completes every ready() future, for good once the actor has stopped.
+    void wake_senders(bool stopped = false) {
+        std::vector<Promise<Void>> woken;
+        {
+            std::unique_lock<std::mutex> lock(m_ready_mutex);
+            if (stopped) {
+                m_stopped.store(true, std::memory_order_release);
+            }
+            woken.swap(m_ready_promises);
+            m_ready_waiting.fetch_sub(woken.size(), std::memory_order_relaxed);
+        }
+        for (auto &promise: woken) {
+            promise.set_value();
+        }
+    }
+
+    // Marks the calling thread as running this actor for the scope's lifetime.
+    class CurrentScope {
+    public:
+        explicit CurrentScope(ActorBase *actor) : m_previous(std::exchange(t_current, actor)) {}
+
+        ~CurrentScope() {
+            t_current = m_previous;
+        }
+
+    private:
+        ActorBase *m_previous;
+    };
+
+    // Enqueues the actor on its executor. A reference is held until run()
+    // claims it, so an actor with pending messages is never destroyed.
+    void schedule() {
+        assert(m_executor != nullptr);
+        m_self = shared_from_this();
+        m_executor->schedule(this);
+    }
+
+    // Takes over the reference held while the actor was queued.
+    std::shared_ptr<ActorBase> claim() {
+        return std::move(m_self);
+    }
+
+    // Adds one run to the actor's counters. Called by run() before the actor
+    // can be scheduled again, so only one thread writes them at a time and a
+    // plain load and store suffice.
+    void account_run(uint64_t processed, uint64_t queue_nanos, uint64_t queue_samples, uint64_t backlog) {
+        auto add = [](std::atomic<uint64_t> &counter, uint64_t amount) {
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        };
+        add(m_processed, processed);
+        add(m_runs, 1);
+        add(m_queue_nanos, queue_nanos);
+        add(m_queue_samples, queue_samples);
+        m_backlog.store(backlog, std::memory_order_relaxed);
+        if (backlog > m_peak_backlog.load(std::memory_order_relaxed)) {
+            m_peak_backlog.store(backlog, std::memory_order_relaxed);
+        }
+        Metrics::add(Metrics::Counter::ActorMessagesProcessed, processed);
+        Metrics::add(Metrics::Counter::ActorRuns);
+    }
+
+private:
+    // The executor this actor is scheduled on
+    Executor *m_executor = nullptr;
+
+    // Keeps the actor alive while it sits in the executor's queues
+    std::shared_ptr<ActorBase> m_self;
+
+    // Mailbox capacity, 0 for unbounded, and messages counted against it:
+    // reserved by senders and not yet released by run()
+    size_t m_capacity = 0;
+    Overflow m_overflow = Overflow::Fail;
+    std::atomic<size_t> m_depth{0};
+
+    // Senders waiting for room, and how many there are
+    std::mutex m_ready_mutex;
+    std::vector<Promise<Void>> m_ready_promises;
+    std::atomic<size_t> m_ready_waiting{0};
+    std::atomic<bool> m_stopped{false};
+
+    // Counters reported by stats()
+    std::atomic<uint64_t> m_processed{0};
+    std::atomic<uint64_t> m_runs{0};
+    std::atomic<uint64_t> m_queue_nanos{0};
+    std::atomic<uint64_t> m_queue_samples{0};
+    std::atomic<uint64_t> m_backlog{0};
+    std::atomic<uint64_t> m_peak_backlog{0};
+
+    static inline thread_local ActorBase *t_current = nullptr;
 };
 
-template<typename T>
+// An actor with a closed, statically typed message set:
+//
+//     struct Get { std::string key; Promise<std::string> reply; };
+//     struct Set { std::string key; std::string value; };
+//
+//     class Storage : public Actor<Storage, Get, Set> {
+//     public:
+//         void handle(Get &message);
+//         void handle(Set &message);
+//     };
+//
+// Messages are moved into the mailbox node by value as a std::variant and
+// dispatched with std::visit to the overload of Derived::handle() for their
+// type, so there is no member-pointer indirection and nothing for the sender
+// to keep alive. Handlers may move out of the message they are given.
+//
+// A Derived that declares `void end_batch()` has it called after every run()
+// that processed at least one message, so handlers can queue work and act on
+// the whole batch at once.
+template<typename Derived, typename... Messages>
 class Actor : public ActorBase {
 public:
-    Actor() : m_done(false) {}
+    using Message = std::variant<Messages...>;
+
+    Actor() : m_done(false), m_pending(nullptr) {}
+
+    ~Actor() override {
+        discard(m_pending);
+        if (!m_mailbox.empty()) {
+            discard(m_mailbox.take_all());
+        }
+    }
+
+    // Sends a message to the actor. Only the message that wakes an idle
+    // mailbox schedules the actor.
+    //
+    // @throws MailboxFull if the mailbox is full and the overflow policy, or
+    // the sender being an actor, rules out waiting.
+    template<typename M>
+    void tell(M &&message) {
+        this->reserve();
+        enqueue(new Envelope(std::in_place_type<std::decay_t<M>>, std::forward<M>(message)));
+    }
 
-    ~Actor() override = default;
+    // Sends a message unless the mailbox is full, whatever the overflow
+    // policy. The message is left untouched when this returns false.
+    template<typename M>
+    bool try_tell(M &&message) {
+        if (!this->try_reserve()) {
+            return false;
+        }
+        enqueue(new Envelope(std::in_place_type<std::decay_t<M>>, std::forward<M>(message)));
+        return true;
+    }
 
-    // Sends a message to the actor.
-    void tell(std::shared_ptr<Promise<T>> &promise, void (Actor<T>::*method)(std::shared_ptr<Promise<T>> &)) {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_queue.emplace(method, &promise);
-        m_cv.notify_one();
+    // Sends a message with a `reply` promise and returns the matching future.
+    //
+    // @throws MailboxFull as tell() does.
+    template<typename M>
+    auto ask(M message) {
+        auto reply = message.reply.get_future();
+        tell(std::move(message));
+        return reply;
     }
 
-    // Stops the actor and waits for it to finish processing messages.
+    // Queues a coroutine continuation behind the messages already pending.
+    void resume(std::coroutine_handle<> handle) override {
+        enqueue(new Node(handle));
+    }
+
+    // Stops the actor. Messages that have not been processed yet are dropped,
+    // and senders waiting for room are let go.
     void stop() override {
         m_done = true;
-        m_cv.notify_one();
+        this->wake_senders(true);
     }
 
-    // Starts the actor's message processing loop.
+    // Processes up to kBatchSize messages, then either reschedules the actor
+    // behind other work or parks the mailbox if it is empty.
     void run() override {
-        while (!m_done) {
-            std::unique_lock<std::mutex> lock(m_mutex);
-
-            // Wait until there is a message in the queue or the actor is stopped
-            m_cv.wait(lock, [this] { return !m_queue.empty() || m_done; });
-            while (!m_queue.empty()) {
+        std::shared_ptr<ActorBase> self = this->claim();
+        CurrentScope scope(this);
+        uint64_t queue_nanos = 0;
+        uint64_t queue_samples = 0;
+        size_t processed = 0;
+        size_t messages = 0;
+        for (; processed < ActorBase::kBatchSize && !m_done; processed++) {
+            if (m_pending == nullptr) {
+                m_pending = take();
+                if (m_pending == nullptr) {
+                    break;
+                }
+            }
+            Node *node = m_pending;
+            m_pending = static_cast<Node *>(node->next);
+            m_pending_count--;
+            if (!node->continuation) {
+                messages++;
+            }
 
-                // Get the next message from the queue
-                auto [method, promise] = std::move(m_queue.front());
-                m_queue.pop();
-                lock.unlock();
+            // Time spent in the mailbox and behind earlier messages of the batch
+            if (node->enqueued != 0) {
+                uint64_t now = Metrics::now();
+                uint64_t waited = now > node->enqueued ? now - node->enqueued : 0;
+                queue_nanos += waited;
+                queue_samples++;
+                Metrics::record(Metrics::Latency::ActorQueue, waited);
+            }
 
-                // Process the message
-                (this->*method)(*promise);
-                lock.lock();
+            if (Trace::enabled()) [[unlikely]] {
+                process_traced(node);
+            } else {
+                process(node);
+            }
+        }
+        if constexpr (requires(Derived &derived) { derived.end_batch(); }) {
+            if (processed > 0 && !m_done) {
+                static_cast<Derived *>(this)->end_batch();
             }
         }
+        if (m_done) {
+            messages += discard(m_pending);
+            m_pending = nullptr;
+            m_pending_count = 0;
+            messages += discard(m_mailbox.take_all());
+        }
+        this->release(messages);
+        if (m_pending == nullptr) {
+            m_pending = take();
+        }
+        this->account_run(processed, queue_nanos, queue_samples, m_pending_count);
+        if (m_pending == nullptr && m_mailbox.try_idle()) {
+            return;
+        }
+        this->schedule();
     }
 
-protected:
-    // Called when a message is received by the actor.
-    // Subclasses should implement this method to handle messages.
-    virtual void receive(T msg) = 0;
-
 private:
-    // The queue of messages waiting to be processed by the actor.
-    std::queue<std::pair<void (Actor<T>::*)(std::shared_ptr<Promise<T>> &), std::shared_ptr<Promise<T>> *>> m_queue;
+    // A mailbox entry. A node with a continuation resumes a suspended
+    // coroutine; every other node is an Envelope carrying a message.
+    struct Node : MailboxNode, Recycled {
+        explicit Node(std::coroutine_handle<> continuation = {}) : continuation(continuation) {}
+
+        std::coroutine_handle<> continuation;
+        // Metrics::now() when the node was pushed, if it was sampled for the
+        // queue latency, otherwise 0
+        uint64_t enqueued = 0;
+        // The sender's trace span, if tracing was on when the node was pushed
+        uint64_t span = 0;
+    };
 
-    // The mutex used to synchronize access to the message queue.
-    std::mutex m_mutex;
+    struct Envelope : Node {
+        template<typename M, typename... Args>
+        explicit Envelope(std::in_place_type_t<M> type, Args &&... args) : message(type, std::forward<Args>(args)...) {}
 
-    // The condition variable used to signal when a new message is available.
-    std::condition_variable m_cv;
+        Message message;
+    };
+
+    void enqueue(Node *node) {
+        if (Metrics::sample()) {
+            node->enqueued = Metrics::now();
+        }
+        Metrics::add(Metrics::Counter::ActorMessagesSent);
+        // Before the push, after which the node may already be processed
+        if (Trace::enabled()) [[unlikely]] {
+            node->span = Trace::current();
+            Trace::emit(Trace::Event::Send, typeid(Derived).name(), node->span, reinterpret_cast<uintptr_t>(node));
+        }
+        if (m_mailbox.push(node)) {
+            this->schedule();
+        }
+    }
+
+    // Takes everything that arrived since the last drain in one swap.
+    Node *take() {
+        auto *head = static_cast<Node *>(m_mailbox.take_all(m_pending_count));
+        if (head != nullptr && Trace::enabled()) [[unlikely]] {
+            Trace::emit(Trace::Event::Dequeue, typeid(Derived).name(), 0, m_pending_count);
+        }
+        return head;
+    }
+
+    // Runs a message's handler, or resumes its coroutine, and frees the node.
+    void process(Node *node) {
+        if (node->continuation) {
+            node->continuation.resume();
+            delete node;
+        } else {
+            auto *envelope = static_cast<Envelope *>(node);
+            std::visit([this](auto &message) { static_cast<Derived *>(this)->handle(message); }, envelope->message);
+            delete envelope;
+        }
+    }
+
+    // process() inside the sender's span, between handler events named after
+    // the message type
+    void process_traced(Node *node) {
+        Trace::Scope scope(node->span);
+        const char *name = nullptr;
+        if (!node->continuation) {
+            name = std::visit([](auto &message) { return typeid(message).name(); },
+                              static_cast<Envelope *>(node)->message);
+        }
+        auto id = reinterpret_cast<uintptr_t>(node);
+        Trace::emit(Trace::Event::HandlerBegin, name, node->span, id);
+        process(node);
+        Trace::emit(Trace::Event::HandlerEnd, name, Trace::current(), id);
+    }
+
+    // Drops unprocessed messages and returns how many there were. Every node
+    // counts as dropped, as every node counted as sent.
+    // Suspended coroutines are destroyed, which breaks the promises they would
+    // have fulfilled.
+    static size_t discard(MailboxNode *head) {
+        size_t messages = 0;
+        size_t nodes = 0;
+        while (head != nullptr) {
+            auto *node = static_cast<Node *>(head);
+            head = head->next;
+            nodes++;
+            if (node->continuation) {
+                node->continuation.destroy();
+                delete node;
+            } else {
+                delete static_cast<Envelope *>(node);
+                messages++;
+            }
+        }
+        if (nodes != 0) {
+            Metrics::add(Metrics::Counter::ActorMessagesDropped, nodes);
+        }
+        return messages;
+    }
+
+    // Messages sent to the actor but not yet taken by run().
+    Mailbox m_mailbox;
 
     // A flag indicating whether the actor should stop processing messages.
     std::atomic<bool> m_done;
+
+    // Messages taken from the mailbox but not processed yet, in FIFO order,
+    // and how many there are. Only touched by run().
+    Node *m_pending;
+    size_t m_pending_count = 0;
 };
 
 #endif //FLOWDB_ACTOR_H
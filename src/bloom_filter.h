@@ -0,0 +1,84 @@
+#ifndef FLOWDB_BLOOM_FILTER_H
+#define FLOWDB_BLOOM_FILTER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 64-bit hash of a byte string, MurmurHash64A-style: eight bytes per step,
+// then a final avalanche.
+inline uint64_t hash64(std::string_view data, uint64_t seed = 0x9e3779b97f4a7c15ull) {
+    constexpr uint64_t m = 0xc6a4a7935bd1e995ull;
+    constexpr int r = 47;
+    uint64_t h = seed ^ (data.size() * m);
+    const char *p = data.data();
+    size_t words = data.size() / 8;
+    for (size_t i = 0; i < words; i++, p += 8) {
+        uint64_t k;
+        std::memcpy(&k, p, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    size_t tail = data.size() & 7;
+    if (tail != 0) {
+        uint64_t k = 0;
+        std::memcpy(&k, p, tail);
+        h ^= k;
+        h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+// Bloom filter over the keys of one table, stored as the bit array followed by
+// one byte with the number of probes. Probes use double hashing: probe i tests
+// bit (h1 + i * h2) mod bits, with h1 and h2 the halves of hash64(key).
+
+// Builds the filter bytes for a set of key hashes.
+inline std::string build_bloom_filter(const std::vector<uint64_t> &hashes, size_t bits_per_key) {
+    // ln 2 * bits per key probes minimises the false positive rate
+    size_t probes = std::max<size_t>(1, std::min<size_t>(30, bits_per_key * 69 / 100));
+    size_t bits = std::max<size_t>(64, hashes.size() * bits_per_key);
+    size_t bytes = (bits + 7) / 8;
+    bits = bytes * 8;
+    std::string filter(bytes + 1, '\0');
+    for (uint64_t hash: hashes) {
+        uint64_t h1 = hash;
+        uint64_t h2 = (hash >> 32) | (hash << 32) | 1;
+        for (size_t i = 0; i < probes; i++) {
+            uint64_t bit = (h1 + i * h2) % bits;
+            filter[bit / 8] = static_cast<char>(filter[bit / 8] | (1 << (bit % 8)));
+        }
+    }
+    filter[bytes] = static_cast<char>(probes);
+    return filter;
+}
+
+// False means the key is certainly not in the set; true means it may be.
+inline bool bloom_may_contain(std::string_view filter, uint64_t hash) {
+    if (filter.size() < 2) {
+        return true;
+    }
+    size_t bits = (filter.size() - 1) * 8;
+    auto probes = static_cast<size_t>(static_cast<unsigned char>(filter.back()));
+    uint64_t h1 = hash;
+    uint64_t h2 = (hash >> 32) | (hash << 32) | 1;
+    for (size_t i = 0; i < probes; i++) {
+        uint64_t bit = (h1 + i * h2) % bits;
+        if ((static_cast<unsigned char>(filter[bit / 8]) & (1 << (bit % 8))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif //FLOWDB_BLOOM_FILTER_H
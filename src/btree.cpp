@@ -0,0 +1,538 @@
+#include "btree.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "codec.h"
+
+namespace {
+
+// The first four bytes of s as a big-endian integer, zero-padded. If the heads
+// of two strings differ, they order the strings the same way the strings do.
+inline uint32_t load_head(std::string_view s) {
+    unsigned char bytes[4] = {0, 0, 0, 0};
+    if (!s.empty()) {
+        std::memcpy(bytes, s.data(), std::min<size_t>(s.size(), 4));
+    }
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+           (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+// Number of heads smaller than probe, i.e. the lower bound in a sorted head
+// array. Kept branch-free so it compiles to vector compares.
+inline size_t count_less(const uint32_t *heads, size_t count, uint32_t probe) {
+    size_t less = 0;
+    for (size_t i = 0; i < count; i++) {
+        less += heads[i] < probe ? 1 : 0;
+    }
+    return less;
+}
+
+inline size_t common_prefix(std::string_view a, std::string_view b) {
+    size_t limit = std::min(a.size(), b.size());
+    size_t i = 0;
+    while (i < limit && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+// Heap bytes owned by a string, beyond the string object itself
+inline size_t heap_usage(const std::string &s) {
+    return s.capacity() > 15 ? s.capacity() + 1 : 0;
+}
+
+} // namespace
+
+// Entries are stored in blob as varint suffix length, suffix, varint value
+// length, value. heads and offsets are kept in key order; updates and removals
+// leave garbage in the blob that is compacted once it dominates.
+struct BTree::Leaf : Node {
+    Leaf() : Node(true) {}
+
+    [[nodiscard]] std::string_view suffix(size_t i) const {
+        uint64_t size;
+        const char *p = get_varint(blob.data() + offsets[i], size);
+        return {p, size};
+    }
+
+    [[nodiscard]] std::string_view value(size_t i) const {
+        uint64_t size;
+        const char *p = get_varint(blob.data() + offsets[i], size);
+        p = get_varint(p + size, size);
+        return {p, size};
+    }
+
+    [[nodiscard]] size_t entry_size(size_t i) const {
+        std::string_view v = value(i);
+        return v.data() + v.size() - (blob.data() + offsets[i]);
+    }
+
+    [[nodiscard]] std::string key(size_t i) const {
+        std::string_view rest = suffix(i);
+        std::string full;
+        full.reserve(prefix.size() + rest.size());
+        full.append(prefix).append(rest);
+        return full;
+    }
+
+    // Position of the first entry not less than key; found is set if it is equal.
+    size_t lower_bound(std::string_view key, bool &found) const {
+        found = false;
+        size_t shared = common_prefix(key, prefix);
+        if (shared < prefix.size()) {
+            // Every key here starts with the prefix, and key does not
+            bool before = shared == key.size() ||
+                          static_cast<unsigned char>(key[shared]) < static_cast<unsigned char>(prefix[shared]);
+            return before ? 0 : count;
+        }
+        std::string_view rest = key.substr(prefix.size());
+        uint32_t probe = load_head(rest);
+        size_t i = count_less(heads, count, probe);
+        for (; i < count && heads[i] == probe; i++) {
+            int order = suffix(i).compare(rest);
+            if (order >= 0) {
+                found = order == 0;
+                return i;
+            }
+        }
+        return i;
+    }
+
+    uint32_t append(std::string_view rest, std::string_view entry_value) {
+        auto offset = static_cast<uint32_t>(blob.size());
+        put_bytes(blob, rest);
+        put_bytes(blob, entry_value);
+        return offset;
+    }
+
+    void insert(size_t pos, std::string_view full_key, std::string_view entry_value) {
+        if (full_key.substr(0, prefix.size()) != prefix) {
+            rebuild(prefix.substr(0, common_prefix(full_key, prefix)));
+        }
+        std::string_view rest = full_key.substr(prefix.size());
+        std::memmove(heads + pos + 1, heads + pos, (count - pos) * sizeof(heads[0]));
+        std::memmove(offsets + pos + 1, offsets + pos, (count - pos) * sizeof(offsets[0]));
+        heads[pos] = load_head(rest);
+        offsets[pos] = append(rest, entry_value);
+        count++;
+    }
+
+    void assign(size_t pos, std::string_view entry_value) {
+        garbage += entry_size(pos);
+        // Reserve first so the suffix, which points into the blob, stays valid
+        size_t needed = blob.size() + suffix(pos).size() + entry_value.size() + 20;
+        if (blob.capacity() < needed) {
+            blob.reserve(std::max(needed, blob.capacity() * 2));
+        }
+        offsets[pos] = append(suffix(pos), entry_value);
+        maybe_compact();
+    }
+
+    void erase(size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            garbage += entry_size(i);
+        }
+        std::memmove(heads + begin, heads + end, (count - end) * sizeof(heads[0]));
+        std::memmove(offsets + begin, offsets + end, (count - end) * sizeof(offsets[0]));
+        count -= end - begin;
+        if (count == 0) {
+            blob.clear();
+            prefix.clear();
+            garbage = 0;
+        } else {
+            maybe_compact();
+        }
+    }
+
+    void maybe_compact() {
+        if (garbage > 1024 && garbage * 2 > blob.size()) {
+            rebuild(prefix);
+        }
+    }
+
+    // Re-encodes the live entries against a new prefix, which must be a prefix
+    // of every key in the leaf, dropping garbage.
+    void rebuild(std::string new_prefix) {
+        std::string fresh;
+        fresh.reserve(blob.size() - garbage + count * (prefix.size() > new_prefix.size() ? prefix.size() : 0));
+        for (size_t i = 0; i < count; i++) {
+            std::string_view rest = suffix(i);
+            auto offset = static_cast<uint32_t>(fresh.size());
+            if (new_prefix.size() <= prefix.size()) {
+                std::string_view extra = std::string_view(prefix).substr(new_prefix.size());
+                put_varint(fresh, extra.size() + rest.size());
+                fresh.append(extra).append(rest);
+            } else {
+                put_bytes(fresh, rest.substr(new_prefix.size() - prefix.size()));
+            }
+            put_bytes(fresh, value(i));
+            offsets[i] = offset;
+        }
+        blob.swap(fresh);
+        prefix = std::move(new_prefix);
+        garbage = 0;
+        for (size_t i = 0; i < count; i++) {
+            heads[i] = load_head(suffix(i));
+        }
+    }
+
+    std::string prefix;
+    uint32_t heads[kLeafCapacity];
+    uint32_t offsets[kLeafCapacity];
+    std::string blob;
+    // Blob bytes no longer referenced by any entry
+    size_t garbage = 0;
+    Leaf *prev = nullptr;
+    Leaf *next = nullptr;
+};
+
+// children[i + 1] holds the keys from keys[i] up to keys[i + 1].
+struct BTree::Internal : Node {
+    Internal() : Node(false) {}
+
+    // Index of the child whose range contains key.
+    [[nodiscard]] size_t child_index(std::string_view key) const {
+        size_t separators = count - 1;
+        uint32_t probe = load_head(key);
+        size_t i = count_less(heads, separators, probe);
+        while (i < separators && heads[i] == probe && std::string_view(keys[i]) <= key) {
+            i++;
+        }
+        return i;
+    }
+
+    // Inserts right after children[index], with separator between them.
+    void insert(size_t index, std::string separator, Node *right) {
+        for (size_t i = count - 1; i > index; i--) {
+            keys[i] = std::move(keys[i - 1]);
+            heads[i] = heads[i - 1];
+        }
+        heads[index] = load_head(separator);
+        keys[index] = std::move(separator);
+        for (size_t i = count; i > index + 1; i--) {
+            children[i] = children[i - 1];
+        }
+        children[index + 1] = right;
+        count++;
+    }
+
+    // Removes children[index] and one of the separators next to it; the range
+    // of the removed child, which must be empty, goes to a neighbour.
+    void erase(size_t index) {
+        size_t separators = count - 1;
+        for (size_t i = index > 0 ? index - 1 : 0; i + 1 < separators; i++) {
+            keys[i] = std::move(keys[i + 1]);
+            heads[i] = heads[i + 1];
+        }
+        if (separators > 0) {
+            std::string().swap(keys[separators - 1]);
+        }
+        for (size_t i = index; i + 1 < count; i++) {
+            children[i] = children[i + 1];
+        }
+        count--;
+    }
+
+    uint32_t heads[kInternalCapacity - 1];
+    std::string keys[kInternalCapacity - 1];
+    Node *children[kInternalCapacity];
+};
+
+BTree::BTree() : m_root(new Leaf()), m_first(static_cast<Leaf *>(m_root)) {}
+
+BTree::~BTree() {
+    destroy(m_root);
+}
+
+bool BTree::get(std::string_view key, std::string &value) const {
+    const Leaf *leaf = find_leaf(key, nullptr);
+    bool found;
+    size_t pos = leaf->lower_bound(key, found);
+    if (found) {
+        value.assign(leaf->value(pos));
+    }
+    return found;
+}
+
+void BTree::set(std::string_view key, std::string_view value) {
+    Path path;
+    Leaf *leaf = find_leaf(key, &path);
+    bool found;
+    size_t pos = leaf->lower_bound(key, found);
+    if (found) {
+        leaf->assign(pos, value);
+        return;
+    }
+    if (leaf->count == kLeafCapacity) {
+        leaf = split(leaf, path, key);
+        pos = leaf->lower_bound(key, found);
+    }
+    leaf->insert(pos, key, value);
+    m_size++;
+}
+
+bool BTree::clear(std::string_view key) {
+    Path path;
+    Leaf *leaf = find_leaf(key, &path);
+    bool found;
+    size_t pos = leaf->lower_bound(key, found);
+    if (!found) {
+        return false;
+    }
+    leaf->erase(pos, pos + 1);
+    m_size--;
+    if (leaf->count == 0 && leaf != m_root) {
+        remove_leaf(leaf, path);
+    }
+    return true;
+}
+
+/**
+ * @brief Clears [begin, end) one leaf at a time: each step erases the run of
+ * matching entries in a leaf with a single shift, then moves on to the next
+ * leaf if the range may continue there.
+ */
+size_t BTree::clear_range(std::string_view begin, std::string_view end) {
+    size_t removed = 0;
+    if (begin >= end) {
+        return removed;
+    }
+    std::string cursor(begin);
+    while (true) {
+        Path path;
+        Leaf *leaf = find_leaf(cursor, &path);
+        bool found;
+        size_t from = leaf->lower_bound(cursor, found);
+        size_t to = leaf->lower_bound(end, found);
+        bool more = to == leaf->count && leaf->next != nullptr;
+        std::string next_key = more ? leaf->next->key(0) : std::string();
+        leaf->erase(from, to);
+        removed += to - from;
+        m_size -= to - from;
+        if (leaf->count == 0 && leaf != m_root) {
+            remove_leaf(leaf, path);
+        }
+        if (!more || next_key >= end) {
+            return removed;
+        }
+        cursor = std::move(next_key);
+    }
+}
+
+size_t BTree::range(std::string_view begin, std::string_view end, size_t limit, std::vector<KeyValue> &out) const {
+    size_t added = 0;
+    if (begin >= end) {
+        return added;
+    }
+    const Leaf *leaf = find_leaf(begin, nullptr);
+    bool found;
+    size_t i = leaf->lower_bound(begin, found);
+    while (leaf != nullptr && added < limit) {
+        for (; i < leaf->count && added < limit; i++) {
+            std::string key = leaf->key(i);
+            if (std::string_view(key) >= end) {
+                return added;
+            }
+            out.push_back(KeyValue{std::move(key), std::string(leaf->value(i))});
+            added++;
+        }
+        leaf = leaf->next;
+        i = 0;
+    }
+    return added;
+}
+
+BTree::Cursor BTree::seek(std::string_view key) const {
+    const Leaf *leaf = find_leaf(key, nullptr);
+    bool found;
+    return {leaf, leaf->lower_bound(key, found)};
+}
+
+BTree::Cursor::Cursor(const Leaf *leaf, size_t index) : m_leaf(leaf), m_index(index) {
+    settle();
+}
+
+void BTree::Cursor::next() {
+    m_index++;
+    settle();
+}
+
+std::string_view BTree::Cursor::value() const {
+    return m_leaf->value(m_index);
+}
+
+void BTree::Cursor::settle() {
+    while (m_leaf != nullptr && m_index >= m_leaf->count) {
+        m_leaf = m_leaf->next;
+        m_index = 0;
+    }
+    if (m_leaf != nullptr) {
+        m_key.assign(m_leaf->prefix).append(m_leaf->suffix(m_index));
+    }
+}
+
+size_t BTree::memory_usage() const {
+    return memory_usage(m_root);
+}
+
+BTree::Leaf *BTree::find_leaf(std::string_view key, Path *path) const {
+    Node *node = m_root;
+    if (path != nullptr) {
+        path->depth = 0;
+    }
+    while (!node->leaf) {
+        auto *internal = static_cast<Internal *>(node);
+        size_t index = internal->child_index(key);
+        if (path != nullptr) {
+            assert(path->depth < Path::kMaxDepth);
+            path->entries[path->depth++] = {internal, index};
+        }
+        node = internal->children[index];
+    }
+    return static_cast<Leaf *>(node);
+}
+
+/**
+ * @brief Moves the upper half of a full leaf into a new right sibling.
+ *
+ * The separator pushed to the parent is the shortest prefix of the right
+ * half's first key that is still greater than the left half's last key, and
+ * both halves recompute their shared prefix, which can only grow.
+ */
+BTree::Leaf *BTree::split(Leaf *leaf, Path &path, std::string_view key) {
+    size_t mid = leaf->count / 2;
+    std::string_view last_left = leaf->suffix(mid - 1);
+    std::string_view first_right = leaf->suffix(mid);
+    std::string separator = leaf->prefix;
+    separator.append(first_right.substr(0, common_prefix(last_left, first_right) + 1));
+
+    auto *right = new Leaf();
+    size_t right_extra = common_prefix(first_right, leaf->suffix(leaf->count - 1));
+    right->prefix = leaf->prefix;
+    right->prefix.append(first_right.substr(0, right_extra));
+    for (size_t i = mid; i < leaf->count; i++) {
+        std::string_view rest = leaf->suffix(i).substr(right_extra);
+        right->heads[i - mid] = load_head(rest);
+        right->offsets[i - mid] = right->append(rest, leaf->value(i));
+    }
+    right->count = leaf->count - mid;
+
+    std::string left_prefix = leaf->prefix;
+    left_prefix.append(leaf->suffix(0).substr(0, common_prefix(leaf->suffix(0), leaf->suffix(mid - 1))));
+    leaf->count = mid;
+    leaf->rebuild(std::move(left_prefix));
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next != nullptr) {
+        leaf->next->prev = right;
+    }
+    leaf->next = right;
+
+    bool goes_right = key >= std::string_view(separator);
+    insert_into_parent(path, path.depth, leaf, std::move(separator), right);
+    return goes_right ? right : leaf;
+}
+
+void BTree::insert_into_parent(Path &path, size_t depth, Node *left, std::string separator, Node *right) {
+    if (depth == 0) {
+        auto *root = new Internal();
+        root->children[0] = left;
+        root->children[1] = right;
+        root->heads[0] = load_head(separator);
+        root->keys[0] = std::move(separator);
+        root->count = 2;
+        m_root = root;
+        return;
+    }
+    auto [parent, index] = path.entries[depth - 1];
+    if (parent->count < kInternalCapacity) {
+        parent->insert(index, std::move(separator), right);
+        return;
+    }
+
+    // Split the parent: children [0, mid) stay, the rest move to a sibling and
+    // the separator between the halves moves up
+    size_t mid = kInternalCapacity / 2;
+    auto *sibling = new Internal();
+    std::string promoted = std::move(parent->keys[mid - 1]);
+    sibling->count = parent->count - mid;
+    for (size_t i = 0; i < sibling->count; i++) {
+        sibling->children[i] = parent->children[mid + i];
+    }
+    for (size_t i = 0; i + 1 < sibling->count; i++) {
+        sibling->keys[i] = std::move(parent->keys[mid + i]);
+        sibling->heads[i] = parent->heads[mid + i];
+    }
+    parent->count = mid;
+    if (index < mid) {
+        parent->insert(index, std::move(separator), right);
+    } else {
+        sibling->insert(index - mid, std::move(separator), right);
+    }
+    insert_into_parent(path, depth - 1, parent, std::move(promoted), sibling);
+}
+
+void BTree::remove_leaf(Leaf *leaf, Path &path) {
+    if (leaf->prev != nullptr) {
+        leaf->prev->next = leaf->next;
+    } else {
+        m_first = leaf->next;
+    }
+    if (leaf->next != nullptr) {
+        leaf->next->prev = leaf->prev;
+    }
+    delete leaf;
+
+    // Remove the leaf from its parent, and parents left without children from theirs
+    for (size_t depth = path.depth; depth > 0; depth--) {
+        auto [parent, index] = path.entries[depth - 1];
+        parent->erase(index);
+        if (parent->count > 0) {
+            break;
+        }
+        if (depth == 1) {
+            // The whole tree is empty
+            delete parent;
+            m_root = m_first = new Leaf();
+            return;
+        }
+        delete parent;
+    }
+
+    // Drop roots with a single child
+    while (!m_root->leaf && m_root->count == 1) {
+        auto *root = static_cast<Internal *>(m_root);
+        m_root = root->children[0];
+        delete root;
+    }
+}
+
+void BTree::destroy(Node *node) {
+    if (node->leaf) {
+        delete static_cast<Leaf *>(node);
+        return;
+    }
+    auto *internal = static_cast<Internal *>(node);
+    for (size_t i = 0; i < internal->count; i++) {
+        destroy(internal->children[i]);
+    }
+    delete internal;
+}
+
+size_t BTree::memory_usage(const Node *node) {
+    if (node->leaf) {
+        auto *leaf = static_cast<const Leaf *>(node);
+        return sizeof(Leaf) + heap_usage(leaf->prefix) + leaf->blob.capacity() + 1;
+    }
+    auto *internal = static_cast<const Internal *>(node);
+    size_t total = sizeof(Internal);
+    for (size_t i = 0; i < internal->count; i++) {
+        if (i + 1 < internal->count) {
+            total += heap_usage(internal->keys[i]);
+        }
+        total += memory_usage(internal->children[i]);
+    }
+    return total;
+}
@@ -0,0 +1,142 @@
+#ifndef FLOWDB_BTREE_H
+#define FLOWDB_BTREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ordered_store.h"
+
+// In-memory ordered map from byte-string keys to byte-string values, built as
+// a B+tree with wide nodes. It is not thread-safe; the storage actor that owns
+// it serialises access.
+//
+// Leaves hold up to kLeafCapacity entries. The prefix shared by all keys of a
+// leaf is stored once, and each entry keeps only the rest of its key, packed
+// with its value into one contiguous buffer per leaf. Both leaves and internal
+// nodes keep the first four bytes of every key (or key suffix) as a big-endian
+// integer in a dense array. A search first counts the heads that are smaller
+// than the probe's head with a branch-free loop the compiler vectorises, and
+// only compares full keys among entries with an equal head. Separators are
+// truncated to the shortest prefix that still separates their children, and
+// leaves are linked for range scans.
+//
+// Empty leaves are unlinked, but underfull nodes are not merged: that keeps
+// clears cheap, at the cost of some slack after heavy deletion.
+class BTree final : public OrderedStore {
+public:
+    static constexpr size_t kLeafCapacity = 64;
+    static constexpr size_t kInternalCapacity = 64;
+
+    BTree();
+
+    BTree(const BTree &) = delete;
+
+    BTree &operator=(const BTree &) = delete;
+
+    ~BTree() override;
+
+    using OrderedStore::get;
+
+    bool get(std::string_view key, std::string &value) const override;
+
+    void set(std::string_view key, std::string_view value) override;
+
+    bool clear(std::string_view key) override;
+
+    size_t clear_range(std::string_view begin, std::string_view end) override;
+
+    size_t range(std::string_view begin, std::string_view end, size_t limit,
+                 std::vector<KeyValue> &out) const override;
+
+    class Cursor;
+
+    // Positions a cursor at the first entry not less than key.
+    [[nodiscard]] Cursor seek(std::string_view key) const;
+
+    [[nodiscard]] size_t size() const {
+        return m_size;
+    }
+
+    // Bytes allocated for nodes, keys and values, including slack.
+    [[nodiscard]] size_t memory_usage() const;
+
+private:
+    struct Node {
+        explicit Node(bool leaf) : leaf(leaf) {}
+
+        bool leaf;
+        // Entries in a leaf, children in an internal node
+        uint32_t count = 0;
+    };
+
+    struct Leaf;
+    struct Internal;
+
+    // Internal nodes visited on the way to a leaf, with the child taken at each
+    struct Path {
+        static constexpr size_t kMaxDepth = 16;
+
+        struct Entry {
+            Internal *node;
+            size_t index;
+        };
+
+        Entry entries[kMaxDepth];
+        size_t depth = 0;
+    };
+
+    Leaf *find_leaf(std::string_view key, Path *path) const;
+
+    // Splits a full leaf in half and links the new right half into the tree.
+    // Returns the leaf that should hold key afterwards.
+    Leaf *split(Leaf *leaf, Path &path, std::string_view key);
+
+    // Inserts separator and right after path's last child, splitting parents
+    // as needed.
+    void insert_into_parent(Path &path, size_t depth, Node *left, std::string separator, Node *right);
+
+    // Unlinks an empty leaf, and any parents it leaves empty.
+    void remove_leaf(Leaf *leaf, Path &path);
+
+    static void destroy(Node *node);
+
+    static size_t memory_usage(const Node *node);
+
+    Node *m_root;
+    Leaf *m_first;
+    size_t m_size = 0;
+};
+
+// Walks the entries of a BTree in key order. Any change to the tree
+// invalidates it.
+class BTree::Cursor {
+public:
+    [[nodiscard]] bool valid() const {
+        return m_leaf != nullptr;
+    }
+
+    void next();
+
+    // Both views stay valid until the cursor moves.
+    [[nodiscard]] std::string_view key() const {
+        return m_key;
+    }
+
+    [[nodiscard]] std::string_view value() const;
+
+private:
+    friend class BTree;
+
+    Cursor(const Leaf *leaf, size_t index);
+
+    // Moves past the end of empty leaves and loads the key.
+    void settle();
+
+    const Leaf *m_leaf;
+    size_t m_index;
+    std::string m_key;
+};
+
+#endif //FLOWDB_BTREE_H
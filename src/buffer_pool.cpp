@@ -0,0 +1,124 @@
+#include "buffer_pool.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <new>
+
+namespace {
+
+constexpr uint32_t kUnpooled = UINT32_MAX;
+constexpr size_t kNumClasses = std::countr_zero(BufferRef::kMaxPooledSize / BufferRef::kMinBufferSize) + 1;
+constexpr uint32_t kMaxCachedPerClass = 64;
+
+struct FreeList {
+    void *buffers[kMaxCachedPerClass];
+    uint32_t count;
+};
+
+// Trivially destructible so the fast paths need no TLS initialisation guard;
+// Flusher frees the cached buffers at thread exit, after which buffers
+// released on the thread go straight back to the heap.
+struct Cache {
+    FreeList lists[kNumClasses];
+    bool flushed;
+};
+
+thread_local constinit Cache t_cache{};
+
+struct Flusher {
+    ~Flusher() {
+        for (auto &list: t_cache.lists) {
+            while (list.count > 0) {
+                ::operator delete(list.buffers[--list.count]);
+            }
+        }
+        t_cache.flushed = true;
+    }
+};
+
+void register_flusher() {
+    static thread_local Flusher flusher;
+    (void) flusher;
+}
+
+} // namespace
+
+/**
+ * @brief Rounds size up to a power of two and takes a buffer of that size
+ * from the calling thread's free list, or from the heap if the list is empty
+ * or the size is above kMaxPooledSize.
+ */
+BufferRef BufferRef::allocate(size_t size) {
+    size = std::max(size, kMinBufferSize);
+    BufferRef result;
+    if (size > kMaxPooledSize) {
+        void *memory = ::operator new(sizeof(Header) + size);
+        result.m_header = new(memory) Header{{1}, kUnpooled, size};
+        return result;
+    }
+    size_t capacity = std::bit_ceil(size);
+    auto size_class = static_cast<uint32_t>(std::countr_zero(capacity / kMinBufferSize));
+    FreeList &list = t_cache.lists[size_class];
+    void *memory = list.count > 0 ? list.buffers[--list.count] : ::operator new(sizeof(Header) + capacity);
+    result.m_header = new(memory) Header{{1}, size_class, capacity};
+    return result;
+}
+
+void BufferRef::release(Header *header) {
+    uint32_t size_class = header->size_class;
+    header->~Header();
+    if (size_class == kUnpooled) {
+        ::operator delete(header);
+        return;
+    }
+    FreeList &list = t_cache.lists[size_class];
+    if (list.count >= kMaxCachedPerClass || t_cache.flushed) {
+        ::operator delete(header);
+        return;
+    }
+    if (list.count == 0) {
+        register_flusher();
+    }
+    list.buffers[list.count++] = header;
+}
+
+/**
+ * @brief Serves the allocation from the current buffer if it fits, otherwise
+ * starts a new buffer large enough for it.
+ */
+char *Arena::allocate(size_t size) {
+    if (size > m_left) {
+        BufferRef buffer = BufferRef::allocate(std::max(m_next_size, size));
+        m_next = buffer.data();
+        m_left = buffer.capacity();
+        if (!m_first) {
+            m_first = std::move(buffer);
+        } else {
+            m_buffers.push_back(std::move(buffer));
+        }
+        m_next_size = std::min(m_next_size * 2, BufferRef::kMaxPooledSize);
+    }
+    char *result = m_next;
+    m_next += size;
+    m_left -= size;
+    m_used += size;
+    return result;
+}
+
+std::string_view Arena::copy(std::string_view bytes) {
+    char *out = allocate(bytes.size());
+    if (!bytes.empty()) {
+        std::memcpy(out, bytes.data(), bytes.size());
+    }
+    return {out, bytes.size()};
+}
+
+void Arena::clear() {
+    m_first = BufferRef();
+    m_buffers.clear();
+    m_next = nullptr;
+    m_left = 0;
+    m_used = 0;
+    m_next_size = m_initial_size;
+}
@@ -0,0 +1,171 @@
+#ifndef FLOWDB_BUFFER_POOL_H
+#define FLOWDB_BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Reference-counted byte buffers, recycled through per-thread free lists, for
+// receive buffers and message arenas. Capacities are powers of two from
+// kMinBufferSize to kMaxPooledSize; larger buffers come from the heap and go
+// straight back to it.
+//
+// A buffer is released by whichever thread drops the last reference, which is
+// often not the thread that allocated it: a receive buffer filled on a network
+// thread is released by the client that consumed the response. Each thread
+// caches a few dozen free buffers of each size and returns the rest to the
+// system, so a thread that only releases does not hoard them.
+class BufferRef {
+public:
+    static constexpr size_t kMinBufferSize = 256;
+    static constexpr size_t kMaxPooledSize = 64 * 1024;
+
+    BufferRef() = default;
+
+    // A buffer of at least size bytes.
+    static BufferRef allocate(size_t size);
+
+    BufferRef(const BufferRef &other) noexcept: m_header(other.m_header) {
+        if (m_header) {
+            m_header->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    BufferRef(BufferRef &&other) noexcept: m_header(std::exchange(other.m_header, nullptr)) {}
+
+    BufferRef &operator=(BufferRef other) noexcept {
+        std::swap(m_header, other.m_header);
+        return *this;
+    }
+
+    ~BufferRef() {
+        if (m_header && m_header->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            release(m_header);
+        }
+    }
+
+    [[nodiscard]] char *data() const {
+        return m_header ? reinterpret_cast<char *>(m_header + 1) : nullptr;
+    }
+
+    [[nodiscard]] size_t capacity() const {
+        return m_header ? m_header->capacity : 0;
+    }
+
+    // True if this is the only reference, so the contents may be overwritten
+    [[nodiscard]] bool unique() const {
+        return m_header && m_header->refs.load(std::memory_order_acquire) == 1;
+    }
+
+    explicit operator bool() const {
+        return m_header != nullptr;
+    }
+
+private:
+    // Precedes the data; 16 bytes, so the data stays 16-byte aligned
+    struct Header {
+        std::atomic<uint32_t> refs;
+        uint32_t size_class;
+        size_t capacity;
+    };
+
+    static void release(Header *header);
+
+    Header *m_header = nullptr;
+};
+
+// A view into a buffer that keeps the buffer alive, such as a frame payload
+// handed out by a FrameReader.
+class BufferSlice {
+public:
+    BufferSlice() = default;
+
+    BufferSlice(BufferRef buffer, std::string_view bytes) : m_buffer(std::move(buffer)), m_bytes(bytes) {}
+
+    [[nodiscard]] std::string_view view() const {
+        return m_bytes;
+    }
+
+    [[nodiscard]] size_t size() const {
+        return m_bytes.size();
+    }
+
+    [[nodiscard]] bool empty() const {
+        return m_bytes.empty();
+    }
+
+    [[nodiscard]] std::string str() const {
+        return std::string(m_bytes);
+    }
+
+    // A slice of the same buffer; bytes must lie within this slice.
+    [[nodiscard]] BufferSlice slice(std::string_view bytes) const {
+        return {m_buffer, bytes};
+    }
+
+private:
+    BufferRef m_buffer;
+    std::string_view m_bytes;
+};
+
+// Bump allocator over pooled buffers, for data that lives and dies together:
+// the fields of one message, or the frame headers of one write. Nothing is
+// freed on its own; the buffers go back to the pool with the arena.
+class Arena {
+public:
+    // The first buffer has this capacity; each next one doubles it, up to
+    // BufferRef::kMaxPooledSize
+    explicit Arena(size_t initial_size = 512) : m_initial_size(initial_size), m_next_size(initial_size) {}
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    Arena(Arena &&other) noexcept
+            : m_first(std::move(other.m_first)), m_buffers(std::move(other.m_buffers)),
+              m_next(std::exchange(other.m_next, nullptr)),
+              m_left(std::exchange(other.m_left, 0)), m_used(std::exchange(other.m_used, 0)),
+              m_initial_size(other.m_initial_size), m_next_size(std::exchange(other.m_next_size, other.m_initial_size)) {}
+
+    Arena &operator=(Arena &&other) noexcept {
+        m_first = std::move(other.m_first);
+        m_buffers = std::move(other.m_buffers);
+        m_next = std::exchange(other.m_next, nullptr);
+        m_left = std::exchange(other.m_left, 0);
+        m_used = std::exchange(other.m_used, 0);
+        m_initial_size = other.m_initial_size;
+        m_next_size = std::exchange(other.m_next_size, other.m_initial_size);
+        return *this;
+    }
+
+    // Returns size contiguous bytes. Consecutive allocations are adjacent
+    // while they fit in the current buffer.
+    char *allocate(size_t size);
+
+    // Copies bytes into the arena and returns the copy.
+    std::string_view copy(std::string_view bytes);
+
+    // Releases every buffer and starts over at the initial size.
+    void clear();
+
+    // Bytes handed out since construction or the last clear()
+    [[nodiscard]] size_t used() const {
+        return m_used;
+    }
+
+private:
+    // Kept apart so an arena that fits in one buffer needs no vector
+    BufferRef m_first;
+    std::vector<BufferRef> m_buffers;
+    char *m_next = nullptr;
+    size_t m_left = 0;
+    size_t m_used = 0;
+    size_t m_initial_size;
+    size_t m_next_size;
+};
+
+#endif //FLOWDB_BUFFER_POOL_H
@@ -0,0 +1,103 @@
+#ifndef FLOWDB_CODEC_H
+#define FLOWDB_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Fixed-width little-endian integers, variable-length integers (LEB128) and
+// length-prefixed byte strings, used for frame headers, request payloads, log
+// records and the storage engine's compact entry encoding.
+
+namespace detail {
+
+template<typename T>
+void store_le(char *out, T value) {
+    for (size_t i = 0; i < sizeof(T); i++) {
+        out[i] = static_cast<char>(static_cast<uint64_t>(value) >> (8 * i));
+    }
+}
+
+template<typename T>
+T load_le(const char *in) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    return static_cast<T>(value);
+}
+
+} // namespace detail
+
+inline void put_varint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Decodes a varint at p without bounds checks; for trusted, in-memory data.
+inline const char *get_varint(const char *p, uint64_t &value) {
+    value = 0;
+    for (int shift = 0;; shift += 7) {
+        auto byte = static_cast<unsigned char>(*p++);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return p;
+        }
+    }
+}
+
+inline void put_bytes(std::string &out, std::string_view bytes) {
+    put_varint(out, bytes.size());
+    out.append(bytes);
+}
+
+// Reads varints and byte strings from untrusted input such as a request
+// payload. Every read is bounds-checked.
+class Decoder {
+public:
+    explicit Decoder(std::string_view input) : m_input(input) {}
+
+    // @throws std::invalid_argument on truncated or oversized input.
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (m_input.empty()) {
+                throw std::invalid_argument("Truncated varint");
+            }
+            auto byte = static_cast<unsigned char>(m_input.front());
+            m_input.remove_prefix(1);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (byte < 0x80) {
+                return value;
+            }
+        }
+        throw std::invalid_argument("Varint too long");
+    }
+
+    // Returns a view into the input.
+    //
+    // @throws std::invalid_argument on truncated input.
+    std::string_view bytes() {
+        uint64_t size = varint();
+        if (size > m_input.size()) {
+            throw std::invalid_argument("Truncated byte string");
+        }
+        std::string_view result = m_input.substr(0, size);
+        m_input.remove_prefix(size);
+        return result;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return m_input.empty();
+    }
+
+private:
+    std::string_view m_input;
+};
+
+#endif //FLOWDB_CODEC_H
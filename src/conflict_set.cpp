@@ -0,0 +1,68 @@
+#include "conflict_set.h"
+
+#include <algorithm>
+#include <iterator>
+
+/**
+ * @brief Overwrites the steps covering [begin, end) with one step at version,
+ * keeping the version of the keys from end onwards.
+ */
+void ConflictSet::insert(std::string_view begin, std::string_view end, Version version) {
+    if (begin >= end) {
+        return;
+    }
+    Version end_version = version_at(end);
+    auto first = m_steps.lower_bound(begin);
+    auto last = m_steps.lower_bound(end);
+    bool boundary_at_end = last != m_steps.end() && last->first == end;
+    m_steps.erase(first, last);
+
+    auto step = m_steps.emplace_hint(last, std::string(begin), version);
+    if (step != m_steps.begin() && std::prev(step)->second == version) {
+        m_steps.erase(step);
+    }
+    if (!boundary_at_end) {
+        if (end_version != version) {
+            m_steps.emplace_hint(last, std::string(end), end_version);
+        }
+    } else if (last->second == version) {
+        m_steps.erase(last);
+    }
+}
+
+Version ConflictSet::max_version(std::string_view begin, std::string_view end) const {
+    if (begin >= end) {
+        return 0;
+    }
+    auto it = m_steps.upper_bound(begin);
+    Version result = it == m_steps.begin() ? 0 : std::prev(it)->second;
+    for (; it != m_steps.end() && it->first < end; ++it) {
+        result = std::max(result, it->second);
+    }
+    return result;
+}
+
+/**
+ * @brief Resets steps older than version to 0 and merges the steps that become
+ * equal to their left neighbour. Walks every step, so the resolver calls it
+ * once in a while rather than per batch.
+ */
+void ConflictSet::forget_before(Version version) {
+    Version previous = 0;
+    for (auto it = m_steps.begin(); it != m_steps.end();) {
+        if (it->second < version) {
+            it->second = 0;
+        }
+        if (it->second == previous) {
+            it = m_steps.erase(it);
+        } else {
+            previous = it->second;
+            ++it;
+        }
+    }
+}
+
+Version ConflictSet::version_at(std::string_view key) const {
+    auto it = m_steps.upper_bound(key);
+    return it == m_steps.begin() ? 0 : std::prev(it)->second;
+}
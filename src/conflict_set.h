@@ -0,0 +1,47 @@
+#ifndef FLOWDB_CONFLICT_SET_H
+#define FLOWDB_CONFLICT_SET_H
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include "mvcc.h"
+
+// Recent write history for conflict checks: for every key, the newest version
+// at which a committed transaction wrote it.
+//
+// The history is a step function over the key space, stored as an ordered map
+// from boundary keys to the version of every key from that boundary up to the
+// next one; keys before the first boundary have version 0. Writes arrive in
+// version order, so recording one simply overwrites the steps it covers, and a
+// range of adjacent keys written together costs two boundaries however many
+// keys it spans. Neighbouring steps with equal versions are merged.
+class ConflictSet {
+public:
+    // Records a write to [begin, end) at version, which must not be older
+    // than any version recorded before.
+    void insert(std::string_view begin, std::string_view end, Version version);
+
+    // The newest version at which any key in [begin, end) was written, or 0.
+    [[nodiscard]] Version max_version(std::string_view begin, std::string_view end) const;
+
+    // Forgets writes older than version. Transactions reading before it are
+    // rejected as too old, so those writes can no longer cause a conflict.
+    void forget_before(Version version);
+
+    // Number of steps
+    [[nodiscard]] size_t size() const {
+        return m_steps.size();
+    }
+
+private:
+    using Steps = std::map<std::string, Version, std::less<>>;
+
+    // The version of key
+    [[nodiscard]] Version version_at(std::string_view key) const;
+
+    Steps m_steps;
+};
+
+#endif //FLOWDB_CONFLICT_SET_H
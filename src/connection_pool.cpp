@@ -1,151 +1,344 @@
 #include "connection_pool.h"
 
+#include <algorithm>
+#include <cassert>
+#include <optional>
+#include <stdexcept>
 #include <utility>
-#include <iostream>
+#include "metrics.h"
+
+/**
+ * @brief Returns the socket to the pool when the last copy of a lease goes away,
+ * and reports the outcome and duration of the checkout to the endpoint selector.
+ */
+ConnectionPool::Lease::State::~State() {
+    if (!timed) {
+        // The checkout was accounted for by untimed()
+        if (!healthy) {
+            pool->selector_.report_failure(endpoint_index);
+        }
+    } else if (healthy) {
+        pool->selector_.on_success(endpoint_index, std::chrono::steady_clock::now() - start);
+    } else {
+        pool->selector_.on_failure(endpoint_index);
+    }
+    pool->release(endpoint_index, std::move(socket), healthy);
+}
+
+const tcp::endpoint &ConnectionPool::Lease::endpoint() const {
+    return state_->pool->endpoints_[state_->endpoint_index];
+}
+
+void ConnectionPool::Lease::untimed() {
+    if (state_->timed) {
+        state_->timed = false;
+        state_->pool->selector_.on_abandon(state_->endpoint_index);
+    }
+}
+
+EndpointSelector &ConnectionPool::Lease::selector() const {
+    return state_->pool->selector_;
+}
 
 /**
  * @brief Constructor for ConnectionPool class.
- * 
+ *
+ * Starts connecting min_connections sockets to every endpoint so the first
+ * checkouts find warm connections.
+ *
  * @param io_context The boost::asio::io_context object to use for asynchronous operations.
- * @param endpoint The TCP endpoint to connect to.
+ * @param endpoints The TCP endpoints to connect to.
+ * @param min_connections Number of connections kept open per endpoint.
+ * @param max_connections Upper bound on connections per endpoint.
+ * @param strategy How checkout() chooses among the endpoints.
  */
 ConnectionPool::ConnectionPool(boost::asio::io_context &io_context, const std::vector<tcp::endpoint> &endpoints,
-                               int num_connections)
-        : io_context_(io_context), endpoints_(endpoints), num_connections_(num_connections), next_endpoint_(0),
-          next_connection_(0) {
-    // Use the resize method to pre-allocate space for the connections vector
-    connections_.resize(num_connections_);
-    // Use a for loop to initialize each socket in the vector
-    for (auto &socket: connections_) {
-        socket = std::make_unique<tcp::socket>(io_context_);
+                               int min_connections, int max_connections, SelectionStrategy strategy)
+        : io_context_(io_context), endpoints_(endpoints), min_connections_(std::max(min_connections, 0)),
+          max_connections_(std::max({max_connections, min_connections, 1})),
+          selector_(endpoints.size(), strategy) {
+    assert(!endpoints_.empty());
+    for (const auto &endpoint: endpoints_) {
+        pools_.emplace_back(endpoint);
+    }
+    std::vector<size_t> to_connect;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        replenish(to_connect);
+    }
+    for (size_t endpoint_index: to_connect) {
+        connect(endpoint_index);
     }
 }
 
 /**
- * @brief Returns a TCP socket from the connection pool.
- * 
- * If there is an available socket in the pool, it is returned. Otherwise, a new socket is created and returned.
- * 
- * @return std::shared_ptr<tcp::socket> A shared pointer to a TCP socket.
+ * @brief Fails pending checkouts and closes idle sockets.
+ *
+ * Outstanding leases and in-flight connects must have completed, or the
+ * io_context must have stopped, before the pool is destroyed.
  */
-// Use a const reference parameter to avoid unnecessary copying of endpoint objects
-tcp::socket &ConnectionPool::get_connection(const tcp::endpoint &local_endpoint) {
-    // Lock the mutex to ensure thread safety.
-    std::unique_lock<std::mutex> lock(mutex_);
-    // Use an assert to check that the connection pool is not empty
-    assert(!connections_.empty());
-    auto &socket = *connections_[next_connection_];
-    next_connection_ = (next_connection_ + 1) % num_connections_;
-    lock.unlock();
-    // Check if the socket is already open
-    if (!socket.is_open()) {
-        // Open the socket if it is not already open
-        socket.open(tcp::v4());
+ConnectionPool::~ConnectionPool() {
+    std::vector<Promise<Lease>> waiters;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto &pool: pools_) {
+            for (auto &waiter: pool.waiters) {
+                waiters.push_back(std::move(waiter.promise));
+            }
+            pool.waiters.clear();
+            for (auto &socket: pool.idle) {
+                boost::system::error_code ec;
+                socket->close(ec);
+            }
+            pool.idle.clear();
+        }
     }
-    // Use the bind method to bind the socket to the local endpoint
-    boost::system::error_code ec;
-    socket.bind(local_endpoint, ec);
-    if (ec) {
-        // Handle the error if the bind method failed
-        throw std::runtime_error("Failed to bind socket to local endpoint: " + ec.message());
+    for (auto &waiter: waiters) {
+        waiter.set_exception(std::make_exception_ptr(std::runtime_error("Connection pool destroyed")));
     }
-    // Use the connect method to connect the socket to the remote endpoint
-    socket.connect(get_next_endpoint());
-    lock.lock();
-    return socket;
 }
 
 /**
- * @brief Returns a TCP socket to the connection pool.
+ * @brief Checks out a connected socket to the endpoint picked by the selector:
+ * round-robin, least outstanding, or power-of-two-choices over latency-weighted
+ * load, skipping ejected endpoints.
  *
- * @param socket A shared pointer to a TCP socket.
+ * @return Future<Lease> Ready immediately when an idle socket is available.
  */
-// Use a rvalue reference parameter to allow move semantics
-void ConnectionPool::return_connection(std::unique_ptr<tcp::socket> socket) {
-    // Lock the mutex to ensure thread safety.
+Future<ConnectionPool::Lease> ConnectionPool::checkout() {
+    return checkout(selector_.select());
+}
+
+/**
+ * @brief Checks out a connected socket to the given endpoint.
+ *
+ * @throws std::invalid_argument if the endpoint is not part of the pool.
+ */
+Future<ConnectionPool::Lease> ConnectionPool::checkout(const tcp::endpoint &endpoint) {
+    return checkout(index_of(endpoint));
+}
+
+/**
+ * @brief Picks among some endpoints of the pool with the pool's strategy and
+ * the latency and load the selector has seen for them.
+ *
+ * @throws std::invalid_argument if a candidate is not part of the pool.
+ */
+size_t ConnectionPool::select(const std::vector<tcp::endpoint> &candidates) {
+    std::vector<size_t> indices;
+    indices.reserve(candidates.size());
+    for (const auto &candidate: candidates) {
+        indices.push_back(index_of(candidate));
+    }
+    size_t chosen = selector_.select(indices);
+    return static_cast<size_t>(std::find(indices.begin(), indices.end(), chosen) - indices.begin());
+}
+
+size_t ConnectionPool::index_of(const tcp::endpoint &endpoint) const {
+    for (size_t i = 0; i < endpoints_.size(); i++) {
+        if (endpoints_[i] == endpoint) {
+            return i;
+        }
+    }
+    throw std::invalid_argument("Endpoint is not part of the connection pool");
+}
+
+Future<ConnectionPool::Lease> ConnectionPool::checkout(size_t endpoint_index) {
+    auto start = std::chrono::steady_clock::now();
+    selector_.on_start(endpoint_index);
     std::unique_lock<std::mutex> lock(mutex_);
-    if (!socket || !socket->is_open()) {
-        // Handle the error if the socket is null or not open
-        throw std::runtime_error("Socket is null or not open");
+    auto &pool = pools_[endpoint_index];
+    if (!pool.idle.empty()) {
+        // Fast path: hand out a warm socket without waiting
+        auto socket = std::move(pool.idle.back());
+        pool.idle.pop_back();
+        lock.unlock();
+        return make_ready_future(make_lease(endpoint_index, std::move(socket), start));
+    }
+    Metrics::add(Metrics::Counter::ConnectionCheckoutWaits);
+    Promise<Lease> promise;
+    auto future = promise.get_future();
+    pool.waiters.push_back(Waiter{std::move(promise), start});
+    bool grow = pool.open < max_connections_;
+    if (grow) {
+        pool.open++;
     }
-    // Use the emplace_back method to move the socket to the back of the vector
-    connections_.emplace_back(std::move(socket));
+    lock.unlock();
+    if (grow) {
+        connect(endpoint_index);
+    }
+    return future;
 }
 
 /**
- * Detects failures in the connections of the ConnectionPool object.
- * This function iterates over each socket in the connections vector, sends a "ping" message to the socket,
- * and checks if the socket fails to respond to the "ping" message. If a socket fails to respond,
- * the function closes and reconnects the socket to the endpoint.
+ * @brief Starts an asynchronous connect to the endpoint. The caller must
+ * already have counted the socket in EndpointPool::open.
  */
-void ConnectionPool::detect_failures() {
-    // Lock the mutex to prevent concurrent access to the connections vector
-    std::unique_lock<std::mutex> lock(mutex_);
+void ConnectionPool::connect(size_t endpoint_index) {
+    auto socket = std::make_unique<tcp::socket>(io_context_);
+    auto &socket_ref = *socket;
+    socket_ref.async_connect(endpoints_[endpoint_index],
+                             [this, endpoint_index, socket = std::move(socket)](
+                                     const boost::system::error_code &ec) mutable {
+                                 on_connected(endpoint_index, std::move(socket), ec);
+                             });
+}
 
-    // Iterate over each socket in the connections vector
-    for (auto &socket: connections_) {
-        // Set the socket to keep alive and non-blocking mode
-        boost::system::error_code ec;
-        socket->set_option(tcp::socket::keep_alive(true));
-        socket->non_blocking(true);
+void ConnectionPool::on_connected(size_t endpoint_index, std::unique_ptr<tcp::socket> socket,
+                                  const boost::system::error_code &ec) {
+    if (!ec) {
+        Metrics::add(Metrics::Counter::ConnectionsOpened);
+        boost::system::error_code option_ec;
+        socket->set_option(tcp::no_delay(true), option_ec);
+        socket->set_option(tcp::socket::keep_alive(true), option_ec);
+        release(endpoint_index, std::move(socket), true);
+        return;
+    }
 
-        // Send a "ping" message to the socket
-        socket->send(boost::asio::buffer("ping"), 0, ec);
+    // The connection attempt failed; fail the oldest waiter rather than leave it hanging
+    Metrics::add(Metrics::Counter::ConnectionFailures);
+    std::optional<Waiter> waiter;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto &pool = pools_[endpoint_index];
+        pool.open--;
+        if (!pool.waiters.empty()) {
+            waiter.emplace(std::move(pool.waiters.front()));
+            pool.waiters.pop_front();
+        }
+    }
+    if (waiter) {
+        selector_.on_failure(endpoint_index);
+        waiter->promise.set_exception(std::make_exception_ptr(boost::system::system_error(ec)));
+    } else {
+        selector_.report_failure(endpoint_index);
+    }
+}
 
-        // If the socket fails to respond to the "ping" message
-        if (ec) {
-            // Close and reconnect the socket to the endpoint
-            socket->shutdown(tcp::socket::shutdown_both, ec);
+/**
+ * @brief Returns a socket to its endpoint's pool.
+ *
+ * A healthy socket goes to the oldest waiter if there is one, otherwise to the
+ * idle list. A broken socket is closed and the endpoint is topped back up to
+ * the configured minimum.
+ */
+void ConnectionPool::release(size_t endpoint_index, std::unique_ptr<tcp::socket> socket, bool healthy) {
+    std::optional<Waiter> waiter;
+    std::vector<size_t> to_connect;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto &pool = pools_[endpoint_index];
+        if (!healthy || !socket->is_open() || pool.open > max_connections_) {
+            boost::system::error_code ec;
             socket->close(ec);
-
-            // Use exponential backoff to avoid overwhelming the network
-            auto delay = std::chrono::milliseconds(1);
-            for (int i = 0; i < 5; ++i) {
-                delay *= 2;
-                boost::asio::steady_timer timer(io_context_, delay);
-                timer.async_wait([this, &socket, delay](const boost::system::error_code &ec) {
-                    if (!ec) {
-                        socket->close();
-                        socket->async_connect(get_next_endpoint(),
-                                              [this, &socket, delay](const boost::system::error_code &ec) {
-                                                  if (ec) {
-                                                      // If the reconnection fails, close the socket
-                                                      io_context_.post([this, &socket, delay]() {
-                                                          socket->close();
-                                                          socket->connect(get_next_endpoint());
-                                                      });
-                                                  }
-                                              });
-                    }
-                });
+            socket.reset();
+            pool.open--;
+            if (!pool.waiters.empty() && pool.open < max_connections_) {
+                pool.open++;
+                to_connect.push_back(endpoint_index);
             }
+            replenish(to_connect);
+        } else if (!pool.waiters.empty()) {
+            waiter.emplace(std::move(pool.waiters.front()));
+            pool.waiters.pop_front();
+        } else {
+            pool.idle.push_back(std::move(socket));
         }
-
-        // Set the socket back to blocking mode
-        socket->non_blocking(false);
+    }
+    if (waiter) {
+        waiter->promise.set_value(make_lease(endpoint_index, std::move(socket), waiter->start));
+    }
+    for (size_t index: to_connect) {
+        connect(index);
     }
 }
 
-void ConnectionPool::resize(int num_connections) {
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (num_connections > num_connections_) {
-        connections_.resize(num_connections_);
-        for (auto &socket: connections_) {
-            socket = std::make_unique<tcp::socket>(io_context_);
+void ConnectionPool::replenish(std::vector<size_t> &to_connect) {
+    for (size_t i = 0; i < pools_.size(); i++) {
+        if (selector_.down(i)) {
+            continue;
         }
-    } else if (num_connections < num_connections_) {
-        for (int i = 0; i < num_connections_ - num_connections; i++) {
-            connections_.back()->close();
-            connections_.pop_back();
+        while (pools_[i].open < min_connections_) {
+            pools_[i].open++;
+            to_connect.push_back(i);
         }
     }
-    num_connections_ = num_connections;
 }
 
-tcp::endpoint ConnectionPool::get_next_endpoint() {
-    std::unique_lock<std::mutex> lock(mutex_);
-    assert(!endpoints_.empty());
-    auto &endpoint = endpoints_[next_endpoint_];
-    next_endpoint_ = (next_endpoint_ + 1) % endpoints_.size();
-    return endpoint;
+/**
+ * @brief Wraps a socket handed to a checkout, recording how long the checkout
+ * waited for it.
+ */
+ConnectionPool::Lease ConnectionPool::make_lease(size_t endpoint_index, std::unique_ptr<tcp::socket> socket,
+                                                 std::chrono::steady_clock::time_point start) {
+    std::chrono::nanoseconds waited = std::chrono::steady_clock::now() - start;
+    Metrics::record(Metrics::Latency::ConnectionCheckout, static_cast<uint64_t>(waited.count()));
+    return Lease(std::allocate_shared<Lease::State>(RecyclingStdAllocator<Lease::State>(), this, endpoint_index,
+                                                    std::move(socket), start));
+}
+
+/**
+ * @brief Takes an endpoint out of rotation after it failed its health checks.
+ *
+ * Idle sockets to it are closed and waiting checkouts are failed rather than
+ * left to time out. Leased sockets stay with their holders and are closed
+ * when they come back unhealthy.
+ */
+void ConnectionPool::mark_down(size_t endpoint_index) {
+    selector_.set_down(endpoint_index, true);
+    std::deque<Waiter> waiters;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto &pool = pools_[endpoint_index];
+        for (auto &socket: pool.idle) {
+            boost::system::error_code ec;
+            socket->close(ec);
+        }
+        pool.open -= pool.idle.size();
+        pool.idle.clear();
+        waiters.swap(pool.waiters);
+    }
+    for (auto &waiter: waiters) {
+        selector_.on_failure(endpoint_index);
+        waiter.promise.set_exception(std::make_exception_ptr(
+                boost::system::system_error(boost::asio::error::host_unreachable, "Endpoint is down")));
+    }
+}
+
+/**
+ * @brief Puts an endpoint back into rotation once it answers health checks
+ * again, and reconnects it up to the minimum.
+ */
+void ConnectionPool::mark_up(size_t endpoint_index) {
+    selector_.set_down(endpoint_index, false);
+    std::vector<size_t> to_connect;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        replenish(to_connect);
+    }
+    for (size_t index: to_connect) {
+        connect(index);
+    }
+}
+
+void ConnectionPool::resize(int min_connections, int max_connections) {
+    std::vector<size_t> to_connect;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        min_connections_ = std::max(min_connections, 0);
+        max_connections_ = std::max({max_connections, min_connections, 1});
+        for (auto &pool: pools_) {
+            // Close surplus idle sockets; leased ones are closed when they come back
+            while (pool.open > max_connections_ && !pool.idle.empty()) {
+                boost::system::error_code ec;
+                pool.idle.back()->close(ec);
+                pool.idle.pop_back();
+                pool.open--;
+            }
+        }
+        replenish(to_connect);
+    }
+    for (size_t endpoint_index: to_connect) {
+        connect(endpoint_index);
+    }
 }
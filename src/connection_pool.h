@@ -2,34 +2,179 @@
 #define FLOWDB_CONNECTION_POOL_H
 
 #include <boost/asio.hpp>
+#include <chrono>
 #include <deque>
+#include <memory>
 #include <mutex>
+#include <vector>
+#include "endpoint_selector.h"
+#include "future.h"
 
 using boost::asio::ip::tcp;
 
+// Pool of connected sockets kept per endpoint. Sockets are connected ahead of
+// time and handed out as leases; a checkout that finds an idle socket
+// completes immediately, otherwise it waits for a new connection (up to the
+// per-endpoint maximum) or for another lease to be returned. Connection setup
+// and the other asynchronous work run on the io_context, which the owner must
+// keep running. Leases must not outlive the pool.
 class ConnectionPool {
 public:
+    // Exclusive use of one pooled socket. Copies share the same checkout; the
+    // socket goes back to its endpoint's idle list when the last copy is
+    // destroyed (including the one held by the Future it arrived in), or is
+    // closed instead if invalidate() was called.
+    class Lease {
+    public:
+        Lease() = default;
+
+        [[nodiscard]] tcp::socket &socket() const {
+            return *state_->socket;
+        }
+
+        [[nodiscard]] const tcp::endpoint &endpoint() const;
+
+        explicit operator bool() const {
+            return state_ != nullptr;
+        }
+
+        // Marks the socket as broken so it is closed rather than reused.
+        void invalidate() {
+            state_->healthy = false;
+        }
+
+        // Ends this checkout's sample in the selector at once, for leases
+        // held across many requests that report each request themselves
+        // through selector(). Only a broken socket is still reported when the
+        // lease goes away.
+        void untimed();
+
+        // The selector of the pool the lease came from, and the endpoint's
+        // index in it. Only valid while the lease is held.
+        [[nodiscard]] EndpointSelector &selector() const;
+
+        [[nodiscard]] size_t endpoint_index() const {
+            return state_->endpoint_index;
+        }
+
+        // Gives up this copy of the lease.
+        void release() {
+            state_.reset();
+        }
+
+    private:
+        friend class ConnectionPool;
+
+        struct State {
+            State(ConnectionPool *pool, size_t endpoint_index, std::unique_ptr<tcp::socket> socket,
+                  std::chrono::steady_clock::time_point start)
+                    : pool(pool), endpoint_index(endpoint_index), socket(std::move(socket)), start(start) {}
+
+            ~State();
+
+            ConnectionPool *pool;
+            size_t endpoint_index;
+            std::unique_ptr<tcp::socket> socket;
+            // When the checkout was requested; the lease's lifetime is the
+            // latency sample reported to the endpoint selector
+            std::chrono::steady_clock::time_point start;
+            bool healthy = true;
+            bool timed = true;
+        };
+
+        explicit Lease(std::shared_ptr<State> state) : state_(std::move(state)) {}
+
+        std::shared_ptr<State> state_;
+    };
+
     ConnectionPool(boost::asio::io_context &io_context, const std::vector<tcp::endpoint> &endpoints,
-                   int num_connections);
+                   int min_connections, int max_connections,
+                   SelectionStrategy strategy = SelectionStrategy::PowerOfTwoChoices);
+
+    ~ConnectionPool();
+
+    // Checks out a socket to the endpoint chosen by the selection strategy.
+    Future<Lease> checkout();
+
+    // Checks out a socket to a specific endpoint of the pool.
+    Future<Lease> checkout(const tcp::endpoint &endpoint);
 
-    tcp::socket &get_connection(const tcp::endpoint &local_endpoint);
+    // The position in candidates, all endpoints of the pool, of the one the
+    // selection strategy picks for the next request.
+    //
+    // @throws std::invalid_argument if a candidate is not part of the pool.
+    size_t select(const std::vector<tcp::endpoint> &candidates);
 
-    void return_connection(std::unique_ptr<tcp::socket> socket);
+    // Takes an endpoint out of rotation: its idle sockets are closed, pending
+    // checkouts for it fail and no new connections are opened to it. Called by
+    // the health checker; checkouts are only affected through the selector.
+    void mark_down(size_t endpoint_index);
 
-    void detect_failures();
+    // Puts an endpoint back into rotation and reopens its minimum connections.
+    void mark_up(size_t endpoint_index);
 
-    void resize(int num_connections);
+    // Changes the per-endpoint limits and opens connections up to the new minimum.
+    void resize(int min_connections, int max_connections);
+
+    [[nodiscard]] const std::vector<tcp::endpoint> &endpoints() const {
+        return endpoints_;
+    }
+
+    void set_selection_strategy(SelectionStrategy strategy) {
+        selector_.set_strategy(strategy);
+    }
+
+    // Per-endpoint latency, load and ejection state
+    [[nodiscard]] const EndpointSelector &selector() const {
+        return selector_;
+    }
 
 private:
+    struct Waiter {
+        Promise<Lease> promise;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    struct EndpointPool {
+        explicit EndpointPool(const tcp::endpoint &endpoint) : endpoint(endpoint) {}
+
+        tcp::endpoint endpoint;
+
+        // Connected sockets ready to be leased
+        std::vector<std::unique_ptr<tcp::socket>> idle;
+
+        // Sockets that are idle, leased or still connecting
+        size_t open = 0;
+
+        // Checkouts waiting for a socket, oldest first
+        std::deque<Waiter> waiters;
+    };
+
+    Future<Lease> checkout(size_t endpoint_index);
+
+    // @throws std::invalid_argument if the endpoint is not part of the pool.
+    [[nodiscard]] size_t index_of(const tcp::endpoint &endpoint) const;
+
+    void connect(size_t endpoint_index);
+
+    void on_connected(size_t endpoint_index, std::unique_ptr<tcp::socket> socket, const boost::system::error_code &ec);
+
+    void release(size_t endpoint_index, std::unique_ptr<tcp::socket> socket, bool healthy);
+
+    // Starts connections until every endpoint that is not down has at least
+    // min_connections_ open. Requires mutex_.
+    void replenish(std::vector<size_t> &to_connect);
+
+    Lease make_lease(size_t endpoint_index, std::unique_ptr<tcp::socket> socket,
+                     std::chrono::steady_clock::time_point start);
+
     boost::asio::io_context &io_context_;
     std::vector<tcp::endpoint> endpoints_;
-    int num_connections_;
-    int next_endpoint_;
-    std::atomic<int> next_connection_;
-    std::vector<std::unique_ptr<tcp::socket>> connections_;
+    std::deque<EndpointPool> pools_;
+    size_t min_connections_;
+    size_t max_connections_;
+    EndpointSelector selector_;
     std::mutex mutex_;
-
-    tcp::endpoint get_next_endpoint();
 };
 
 #endif //FLOWDB_CONNECTION_POOL_H
@@ -0,0 +1,320 @@
+#include "core_set.h"
+
+#include <condition_variable>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <system_error>
+#include <utility>
+#include "metrics.h"
+
+namespace {
+
+// io_context handlers run between two rounds of runnables, at most
+constexpr int kHandlersPerRound = 64;
+
+// Empty rounds a core yields through before it blocks, as pool workers do
+constexpr int kSpinRounds = 64;
+
+class TaskNode : public Runnable, public Recycled {
+public:
+    explicit TaskNode(Task task) : m_task(std::move(task)) {}
+
+    void run() override {
+        m_task();
+        delete this;
+    }
+
+private:
+    Task m_task;
+};
+
+// The CPUs the process may run on, in order
+std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
+
+} // namespace
+
+/**
+ * @brief Constructor for CoreSet class. Every core is created, lanes
+ * included, before any thread starts, so cores can schedule on each other
+ * from their first round. Each thread pins itself before it runs anything, so
+ * what it allocates is first touched on its own CPU, and reports back; the
+ * constructor returns, and the cores accept work, only once all have.
+ *
+ * @param options The number of cores, pinning and lane capacity.
+ * @throws std::system_error if a thread cannot be pinned; the threads that
+ * were started are stopped first.
+ */
+CoreSet::CoreSet(Options options) : m_lane_capacity(options.lane_capacity) {
+    std::vector<int> cpus = allowed_cpus();
+    size_t count = options.cores;
+    if (count == 0) {
+        count = cpus.empty() ? std::max<size_t>(std::thread::hardware_concurrency(), 1) : cpus.size();
+    }
+    m_cores.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        m_cores.push_back(std::make_unique<Core>(*this, i, count));
+        if (options.pin && !cpus.empty()) {
+            m_cores.back()->cpu = cpus[i % cpus.size()];
+        }
+    }
+
+    // Pinning outcomes, reported under the mutex so that a thread is done
+    // with them once it releases it
+    std::mutex mutex;
+    std::condition_variable reported;
+    std::vector<int> errors(count, 0);
+    size_t started = 0;
+    for (size_t i = 0; i < count; i++) {
+        Core &core = *m_cores[i];
+        core.thread = std::thread([&core, &mutex, &reported, &error = errors[i], &started] {
+            int result = 0;
+            if (core.cpu >= 0) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(core.cpu, &set);
+                result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            }
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                error = result;
+                started++;
+                reported.notify_one();
+            }
+            if (result == 0) {
+                core.run();
+            } else {
+                // Nothing was scheduled here, but stop() still counts the core
+                core.set.quiesce(core);
+            }
+        });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    reported.wait(lock, [&started, count] { return started == count; });
+    for (size_t i = 0; i < count; i++) {
+        if (errors[i] != 0) {
+            lock.unlock();
+            stop();
+            throw std::system_error(errors[i], std::generic_category(), "Cannot pin core " + std::to_string(i));
+        }
+    }
+}
+
+CoreSet::~CoreSet() {
+    stop();
+}
+
+Executor &CoreSet::executor(size_t core) {
+    return *m_cores.at(core);
+}
+
+boost::asio::io_context &CoreSet::io_context(size_t core) {
+    return m_cores.at(core)->io_context;
+}
+
+void CoreSet::submit(size_t core, Task task) {
+    m_cores.at(core)->schedule(new TaskNode(std::move(task)));
+}
+
+size_t CoreSet::current() const {
+    return t_core != nullptr && &t_core->set == this ? t_core->index : kNoCore;
+}
+
+int CoreSet::cpu(size_t core) const {
+    return m_cores.at(core)->cpu;
+}
+
+void CoreSet::stop() {
+    m_done.store(true, std::memory_order_seq_cst);
+    for (auto &core: m_cores) {
+        core->wake_always();
+    }
+    for (auto &core: m_cores) {
+        if (core->thread.joinable()) {
+            core->thread.join();
+        }
+    }
+}
+
+/**
+ * @brief Shutdown is two-phase. A core that runs out of work waits here
+ * instead of exiting, since a core that is still running could schedule on
+ * it, and the runnable would never run: an actor would stay pinned by its own
+ * reference and the futures waiting on it would never complete. Only the core
+ * that finds every core waiting, with nothing queued on any, releases them;
+ * no core runs then, so nothing can be scheduled any more. A core given work
+ * leaves, runs it and comes back.
+ */
+bool CoreSet::quiesce(Core &core) {
+    std::unique_lock<std::mutex> lock(m_stop_mutex);
+    m_idle_cores++;
+    while (true) {
+        if (m_finished) {
+            return true;
+        }
+        if (core.pending()) {
+            m_idle_cores--;
+            return false;
+        }
+        if (m_idle_cores == m_cores.size()) {
+            bool pending = false;
+            for (const auto &other: m_cores) {
+                pending = pending || other->pending();
+            }
+            if (!pending) {
+                m_finished = true;
+                m_stop_changed.notify_all();
+                return true;
+            }
+            // Let the cores that still have work take it
+            m_stop_changed.notify_all();
+        }
+        m_stop_changed.wait(lock);
+    }
+}
+
+CoreSet::Core::Core(CoreSet &set, size_t index, size_t cores) : set(set), index(index) {
+    m_lanes.reserve(cores);
+    for (size_t i = 0; i < cores; i++) {
+        m_lanes.push_back(std::make_unique<SpscQueue<Runnable *>>(set.m_lane_capacity));
+    }
+}
+
+/**
+ * @brief Runnables from the core itself go straight to its local queue, from
+ * another core of the set through that core's lane, and from anywhere else
+ * through the injection queue.
+ */
+void CoreSet::Core::schedule(Runnable *task) {
+    Core *source = t_core;
+    if (source == this) {
+        m_local.push_back(task);
+        return;
+    }
+    if (source != nullptr && &source->set == &set) {
+        if (m_lanes[source->index]->try_push(task)) {
+            Metrics::add(Metrics::Counter::CoreHandoffs);
+            wake();
+            return;
+        }
+        Metrics::add(Metrics::Counter::CoreLaneOverflows);
+    }
+    {
+        std::unique_lock<std::mutex> lock(m_injection_mutex);
+        m_injection.push_back(task);
+        m_injection_size.store(m_injection.size(), std::memory_order_release);
+    }
+    wake();
+}
+
+/**
+ * @brief Before blocking, the core announces it is going to sleep and then
+ * checks the queues once more; a thread that schedules work makes it visible
+ * and then checks the announcement. With a full fence on both sides, either
+ * the core sees the work or the scheduling thread sees it sleeping.
+ */
+void CoreSet::Core::run() {
+    t_core = this;
+    Metrics::set_thread_name("core-" + std::to_string(index));
+    auto work = boost::asio::make_work_guard(io_context);
+    int idle_rounds = 0;
+    while (true) {
+        collect();
+        m_running.swap(m_local);
+        for (Runnable *task: m_running) {
+            task->run();
+        }
+        size_t ran = m_running.size();
+        m_running.clear();
+        for (int i = 0; i < kHandlersPerRound && io_context.poll_one() != 0; i++) {
+            ran++;
+        }
+        if (ran != 0) {
+            Metrics::add(Metrics::Counter::CoreTasksRun, ran);
+            idle_rounds = 0;
+            continue;
+        }
+        if (idle_rounds++ < kSpinRounds) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        m_sleeping.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (pending()) {
+            m_sleeping.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        if (set.m_done.load(std::memory_order_seq_cst)) {
+            m_sleeping.store(false, std::memory_order_relaxed);
+            if (set.quiesce(*this)) {
+                break;
+            }
+            idle_rounds = 0;
+            continue;
+        }
+        Metrics::add(Metrics::Counter::CoreSleeps);
+        io_context.run_one();
+        m_sleeping.store(false, std::memory_order_relaxed);
+        idle_rounds = 0;
+    }
+    work.reset();
+    t_core = nullptr;
+}
+
+void CoreSet::Core::wake() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_seq_cst) && m_sleeping.exchange(false, std::memory_order_acq_rel)) {
+        boost::asio::post(io_context, [] {});
+    }
+    if (set.m_done.load(std::memory_order_seq_cst)) {
+        // The core may be waiting in quiesce(); the lock orders the check of
+        // its queues against the work just made visible
+        std::unique_lock<std::mutex> lock(set.m_stop_mutex);
+        set.m_stop_changed.notify_all();
+    }
+}
+
+void CoreSet::Core::wake_always() {
+    m_sleeping.store(false, std::memory_order_relaxed);
+    boost::asio::post(io_context, [] {});
+}
+
+void CoreSet::Core::collect() {
+    Runnable *task = nullptr;
+    for (auto &lane: m_lanes) {
+        while (lane->try_pop(task)) {
+            m_local.push_back(task);
+        }
+    }
+    if (m_injection_size.load(std::memory_order_acquire) != 0) {
+        std::unique_lock<std::mutex> lock(m_injection_mutex);
+        m_local.insert(m_local.end(), m_injection.begin(), m_injection.end());
+        m_injection.clear();
+        m_injection_size.store(0, std::memory_order_release);
+    }
+}
+
+bool CoreSet::Core::pending() const {
+    if (!m_local.empty() || m_injection_size.load(std::memory_order_acquire) != 0) {
+        return true;
+    }
+    for (const auto &lane: m_lanes) {
+        if (!lane->empty()) {
+            return true;
+        }
+    }
+    return false;
+}
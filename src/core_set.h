@@ -0,0 +1,160 @@
+#ifndef FLOWDB_CORE_SET_H
+#define FLOWDB_CORE_SET_H
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "spsc_queue.h"
+#include "task.h"
+#include "thread_pool.h"
+
+// Thread-per-core executor for shared-nothing operation. Each core is one
+// thread, pinned to its own CPU, that runs both the actors placed on it and
+// its own io_context, so a connection accepted on a core and the actor that
+// serves it can share a thread and its caches. Nothing is stolen between
+// cores: work stays on the core it was scheduled on. The per-thread free lists
+// of RecyclingAllocator and BufferRef make each core's memory its own, and
+// with pinning the kernel places it on the core's NUMA node on first touch.
+//
+// Every ordered pair of cores has its own SPSC lane, which carries the
+// runnables one core schedules on the other, such as an actor woken by a
+// message from another core; the message itself travels in the actor's
+// mailbox. A lane that is full, and any scheduling from a thread that is not
+// a core of this set, falls back to the core's locked injection queue.
+//
+// A core runs what is scheduled on it in rounds, polling its io_context for
+// ready handlers between rounds. When it finds nothing to do it blocks in the
+// io_context, and a thread scheduling work on it wakes it with an empty
+// handler, which it only posts if the core said it was going to sleep.
+class CoreSet {
+public:
+    struct Options {
+        // Number of cores; 0 starts one per CPU the process may run on
+        size_t cores = 0;
+        // Pins core i to the i-th CPU the process may run on, wrapping around
+        bool pin = true;
+        // Runnables one core can have in flight to another before it falls
+        // back to the injection queue
+        size_t lane_capacity = 1024;
+    };
+
+    // Returned by current() on threads that are not cores of the set
+    static constexpr size_t kNoCore = SIZE_MAX;
+
+    // Starts and pins the core threads.
+    //
+    // @throws std::system_error if a thread cannot be pinned.
+    explicit CoreSet(Options options);
+
+    CoreSet(const CoreSet &) = delete;
+
+    CoreSet &operator=(const CoreSet &) = delete;
+
+    ~CoreSet();
+
+    [[nodiscard]] size_t size() const {
+        return m_cores.size();
+    }
+
+    // Schedules runnables on one core, for actors placed there.
+    Executor &executor(size_t core);
+
+    // The io_context run by a core. Objects created on it must only be used
+    // from that core, since its handlers all run there.
+    boost::asio::io_context &io_context(size_t core);
+
+    // Runs task on a core. Safe to call from any thread; tasks submitted from
+    // one thread are not guaranteed to run in order.
+    void submit(size_t core, Task task);
+
+    // The core the calling thread is, or kNoCore.
+    [[nodiscard]] size_t current() const;
+
+    // Whether the calling thread is a core of any set.
+    static bool on_core() {
+        return t_core != nullptr;
+    }
+
+    // The CPU a core is pinned to, or -1 if it is not pinned
+    [[nodiscard]] int cpu(size_t core) const;
+
+    // Stops the cores once they all run out of work and joins their threads.
+    // No core exits while another can still schedule on it, so every runnable
+    // queued before the last core goes idle is run. Handlers still pending in
+    // their io_contexts are never run.
+    void stop();
+
+private:
+    class Core : public Executor {
+    public:
+        Core(CoreSet &set, size_t index, size_t cores);
+
+        void schedule(Runnable *task) override;
+
+        // The core's thread: rounds of runnables and io handlers until the
+        // set stops and there is nothing left to run.
+        void run();
+
+        // Wakes the core if it is blocked, or about to block, in its io_context,
+        // or waiting for the others to stop.
+        void wake();
+
+        // Posts a wakeup whether or not the core is sleeping.
+        void wake_always();
+
+        // Whether anything waits to run on the core. Other cores only call
+        // it from quiesce() while this one waits there too.
+        [[nodiscard]] bool pending() const;
+
+        CoreSet &set;
+        size_t index;
+        int cpu = -1;
+        boost::asio::io_context io_context;
+        std::thread thread;
+
+    private:
+        // Moves the runnables of the lanes and the injection queue to m_local.
+        void collect();
+
+        // Scheduled from this core; only touched by it
+        std::vector<Runnable *> m_local;
+        std::vector<Runnable *> m_running;
+
+        // One lane per source core, indexed by the source's index
+        std::vector<std::unique_ptr<SpscQueue<Runnable *>>> m_lanes;
+
+        // Scheduled from other threads, or from a core whose lane was full
+        std::mutex m_injection_mutex;
+        std::vector<Runnable *> m_injection;
+        std::atomic<size_t> m_injection_size{0};
+
+        // Set while the core is blocked in its io_context, or about to be
+        std::atomic<bool> m_sleeping{false};
+    };
+
+    // Called by a core that has nothing left to run once the set is done.
+    // Returns true when every core is idle and none has work, so all may
+    // exit, or false when the core has been given more work.
+    bool quiesce(Core &core);
+
+    std::vector<std::unique_ptr<Core>> m_cores;
+    size_t m_lane_capacity;
+    std::atomic<bool> m_done{false};
+
+    // Cores waiting in quiesce(), and whether they have all been let go
+    std::mutex m_stop_mutex;
+    std::condition_variable m_stop_changed;
+    size_t m_idle_cores = 0;
+    bool m_finished = false;
+
+    // The core the calling thread is, in whichever set
+    static inline thread_local Core *t_core = nullptr;
+};
+
+#endif //FLOWDB_CORE_SET_H
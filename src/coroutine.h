@@ -0,0 +1,117 @@
+#ifndef FLOWDB_COROUTINE_H
+#define FLOWDB_COROUTINE_H
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <utility>
+#include "actor.h"
+#include "future.h"
+#include "recycling_allocator.h"
+
+// C++20 coroutine support in the style of Flow's ACTOR/wait():
+//
+//     Future<int> StorageActor::read_twice(Key key) {
+//         int a = co_await lookup(key);
+//         int b = co_await lookup(key);
+//         co_return a + b;
+//     }
+//
+// A function returning Future<T> may co_await any Future. It runs eagerly until
+// its first suspension. When the awaited future is fulfilled, the coroutine is
+// resumed as a message on the actor that was running when it suspended, so
+// its state is only ever touched by that actor's scheduling slot; outside an
+// actor it is resumed inline by whoever fulfils the future. Frames come from
+// RecyclingAllocator, so a suspended request costs its frame size rather
+// than a thread.
+
+namespace detail {
+
+template<typename T>
+class CoroutinePromiseBase {
+public:
+    Future<T> get_return_object() {
+        return m_promise.get_future();
+    }
+
+    std::suspend_never initial_suspend() noexcept {
+        return {};
+    }
+
+    std::suspend_never final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() {
+        m_promise.set_exception(std::current_exception());
+    }
+
+    static void *operator new(size_t size) {
+        return RecyclingAllocator::allocate(size);
+    }
+
+    static void operator delete(void *ptr, size_t size) {
+        RecyclingAllocator::deallocate(ptr, size);
+    }
+
+protected:
+    Promise<T> m_promise;
+};
+
+template<typename T>
+class CoroutinePromise : public CoroutinePromiseBase<T> {
+public:
+    template<typename U>
+    void return_value(U &&value) {
+        this->m_promise.set_value(std::forward<U>(value));
+    }
+};
+
+// Future<Void> coroutines finish with a plain co_return.
+template<>
+class CoroutinePromise<Void> : public CoroutinePromiseBase<Void> {
+public:
+    void return_void() {
+        this->m_promise.set_value(Void{});
+    }
+};
+
+template<typename T>
+class FutureAwaiter {
+public:
+    explicit FutureAwaiter(Future<T> future) : m_future(std::move(future)) {}
+
+    bool await_ready() const {
+        return m_future.is_ready();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        ActorBase *actor = ActorBase::current();
+        if (actor == nullptr) {
+            m_future.on_ready([handle] { handle.resume(); });
+            return;
+        }
+        m_future.on_ready([handle, owner = actor->shared_from_this()] { owner->resume(handle); });
+    }
+
+    T await_resume() {
+        return m_future.get();
+    }
+
+private:
+    Future<T> m_future;
+};
+
+} // namespace detail
+
+template<typename T, typename... Args>
+struct std::coroutine_traits<Future<T>, Args...> {
+    using promise_type = detail::CoroutinePromise<T>;
+};
+
+template<typename T>
+detail::FutureAwaiter<T> operator co_await(Future<T> future) {
+    return detail::FutureAwaiter<T>(std::move(future));
+}
+
+#endif //FLOWDB_COROUTINE_H
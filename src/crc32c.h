@@ -0,0 +1,39 @@
+#ifndef FLOWDB_CRC32C_H
+#define FLOWDB_CRC32C_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// CRC-32C (Castagnoli), the checksum of log records. Table-driven, one byte
+// per step.
+
+namespace detail {
+
+constexpr std::array<uint32_t, 256> make_crc32c_table() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1u)));
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+inline constexpr std::array<uint32_t, 256> kCrc32cTable = make_crc32c_table();
+
+} // namespace detail
+
+// Extends crc, the checksum of the preceding bytes, over data.
+inline uint32_t crc32c(std::string_view data, uint32_t crc = 0) {
+    crc = ~crc;
+    for (char c: data) {
+        crc = detail::kCrc32cTable[(crc ^ static_cast<unsigned char>(c)) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#endif //FLOWDB_CRC32C_H
@@ -0,0 +1,105 @@
+#ifndef FLOWDB_DEADLINE_QUEUE_H
+#define FLOWDB_DEADLINE_QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Deadlines served by a thread of the queue's own, for timers that are armed
+// far more often than they fire and must be cheap to arm, such as a request's
+// batching window or hedging delay. Arming one is a lock and a push.
+//
+// The queue is a FIFO rather than a heap: items are expected to arrive in
+// deadline order, which holds when every item gets the same delay. An item
+// behind a later deadline waits for it, so if the delay changes, items can be
+// late by at most that change.
+//
+// Items whose deadline has passed are handed to expire(), oldest first, on the
+// queue's thread and without the lock held. An item that no longer needs its
+// deadline is not removed; expire() is expected to skip it.
+template<typename T>
+class DeadlineQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Expire = std::function<void(std::vector<T> &due)>;
+
+    explicit DeadlineQueue(Expire expire) : m_expire(std::move(expire)) {
+        m_thread = std::thread([this] { run(); });
+    }
+
+    DeadlineQueue(const DeadlineQueue &) = delete;
+
+    DeadlineQueue &operator=(const DeadlineQueue &) = delete;
+
+    ~DeadlineQueue() {
+        stop();
+    }
+
+    // Hands item to expire() once deadline has passed.
+    void push(Clock::time_point deadline, T item) {
+        bool idle;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            idle = m_items.empty();
+            m_items.emplace_back(deadline, std::move(item));
+        }
+        // Otherwise the thread is already waiting for an earlier deadline
+        if (idle) {
+            m_cv.notify_one();
+        }
+    }
+
+    // Stops the thread after the call to expire() in progress, if any. Items
+    // still waiting are dropped without expiring.
+    void stop() {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_stopping) {
+                return;
+            }
+            m_stopping = true;
+        }
+        m_cv.notify_one();
+        m_thread.join();
+    }
+
+private:
+    // Sleeps until the oldest deadline, then expires every item that is due.
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        std::vector<T> due;
+        while (!m_stopping) {
+            if (m_items.empty()) {
+                m_cv.wait(lock);
+                continue;
+            }
+            auto now = Clock::now();
+            if (m_items.front().first > now) {
+                m_cv.wait_until(lock, m_items.front().first);
+                continue;
+            }
+            while (!m_items.empty() && m_items.front().first <= now) {
+                due.push_back(std::move(m_items.front().second));
+                m_items.pop_front();
+            }
+            lock.unlock();
+            m_expire(due);
+            due.clear();
+            lock.lock();
+        }
+    }
+
+    Expire m_expire;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::pair<Clock::time_point, T>> m_items;
+    bool m_stopping = false;
+    std::thread m_thread;
+};
+
+#endif //FLOWDB_DEADLINE_QUEUE_H
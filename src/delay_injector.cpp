@@ -0,0 +1,46 @@
+#include "delay_injector.h"
+
+#include <memory>
+#include <random>
+#include <utility>
+
+/**
+ * @brief Constructor for DelayInjector class. Starts the timer thread.
+ *
+ * @param delay How long a delayed response is held back.
+ * @param probability Fraction of responses that are delayed, in [0, 1].
+ */
+DelayInjector::DelayInjector(std::chrono::microseconds delay, double probability)
+        : m_delay(delay), m_probability(probability), m_work(m_io_context.get_executor()),
+          m_thread([this] { m_io_context.run(); }) {}
+
+DelayInjector::~DelayInjector() {
+    m_work.reset();
+    m_io_context.stop();
+    m_thread.join();
+}
+
+FrameSession::Handler DelayInjector::wrap(FrameSession::Handler handler) {
+    return [this, handler = std::move(handler)](Opcode opcode, std::string_view payload) {
+        return delay(handler(opcode, payload));
+    };
+}
+
+/**
+ * @brief Decides per response, with a per-thread generator, whether to hold
+ * it back, and if so passes it on once both it and the timer are done.
+ */
+Future<Message> DelayInjector::delay(Future<Message> response) {
+    static thread_local std::minstd_rand random(std::random_device{}());
+    if (std::uniform_real_distribution<double>(0, 1)(random) >= m_probability) {
+        return response;
+    }
+    Promise<Message> promise;
+    auto delayed = promise.get_future();
+    auto timer = std::make_shared<boost::asio::steady_timer>(m_io_context, m_delay);
+    timer->async_wait([promise = std::move(promise), response = std::move(response), timer](
+            const boost::system::error_code &) mutable {
+        response.forward_to(std::move(promise));
+    });
+    return delayed;
+}
@@ -0,0 +1,43 @@
+#ifndef FLOWDB_DELAY_INJECTOR_H
+#define FLOWDB_DELAY_INJECTOR_H
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <optional>
+#include <thread>
+#include "frame_session.h"
+#include "future.h"
+#include "message.h"
+
+// Holds back a fraction of a server's responses for a fixed delay, to stand in
+// for a replica that is slow or stalled (a long GC pause, a busy disk) when
+// measuring how clients cope. Delayed responses wait on a timer of the
+// injector's own thread, so they take no time from the network threads, and
+// requests answered by the session itself (Ping) are never delayed.
+class DelayInjector {
+public:
+    // Delays each response by delay with the given probability.
+    DelayInjector(std::chrono::microseconds delay, double probability);
+
+    DelayInjector(const DelayInjector &) = delete;
+
+    DelayInjector &operator=(const DelayInjector &) = delete;
+
+    // Drops the responses that are still waiting.
+    ~DelayInjector();
+
+    // Wraps handler so its responses are delayed. The injector must outlive
+    // the returned handler.
+    FrameSession::Handler wrap(FrameSession::Handler handler);
+
+private:
+    Future<Message> delay(Future<Message> response);
+
+    std::chrono::microseconds m_delay;
+    double m_probability;
+    boost::asio::io_context m_io_context;
+    std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> m_work;
+    std::thread m_thread;
+};
+
+#endif //FLOWDB_DELAY_INJECTOR_H
@@ -0,0 +1,193 @@
+#include "endpoint_selector.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+/**
+ * @brief Constructor for EndpointSelector class.
+ *
+ * @param num_endpoints Number of endpoints; indices run from 0 to num_endpoints - 1.
+ * @param strategy The initial selection strategy.
+ */
+EndpointSelector::EndpointSelector(size_t num_endpoints, SelectionStrategy strategy)
+        : m_size(num_endpoints), m_stats(new Stats[num_endpoints]), m_strategy(strategy), m_next(0) {
+    assert(num_endpoints > 0);
+}
+
+/**
+ * @brief Picks an endpoint for the next request.
+ *
+ * Ejected endpoints and endpoints marked down are skipped. If no endpoint is
+ * left the selector falls back to ejected endpoints that are not down, and
+ * then to all of them, rather than refusing to route anything.
+ *
+ * @return size_t Index of the selected endpoint.
+ */
+size_t EndpointSelector::select() {
+    return pick(m_size, [](size_t k) { return k; });
+}
+
+size_t EndpointSelector::select(std::span<const size_t> candidates) {
+    assert(!candidates.empty());
+    return pick(candidates.size(), [candidates](size_t k) { return candidates[k]; });
+}
+
+template<typename Id>
+size_t EndpointSelector::pick(size_t count, Id id) {
+    // Snapshot the usable candidates once: the health flags may change under
+    // us, and every strategy below must choose from one consistent set
+    size_t inline_ids[kInlineCandidates];
+    std::unique_ptr<size_t[]> heap_ids;
+    size_t *usable = inline_ids;
+    if (count > kInlineCandidates) {
+        heap_ids = std::make_unique<size_t[]>(count);
+        usable = heap_ids.get();
+    }
+    int64_t time = now();
+    // Prefer admitted endpoints, then ones that are merely ejected, then any
+    size_t usable_count = 0;
+    for (int level = 0; level < 3 && usable_count == 0; level++) {
+        for (size_t k = 0; k < count; k++) {
+            size_t index = id(k);
+            if (usable_at(index, time, level)) {
+                usable[usable_count++] = index;
+            }
+        }
+    }
+    assert(usable_count > 0);
+    if (usable_count == 1) {
+        return usable[0];
+    }
+
+    switch (m_strategy.load(std::memory_order_relaxed)) {
+        case SelectionStrategy::RoundRobin:
+            return usable[m_next.fetch_add(1, std::memory_order_relaxed) % usable_count];
+        case SelectionStrategy::LeastOutstanding: {
+            // Start at a rotating offset so ties are spread across endpoints
+            size_t start = m_next.fetch_add(1, std::memory_order_relaxed);
+            size_t best = usable[start % usable_count];
+            uint32_t best_outstanding = outstanding(best);
+            for (size_t k = 1; k < usable_count; k++) {
+                size_t index = usable[(start + k) % usable_count];
+                uint32_t load = outstanding(index);
+                if (load < best_outstanding) {
+                    best = index;
+                    best_outstanding = load;
+                }
+            }
+            return best;
+        }
+        case SelectionStrategy::PowerOfTwoChoices:
+        default: {
+            // Draw two distinct endpoints among the usable ones
+            uint64_t random = next_random();
+            size_t first = random % usable_count;
+            size_t second = (first + 1 + (random >> 32) % (usable_count - 1)) % usable_count;
+            size_t a = usable[first];
+            size_t b = usable[second];
+            return cost(a) <= cost(b) ? a : b;
+        }
+    }
+}
+
+void EndpointSelector::on_start(size_t index) {
+    m_stats[index].outstanding.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Records a completed request, folding its latency into the EWMA and
+ * readmitting the endpoint if it was on probation after an ejection.
+ */
+void EndpointSelector::on_success(size_t index, std::chrono::nanoseconds latency) {
+    on_success(index);
+
+    Stats &stats = m_stats[index];
+    auto sample = static_cast<double>(std::max<int64_t>(latency.count(), 0));
+    uint64_t current = stats.latency_ns.load(std::memory_order_relaxed);
+    uint64_t updated;
+    do {
+        updated = current == 0 ? static_cast<uint64_t>(sample)
+                               : static_cast<uint64_t>(kAlpha * sample + (1 - kAlpha) * static_cast<double>(current));
+        updated = std::max<uint64_t>(updated, 1);
+    } while (!stats.latency_ns.compare_exchange_weak(current, updated, std::memory_order_relaxed));
+}
+
+void EndpointSelector::on_success(size_t index) {
+    Stats &stats = m_stats[index];
+    stats.outstanding.fetch_sub(1, std::memory_order_relaxed);
+    stats.consecutive_failures.store(0, std::memory_order_relaxed);
+    stats.ejected_until.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Records a failure. After kFailuresToEject consecutive failures the
+ * endpoint is ejected for kBaseEjection, doubling with every further failure
+ * up to kMaxEjection.
+ */
+void EndpointSelector::on_failure(size_t index) {
+    m_stats[index].outstanding.fetch_sub(1, std::memory_order_relaxed);
+    report_failure(index);
+}
+
+void EndpointSelector::on_abandon(size_t index) {
+    m_stats[index].outstanding.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void EndpointSelector::report_failure(size_t index) {
+    Stats &stats = m_stats[index];
+    uint32_t failures = stats.consecutive_failures.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (failures >= kFailuresToEject) {
+        uint32_t doublings = std::min<uint32_t>(failures - kFailuresToEject, 16);
+        auto duration = std::min<std::chrono::nanoseconds>(kBaseEjection * (1u << doublings), kMaxEjection);
+        stats.ejected_until.store(now() + duration.count(), std::memory_order_relaxed);
+    }
+}
+
+std::chrono::nanoseconds EndpointSelector::latency(size_t index) const {
+    return std::chrono::nanoseconds(m_stats[index].latency_ns.load(std::memory_order_relaxed));
+}
+
+uint32_t EndpointSelector::outstanding(size_t index) const {
+    return m_stats[index].outstanding.load(std::memory_order_relaxed);
+}
+
+bool EndpointSelector::ejected(size_t index) const {
+    return !admitted(index, now());
+}
+
+int64_t EndpointSelector::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool EndpointSelector::usable_at(size_t index, int64_t now, int level) const {
+    switch (level) {
+        case 0:
+            return admitted(index, now);
+        case 1:
+            return !m_stats[index].down.load(std::memory_order_relaxed);
+        default:
+            return true;
+    }
+}
+
+bool EndpointSelector::admitted(size_t index, int64_t now) const {
+    const Stats &stats = m_stats[index];
+    return !stats.down.load(std::memory_order_relaxed) &&
+           stats.ejected_until.load(std::memory_order_relaxed) <= now;
+}
+
+double EndpointSelector::cost(size_t index) const {
+    // Unmeasured endpoints look cheap so that they get sampled
+    auto latency = static_cast<double>(m_stats[index].latency_ns.load(std::memory_order_relaxed));
+    return (latency + 1.0) * (static_cast<double>(outstanding(index)) + 1.0);
+}
+
+uint64_t EndpointSelector::next_random() {
+    // splitmix64 over a shared counter: cheap, and distinct across threads
+    uint64_t z = m_next.fetch_add(1, std::memory_order_relaxed) * 0x9E3779B97F4A7C15ull + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
@@ -0,0 +1,130 @@
+#ifndef FLOWDB_ENDPOINT_SELECTOR_H
+#define FLOWDB_ENDPOINT_SELECTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+enum class SelectionStrategy {
+    // Cycle through endpoints regardless of load
+    RoundRobin,
+    // Pick the endpoint with the fewest requests in flight
+    LeastOutstanding,
+    // Sample two endpoints and pick the one with the lower latency-weighted load
+    PowerOfTwoChoices,
+};
+
+// Load and health bookkeeping for a fixed set of endpoints, shared by all
+// threads checking out connections. Each endpoint tracks an EWMA of observed
+// request latency and the number of requests in flight; selection uses them
+// according to the configured strategy. An endpoint that fails
+// kFailuresToEject times in a row is ejected for an exponentially growing
+// period and readmitted automatically once it expires; a success resets it.
+// Independently of that, an external health checker can mark an endpoint down
+// until it reports it up again.
+class EndpointSelector {
+public:
+    static constexpr uint32_t kFailuresToEject = 3;
+    static constexpr std::chrono::milliseconds kBaseEjection{500};
+    static constexpr std::chrono::milliseconds kMaxEjection{30'000};
+
+    explicit EndpointSelector(size_t num_endpoints, SelectionStrategy strategy = SelectionStrategy::PowerOfTwoChoices);
+
+    // Returns the index of the endpoint the next request should go to.
+    size_t select();
+
+    // The same among some of the endpoints only, such as the replicas of a
+    // shard. Returns an index from candidates, which must not be empty.
+    size_t select(std::span<const size_t> candidates);
+
+    // Records that a request to the endpoint has started.
+    void on_start(size_t index);
+
+    // Records a completed request and its latency.
+    void on_success(size_t index, std::chrono::nanoseconds latency);
+
+    // Records a completed request without a latency sample.
+    void on_success(size_t index);
+
+    // Records a failed request.
+    void on_failure(size_t index);
+
+    // Records a request that ended without an outcome for the endpoint, such
+    // as one failed by the client closing its connection.
+    void on_abandon(size_t index);
+
+    // Records a failure that was not counted by on_start(), such as a
+    // background connection attempt.
+    void report_failure(size_t index);
+
+    // Takes the endpoint out of (or back into) rotation.
+    void set_down(size_t index, bool down) {
+        m_stats[index].down.store(down, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool down(size_t index) const {
+        return m_stats[index].down.load(std::memory_order_relaxed);
+    }
+
+    void set_strategy(SelectionStrategy strategy) {
+        m_strategy.store(strategy, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] SelectionStrategy strategy() const {
+        return m_strategy.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] size_t size() const {
+        return m_size;
+    }
+
+    [[nodiscard]] std::chrono::nanoseconds latency(size_t index) const;
+
+    [[nodiscard]] uint32_t outstanding(size_t index) const;
+
+    [[nodiscard]] bool ejected(size_t index) const;
+
+private:
+    struct alignas(64) Stats {
+        // Smoothed latency in nanoseconds; 0 until the first sample
+        std::atomic<uint64_t> latency_ns{0};
+        std::atomic<uint32_t> outstanding{0};
+        std::atomic<uint32_t> consecutive_failures{0};
+        // steady_clock time in nanoseconds until which the endpoint is ejected
+        std::atomic<int64_t> ejected_until{0};
+        // Set by the health checker while the endpoint fails its pings
+        std::atomic<bool> down{false};
+    };
+
+    // Weight of a new latency sample in the moving average
+    static constexpr double kAlpha = 0.2;
+
+    // Candidates pick() can snapshot without allocating
+    static constexpr size_t kInlineCandidates = 16;
+
+    static int64_t now();
+
+    // select() over count candidates, candidate k being endpoint id(k)
+    template<typename Id>
+    size_t pick(size_t count, Id id);
+
+    [[nodiscard]] bool admitted(size_t index, int64_t now) const;
+
+    // Whether select() may pick the endpoint at the given fallback level:
+    // 0 admitted only, 1 not marked down, 2 any
+    [[nodiscard]] bool usable_at(size_t index, int64_t now, int level) const;
+
+    // Latency-weighted load used to compare endpoints
+    [[nodiscard]] double cost(size_t index) const;
+
+    uint64_t next_random();
+
+    size_t m_size;
+    std::unique_ptr<Stats[]> m_stats;
+    std::atomic<SelectionStrategy> m_strategy;
+    std::atomic<size_t> m_next;
+};
+
+#endif //FLOWDB_ENDPOINT_SELECTOR_H
@@ -1,33 +1,40 @@
 #include "runtime.h"
 #include "actor.h"
 #include "future.h"
+#include "coroutine.h"
 #include <iostream>
 
-class MyActor : public Actor<int> {
+// Asks MyActor to compute a value.
+struct Compute {
+    Promise<int> reply;
+};
+
+class MyActor : public Actor<MyActor, Compute> {
 public:
     MyActor() : m_received(false) {}
 
-    std::shared_ptr<Promise<int>> compute() {
-        auto promise = std::make_shared<Promise<int>>();
-        tell(promise, reinterpret_cast<void (Actor<int>::*)(std::shared_ptr<Promise<int>>&)>(&MyActor::handle_compute));
-        return promise;
+    Future<int> compute() {
+        return ask(Compute{});
+    }
+
+    // Two round trips through the actor without blocking a thread in between.
+    Future<int> compute_twice() {
+        int a = co_await compute();
+        int b = co_await compute();
+        co_return a + b;
     }
 
     bool received() const {
         return m_received;
     }
 
-protected:
-    void receive(int msg) override {
+    void handle(Compute &msg) {
         m_received = true;
-    }
-
-private:
-    void handle_compute(const std::shared_ptr<Promise<int>>& promise) {
         int result = 42;
-        promise->set_value(result);
+        msg.reply.set_value(result);
     }
 
+private:
     bool m_received;
 };
 
@@ -35,15 +42,14 @@ int main() {
     Runtime runtime(4);
     auto actor = runtime.create_actor<MyActor>();
 
-    auto promise = actor->compute();
-
-    int result = promise->get_future().get();
+    int result = actor->compute().get();
 
     std::cout << "Result: " << result << std::endl;
+    std::cout << "Twice: " << actor->compute_twice().get() << std::endl;
     std::cout << "Received: " << actor->received() << std::endl;
 
     actor->stop();
     runtime.stop();
 
     return 0;
-}
\ No newline at end of file
+}
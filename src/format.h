@@ -0,0 +1,20 @@
+#ifndef FLOWDB_FORMAT_H
+#define FLOWDB_FORMAT_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+// Appends printf-style formatted text to out, formatting in place rather than
+// through a temporary string. For the text pages and JSON the runtime renders.
+inline void append_format(std::string &out, const char *format, auto... args) {
+    int size = std::snprintf(nullptr, 0, format, args...);
+    if (size > 0) {
+        size_t offset = out.size();
+        out.resize(offset + static_cast<size_t>(size) + 1);
+        std::snprintf(out.data() + offset, static_cast<size_t>(size) + 1, format, args...);
+        out.pop_back();
+    }
+}
+
+#endif //FLOWDB_FORMAT_H
@@ -0,0 +1,211 @@
+#ifndef FLOWDB_FRAME_H
+#define FLOWDB_FRAME_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "buffer_pool.h"
+#include "codec.h"
+
+// Wire format shared by clients and servers. Every message is a frame: a fixed
+// 16-byte header followed by the payload.
+//
+//     uint32 length      payload bytes following the header
+//     uint16 opcode      what the request asks for; echoed in the response
+//     uint16 flags       kResponse, kError, kWrongShard, kTraced
+//     uint64 request_id  chosen by the client, echoed in the response
+//
+// Integers are little-endian. A request id only has to be unique among the
+// requests in flight on one connection, which is what lets many requests share
+// a connection and their responses come back in any order.
+enum class Opcode : uint16_t {
+    // Empty request answered with an empty response; used by health checks
+    Ping = 0,
+    // Responds with the request payload
+    Echo = 1,
+    // Storage requests; payloads are described in storage_protocol.h
+    Get = 2,
+    Set = 3,
+    Clear = 4,
+    ClearRange = 5,
+    GetRange = 6,
+    // Responds with the server's shard map; see shard_map.h
+    GetShardMap = 7,
+    // 8 was SplitShard. Shard maps are now changed by the ShardCoordinator
+    // only, which installs them with InstallShardMap
+    // Several requests in one frame, served as if each had arrived in a frame
+    // of its own, in order. The payload is a flat message (message.h) of
+    // [opcode, request, opcode, request, ...] with integer opcodes, and the
+    // response is [flags, response, ...], where flags holds the kError and
+    // kWrongShard bits each response frame would have carried. Batches do
+    // not nest.
+    Batch = 9,
+    // Replaces the server's shard map with the one in the payload, if it is
+    // newer, and responds with the map the server holds after
+    InstallShardMap = 10,
+    // Responds with the keys the server would split its busy shards at
+    GetSplitKeys = 11,
+};
+
+struct FrameHeader {
+    // The frame is a response to the request with the same id
+    static constexpr uint16_t kResponse = 1;
+    // The response payload is an error message rather than a result
+    static constexpr uint16_t kError = 2;
+    // Set with kError when the server does not serve the request's key; the
+    // payload is the server's shard map rather than a message
+    static constexpr uint16_t kWrongShard = 4;
+    // The payload starts with the request's 8-byte trace span (trace.h),
+    // which is not part of the request and is counted in length
+    static constexpr uint16_t kTraced = 8;
+
+    uint32_t length = 0;
+    Opcode opcode = Opcode::Ping;
+    uint16_t flags = 0;
+    uint64_t request_id = 0;
+};
+
+constexpr size_t kFrameHeaderSize = 16;
+
+// Size of the span that leads the payload of a kTraced frame
+constexpr size_t kTraceSpanSize = 8;
+
+// A request reached a server that does not serve its key. Thrown by request
+// handlers to produce a kWrongShard response, and by clients that receive one.
+class WrongShard : public std::runtime_error {
+public:
+    explicit WrongShard(std::string shard_map)
+            : std::runtime_error("Key is not served by this server"), m_shard_map(std::move(shard_map)) {}
+
+    // The encoded shard map of the server that rejected the request
+    [[nodiscard]] const std::string &shard_map() const {
+        return m_shard_map;
+    }
+
+private:
+    std::string m_shard_map;
+};
+
+// Frames larger than this are treated as a protocol error
+constexpr size_t kMaxFramePayload = 16 << 20;
+
+inline void encode_header(const FrameHeader &header, char *out) {
+    detail::store_le(out, header.length);
+    detail::store_le(out + 4, static_cast<uint16_t>(header.opcode));
+    detail::store_le(out + 6, header.flags);
+    detail::store_le(out + 8, header.request_id);
+}
+
+inline FrameHeader decode_header(const char *in) {
+    FrameHeader header;
+    header.length = detail::load_le<uint32_t>(in);
+    header.opcode = static_cast<Opcode>(detail::load_le<uint16_t>(in + 4));
+    header.flags = detail::load_le<uint16_t>(in + 6);
+    header.request_id = detail::load_le<uint64_t>(in + 8);
+    return header;
+}
+
+// Appends a complete frame to out, so several frames can go out in one write.
+inline void append_frame(std::string &out, Opcode opcode, uint16_t flags, uint64_t request_id,
+                         std::string_view payload) {
+    FrameHeader header{static_cast<uint32_t>(payload.size()), opcode, flags, request_id};
+    size_t offset = out.size();
+    out.resize(offset + kFrameHeaderSize);
+    encode_header(header, out.data() + offset);
+    out.append(payload);
+}
+
+struct Frame {
+    FrameHeader header;
+    // Points into the reader's buffer; valid until the reader's next
+    // prepare(), or for as long as a slice from FrameReader::retain() is held
+    std::string_view payload;
+};
+
+// Reassembles frames from a byte stream. Bytes are read straight into the
+// buffer returned by prepare(), and next() then yields every complete frame
+// they contain, so all the frames delivered by one read are handled as a batch
+// without copying their payloads.
+//
+// The buffers come from the buffer pool. A payload can be kept beyond the
+// next read with retain(); the reader then leaves the bytes alone and moves on
+// to a fresh buffer when it needs to reclaim space.
+class FrameReader {
+public:
+    // Receive buffers hold at least this much
+    static constexpr size_t kBufferSize = BufferRef::kMaxPooledSize;
+
+    // Returns space for at least min_size more bytes. Consumed bytes are
+    // dropped first, which invalidates the payloads of earlier frames that
+    // were not retained.
+    std::pair<char *, size_t> prepare(size_t min_size = 4096) {
+        if (m_begin == m_end && m_buffer.unique()) {
+            m_begin = m_end = 0;
+        }
+        if (m_buffer.capacity() - m_end < min_size) {
+            size_t pending = m_end - m_begin;
+            if (m_buffer.unique() && m_buffer.capacity() - pending >= min_size) {
+                std::memmove(m_buffer.data(), m_buffer.data() + m_begin, pending);
+            } else {
+                // Retained payloads keep the old buffer; a partial frame that
+                // outgrew it moves to one twice its size
+                BufferRef buffer = BufferRef::allocate(std::max({kBufferSize, 2 * pending, pending + min_size}));
+                if (pending > 0) {
+                    std::memcpy(buffer.data(), m_buffer.data() + m_begin, pending);
+                }
+                m_buffer = std::move(buffer);
+            }
+            m_begin = 0;
+            m_end = pending;
+        }
+        return {m_buffer.data() + m_end, m_buffer.capacity() - m_end};
+    }
+
+    // Marks size bytes of the prepared space as filled.
+    void commit(size_t size) {
+        m_end += size;
+    }
+
+    // Takes the next complete frame, if there is one.
+    //
+    // @throws std::runtime_error if the frame exceeds kMaxFramePayload.
+    bool next(Frame &frame) {
+        if (m_end - m_begin < kFrameHeaderSize) {
+            return false;
+        }
+        FrameHeader header = decode_header(m_buffer.data() + m_begin);
+        if (header.length > kMaxFramePayload) {
+            throw std::runtime_error("Frame exceeds the maximum payload size");
+        }
+        if (m_end - m_begin < kFrameHeaderSize + header.length) {
+            return false;
+        }
+        frame.header = header;
+        frame.payload = std::string_view(m_buffer.data() + m_begin + kFrameHeaderSize, header.length);
+        m_begin += kFrameHeaderSize + header.length;
+        return true;
+    }
+
+    // Keeps the payload of a frame from the latest next() calls valid for as
+    // long as the slice is held.
+    [[nodiscard]] BufferSlice retain(const Frame &frame) const {
+        return BufferSlice(m_buffer, frame.payload);
+    }
+
+    // True if a frame has been started but not completed
+    [[nodiscard]] bool partial() const {
+        return m_begin != m_end;
+    }
+
+private:
+    BufferRef m_buffer;
+    size_t m_begin = 0;
+    size_t m_end = 0;
+};
+
+#endif //FLOWDB_FRAME_H
@@ -0,0 +1,85 @@
+#include "frame_queue.h"
+
+#include <cstring>
+#include <utility>
+
+void FrameQueue::push(Opcode opcode, uint16_t flags, uint64_t request_id, std::string_view payload,
+                      uint64_t span) {
+    size_t size;
+    char *out = header(opcode, flags, request_id, payload.size(), span, 0, size);
+    append({out, size});
+    append(m_arena.copy(payload));
+}
+
+/**
+ * @brief Copies the header, and the payload too if it is short; otherwise
+ * the message's segments go into the gather list as they are.
+ */
+void FrameQueue::push(Opcode opcode, uint16_t flags, uint64_t request_id, const Message &message,
+                      uint64_t span) {
+    size_t size;
+    char *out = header(opcode, flags, request_id, message.size(), span,
+                       message.size() < kCopySize ? message.size() : 0, size);
+    if (message.size() < kCopySize) {
+        char *payload = out + size;
+        for (std::string_view segment: message.segments()) {
+            std::memcpy(payload, segment.data(), segment.size());
+            payload += segment.size();
+        }
+        append({out, size + message.size()});
+        return;
+    }
+    append({out, size});
+    for (std::string_view segment: message.segments()) {
+        append(segment);
+    }
+    m_messages.push_back(message);
+}
+
+void FrameQueue::clear() {
+    m_arena.clear();
+    m_messages.clear();
+    m_buffers.clear();
+    m_size = 0;
+}
+
+void FrameQueue::swap(FrameQueue &other) noexcept {
+    std::swap(m_arena, other.m_arena);
+    m_messages.swap(other.m_messages);
+    m_buffers.swap(other.m_buffers);
+    std::swap(m_size, other.m_size);
+}
+
+char *FrameQueue::header(Opcode opcode, uint16_t flags, uint64_t request_id, size_t payload, uint64_t span,
+                         size_t extra, size_t &size) {
+    size = kFrameHeaderSize + (span != 0 ? kTraceSpanSize : 0);
+    FrameHeader header{static_cast<uint32_t>(payload + size - kFrameHeaderSize), opcode, flags, request_id};
+    if (span != 0) {
+        header.flags |= FrameHeader::kTraced;
+    }
+    char *out = m_arena.allocate(size + extra);
+    encode_header(header, out);
+    if (span != 0) {
+        detail::store_le(out + kFrameHeaderSize, span);
+    }
+    return out;
+}
+
+/**
+ * @brief Adds bytes to the gather list, extending the last buffer instead if
+ * bytes directly follows it in memory.
+ */
+void FrameQueue::append(std::string_view bytes) {
+    if (bytes.empty()) {
+        return;
+    }
+    m_size += bytes.size();
+    if (!m_buffers.empty()) {
+        auto &last = m_buffers.back();
+        if (static_cast<const char *>(last.data()) + last.size() == bytes.data()) {
+            last = boost::asio::const_buffer(last.data(), last.size() + bytes.size());
+            return;
+        }
+    }
+    m_buffers.emplace_back(bytes.data(), bytes.size());
+}
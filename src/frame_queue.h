@@ -0,0 +1,67 @@
+#ifndef FLOWDB_FRAME_QUEUE_H
+#define FLOWDB_FRAME_QUEUE_H
+
+#include <boost/asio/buffer.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "buffer_pool.h"
+#include "frame.h"
+#include "message.h"
+
+// Frames waiting to be written, kept as a gather list for one vectored write.
+// Headers and short payloads are copied into an arena, where consecutive ones
+// form a single buffer; longer message payloads are referenced where they
+// are, and the queue keeps their messages alive until it is cleared.
+class FrameQueue {
+public:
+    // Message payloads shorter than this are copied, since a copy is cheaper
+    // than another buffer in the gather list
+    static constexpr size_t kCopySize = 512;
+
+    // Appends a frame with a copy of payload. A nonzero span is sent ahead
+    // of the payload in a kTraced frame.
+    void push(Opcode opcode, uint16_t flags, uint64_t request_id, std::string_view payload, uint64_t span = 0);
+
+    // Appends a frame whose payload is message.
+    void push(Opcode opcode, uint16_t flags, uint64_t request_id, const Message &message, uint64_t span = 0);
+
+    [[nodiscard]] bool empty() const {
+        return m_buffers.empty();
+    }
+
+    // Bytes queued
+    [[nodiscard]] size_t size() const {
+        return m_size;
+    }
+
+    // Bytes copied into the queue, headers included
+    [[nodiscard]] size_t copied() const {
+        return m_arena.used();
+    }
+
+    // The queued frames, valid until the queue is changed.
+    [[nodiscard]] const std::vector<boost::asio::const_buffer> &buffers() const {
+        return m_buffers;
+    }
+
+    void clear();
+
+    void swap(FrameQueue &other) noexcept;
+
+private:
+    // Allocates and encodes the header, and the span if there is one, with
+    // extra bytes of arena space after them
+    char *header(Opcode opcode, uint16_t flags, uint64_t request_id, size_t payload, uint64_t span,
+                 size_t extra, size_t &size);
+
+    void append(std::string_view bytes);
+
+    Arena m_arena;
+    std::vector<Message> m_messages;
+    std::vector<boost::asio::const_buffer> m_buffers;
+    size_t m_size = 0;
+};
+
+#endif //FLOWDB_FRAME_QUEUE_H
@@ -0,0 +1,309 @@
+#include "frame_session.h"
+
+#include <algorithm>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "metrics.h"
+#include "trace.h"
+
+namespace {
+
+// The flags and payload of the response to a completed request
+std::pair<uint16_t, Message> outcome(const Future<Message> &response) {
+    try {
+        return {0, response.get()};
+    } catch (const WrongShard &e) {
+        return {FrameHeader::kError | FrameHeader::kWrongShard, Message(e.shard_map())};
+    } catch (const std::exception &e) {
+        return {FrameHeader::kError, Message(e.what())};
+    } catch (...) {
+        return {FrameHeader::kError, Message("Unknown error")};
+    }
+}
+
+} // namespace
+
+/**
+ * @brief Constructor for FrameSession class.
+ *
+ * @param socket An accepted connection.
+ * @param handler Called for every request other than Ping and Batch.
+ */
+FrameSession::FrameSession(tcp::socket socket, Handler handler)
+        : FrameSession(std::move(socket), std::move(handler), Options()) {}
+
+/**
+ * @brief Constructor for FrameSession class.
+ *
+ * @param socket An accepted connection.
+ * @param handler Called for every request other than Ping and Batch.
+ * @param options The credits and unsent bytes after which reading pauses.
+ */
+FrameSession::FrameSession(tcp::socket socket, Handler handler, Options options)
+        : m_socket(std::move(socket)), m_strand(boost::asio::make_strand(m_socket.get_executor())),
+          m_handler(std::move(handler)), m_options(options) {}
+
+void FrameSession::start() {
+    boost::system::error_code ec;
+    m_socket.set_option(tcp::no_delay(true), ec);
+    boost::asio::post(m_strand, [self = shared_from_this()] { self->read(); });
+}
+
+void FrameSession::read() {
+    auto [data, size] = m_reader.prepare();
+    m_socket.async_read_some(boost::asio::buffer(data, size),
+                             boost::asio::bind_executor(m_strand, [self = shared_from_this()](
+                                     const boost::system::error_code &ec, size_t bytes) {
+                                 self->on_read(ec, bytes);
+                             }));
+}
+
+void FrameSession::on_read(const boost::system::error_code &ec, size_t bytes) {
+    if (ec) {
+        close();
+        return;
+    }
+    if (Trace::enabled()) [[unlikely]] {
+        Trace::emit(Trace::Event::SocketRead, nullptr, 0, bytes);
+    }
+    m_reader.commit(bytes);
+    serve_buffered();
+}
+
+/**
+ * @brief Serves the frames contained in the reads so far, up to the credits
+ * left, then issues a single write for all the responses that are already
+ * available. A stalled request goes first, and no frame after it is served
+ * until it has been handed over. Exactly one of a read in progress and a
+ * pause follows, until the session closes.
+ */
+void FrameSession::serve_buffered() {
+    try {
+        if (m_stalled && dispatch(*m_stalled)) {
+            m_stalled.reset();
+        }
+        Frame frame;
+        while (!m_stalled && (m_options.max_in_flight == 0 || m_in_flight < m_options.max_in_flight) &&
+               m_reader.next(frame)) {
+            // The request is served inside the client's span
+            std::optional<Trace::Scope> scope;
+            if (frame.header.flags & FrameHeader::kTraced) {
+                if (frame.payload.size() < kTraceSpanSize) {
+                    throw std::runtime_error("Traced frame without a span");
+                }
+                uint64_t span = detail::load_le<uint64_t>(frame.payload.data());
+                frame.payload.remove_prefix(kTraceSpanSize);
+                if (Trace::enabled()) {
+                    scope.emplace(span);
+                    Trace::emit(Trace::Event::RequestReceived, nullptr, span,
+                                static_cast<uint64_t>(frame.header.opcode));
+                }
+            }
+            if (frame.header.opcode == Opcode::Ping) {
+                m_output.push(Opcode::Ping, FrameHeader::kResponse, frame.header.request_id, std::string_view());
+                continue;
+            }
+            auto request = std::make_unique<Request>();
+            request->opcode = frame.header.opcode;
+            request->id = frame.header.request_id;
+            try {
+                parse(frame, *request);
+            } catch (...) {
+                Promise<Message> failed;
+                failed.set_exception(std::current_exception());
+                respond(frame, failed.get_future());
+                continue;
+            }
+            if (!dispatch(*request)) {
+                request->payload = m_reader.retain(frame);
+                m_stalled = std::move(request);
+            }
+        }
+    } catch (const std::exception &) {
+        // Malformed stream; there is no way to resynchronise
+        close();
+        return;
+    }
+    flush();
+    if (m_stalled || saturated()) {
+        if (!m_paused) {
+            m_paused = true;
+            Metrics::add(Metrics::Counter::SessionReadPauses);
+        }
+        return;
+    }
+    m_paused = false;
+    read();
+}
+
+/**
+ * @brief Checks a whole batch before any of it is served, so a malformed one
+ * is rejected without side effects.
+ */
+void FrameSession::parse(const Frame &frame, Request &request) const {
+    if (frame.header.opcode != Opcode::Batch) {
+        request.parts.emplace_back(frame.header.opcode, frame.payload);
+        return;
+    }
+    MessageView batch(frame.payload);
+    if (batch.size() % 2 != 0) {
+        throw std::invalid_argument("Malformed batch");
+    }
+    if (m_options.max_batch != 0 && batch.size() / 2 > m_options.max_batch) {
+        throw std::invalid_argument("Batch too large");
+    }
+    request.parts.reserve(batch.size() / 2);
+    for (size_t i = 0; i < batch.size(); i += 2) {
+        auto opcode = static_cast<Opcode>(batch.u64(i));
+        if (opcode == Opcode::Batch) {
+            throw std::invalid_argument("Batches do not nest");
+        }
+        request.parts.emplace_back(opcode, batch.bytes(i + 1));
+    }
+}
+
+/**
+ * @brief A request only starts once the session has a credit for each of its
+ * parts, or holds none at all, so a batch larger than the credits still gets
+ * served alone. When the handler throws Overloaded the parts handed over so
+ * far stay handed over, and the rest wait for its future.
+ */
+bool FrameSession::dispatch(Request &request) {
+    if (request.ready.valid()) {
+        if (!request.ready.is_ready()) {
+            return false;
+        }
+        request.ready = {};
+    }
+    if (request.credits == 0) {
+        size_t credits = std::max<size_t>(request.parts.size(), 1);
+        if (m_options.max_in_flight != 0 && m_in_flight != 0 && m_in_flight + credits > m_options.max_in_flight) {
+            return false;
+        }
+        request.credits = credits;
+        m_in_flight += credits;
+    }
+    while (request.responses.size() < request.parts.size()) {
+        const auto &[opcode, payload] = request.parts[request.responses.size()];
+        try {
+            request.responses.push_back(serve(opcode, payload));
+        } catch (const Overloaded &e) {
+            request.ready = e.ready();
+            request.ready.on_ready([self = shared_from_this()] {
+                boost::asio::post(self->m_strand, [self] { self->resume(); });
+            });
+            return false;
+        }
+    }
+    finish(request);
+    return true;
+}
+
+/**
+ * @brief The response to a batch is encoded once every request it carries has
+ * been answered, each failure in place of its response.
+ */
+void FrameSession::finish(Request &request) {
+    Future<Message> response;
+    if (request.opcode != Opcode::Batch) {
+        response = std::move(request.responses.front());
+    } else {
+        response = when_settled(std::move(request.responses)).then(
+                [](const std::vector<Future<Message>> &responses) {
+                    MessageBuilder builder;
+                    for (const auto &part: responses) {
+                        auto [flags, message] = outcome(part);
+                        builder.add_u64(flags).add(message);
+                    }
+                    return builder.finish();
+                });
+    }
+    if (response.is_ready()) {
+        m_in_flight -= request.credits;
+        respond(request.opcode, request.id, response);
+        return;
+    }
+    response.on_ready([self = shared_from_this(), opcode = request.opcode, id = request.id,
+                              credits = request.credits, response] {
+        boost::asio::post(self->m_strand, [self, opcode, id, credits, response] {
+            self->m_in_flight -= credits;
+            self->respond(opcode, id, response);
+            self->flush();
+            self->resume();
+        });
+    });
+}
+
+bool FrameSession::saturated() const {
+    if (m_options.max_in_flight != 0 && m_in_flight >= m_options.max_in_flight) {
+        return true;
+    }
+    return m_options.max_unsent_bytes != 0 && m_output.size() + m_writing.size() >= m_options.max_unsent_bytes;
+}
+
+void FrameSession::resume() {
+    if (m_paused && !m_closed && !saturated()) {
+        serve_buffered();
+    }
+}
+
+Future<Message> FrameSession::serve(Opcode opcode, std::string_view payload) {
+    try {
+        if (opcode == Opcode::Ping) {
+            return make_ready_future(Message());
+        }
+        return m_handler(opcode, payload);
+    } catch (const Overloaded &) {
+        throw;
+    } catch (...) {
+        Promise<Message> failed;
+        failed.set_exception(std::current_exception());
+        return failed.get_future();
+    }
+}
+
+void FrameSession::respond(const Frame &request, const Future<Message> &response) {
+    respond(request.header.opcode, request.header.request_id, response);
+}
+
+void FrameSession::respond(Opcode opcode, uint64_t request_id, const Future<Message> &response) {
+    auto [flags, payload] = outcome(response);
+    m_output.push(opcode, FrameHeader::kResponse | flags, request_id, payload);
+}
+
+void FrameSession::flush() {
+    if (m_writing_active || m_output.empty() || m_closed) {
+        return;
+    }
+    m_writing_active = true;
+    m_writing.clear();
+    m_writing.swap(m_output);
+    boost::asio::async_write(m_socket, m_writing.buffers(),
+                             boost::asio::bind_executor(m_strand, [self = shared_from_this()](
+                                     const boost::system::error_code &ec, size_t bytes) {
+                                 if (Trace::enabled()) [[unlikely]] {
+                                     Trace::emit(Trace::Event::SocketWrite, nullptr, 0, bytes);
+                                 }
+                                 self->m_writing_active = false;
+                                 if (ec) {
+                                     self->close();
+                                     return;
+                                 }
+                                 self->m_writing.clear();
+                                 self->flush();
+                                 self->resume();
+                             }));
+}
+
+void FrameSession::close() {
+    if (m_closed) {
+        return;
+    }
+    m_closed = true;
+    boost::system::error_code ec;
+    m_socket.shutdown(tcp::socket::shutdown_both, ec);
+    m_socket.close(ec);
+}
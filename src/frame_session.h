@@ -0,0 +1,164 @@
+#ifndef FLOWDB_FRAME_SESSION_H
+#define FLOWDB_FRAME_SESSION_H
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "buffer_pool.h"
+#include "frame.h"
+#include "frame_queue.h"
+#include "future.h"
+#include "message.h"
+
+using boost::asio::ip::tcp;
+
+// Thrown by a handler that cannot take a request yet, such as one whose actor
+// has a full mailbox, before the request has had any effect. The session
+// stops reading and hands the request over again once ready() completes.
+class Overloaded : public std::runtime_error {
+public:
+    explicit Overloaded(Future<Void> ready) : std::runtime_error("Overloaded"), m_ready(std::move(ready)) {}
+
+    [[nodiscard]] const Future<Void> &ready() const {
+        return m_ready;
+    }
+
+private:
+    Future<Void> m_ready;
+};
+
+// Server end of a framed connection. The connection stays open for any number
+// of requests. Every read is parsed into as many frames as it holds, and the
+// handler is called for each of them in turn, with the payload still in the
+// pooled receive buffer. Responses that are ready at once are gathered into a
+// single write for the whole batch. Responses that complete later are written
+// as they arrive, so they can overtake earlier requests. Either way a response
+// message is written from where it was built, by a vectored write.
+//
+// Ping requests are answered by the session itself. Batch requests are
+// unpacked by the session, which calls the handler for each request they
+// carry, in order, and answers once all of them are served. A handler that
+// throws, or whose future fails, produces an error response carrying the
+// exception message, or a kWrongShard response carrying the shard map for
+// WrongShard. Create sessions with make_shared and call start().
+//
+// Every session has a fixed number of credits: requests whose responses are
+// not ready at once each hold one until they complete, and a batch holds one
+// for every request it carries. A session that runs out of credits, whose
+// client leaves too many response bytes unread, or whose handler throws
+// Overloaded, stops reading its socket; frames already read stay buffered
+// until it can go on. The client then sees its TCP window close, so saturated
+// actors slow the clients down instead of queueing their requests without
+// limit or failing them.
+class FrameSession : public std::enable_shared_from_this<FrameSession> {
+public:
+    // Serves one request. The payload is only valid during the call.
+    using Handler = std::function<Future<Message>(Opcode opcode, std::string_view payload)>;
+
+    struct Options {
+        // Requests, counting every one a batch carries, whose responses may
+        // be pending before the session stops reading (0 is unlimited)
+        size_t max_in_flight = 256;
+        // Requests a batch may carry; a larger one fails without being
+        // served (0 is unlimited)
+        size_t max_batch = 256;
+        // Response bytes waiting for the client before the session stops
+        // reading (0 is unlimited)
+        size_t max_unsent_bytes = 4 << 20;
+    };
+
+    FrameSession(tcp::socket socket, Handler handler);
+
+    FrameSession(tcp::socket socket, Handler handler, Options options);
+
+    FrameSession(const FrameSession &) = delete;
+
+    FrameSession &operator=(const FrameSession &) = delete;
+
+    void start();
+
+private:
+    // A request read from the socket, with the requests to hand to the
+    // handler: the frame itself, or the ones a batch carries
+    struct Request {
+        Opcode opcode;
+        uint64_t id;
+        std::vector<std::pair<Opcode, std::string_view>> parts;
+        // Responses of the parts handed over so far
+        std::vector<Future<Message>> responses;
+        // Credits taken, none until the whole request fits
+        size_t credits = 0;
+        // Keeps the parts valid while the request waits
+        BufferSlice payload;
+        // Set while the handler cannot take the next part
+        Future<Void> ready;
+    };
+
+    void read();
+
+    void on_read(const boost::system::error_code &ec, size_t bytes);
+
+    // Serves the buffered frames while credits last, then reads more unless
+    // the session is saturated or a request is stalled, in which case it
+    // pauses.
+    void serve_buffered();
+
+    // Splits a frame into the requests to hand to the handler.
+    //
+    // @throws std::invalid_argument if a batch is malformed, nested or too
+    // large.
+    void parse(const Frame &frame, Request &request) const;
+
+    // Takes the request's credits and hands its parts to the handler. False
+    // if it has to wait, for credits or for the handler; call again to go on.
+    bool dispatch(Request &request);
+
+    // Responds to a request whose parts have all been handed over, now or
+    // once they complete, and gives its credits back then.
+    void finish(Request &request);
+
+    // Whether the session is out of credits or its client is behind
+    [[nodiscard]] bool saturated() const;
+
+    // Continues a paused session once it is no longer saturated.
+    void resume();
+
+    // Serves one request; a handler that throws yields a failed future,
+    // unless it throws Overloaded.
+    Future<Message> serve(Opcode opcode, std::string_view payload);
+
+    // Appends the response for a completed future to the output buffer.
+    void respond(const Frame &request, const Future<Message> &response);
+
+    void respond(Opcode opcode, uint64_t request_id, const Future<Message> &response);
+
+    // Starts writing the output buffer unless a write is already in progress.
+    void flush();
+
+    void close();
+
+    tcp::socket m_socket;
+    boost::asio::strand<boost::asio::any_io_executor> m_strand;
+    Handler m_handler;
+    Options m_options;
+    FrameReader m_reader;
+    // Credits held by requests whose responses are pending, and whether
+    // reading stopped because of them, of unsent responses or of a stall
+    size_t m_in_flight = 0;
+    bool m_paused = false;
+    // The request that is waiting to be handed over, if any
+    std::unique_ptr<Request> m_stalled;
+    // Responses not yet handed to the socket
+    FrameQueue m_output;
+    // Responses in the write in progress
+    FrameQueue m_writing;
+    bool m_writing_active = false;
+    bool m_closed = false;
+};
+
+#endif //FLOWDB_FRAME_SESSION_H
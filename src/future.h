@@ -1,102 +1,414 @@
 #ifndef FLOWDB_FUTURE_H
 #define FLOWDB_FUTURE_H
 
-#include <mutex>
-#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <exception>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "metrics.h"
+#include "recycling_allocator.h"
+#include "trace.h"
 
 template<typename T>
 class Promise;
 
+template<typename T>
+class Future;
+
+// Value type of futures that only signal completion, like Flow's Void.
+struct Void {
+};
+
+namespace detail {
+
+template<typename T>
+class SharedState;
+
+// A continuation waiting on a SharedState. Fired exactly once, after which it
+// deletes itself.
+template<typename T>
+class Callback : public Recycled {
+public:
+    virtual ~Callback() = default;
+
+    virtual void fire(SharedState<T> &state) = 0;
+
+    Callback *next = nullptr;
+};
+
+template<typename T, typename F>
+class CallbackImpl : public Callback<T> {
+public:
+    template<typename G>
+    explicit CallbackImpl(G &&f) : m_f(std::forward<G>(f)) {}
+
+    void fire(SharedState<T> &state) override {
+        m_f(state);
+        delete this;
+    }
+
+private:
+    F m_f;
+};
+
+// The single reference-counted state shared by a Promise and all of its
+// Futures. Continuations are kept on a lock-free stack that is swapped for a
+// sentinel when the value arrives; blocking waiters use the ready flag itself.
+// States and callbacks come from RecyclingAllocator.
+template<typename T>
+class SharedState : public Recycled {
+public:
+    SharedState() = default;
+
+    SharedState(const SharedState &) = delete;
+
+    SharedState &operator=(const SharedState &) = delete;
+
+    ~SharedState() {
+        Callback<T> *head = m_callbacks.load(std::memory_order_relaxed);
+        while (head != nullptr && head != fired()) {
+            Callback<T> *next = head->next;
+            delete head;
+            head = next;
+        }
+    }
+
+    void add_ref() {
+        m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() {
+        if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    [[nodiscard]] bool is_ready() const {
+        return (m_ready.load(std::memory_order_acquire) & kReady) != 0;
+    }
+
+    // Claims the right to fulfil the state; fails if it was already fulfilled.
+    bool claim() {
+        return !m_claimed.exchange(true, std::memory_order_acq_rel);
+    }
+
+    template<typename... Args>
+    void set_value(Args &&... args) {
+        m_value.emplace(std::forward<Args>(args)...);
+        publish();
+    }
+
+    void set_exception(std::exception_ptr error) {
+        m_error = std::move(error);
+        publish();
+    }
+
+    [[nodiscard]] bool has_error() const {
+        return m_error != nullptr;
+    }
+
+    [[nodiscard]] const std::exception_ptr &error() const {
+        return m_error;
+    }
+
+    // Returns the value or rethrows the stored exception. Requires is_ready().
+    const T &value() const {
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+        return *m_value;
+    }
+
+    // Runs the callback now if the state is ready, otherwise when it becomes ready.
+    void add_callback(Callback<T> *callback) {
+        Callback<T> *head = m_callbacks.load(std::memory_order_acquire);
+        do {
+            if (head == fired()) {
+                callback->fire(*this);
+                return;
+            }
+            callback->next = head;
+        } while (!m_callbacks.compare_exchange_weak(head, callback, std::memory_order_acq_rel,
+                                                    std::memory_order_acquire));
+    }
+
+    // Blocks the calling thread until the state is ready.
+    void wait() {
+        uint32_t state = m_ready.load(std::memory_order_acquire);
+        if (state & kReady) {
+            return;
+        }
+        uint64_t started = Metrics::now();
+        state = m_ready.fetch_or(kWaiting, std::memory_order_acq_rel) | kWaiting;
+        while (!(state & kReady)) {
+            m_ready.wait(state, std::memory_order_acquire);
+            state = m_ready.load(std::memory_order_acquire);
+        }
+        Metrics::add(Metrics::Counter::FutureBlockingWaits);
+        Metrics::record(Metrics::Latency::FutureWait, Metrics::now() - started);
+        if (Trace::enabled()) [[unlikely]] {
+            Trace::emit(Trace::Event::Wake, typeid(T).name(), Trace::current(), reinterpret_cast<uintptr_t>(this));
+        }
+    }
+
+private:
+    static constexpr uint32_t kReady = 1;
+    static constexpr uint32_t kWaiting = 2;
+
+    // Sentinel stored in m_callbacks once the callbacks have been fired
+    static Callback<T> *fired() {
+        return reinterpret_cast<Callback<T> *>(uintptr_t{1});
+    }
+
+    void publish() {
+        // Before the waiters can wake and release the state
+        if (Trace::enabled()) [[unlikely]] {
+            Trace::emit(Trace::Event::Fulfil, typeid(T).name(), Trace::current(), reinterpret_cast<uintptr_t>(this));
+        }
+
+        // Only wake blocked threads if one announced itself
+        if (m_ready.exchange(kReady, std::memory_order_acq_rel) & kWaiting) {
+            m_ready.notify_all();
+        }
+
+        // Fire continuations in the order they were attached
+        Callback<T> *head = m_callbacks.exchange(fired(), std::memory_order_acq_rel);
+        Callback<T> *ordered = nullptr;
+        uint64_t callbacks = 0;
+        while (head != nullptr) {
+            Callback<T> *next = head->next;
+            head->next = ordered;
+            ordered = head;
+            head = next;
+            callbacks++;
+        }
+        Metrics::add(Metrics::Counter::FuturesFulfilled);
+        Metrics::add(Metrics::Counter::FutureCallbacksDeferred, callbacks);
+        while (ordered != nullptr) {
+            Callback<T> *next = ordered->next;
+            ordered->fire(*this);
+            ordered = next;
+        }
+    }
+
+    std::atomic<uint32_t> m_refs{1};
+    std::atomic<uint32_t> m_ready{0};
+    std::atomic<bool> m_claimed{false};
+    std::atomic<Callback<T> *> m_callbacks{nullptr};
+    std::optional<T> m_value;
+    std::exception_ptr m_error;
+};
+
+template<typename T, typename F>
+void attach(SharedState<T> &state, F &&f) {
+    state.add_callback(new CallbackImpl<T, std::decay_t<F>>(std::forward<F>(f)));
+}
+
+template<typename T>
+struct is_future : std::false_type {
+};
+
+template<typename T>
+struct is_future<Future<T>> : std::true_type {
+};
+
+// The future type produced by a continuation returning R: Future<U> is
+// flattened, void becomes Future<Void>.
+template<typename R>
+struct continuation_future {
+    using type = Future<R>;
+};
+
+template<>
+struct continuation_future<void> {
+    using type = Future<Void>;
+};
+
+template<typename T>
+struct continuation_future<Future<T>> {
+    using type = Future<T>;
+};
+
+template<typename T, typename F>
+using continuation_future_t = typename continuation_future<std::invoke_result_t<F &, const T &>>::type;
+
+} // namespace detail
+
 template<typename T>
 class Future {
 public:
-    Future() : m_promise(nullptr) {}
+    using value_type = T;
 
-    Future(const Future &) = delete;
+    Future() : m_state(nullptr) {}
 
-    // Move constructor
-    Future(Future &&other) noexcept: m_promise(other.m_promise) {
-        other.m_promise = nullptr;
+    Future(const Future &other) : m_state(other.m_state) {
+        if (m_state) {
+            m_state->add_ref();
+        }
     }
 
+    // Move constructor
+    Future(Future &&other) noexcept: m_state(std::exchange(other.m_state, nullptr)) {}
+
     ~Future() {
-        if (m_promise) {
-            m_promise->remove_future(this);
+        if (m_state) {
+            m_state->release();
         }
     }
 
-    Future &operator=(const Future &) = delete;
+    Future &operator=(const Future &other) {
+        Future(other).swap(*this);
+        return *this;
+    }
 
     // Move assignment operator
     Future &operator=(Future &&other) noexcept {
-        if (this != &other) {
-            if (m_promise) {
-                m_promise->remove_future(this);
-            }
-            m_promise = other.m_promise;
-            other.m_promise = nullptr;
-        }
+        Future(std::move(other)).swap(*this);
         return *this;
     }
 
+    void swap(Future &other) noexcept {
+        std::swap(m_state, other.m_state);
+    }
+
     // Check if the future is valid
     [[nodiscard]] bool valid() const {
-        return m_promise != nullptr;
+        return m_state != nullptr;
+    }
+
+    // Check if the value or an exception has been set
+    [[nodiscard]] bool is_ready() const {
+        return m_state && m_state->is_ready();
+    }
+
+    // Get the value of the future, blocking the calling thread until it is set.
+    // Returns a copy, since copies of the future share the value; value()
+    // does not. Prefer then() or co_await from actor code.
+    T get() const {
+        return value();
     }
 
-    // Get the value of the future
-    T get() {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_cv.wait(lock, [this] { return m_promise == nullptr || m_promise->has_value(); });
-        if (m_promise) {
-            return std::move(m_promise->get_value());
-        } else {
+    // Like get(), but returns a reference to the shared value, valid for as
+    // long as a copy of the future is.
+    const T &value() const {
+        if (!m_state) {
             throw std::future_error(std::future_errc::no_state);
         }
+        m_state->wait();
+        return m_state->value();
     }
 
-private:
-    friend class Promise<T>;
+    // Calls f() once the future is ready: inline on the thread that fulfils
+    // the promise, or immediately if it is ready already.
+    template<typename F>
+    void on_ready(F &&f) const {
+        if (!m_state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        detail::attach(*m_state, [f = std::forward<F>(f)](detail::SharedState<T> &) mutable { f(); });
+    }
 
-    // Set the promise associated with this future
-    void set_promise(Promise<T> *promise) {
-        m_promise = promise;
+    // Chains a continuation that receives the value and runs inline when the
+    // value arrives. Exceptions skip the continuation and propagate to the
+    // returned future; a continuation returning a Future is flattened.
+    template<typename F>
+    detail::continuation_future_t<T, F> then(F &&f) const {
+        using Result = detail::continuation_future_t<T, F>;
+        if (!m_state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        Promise<typename Result::value_type> promise;
+        Result result = promise.get_future();
+        detail::attach(*m_state, [promise = std::move(promise), f = std::forward<F>(f)](
+                detail::SharedState<T> &state) mutable {
+            continue_with(state, f, promise);
+        });
+        return result;
     }
 
-    // Reset the promise associated with this future
-    void notify() {
-        m_cv.notify_all();
+    // Like then(), but the continuation is submitted to the executor (for
+    // example the runtime's ThreadPool) instead of running inline.
+    template<typename Executor, typename F>
+    detail::continuation_future_t<T, F> then(Executor &executor, F &&f) const {
+        using Result = detail::continuation_future_t<T, F>;
+        if (!m_state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        Promise<typename Result::value_type> promise;
+        Result result = promise.get_future();
+        Future self = *this;
+        on_ready([&executor, self = std::move(self), promise = std::move(promise), f = std::forward<F>(f)]() mutable {
+            executor.submit([self = std::move(self), promise = std::move(promise), f = std::move(f)]() mutable {
+                continue_with(*self.m_state, f, promise);
+            });
+        });
+        return result;
     }
 
-    // Pointer to the promise associated with this future
-    Promise<T> *m_promise;
+    // Fulfils the promise with this future's value or exception once ready.
+    void forward_to(Promise<T> promise) const {
+        detail::attach(*m_state, [promise = std::move(promise)](detail::SharedState<T> &state) mutable {
+            if (state.has_error()) {
+                promise.set_exception(state.error());
+            } else {
+                promise.set_value(state.value());
+            }
+        });
+    }
 
-    // Mutex to protect access to the future
-    std::mutex m_mutex;
+private:
+    friend class Promise<T>;
 
-    // Condition variable to wait for the value to be set
-    std::condition_variable m_cv;
+    explicit Future(detail::SharedState<T> *state) : m_state(state) {
+        m_state->add_ref();
+    }
+
+    template<typename F, typename U>
+    static void continue_with(detail::SharedState<T> &state, F &f, Promise<U> &promise) {
+        if (state.has_error()) {
+            promise.set_exception(state.error());
+            return;
+        }
+        using R = std::invoke_result_t<F &, const T &>;
+        try {
+            if constexpr (detail::is_future<R>::value) {
+                f(state.value()).forward_to(std::move(promise));
+            } else if constexpr (std::is_void_v<R>) {
+                f(state.value());
+                promise.set_value(Void{});
+            } else {
+                promise.set_value(f(state.value()));
+            }
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    // The state shared with the promise; holds one reference
+    detail::SharedState<T> *m_state;
 };
 
 template<typename T>
 class Promise {
 public:
-    Promise() : m_value_set(false) {}
+    Promise() : m_state(new detail::SharedState<T>()) {}
 
     Promise(const Promise &) = delete;
 
     // Move constructor
-    Promise(Promise &&other) noexcept: m_futures(std::move(other.m_futures)), m_value(std::move(other.m_value)),
-                                       m_value_set(other.m_value_set.load()) {
-        other.m_value_set = false;
-    }
+    Promise(Promise &&other) noexcept: m_state(std::exchange(other.m_state, nullptr)) {}
 
+    // Breaks the promise if it was never fulfilled, so waiters see
+    // std::future_errc::broken_promise instead of hanging.
     ~Promise() {
-        if (!m_value_set) {
-            std::unique_lock<std::mutex> lock(m_mutex);
-            m_futures.clear();
-        }
+        abandon();
     }
 
     Promise &operator=(const Promise &) = delete;
@@ -104,69 +416,218 @@ public:
     // Move assignment operator
     Promise &operator=(Promise &&other) noexcept {
         if (this != &other) {
-            if (!m_value_set) {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                m_futures.clear();
-            }
-            m_futures = std::move(other.m_futures);
-            m_value = std::move(other.m_value);
-            m_value_set = other.m_value_set.load();
-            other.m_value_set = false;
+            abandon();
+            m_state = std::exchange(other.m_state, nullptr);
         }
         return *this;
     }
 
-    // Get a future object associated with this promise
+    // Get a future object associated with this promise. May be called more
+    // than once; every future observes the same value.
     Future<T> get_future() {
-        Future<T> future;
-        std::unique_lock<std::mutex> lock(m_mutex);
-        future.set_promise(this);
-        if (!m_value_set) {
-            m_futures.push_back(&future);
-        }
-        return future;
-    }
-
-    // Set the value of the promise
-    void set_value(T value) {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        if (!m_value_set) {
-            m_value = std::move(value);
-            m_value_set = true;
-            for (auto future: m_futures) {
-                future->notify();
-            }
-            m_futures.clear();
-        } else {
-            throw std::future_error(std::future_errc::promise_already_satisfied);
+        if (!m_state) {
+            throw std::future_error(std::future_errc::no_state);
         }
+        return Future<T>(m_state);
     }
 
-    bool has_value() const {
-        return m_value_set;
+    // Set the value of the promise and run the attached continuations
+    template<typename... Args>
+    void set_value(Args &&... args) {
+        claim().set_value(std::forward<Args>(args)...);
     }
 
-    T &get_value() {
-        return m_value;
+    // Fail the promise; continuations and get() observe the exception
+    void set_exception(std::exception_ptr error) {
+        claim().set_exception(std::move(error));
     }
 
-    void remove_future(Future<T> *future) {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_futures.erase(std::remove(m_futures.begin(), m_futures.end(), future), m_futures.end());
+    bool has_value() const {
+        return m_state && m_state->is_ready();
     }
 
 private:
-    // List of associated futures
-    std::vector<Future<T> *> m_futures;
-
-    // The value of the promise
-    T m_value;
+    detail::SharedState<T> &claim() {
+        if (!m_state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        if (!m_state->claim()) {
+            throw std::future_error(std::future_errc::promise_already_satisfied);
+        }
+        return *m_state;
+    }
 
-    // Flag indicating whether the value has been set
-    std::atomic<bool> m_value_set;
+    void abandon() {
+        if (m_state) {
+            if (m_state->claim()) {
+                m_state->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            }
+            m_state->release();
+            m_state = nullptr;
+        }
+    }
 
-    // Mutex to protect access to the promise
-    std::mutex m_mutex;
+    // The state shared with the futures; holds one reference
+    detail::SharedState<T> *m_state;
 };
 
+// Returns a future that is already fulfilled with the value.
+template<typename T>
+Future<std::decay_t<T>> make_ready_future(T &&value) {
+    Promise<std::decay_t<T>> promise;
+    auto future = promise.get_future();
+    promise.set_value(std::forward<T>(value));
+    return future;
+}
+
+// Returns a future fulfilled with every value, in input order, once all
+// futures are ready. The first exception fails the result immediately.
+template<typename T>
+Future<std::vector<T>> when_all(std::vector<Future<T>> futures) {
+    struct Join {
+        explicit Join(size_t count) : remaining(count), values(count) {}
+
+        Promise<std::vector<T>> promise;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed{false};
+        std::vector<std::optional<T>> values;
+    };
+
+    if (futures.empty()) {
+        return make_ready_future(std::vector<T>());
+    }
+    auto join = std::make_shared<Join>(futures.size());
+    auto result = join->promise.get_future();
+    for (size_t i = 0; i < futures.size(); i++) {
+        futures[i].on_ready([join, i, future = futures[i]] {
+            try {
+                join->values[i].emplace(future.value());
+            } catch (...) {
+                if (!join->failed.exchange(true)) {
+                    join->promise.set_exception(std::current_exception());
+                }
+            }
+            if (join->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1 && !join->failed.load()) {
+                std::vector<T> values;
+                values.reserve(join->values.size());
+                for (auto &value: join->values) {
+                    values.push_back(std::move(*value));
+                }
+                join->promise.set_value(std::move(values));
+            }
+        });
+    }
+    return result;
+}
+
+// Returns a future fulfilled with the inputs themselves, in input order, once
+// every one of them is ready, whether it succeeded or failed. It never fails.
+template<typename T>
+Future<std::vector<Future<T>>> when_settled(std::vector<Future<T>> futures) {
+    struct Join {
+        explicit Join(const std::vector<Future<T>> &futures) : remaining(futures.size()), futures(futures) {}
+
+        Promise<std::vector<Future<T>>> promise;
+        std::atomic<size_t> remaining;
+        std::vector<Future<T>> futures;
+    };
+
+    if (futures.empty()) {
+        return make_ready_future(std::vector<Future<T>>());
+    }
+    auto join = std::make_shared<Join>(futures);
+    auto result = join->promise.get_future();
+    for (auto &future: futures) {
+        future.on_ready([join] {
+            if (join->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                join->promise.set_value(std::move(join->futures));
+            }
+        });
+    }
+    return result;
+}
+
+// Returns a future fulfilled with the values of the first quorum inputs to
+// succeed, in the order they completed. It fails as soon as enough inputs have
+// failed that the quorum can no longer be reached, with the exception of the
+// input that made it unreachable. Inputs that complete afterwards are ignored.
+template<typename T>
+Future<std::vector<T>> when_quorum(std::vector<Future<T>> futures, size_t quorum) {
+    struct Vote {
+        Vote(size_t quorum, size_t tolerated) : quorum(quorum), tolerated(tolerated) {}
+
+        Promise<std::vector<T>> promise;
+        std::mutex mutex;
+        size_t quorum;
+        // Failures that still leave the quorum reachable
+        size_t tolerated;
+        size_t failures = 0;
+        bool decided = false;
+        std::vector<T> values;
+    };
+
+    if (quorum > futures.size()) {
+        throw std::invalid_argument("Quorum exceeds the number of futures");
+    }
+    if (quorum == 0) {
+        return make_ready_future(std::vector<T>());
+    }
+    auto vote = std::make_shared<Vote>(quorum, futures.size() - quorum);
+    auto result = vote->promise.get_future();
+    for (auto &future: futures) {
+        future.on_ready([vote, future] {
+            std::unique_lock<std::mutex> lock(vote->mutex);
+            if (vote->decided) {
+                return;
+            }
+            try {
+                vote->values.push_back(future.value());
+            } catch (...) {
+                if (vote->failures++ == vote->tolerated) {
+                    vote->decided = true;
+                    lock.unlock();
+                    vote->promise.set_exception(std::current_exception());
+                }
+                return;
+            }
+            if (vote->values.size() == vote->quorum) {
+                vote->decided = true;
+                std::vector<T> values = std::move(vote->values);
+                lock.unlock();
+                vote->promise.set_value(std::move(values));
+            }
+        });
+    }
+    return result;
+}
+
+// Returns a future fulfilled by whichever input becomes ready first, as the
+// index of that input and its value (or its exception).
+template<typename T>
+Future<std::pair<size_t, T>> when_any(std::vector<Future<T>> futures) {
+    struct Race {
+        Promise<std::pair<size_t, T>> promise;
+        std::atomic<bool> decided{false};
+    };
+
+    if (futures.empty()) {
+        throw std::invalid_argument("when_any requires at least one future");
+    }
+    auto race = std::make_shared<Race>();
+    auto result = race->promise.get_future();
+    for (size_t i = 0; i < futures.size(); i++) {
+        futures[i].on_ready([race, i, future = futures[i]] {
+            if (race->decided.exchange(true, std::memory_order_acq_rel)) {
+                return;
+            }
+            try {
+                race->promise.set_value(i, future.value());
+            } catch (...) {
+                race->promise.set_exception(std::current_exception());
+            }
+        });
+    }
+    return result;
+}
+
 #endif //FLOWDB_FUTURE_H
@@ -0,0 +1,139 @@
+#include "health_checker.h"
+
+#include <algorithm>
+#include <string_view>
+
+/**
+ * @brief Constructor for HealthChecker class.
+ *
+ * @param io_context The io_context the probes and timers run on.
+ * @param pool The pool whose endpoints are checked and marked down or up.
+ * @param options Probe interval, timeout, backoff and ping payload.
+ */
+HealthChecker::HealthChecker(boost::asio::io_context &io_context, ConnectionPool &pool, Options options)
+        : m_io_context(io_context), m_pool(pool), m_options(std::move(options)) {
+    std::random_device seed;
+    for (size_t i = 0; i < m_pool.endpoints().size(); i++) {
+        m_probes.push_back(std::make_unique<Probe>(m_io_context, i, seed()));
+    }
+}
+
+/**
+ * @brief Schedules the first probe of every endpoint at a random point within
+ * one interval, so the heartbeats of different endpoints do not line up.
+ */
+void HealthChecker::start() {
+    m_stopped.store(false, std::memory_order_relaxed);
+    for (auto &probe: m_probes) {
+        std::uniform_int_distribution<int64_t> offset(0, std::chrono::nanoseconds(m_options.interval).count());
+        schedule(*probe, std::chrono::nanoseconds(offset(probe->random)));
+    }
+}
+
+void HealthChecker::stop() {
+    m_stopped.store(true, std::memory_order_relaxed);
+    for (auto &probe: m_probes) {
+        boost::asio::post(probe->strand, [probe = probe.get()] {
+            probe->timer.cancel();
+            probe->deadline.cancel();
+            boost::system::error_code ec;
+            probe->socket.close(ec);
+        });
+    }
+}
+
+void HealthChecker::schedule(Probe &probe, std::chrono::nanoseconds delay) {
+    probe.timer.expires_after(delay);
+    probe.timer.async_wait([this, &probe](const boost::system::error_code &ec) {
+        if (!ec && !m_stopped.load(std::memory_order_relaxed)) {
+            this->probe(probe);
+        }
+    });
+}
+
+/**
+ * @brief Connects, sends the ping and waits for a reply, all under one
+ * deadline. Every probe uses a fresh connection, so it also exercises the
+ * server's accept path and works with servers that close after one reply.
+ */
+void HealthChecker::probe(Probe &probe) {
+    uint64_t generation = ++probe.generation;
+    probe.deadline.expires_after(m_options.timeout);
+    probe.deadline.async_wait([&probe, generation](const boost::system::error_code &ec) {
+        if (!ec && probe.generation == generation) {
+            // Closing the socket aborts whichever step is still pending
+            boost::system::error_code close_ec;
+            probe.socket.close(close_ec);
+        }
+    });
+    probe.socket.async_connect(m_pool.endpoints()[probe.index], [this, &probe](const boost::system::error_code &ec) {
+        if (ec) {
+            on_reply(probe, ec, 0);
+            return;
+        }
+        boost::asio::async_write(probe.socket, boost::asio::buffer(m_options.ping),
+                                 [this, &probe](const boost::system::error_code &ec, size_t) {
+                                     if (ec) {
+                                         on_reply(probe, ec, 0);
+                                         return;
+                                     }
+                                     probe.socket.async_read_some(
+                                             boost::asio::buffer(probe.buffer),
+                                             [this, &probe](const boost::system::error_code &ec, size_t bytes) {
+                                                 on_reply(probe, ec, bytes);
+                                             });
+                                 });
+    });
+}
+
+void HealthChecker::on_reply(Probe &probe, const boost::system::error_code &ec, size_t bytes) {
+    probe.generation++;
+    probe.deadline.cancel();
+    boost::system::error_code close_ec;
+    probe.socket.close(close_ec);
+    if (m_stopped.load(std::memory_order_relaxed)) {
+        return;
+    }
+    const std::string &expected = m_options.expected_reply;
+    bool healthy = !ec && bytes > 0 &&
+                   (expected.empty() || std::string_view(probe.buffer.data(), bytes).starts_with(expected));
+    if (healthy) {
+        succeed(probe);
+    } else {
+        fail(probe);
+    }
+}
+
+void HealthChecker::succeed(Probe &probe) {
+    probe.failures = 0;
+    if (probe.state.exchange(State::Healthy, std::memory_order_relaxed) == State::Down) {
+        m_pool.mark_up(probe.index);
+    }
+    schedule(probe, m_options.interval);
+}
+
+void HealthChecker::fail(Probe &probe) {
+    probe.failures++;
+    if (probe.failures >= m_options.failures_to_mark_down) {
+        if (probe.state.exchange(State::Down, std::memory_order_relaxed) != State::Down) {
+            m_pool.mark_down(probe.index);
+        }
+    } else {
+        probe.state.store(State::Suspect, std::memory_order_relaxed);
+    }
+    schedule(probe, backoff(probe));
+}
+
+/**
+ * @brief Exponential backoff with "equal jitter": half of the capped delay is
+ * fixed and the other half random, so endpoints that went down together do
+ * not retry in lockstep.
+ */
+std::chrono::nanoseconds HealthChecker::backoff(Probe &probe) {
+    uint32_t doublings = std::min<uint32_t>(probe.failures - 1, 20);
+    auto capped = std::min<std::chrono::nanoseconds>(m_options.base_backoff * (int64_t{1} << doublings),
+                                                     m_options.max_backoff);
+    int64_t half = capped.count() / 2;
+    std::uniform_int_distribution<int64_t> jitter(0, half);
+    return std::chrono::nanoseconds(capped.count() - half + jitter(probe.random));
+}
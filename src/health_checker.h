@@ -0,0 +1,116 @@
+#ifndef FLOWDB_HEALTH_CHECKER_H
+#define FLOWDB_HEALTH_CHECKER_H
+
+#include <array>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "connection_pool.h"
+#include "frame.h"
+
+using boost::asio::ip::tcp;
+
+// Actively checks the endpoints of a ConnectionPool. Every endpoint has its own
+// heartbeat timer and probe: a fresh connection that sends a ping and must get
+// a reply within the timeout. Probes run entirely on the io_context, never
+// touch the pool's sockets and never take the pool lock on the request path;
+// the only thing a checkout sees is the endpoint's down flag in the selector.
+//
+// Each endpoint runs a small state machine. While healthy it is probed every
+// interval. A failed probe is retried after a jittered exponential backoff,
+// and after failures_to_mark_down failures in a row the endpoint is marked
+// down in the pool. The first successful probe marks it up again and resets
+// the backoff.
+class HealthChecker {
+public:
+    struct Options {
+        // Time between probes of a healthy endpoint
+        std::chrono::milliseconds interval{5'000};
+        // Budget for connecting, sending the ping and reading the reply
+        std::chrono::milliseconds timeout{1'000};
+        // Retry delay after the first failure, doubling up to max_backoff
+        std::chrono::milliseconds base_backoff{100};
+        std::chrono::milliseconds max_backoff{30'000};
+        uint32_t failures_to_mark_down = 2;
+        // Sent on every probe; any non-empty reply counts as healthy unless
+        // expected_reply is set, in which case the reply must start with it
+        std::string ping = [] {
+            std::string frame;
+            append_frame(frame, Opcode::Ping, 0, 0, {});
+            return frame;
+        }();
+        std::string expected_reply;
+    };
+
+    enum class State {
+        Healthy,
+        // Failed recently but still in rotation
+        Suspect,
+        Down,
+    };
+
+    HealthChecker(boost::asio::io_context &io_context, ConnectionPool &pool, Options options);
+
+    HealthChecker(boost::asio::io_context &io_context, ConnectionPool &pool)
+            : HealthChecker(io_context, pool, Options()) {}
+
+    // Starts probing every endpoint.
+    void start();
+
+    // Cancels timers and outstanding probes. Handlers that are already queued
+    // still run, so the checker must outlive them (or the io_context must be
+    // stopped) before it is destroyed.
+    void stop();
+
+    [[nodiscard]] State state(size_t endpoint_index) const {
+        return m_probes[endpoint_index]->state.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Probe {
+        Probe(boost::asio::io_context &io_context, size_t index, uint64_t seed)
+                : index(index), strand(boost::asio::make_strand(io_context)), socket(strand), timer(strand),
+                  deadline(strand), random(seed) {}
+
+        size_t index;
+        // Serialises the probe's handlers when the io_context runs on several threads
+        boost::asio::strand<boost::asio::io_context::executor_type> strand;
+        tcp::socket socket;
+        // Schedules the next probe
+        boost::asio::steady_timer timer;
+        // Bounds the probe in flight
+        boost::asio::steady_timer deadline;
+        std::minstd_rand random;
+        uint32_t failures = 0;
+        // Bumped for every probe so a late deadline cannot cancel the next one
+        uint64_t generation = 0;
+        std::atomic<State> state{State::Healthy};
+        std::array<char, 256> buffer{};
+    };
+
+    void schedule(Probe &probe, std::chrono::nanoseconds delay);
+
+    void probe(Probe &probe);
+
+    void on_reply(Probe &probe, const boost::system::error_code &ec, size_t bytes);
+
+    void succeed(Probe &probe);
+
+    void fail(Probe &probe);
+
+    // Jittered delay before the next probe of an endpoint that is failing
+    std::chrono::nanoseconds backoff(Probe &probe);
+
+    boost::asio::io_context &m_io_context;
+    ConnectionPool &m_pool;
+    Options m_options;
+    std::vector<std::unique_ptr<Probe>> m_probes;
+    std::atomic<bool> m_stopped{false};
+};
+
+#endif //FLOWDB_HEALTH_CHECKER_H
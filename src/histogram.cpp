@@ -0,0 +1,79 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+uint64_t Histogram::highest_of(size_t index) {
+    if (index < kSubBuckets) {
+        return index;
+    }
+    size_t shift = index / kHalf - 1;
+    uint64_t sub_bucket = index - shift * kHalf;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value, uint64_t count) {
+    if (count == 0) {
+        return;
+    }
+    m_counts[bucket_of(value)] += count;
+    m_count += count;
+    m_sum += value * count;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+}
+
+void Histogram::record_bucket(size_t index, uint64_t count) {
+    if (count == 0) {
+        return;
+    }
+    uint64_t value = highest_of(index);
+    m_counts[index] += count;
+    m_count += count;
+    m_sum += value * count;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+}
+
+void Histogram::merge(const Histogram &other) {
+    for (size_t i = 0; i < kBuckets; i++) {
+        m_counts[i] += other.m_counts[i];
+    }
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+}
+
+void Histogram::clear() {
+    m_counts.fill(0);
+    m_count = 0;
+    m_min = UINT64_MAX;
+    m_max = 0;
+    m_sum = 0;
+}
+
+double Histogram::mean() const {
+    return m_count == 0 ? 0.0 : static_cast<double>(m_sum) / static_cast<double>(m_count);
+}
+
+/**
+ * @brief Walks the buckets until the running count reaches the rank of the
+ * percentile, rounding the rank up so that percentile(100) is the maximum.
+ */
+uint64_t Histogram::percentile(double percent) const {
+    if (m_count == 0) {
+        return 0;
+    }
+    percent = std::clamp(percent, 0.0, 100.0);
+    auto rank = static_cast<uint64_t>(std::ceil(percent / 100.0 * static_cast<double>(m_count)));
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        seen += m_counts[i];
+        if (seen >= rank) {
+            return std::min(highest_of(i), m_max);
+        }
+    }
+    return m_max;
+}
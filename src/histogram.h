@@ -0,0 +1,88 @@
+#ifndef FLOWDB_HISTOGRAM_H
+#define FLOWDB_HISTOGRAM_H
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// Histogram of non-negative integer values, such as latencies in nanoseconds,
+// with the bucket layout of an HdrHistogram: values below 2^kPrecisionBits are
+// counted exactly, and every larger power-of-two range is split into
+// 2^(kPrecisionBits - 1) equal buckets. Any value is thus reported within
+// 1/2^(kPrecisionBits - 1) (under 1%) of what was recorded, over the whole
+// uint64_t range, in a fixed array of counters. Recording is a few
+// instructions and never allocates.
+//
+// Not synchronised: give each thread its own histogram and merge them.
+class Histogram {
+public:
+    static constexpr unsigned kPrecisionBits = 8;
+    static constexpr size_t kSubBuckets = size_t{1} << kPrecisionBits;
+    static constexpr size_t kHalf = kSubBuckets / 2;
+    // One range of kSubBuckets exact values, then kHalf buckets for each of
+    // the remaining powers of two
+    static constexpr size_t kBuckets = kSubBuckets + (64 - kPrecisionBits) * kHalf;
+
+    // Index of the bucket that value is counted in, for counts kept outside a
+    // Histogram and added with record_bucket(). A value of bit width
+    // w >= kPrecisionBits + 1 keeps its top kPrecisionBits bits, which fall in
+    // [kHalf, kSubBuckets), and its range w - kPrecisionBits selects a block of
+    // kHalf buckets after the exact ones.
+    static size_t bucket_of(uint64_t value) {
+        if (value < kSubBuckets) {
+            return static_cast<size_t>(value);
+        }
+        auto shift = static_cast<unsigned>(std::bit_width(value)) - kPrecisionBits;
+        return shift * kHalf + static_cast<size_t>(value >> shift);
+    }
+
+    void record(uint64_t value) {
+        record(value, 1);
+    }
+
+    // Records count occurrences of value.
+    void record(uint64_t value, uint64_t count);
+
+    // Records count occurrences of the highest value of the bucket at index,
+    // so a histogram rebuilt from bucket counts alone reports min, max and
+    // mean to the same precision as its percentiles.
+    void record_bucket(size_t index, uint64_t count);
+
+    // Adds the counts of other.
+    void merge(const Histogram &other);
+
+    void clear();
+
+    [[nodiscard]] uint64_t count() const {
+        return m_count;
+    }
+
+    // Smallest and largest values recorded, exactly; 0 if empty
+    [[nodiscard]] uint64_t min() const {
+        return m_count == 0 ? 0 : m_min;
+    }
+
+    [[nodiscard]] uint64_t max() const {
+        return m_max;
+    }
+
+    [[nodiscard]] double mean() const;
+
+    // The value that percentile percent of the recorded values are at or
+    // below, as the highest value of its bucket, capped at max(); 0 if empty.
+    [[nodiscard]] uint64_t percentile(double percent) const;
+
+private:
+    // Highest value that falls into the bucket at index
+    static uint64_t highest_of(size_t index);
+
+    std::array<uint64_t, kBuckets> m_counts{};
+    uint64_t m_count = 0;
+    uint64_t m_min = UINT64_MAX;
+    uint64_t m_max = 0;
+    // Sum of the values, for the mean; wraps only after ~584 years of nanoseconds
+    uint64_t m_sum = 0;
+};
+
+#endif //FLOWDB_HISTOGRAM_H
@@ -0,0 +1,124 @@
+#include "local_shards.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+/**
+ * @brief Constructor for LocalShards class.
+ *
+ * @param map The initial shard map, typically the same on every server.
+ * @param local The endpoints this server listens on.
+ * @param options When a shard is busy enough to be split.
+ */
+LocalShards::LocalShards(ShardMap map, std::vector<tcp::endpoint> local, Options options)
+        : m_local(std::move(local)), m_options(options),
+          m_map(std::make_shared<const ShardMap>(std::move(map))),
+          m_window_start(std::chrono::steady_clock::now()) {
+    if (m_options.sample_interval == 0) {
+        throw std::invalid_argument("Sample interval must be at least 1");
+    }
+}
+
+void LocalShards::admit(std::string_view key) {
+    auto map = this->map();
+    if (!serves(*map, map->locate(key))) {
+        throw wrong_shard(*map);
+    }
+    record(key);
+}
+
+void LocalShards::admit_range(std::string_view begin, std::string_view end) {
+    auto map = this->map();
+    for (size_t index: map->overlapping(begin, end)) {
+        if (!serves(*map, index)) {
+            throw wrong_shard(*map);
+        }
+    }
+    record(begin);
+}
+
+std::shared_ptr<const ShardMap> LocalShards::map() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_map;
+}
+
+bool LocalShards::install(ShardMap map) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (map.version() <= m_map->version()) {
+        return false;
+    }
+    m_map = std::make_shared<const ShardMap>(std::move(map));
+    // Samples were counted against the old shards
+    m_load.clear();
+    return true;
+}
+
+std::vector<std::string> LocalShards::split_keys() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return std::exchange(m_split_keys, {});
+}
+
+bool LocalShards::serves(const ShardMap &map, size_t index) const {
+    const auto &team = map[index].team;
+    return std::any_of(team.begin(), team.end(), [this](const tcp::endpoint &endpoint) {
+        return std::find(m_local.begin(), m_local.end(), endpoint) != m_local.end();
+    });
+}
+
+WrongShard LocalShards::wrong_shard(const ShardMap &map) const {
+    return WrongShard(map.encode());
+}
+
+/**
+ * @brief Samples the key into its shard's reservoir. Only one request in
+ * sample_interval takes the lock; the rest cost a relaxed increment.
+ */
+void LocalShards::record(std::string_view key) {
+    if (m_options.split_requests_per_second <= 0) {
+        return;
+    }
+    uint32_t requests = m_requests.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (requests % m_options.sample_interval != 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Load &load = m_load[(*m_map)[m_map->locate(key)].begin];
+    load.samples++;
+    if (load.keys.size() < m_options.sample_keys) {
+        load.keys.emplace_back(key);
+    } else {
+        uint64_t slot = m_random() % load.samples;
+        if (slot < load.keys.size()) {
+            load.keys[slot] = key;
+        }
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now - m_window_start >= m_options.window) {
+        find_split_keys(now);
+    }
+}
+
+/**
+ * @brief Takes the median of the sampled keys of every shard whose estimated
+ * request rate over the window exceeded the threshold as a split key, then
+ * starts a new window. A key that already starts its shard is no use, so a
+ * shard whose samples all fall on its first key gets none.
+ */
+void LocalShards::find_split_keys(std::chrono::steady_clock::time_point now) {
+    std::chrono::duration<double> elapsed = now - m_window_start;
+    m_split_keys.clear();
+    for (auto &[begin, load]: m_load) {
+        double rate = static_cast<double>(load.samples * m_options.sample_interval) / elapsed.count();
+        if (rate <= m_options.split_requests_per_second || load.keys.empty()) {
+            continue;
+        }
+        auto median = load.keys.begin() + static_cast<std::ptrdiff_t>(load.keys.size() / 2);
+        std::nth_element(load.keys.begin(), median, load.keys.end());
+        if (*median != begin) {
+            m_split_keys.push_back(std::move(*median));
+        }
+    }
+    m_load.clear();
+    m_window_start = now;
+}
@@ -0,0 +1,107 @@
+#ifndef FLOWDB_LOCAL_SHARDS_H
+#define FLOWDB_LOCAL_SHARDS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "frame.h"
+#include "shard_map.h"
+
+// A server's view of the shard map: which shards it serves, and how busy each
+// of them is. Request handlers on every network thread admit requests through
+// it, and a request for a key the server does not serve is rejected with
+// WrongShard, which carries the map so the client can correct its cache.
+//
+// The server never changes the map itself. A ShardCoordinator owns the
+// cluster's map and installs every new version here; an install older than
+// the map held is ignored, so maps that arrive out of order cannot roll the
+// server back.
+//
+// Load is tracked by sampling: one admitted request in sample_interval is
+// sampled, and per shard a reservoir of the sampled keys is kept. At
+// the end of every window, the median sampled key of each shard that received
+// more than split_requests_per_second becomes a split key, which the
+// coordinator collects with split_keys() and splits the shard at, so a hot
+// range ends up in a shard of its own.
+class LocalShards {
+public:
+    struct Options {
+        // Request rate above which a shard is split; 0 disables splitting
+        double split_requests_per_second = 50'000;
+        // One request in this many is sampled; at least 1
+        uint32_t sample_interval = 16;
+        // Sampled keys kept per shard
+        size_t sample_keys = 64;
+        std::chrono::milliseconds window{1'000};
+    };
+
+    // local lists the endpoints this server listens on; a shard is served
+    // here if its team names any of them.
+    //
+    // @throws std::invalid_argument if options.sample_interval is 0.
+    LocalShards(ShardMap map, std::vector<tcp::endpoint> local, Options options);
+
+    LocalShards(ShardMap map, std::vector<tcp::endpoint> local)
+            : LocalShards(std::move(map), std::move(local), Options()) {}
+
+    // Admits a request for key.
+    //
+    // @throws WrongShard if key is not served here.
+    void admit(std::string_view key);
+
+    // Admits a request for [begin, end).
+    //
+    // @throws WrongShard if part of the range is not served here.
+    void admit_range(std::string_view begin, std::string_view end);
+
+    [[nodiscard]] std::shared_ptr<const ShardMap> map() const;
+
+    // Replaces the map with map if it is newer. Returns false, keeping the
+    // map held, if it is not.
+    bool install(ShardMap map);
+
+    // Takes the split keys found in the last window that ended.
+    std::vector<std::string> split_keys();
+
+private:
+    struct Load {
+        uint64_t samples = 0;
+        std::vector<std::string> keys;
+    };
+
+    [[nodiscard]] bool serves(const ShardMap &map, size_t index) const;
+
+    [[nodiscard]] WrongShard wrong_shard(const ShardMap &map) const;
+
+    // Counts a request towards key's shard, sampling one in sample_interval.
+    void record(std::string_view key);
+
+    // Finds split keys for the shards that were too busy in the window that
+    // just ended. Called with m_mutex held.
+    void find_split_keys(std::chrono::steady_clock::time_point now);
+
+    std::vector<tcp::endpoint> m_local;
+    Options m_options;
+    // Requests admitted, for picking the ones to sample
+    std::atomic<uint32_t> m_requests{0};
+
+    mutable std::mutex m_mutex;
+    // Replaced rather than modified, so a copy taken under the lock stays valid
+    std::shared_ptr<const ShardMap> m_map;
+    // Keyed by the begin of the shard
+    std::map<std::string, Load, std::less<>> m_load;
+    std::chrono::steady_clock::time_point m_window_start;
+    std::minstd_rand m_random;
+    std::vector<std::string> m_split_keys;
+};
+
+#endif //FLOWDB_LOCAL_SHARDS_H
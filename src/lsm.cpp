@@ -0,0 +1,883 @@
+#include "lsm.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_set>
+#include <utility>
+#include "bloom_filter.h"
+
+namespace {
+
+// Bookkeeping bytes charged per memtable entry on top of its key and value
+constexpr size_t kEntryOverhead = 16;
+
+std::system_error os_error(const std::string &what) {
+    return {errno, std::generic_category(), what};
+}
+
+bool resolve(const std::string &tagged, std::string &value) {
+    if (tagged.empty() || tagged.front() == kTombstone) {
+        return false;
+    }
+    value.assign(tagged, 1);
+    return true;
+}
+
+// Replaces path with contents such that a crash leaves either the old or the
+// new file: write a temporary, sync it, rename it over path, sync the directory.
+void replace_file(const std::string &directory, const std::string &path, const std::string &contents) {
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw os_error("Cannot create " + temporary);
+    }
+    const char *data = contents.data();
+    size_t remaining = contents.size();
+    while (remaining > 0) {
+        ssize_t n = ::write(fd, data, remaining);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            ::close(fd);
+            throw os_error("Cannot write " + temporary);
+        }
+        data += n;
+        remaining -= static_cast<size_t>(n);
+    }
+    if (::fdatasync(fd) != 0) {
+        ::close(fd);
+        throw os_error("Cannot sync " + temporary);
+    }
+    ::close(fd);
+    if (::rename(temporary.c_str(), path.c_str()) != 0) {
+        throw os_error("Cannot rename " + temporary);
+    }
+    int directory_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory_fd >= 0) {
+        ::fsync(directory_fd);
+        ::close(directory_fd);
+    }
+}
+
+class MemtableIterator : public EntryIterator {
+public:
+    explicit MemtableIterator(const BTree &tree) : m_tree(tree) {}
+
+    void seek(std::string_view key) override {
+        m_cursor.emplace(m_tree.seek(key));
+    }
+
+    [[nodiscard]] bool valid() const override {
+        return m_cursor && m_cursor->valid();
+    }
+
+    void next() override {
+        m_cursor->next();
+    }
+
+    [[nodiscard]] std::string_view key() const override {
+        return m_cursor->key();
+    }
+
+    [[nodiscard]] std::string_view value() const override {
+        return m_cursor->value();
+    }
+
+private:
+    const BTree &m_tree;
+    std::optional<BTree::Cursor> m_cursor;
+};
+
+// Concatenates the tables of a level, which are ordered and disjoint.
+class LevelIterator : public EntryIterator {
+public:
+    explicit LevelIterator(const std::vector<std::shared_ptr<SSTable>> &tables) : m_tables(tables) {}
+
+    void seek(std::string_view key) override {
+        auto it = std::lower_bound(m_tables.begin(), m_tables.end(), key,
+                                   [](const std::shared_ptr<SSTable> &table, std::string_view k) {
+                                       return std::string_view(table->largest()) < k;
+                                   });
+        m_index = it - m_tables.begin();
+        if (m_index == m_tables.size()) {
+            m_table.reset();
+            return;
+        }
+        m_table = m_tables[m_index]->iterator();
+        m_table->seek(key);
+        skip_exhausted();
+    }
+
+    [[nodiscard]] bool valid() const override {
+        return m_table && m_table->valid();
+    }
+
+    void next() override {
+        m_table->next();
+        skip_exhausted();
+    }
+
+    [[nodiscard]] std::string_view key() const override {
+        return m_table->key();
+    }
+
+    [[nodiscard]] std::string_view value() const override {
+        return m_table->value();
+    }
+
+private:
+    void skip_exhausted() {
+        while (!m_table->valid() && ++m_index < m_tables.size()) {
+            m_table = m_tables[m_index]->iterator();
+            m_table->seek({});
+        }
+    }
+
+    const std::vector<std::shared_ptr<SSTable>> &m_tables;
+    size_t m_index = 0;
+    std::unique_ptr<EntryIterator> m_table;
+};
+
+// Yields the entries of its children in key order. On equal keys the child
+// that comes first, the newest source, is yielded first; callers skip the
+// older duplicates that follow.
+class MergingIterator : public EntryIterator {
+public:
+    explicit MergingIterator(std::vector<std::unique_ptr<EntryIterator>> children)
+            : m_children(std::move(children)) {}
+
+    void seek(std::string_view key) override {
+        for (auto &child: m_children) {
+            child->seek(key);
+        }
+        pick();
+    }
+
+    [[nodiscard]] bool valid() const override {
+        return m_current != nullptr;
+    }
+
+    void next() override {
+        m_current->next();
+        pick();
+    }
+
+    [[nodiscard]] std::string_view key() const override {
+        return m_current->key();
+    }
+
+    [[nodiscard]] std::string_view value() const override {
+        return m_current->value();
+    }
+
+private:
+    void pick() {
+        m_current = nullptr;
+        for (auto &child: m_children) {
+            if (child->valid() && (m_current == nullptr || child->key() < m_current->key())) {
+                m_current = child.get();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<EntryIterator>> m_children;
+    EntryIterator *m_current = nullptr;
+};
+
+} // namespace
+
+// A merge of tables from level into level + 1, carried out one output table
+// per step.
+struct LsmTree::Compaction {
+    size_t level = 0;
+    // Tables from level, then the overlapping tables from level + 1
+    std::array<std::vector<std::shared_ptr<SSTable>>, 2> inputs;
+    // The version the inputs were picked from
+    std::shared_ptr<const Version> version;
+
+    std::unique_ptr<EntryIterator> input;
+    std::string last_key;
+    bool has_last_key = false;
+    std::unique_ptr<SSTableWriter> output;
+    uint64_t output_number = 0;
+    std::vector<std::shared_ptr<SSTable>> outputs;
+
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    std::chrono::nanoseconds time{0};
+
+    // A lone table with nothing to merge with just changes levels
+    [[nodiscard]] bool trivial_move() const {
+        return level > 0 && inputs[0].size() == 1 && inputs[1].empty();
+    }
+
+    // True if no level below the output may hold key, in which case a
+    // tombstone for it has nothing left to hide and can be dropped
+    [[nodiscard]] bool bottommost(std::string_view key) const {
+        for (size_t l = level + 2; l < kLevels; l++) {
+            const auto &tables = version->levels[l];
+            auto it = std::lower_bound(tables.begin(), tables.end(), key,
+                                       [](const std::shared_ptr<SSTable> &table, std::string_view k) {
+                                           return std::string_view(table->largest()) < k;
+                                       });
+            if (it != tables.end() && std::string_view((*it)->smallest()) <= key) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Opens the tree in directory.
+ *
+ * @param directory Holds the MANIFEST, which lists the live tables by level,
+ * and the tables themselves.
+ * @param pool Runs flushes and compactions as background tasks.
+ * @param options Memtable, table and level sizes.
+ */
+LsmTree::LsmTree(std::string directory, ThreadPool &pool, Options options)
+        : m_directory(std::move(directory)), m_pool(pool), m_options(options), m_active(std::make_unique<BTree>()),
+          m_version(std::make_shared<Version>()) {
+    std::filesystem::create_directories(m_directory);
+    load_manifest();
+}
+
+/**
+ * @brief Stops background work, then flushes the memtable on the calling
+ * thread, so the tree may outlive the pool it was given.
+ */
+LsmTree::~LsmTree() {
+    {
+        std::unique_lock<std::mutex> lock(m_lifetime->mutex);
+        m_lifetime->closed = true;
+        m_lifetime->cv.wait(lock, [this] { return m_lifetime->running == 0; });
+    }
+    try {
+        flush();
+    } catch (...) {
+        // The memtable is lost, as in a crash; a write-ahead log recovers it
+    }
+}
+
+bool LsmTree::get(std::string_view key, std::string &value) const {
+    std::string tagged;
+    if (m_active->get(key, tagged)) {
+        return resolve(tagged, value);
+    }
+    Snapshot current = snapshot();
+    if (current.immutable && current.immutable->get(key, tagged)) {
+        return resolve(tagged, value);
+    }
+
+    uint64_t hash = hash64(key);
+    auto probe = [&](const SSTable &table) {
+        m_table_probes.fetch_add(1, std::memory_order_relaxed);
+        if (!table.may_contain(hash)) {
+            m_bloom_rejections.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return table.get(key, tagged);
+    };
+    for (const auto &table: current.version->levels[0]) {
+        if (key >= std::string_view(table->smallest()) && key <= std::string_view(table->largest()) &&
+            probe(*table)) {
+            return resolve(tagged, value);
+        }
+    }
+    for (size_t level = 1; level < kLevels; level++) {
+        const auto &tables = current.version->levels[level];
+        auto it = std::lower_bound(tables.begin(), tables.end(), key,
+                                   [](const std::shared_ptr<SSTable> &table, std::string_view k) {
+                                       return std::string_view(table->largest()) < k;
+                                   });
+        if (it != tables.end() && std::string_view((*it)->smallest()) <= key && probe(**it)) {
+            return resolve(tagged, value);
+        }
+    }
+    return false;
+}
+
+void LsmTree::set(std::string_view key, std::string_view value) {
+    std::string tagged(1, kValue);
+    tagged.append(value);
+    write(key, tagged, key.size() + value.size());
+}
+
+bool LsmTree::clear(std::string_view key) {
+    std::string value;
+    if (!get(key, value)) {
+        return false;
+    }
+    write(key, std::string_view(&kTombstone, 1), key.size());
+    return true;
+}
+
+/**
+ * @brief Writes a tombstone for every live key in the range. The keys are
+ * collected first, since writing to the memtable would invalidate the scan.
+ */
+size_t LsmTree::clear_range(std::string_view begin, std::string_view end) {
+    std::vector<std::string> keys;
+    scan(begin, end, [&keys](std::string_view key, std::string_view) {
+        keys.emplace_back(key);
+        return true;
+    });
+    for (const auto &key: keys) {
+        write(key, std::string_view(&kTombstone, 1), key.size());
+    }
+    return keys.size();
+}
+
+size_t LsmTree::range(std::string_view begin, std::string_view end, size_t limit, std::vector<KeyValue> &out) const {
+    size_t added = 0;
+    if (limit == 0) {
+        return added;
+    }
+    scan(begin, end, [&](std::string_view key, std::string_view value) {
+        out.push_back(KeyValue{std::string(key), std::string(value)});
+        return ++added < limit;
+    });
+    return added;
+}
+
+void LsmTree::flush() {
+    if (m_active->size() > 0) {
+        rotate();
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_immutable) {
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+        if (!m_flushing) {
+            lock.unlock();
+            flush_step();
+            lock.lock();
+        } else {
+            m_cv.wait(lock);
+        }
+    }
+}
+
+void LsmTree::wait_for_background() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+        if (m_immutable && !m_flushing) {
+            lock.unlock();
+            flush_step();
+            lock.lock();
+        } else if (m_flushing || m_compacting) {
+            m_cv.wait(lock);
+        } else if (m_compaction || compaction_due()) {
+            lock.unlock();
+            compaction_step();
+            lock.lock();
+        } else {
+            return;
+        }
+    }
+}
+
+LsmTree::Metrics LsmTree::metrics() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Metrics metrics = m_metrics;
+    for (size_t level = 0; level < kLevels; level++) {
+        metrics.level_tables[level] = m_version->levels[level].size();
+        for (const auto &table: m_version->levels[level]) {
+            metrics.level_bytes[level] += table->file_size();
+        }
+    }
+    lock.unlock();
+    metrics.user_bytes = m_metrics_user_bytes.load(std::memory_order_relaxed);
+    metrics.table_probes = m_table_probes.load(std::memory_order_relaxed);
+    metrics.bloom_rejections = m_bloom_rejections.load(std::memory_order_relaxed);
+    return metrics;
+}
+
+LsmTree::Snapshot LsmTree::snapshot() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return Snapshot{m_active.get(), m_immutable, m_version};
+}
+
+std::unique_ptr<EntryIterator> LsmTree::merged(const Snapshot &snapshot) const {
+    std::vector<std::unique_ptr<EntryIterator>> children;
+    children.push_back(std::make_unique<MemtableIterator>(*snapshot.active));
+    if (snapshot.immutable) {
+        children.push_back(std::make_unique<MemtableIterator>(*snapshot.immutable));
+    }
+    for (const auto &table: snapshot.version->levels[0]) {
+        children.push_back(table->iterator());
+    }
+    for (size_t level = 1; level < kLevels; level++) {
+        if (!snapshot.version->levels[level].empty()) {
+            children.push_back(std::make_unique<LevelIterator>(snapshot.version->levels[level]));
+        }
+    }
+    return std::make_unique<MergingIterator>(std::move(children));
+}
+
+template<typename F>
+void LsmTree::scan(std::string_view begin, std::string_view end, F &&f) const {
+    if (begin >= end) {
+        return;
+    }
+    Snapshot current = snapshot();
+    std::unique_ptr<EntryIterator> it = merged(current);
+    std::string last_key;
+    bool has_last_key = false;
+    for (it->seek(begin); it->valid() && it->key() < end; it->next()) {
+        std::string_view key = it->key();
+        if (has_last_key && key == last_key) {
+            continue;
+        }
+        last_key.assign(key);
+        has_last_key = true;
+        std::string_view value = it->value();
+        if (value.front() != kTombstone && !f(key, value.substr(1))) {
+            return;
+        }
+    }
+}
+
+void LsmTree::write(std::string_view key, std::string_view tagged, size_t user_bytes) {
+    m_active->set(key, tagged);
+    m_active_bytes += key.size() + tagged.size() + kEntryOverhead;
+    m_metrics_user_bytes.fetch_add(user_bytes, std::memory_order_relaxed);
+    if (m_active_bytes >= m_options.memtable_bytes) {
+        rotate();
+    }
+}
+
+/**
+ * @brief Swaps in a fresh memtable and schedules the flush of the full one.
+ *
+ * If the previous memtable is still waiting for a worker, the writer flushes
+ * it itself, and while level 0 holds l0_stop_writes tables it compacts
+ * inline, so background work that is starved by foreground load slows writes
+ * down instead of letting level 0, and read latency, grow without bound.
+ *
+ * @throws The error that failed an earlier background step, if any.
+ */
+void LsmTree::rotate() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_immutable) {
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+        if (!m_flushing) {
+            lock.unlock();
+            flush_step();
+            lock.lock();
+        } else {
+            m_cv.wait(lock);
+        }
+    }
+    while (m_version->levels[0].size() >= m_options.l0_stop_writes) {
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+        if (!m_compacting) {
+            lock.unlock();
+            compaction_step();
+            lock.lock();
+        } else {
+            m_cv.wait(lock);
+        }
+    }
+    if (m_error) {
+        std::rethrow_exception(m_error);
+    }
+    m_immutable = std::shared_ptr<const BTree>(std::move(m_active));
+    m_immutable_position = m_active_position;
+    lock.unlock();
+    m_active = std::make_unique<BTree>();
+    m_active_bytes = 0;
+    submit(&LsmTree::flush_step);
+}
+
+void LsmTree::submit(void (LsmTree::*step)()) {
+    {
+        std::unique_lock<std::mutex> lock(m_lifetime->mutex);
+        if (m_lifetime->closed) {
+            return;
+        }
+    }
+    m_pool.submit_background([this, lifetime = m_lifetime, step] {
+        {
+            std::unique_lock<std::mutex> lock(lifetime->mutex);
+            if (lifetime->closed) {
+                return;
+            }
+            lifetime->running++;
+        }
+        (this->*step)();
+        std::unique_lock<std::mutex> lock(lifetime->mutex);
+        lifetime->running--;
+        lifetime->cv.notify_all();
+    });
+}
+
+/**
+ * @brief Writes the immutable memtable to a new level-0 table and installs it.
+ */
+void LsmTree::flush_step() {
+    std::shared_ptr<const BTree> memtable;
+    uint64_t number;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_flushing || !m_immutable || m_error) {
+            return;
+        }
+        m_flushing = true;
+        memtable = m_immutable;
+        number = m_next_file++;
+    }
+    bool compact;
+    try {
+        std::shared_ptr<SSTable> table;
+        if (memtable->size() > 0) {
+            SSTableWriter writer(table_path(number), m_options.table);
+            for (BTree::Cursor cursor = memtable->seek({}); cursor.valid(); cursor.next()) {
+                writer.add(cursor.key(), cursor.value());
+            }
+            writer.finish();
+            table = SSTable::open(table_path(number), number);
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto version = std::make_shared<Version>(*m_version);
+        if (table) {
+            version->levels[0].insert(version->levels[0].begin(), table);
+            m_metrics.flush_bytes += table->file_size();
+        }
+        uint64_t position = std::max(m_durable_position.load(std::memory_order_relaxed), m_immutable_position);
+        m_durable_position.store(position, std::memory_order_release);
+        save_manifest(*version);
+        m_version = std::move(version);
+        m_immutable.reset();
+        m_flushing = false;
+        compact = compaction_due();
+    } catch (...) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_error = std::current_exception();
+        m_flushing = false;
+        compact = false;
+    }
+    m_cv.notify_all();
+    if (compact) {
+        submit(&LsmTree::compaction_step);
+    }
+}
+
+/**
+ * @brief Advances the current compaction, picking one if none is under way,
+ * by one output table, and resubmits itself while there is more to do.
+ */
+void LsmTree::compaction_step() {
+    std::unique_ptr<Compaction> compaction;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_compacting || m_error) {
+            return;
+        }
+        if (!m_compaction) {
+            m_compaction = pick_compaction();
+            if (!m_compaction) {
+                return;
+            }
+        }
+        m_compacting = true;
+        compaction = std::move(m_compaction);
+    }
+    bool more;
+    try {
+        bool done = advance(*compaction);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (done) {
+            install(*compaction);
+        } else {
+            m_compaction = std::move(compaction);
+        }
+        m_compacting = false;
+        more = m_compaction || compaction_due();
+    } catch (...) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_error = std::current_exception();
+        m_compacting = false;
+        more = false;
+    }
+    m_cv.notify_all();
+    if (more) {
+        submit(&LsmTree::compaction_step);
+    }
+}
+
+/**
+ * @brief Scores level 0 by table count and deeper levels by size against
+ * their budget, and builds a compaction for the worst level scoring at least
+ * one. A deeper level gives up the table after the last one it compacted, so
+ * successive compactions sweep its key range.
+ */
+std::unique_ptr<LsmTree::Compaction> LsmTree::pick_compaction() {
+    const Version &version = *m_version;
+    size_t level = 0;
+    double best = static_cast<double>(version.levels[0].size()) /
+                  static_cast<double>(std::max<size_t>(m_options.l0_compaction_trigger, 1));
+    for (size_t l = 1; l + 1 < kLevels; l++) {
+        uint64_t bytes = 0;
+        for (const auto &table: version.levels[l]) {
+            bytes += table->file_size();
+        }
+        double score = static_cast<double>(bytes) / static_cast<double>(level_budget(l));
+        if (score > best) {
+            best = score;
+            level = l;
+        }
+    }
+    if (best < 1.0) {
+        return nullptr;
+    }
+
+    auto compaction = std::make_unique<Compaction>();
+    compaction->level = level;
+    compaction->version = m_version;
+    if (level == 0) {
+        compaction->inputs[0] = version.levels[0];
+    } else {
+        const auto &tables = version.levels[level];
+        auto it = std::find_if(tables.begin(), tables.end(), [this, level](const std::shared_ptr<SSTable> &table) {
+            return table->smallest() > m_compact_pointer[level];
+        });
+        const auto &table = it != tables.end() ? *it : tables.front();
+        m_compact_pointer[level] = table->largest();
+        compaction->inputs[0].push_back(table);
+    }
+    std::string_view smallest = compaction->inputs[0].front()->smallest();
+    std::string_view largest = compaction->inputs[0].front()->largest();
+    for (const auto &table: compaction->inputs[0]) {
+        smallest = std::min(smallest, std::string_view(table->smallest()));
+        largest = std::max(largest, std::string_view(table->largest()));
+    }
+    for (const auto &table: version.levels[level + 1]) {
+        if (std::string_view(table->largest()) >= smallest && std::string_view(table->smallest()) <= largest) {
+            compaction->inputs[1].push_back(table);
+        }
+    }
+    return compaction;
+}
+
+bool LsmTree::compaction_due() const {
+    if (m_version->levels[0].size() >= m_options.l0_compaction_trigger) {
+        return true;
+    }
+    for (size_t level = 1; level + 1 < kLevels; level++) {
+        uint64_t bytes = 0;
+        for (const auto &table: m_version->levels[level]) {
+            bytes += table->file_size();
+        }
+        if (bytes > level_budget(level)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t LsmTree::level_budget(size_t level) const {
+    uint64_t budget = m_options.level1_bytes;
+    for (size_t l = 1; l < level; l++) {
+        budget *= m_options.level_multiplier;
+    }
+    return budget;
+}
+
+/**
+ * @brief Merges input entries into the current output table until it reaches
+ * table_bytes or the inputs run out.
+ *
+ * Of several entries for a key only the first, newest one is kept, and a
+ * tombstone is dropped altogether when no deeper level can hold the key.
+ */
+bool LsmTree::advance(Compaction &compaction) {
+    auto start = std::chrono::steady_clock::now();
+    if (compaction.trivial_move()) {
+        return true;
+    }
+    if (!compaction.input) {
+        std::vector<std::unique_ptr<EntryIterator>> children;
+        for (const auto &table: compaction.inputs[0]) {
+            children.push_back(table->iterator());
+            compaction.bytes_read += table->file_size();
+        }
+        for (const auto &table: compaction.inputs[1]) {
+            compaction.bytes_read += table->file_size();
+        }
+        children.push_back(std::make_unique<LevelIterator>(compaction.inputs[1]));
+        compaction.input = std::make_unique<MergingIterator>(std::move(children));
+        compaction.input->seek({});
+    }
+
+    auto finish_output = [this, &compaction] {
+        compaction.output->finish();
+        compaction.output.reset();
+        auto table = SSTable::open(table_path(compaction.output_number), compaction.output_number);
+        compaction.bytes_written += table->file_size();
+        compaction.outputs.push_back(std::move(table));
+    };
+    EntryIterator &input = *compaction.input;
+    bool output_full = false;
+    for (; input.valid() && !output_full; input.next()) {
+        std::string_view key = input.key();
+        if (compaction.has_last_key && key == compaction.last_key) {
+            continue;
+        }
+        compaction.last_key.assign(key);
+        compaction.has_last_key = true;
+        std::string_view value = input.value();
+        if (value.front() == kTombstone && compaction.bottommost(key)) {
+            continue;
+        }
+        if (!compaction.output) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                compaction.output_number = m_next_file++;
+            }
+            compaction.output = std::make_unique<SSTableWriter>(table_path(compaction.output_number),
+                                                                m_options.table);
+        }
+        compaction.output->add(key, value);
+        if (compaction.output->size() >= m_options.table_bytes) {
+            finish_output();
+            output_full = true;
+        }
+    }
+    bool done = !input.valid();
+    if (done && compaction.output) {
+        finish_output();
+    }
+    compaction.time += std::chrono::steady_clock::now() - start;
+    return done;
+}
+
+/**
+ * @brief Replaces the compaction's inputs with its outputs in a new version,
+ * persists it, and unlinks the input files. Called with m_mutex held.
+ */
+void LsmTree::install(Compaction &compaction) {
+    auto version = std::make_shared<Version>(*m_version);
+    auto remove = [](std::vector<std::shared_ptr<SSTable>> &tables,
+                     const std::vector<std::shared_ptr<SSTable>> &obsolete) {
+        tables.erase(std::remove_if(tables.begin(), tables.end(), [&obsolete](const std::shared_ptr<SSTable> &table) {
+            return std::find(obsolete.begin(), obsolete.end(), table) != obsolete.end();
+        }), tables.end());
+    };
+    auto &target = version->levels[compaction.level + 1];
+    remove(version->levels[compaction.level], compaction.inputs[0]);
+    if (compaction.trivial_move()) {
+        target.push_back(compaction.inputs[0].front());
+        m_metrics.trivial_moves++;
+    } else {
+        remove(target, compaction.inputs[1]);
+        target.insert(target.end(), compaction.outputs.begin(), compaction.outputs.end());
+        m_metrics.compactions++;
+        m_metrics.compaction_read_bytes += compaction.bytes_read;
+        m_metrics.compaction_write_bytes += compaction.bytes_written;
+        m_metrics.compaction_time += compaction.time;
+    }
+    std::sort(target.begin(), target.end(), [](const std::shared_ptr<SSTable> &a, const std::shared_ptr<SSTable> &b) {
+        return a->smallest() < b->smallest();
+    });
+    save_manifest(*version);
+    m_version = std::move(version);
+    if (!compaction.trivial_move()) {
+        for (const auto &inputs: compaction.inputs) {
+            for (const auto &table: inputs) {
+                ::unlink(table_path(table->number()).c_str());
+            }
+        }
+    }
+}
+
+/**
+ * @brief Writes the MANIFEST: the next file number, the durable log position,
+ * then one line per live table with its level and number.
+ */
+void LsmTree::save_manifest(const Version &version) {
+    std::string manifest = "next " + std::to_string(m_next_file) + "\n";
+    manifest += "log " + std::to_string(m_durable_position.load(std::memory_order_relaxed)) + "\n";
+    for (size_t level = 0; level < kLevels; level++) {
+        for (const auto &table: version.levels[level]) {
+            manifest += std::to_string(level) + " " + std::to_string(table->number()) + "\n";
+        }
+    }
+    replace_file(m_directory, m_directory + "/MANIFEST", manifest);
+}
+
+void LsmTree::load_manifest() {
+    auto version = std::make_shared<Version>();
+    std::unordered_set<uint64_t> live;
+    std::ifstream manifest(m_directory + "/MANIFEST");
+    if (manifest) {
+        std::string word;
+        if (!(manifest >> word >> m_next_file) || word != "next") {
+            throw std::runtime_error("Corrupt MANIFEST in " + m_directory);
+        }
+        // MANIFESTs written before log positions were recorded have no log line
+        if ((manifest >> std::ws).peek() == 'l') {
+            uint64_t position;
+            if (!(manifest >> word >> position) || word != "log") {
+                throw std::runtime_error("Corrupt MANIFEST in " + m_directory);
+            }
+            m_durable_position.store(position, std::memory_order_relaxed);
+        }
+        size_t level;
+        uint64_t number;
+        while (manifest >> level >> number) {
+            if (level >= kLevels) {
+                throw std::runtime_error("Corrupt MANIFEST in " + m_directory);
+            }
+            version->levels[level].push_back(SSTable::open(table_path(number), number));
+            live.insert(number);
+        }
+    }
+    std::sort(version->levels[0].begin(), version->levels[0].end(),
+              [](const std::shared_ptr<SSTable> &a, const std::shared_ptr<SSTable> &b) {
+                  return a->number() > b->number();
+              });
+    for (size_t level = 1; level < kLevels; level++) {
+        std::sort(version->levels[level].begin(), version->levels[level].end(),
+                  [](const std::shared_ptr<SSTable> &a, const std::shared_ptr<SSTable> &b) {
+                      return a->smallest() < b->smallest();
+                  });
+    }
+    m_version = std::move(version);
+
+    // Tables that never made it into the MANIFEST are leftovers of a crash
+    for (const auto &entry: std::filesystem::directory_iterator(m_directory)) {
+        if (entry.path().extension() != ".sst") {
+            continue;
+        }
+        uint64_t number = std::strtoull(entry.path().stem().c_str(), nullptr, 10);
+        if (live.count(number) == 0) {
+            std::filesystem::remove(entry.path());
+        }
+    }
+}
+
+std::string LsmTree::table_path(uint64_t number) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%06llu.sst", static_cast<unsigned long long>(number));
+    return m_directory + name;
+}
@@ -0,0 +1,245 @@
+#ifndef FLOWDB_LSM_H
+#define FLOWDB_LSM_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "btree.h"
+#include "ordered_store.h"
+#include "sstable.h"
+#include "thread_pool.h"
+
+// Log-structured merge tree: the on-disk OrderedStore, for data sets that do
+// not fit in memory.
+//
+// Writes go to a memtable, a BTree whose values carry a kind tag so that
+// deletions can be recorded as tombstones. A full memtable becomes immutable
+// and is flushed to a new table (see SSTable) in level 0, whose tables may
+// overlap. Levels 1 and up each hold tables with disjoint key ranges, and each
+// level may grow to level_multiplier times the size of the one above before
+// compaction merges tables from it into the next.
+//
+// Flushes and compactions run as background tasks on the ThreadPool, which
+// only picks them up when it has no foreground work. A compaction yields the
+// worker after every output table, so a long merge never holds a worker for
+// more than one table's worth of I/O. If background work falls behind, the
+// writer does it inline: a second memtable fills before the first is flushed,
+// or level 0 reaches l0_stop_writes tables.
+//
+// Reads check the memtables, then the level-0 tables from newest to oldest,
+// then one table per deeper level. Tables whose bloom filter rules the key
+// out are skipped without touching their data, so a lookup of a missing key
+// usually costs one hash and a few filter probes. The set of live tables is
+// an immutable Version swapped under a lock, so a read works from a snapshot
+// while compactions replace tables under it; an obsolete table's file is
+// unlinked at once and its mapping released when the last snapshot drops it.
+//
+// The MANIFEST also records the log position of the newest write in a
+// flushed table (see OrderedStore::durable_log_position()), so a write-ahead
+// log in front of the tree only replays what was still in the memtables.
+//
+// Like BTree, the tree is not thread-safe: one owner calls its methods, and
+// only the background work runs concurrently.
+class LsmTree final : public OrderedStore {
+public:
+    static constexpr size_t kLevels = 7;
+
+    struct Options {
+        TableOptions table;
+        // Approximate key and value bytes a memtable holds before it is flushed
+        size_t memtable_bytes = 4 << 20;
+        // Target size of the tables written by compaction
+        uint64_t table_bytes = 2 << 20;
+        // Level-0 table counts that start a compaction, and that make the
+        // writer compact inline
+        size_t l0_compaction_trigger = 4;
+        size_t l0_stop_writes = 12;
+        uint64_t level1_bytes = 16 << 20;
+        uint64_t level_multiplier = 10;
+    };
+
+    struct Metrics {
+        // Key and value bytes written through set() and clear()
+        uint64_t user_bytes = 0;
+        uint64_t flush_bytes = 0;
+        uint64_t compaction_read_bytes = 0;
+        uint64_t compaction_write_bytes = 0;
+        uint64_t compactions = 0;
+        // Compactions that moved a table down a level without rewriting it
+        uint64_t trivial_moves = 0;
+        std::chrono::nanoseconds compaction_time{0};
+        // Tables whose key range covered a point lookup, and how many of
+        // those the bloom filter answered without a read
+        uint64_t table_probes = 0;
+        uint64_t bloom_rejections = 0;
+        std::array<size_t, kLevels> level_tables{};
+        std::array<uint64_t, kLevels> level_bytes{};
+
+        // Table bytes written per byte written by the user
+        [[nodiscard]] double write_amplification() const {
+            return user_bytes == 0 ? 0.0 : static_cast<double>(flush_bytes + compaction_write_bytes) /
+                                           static_cast<double>(user_bytes);
+        }
+
+        // Bytes read and written per second spent compacting
+        [[nodiscard]] double compaction_throughput() const {
+            auto seconds = std::chrono::duration<double>(compaction_time).count();
+            return seconds == 0 ? 0.0 :
+                   static_cast<double>(compaction_read_bytes + compaction_write_bytes) / seconds;
+        }
+    };
+
+    // Opens the tree stored in directory, creating it if needed, and removes
+    // tables left behind by an interrupted flush or compaction.
+    //
+    // @throws std::system_error or std::runtime_error if the directory or a
+    // table cannot be read.
+    LsmTree(std::string directory, ThreadPool &pool, Options options);
+
+    LsmTree(std::string directory, ThreadPool &pool) : LsmTree(std::move(directory), pool, Options()) {}
+
+    LsmTree(const LsmTree &) = delete;
+
+    LsmTree &operator=(const LsmTree &) = delete;
+
+    // Waits for background steps that have started, then flushes the memtable.
+    ~LsmTree() override;
+
+    using OrderedStore::get;
+
+    bool get(std::string_view key, std::string &value) const override;
+
+    void set(std::string_view key, std::string_view value) override;
+
+    bool clear(std::string_view key) override;
+
+    size_t clear_range(std::string_view begin, std::string_view end) override;
+
+    size_t range(std::string_view begin, std::string_view end, size_t limit,
+                 std::vector<KeyValue> &out) const override;
+
+    void set_log_position(uint64_t position) override {
+        m_active_position = position;
+    }
+
+    [[nodiscard]] uint64_t durable_log_position() const override {
+        return m_durable_position.load(std::memory_order_acquire);
+    }
+
+    // Writes the memtable to a table now.
+    void flush();
+
+    // Runs flushes and compactions, inline if need be, until none is due.
+    void wait_for_background();
+
+    [[nodiscard]] Metrics metrics() const;
+
+private:
+    struct Version {
+        // Level 0 newest first; deeper levels ordered by key
+        std::array<std::vector<std::shared_ptr<SSTable>>, kLevels> levels;
+    };
+
+    // What a read works from; the active memtable is only read by the owner
+    struct Snapshot {
+        const BTree *active;
+        std::shared_ptr<const BTree> immutable;
+        std::shared_ptr<const Version> version;
+    };
+
+    struct Compaction;
+
+    // Outlives the tree so that background tasks still queued when it is
+    // destroyed can see that and do nothing
+    struct Lifetime {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool closed = false;
+        size_t running = 0;
+    };
+
+    [[nodiscard]] Snapshot snapshot() const;
+
+    // Merges every source into one iterator, newest source first.
+    [[nodiscard]] std::unique_ptr<EntryIterator> merged(const Snapshot &snapshot) const;
+
+    // Calls f(key, value) for the live entries in [begin, end) until it returns false.
+    template<typename F>
+    void scan(std::string_view begin, std::string_view end, F &&f) const;
+
+    void write(std::string_view key, std::string_view tagged, size_t user_bytes);
+
+    // Makes a full memtable immutable and schedules its flush.
+    void rotate();
+
+    void submit(void (LsmTree::*step)());
+
+    // Background steps. Each claims its kind of work and returns at once if
+    // another thread has it.
+    void flush_step();
+
+    void compaction_step();
+
+    // Chooses the level that most exceeds its budget. Called with m_mutex held.
+    std::unique_ptr<Compaction> pick_compaction();
+
+    [[nodiscard]] bool compaction_due() const;
+
+    [[nodiscard]] uint64_t level_budget(size_t level) const;
+
+    // Writes one output table of the compaction, or finishes it; returns true
+    // once it is done.
+    bool advance(Compaction &compaction);
+
+    void install(Compaction &compaction);
+
+    // Persists the table list. Called with m_mutex held.
+    void save_manifest(const Version &version);
+
+    void load_manifest();
+
+    [[nodiscard]] std::string table_path(uint64_t number) const;
+
+    std::string m_directory;
+    ThreadPool &m_pool;
+    Options m_options;
+
+    // Owned by the caller's thread
+    std::unique_ptr<BTree> m_active;
+    size_t m_active_bytes = 0;
+    // Log position of the newest write in the active memtable
+    uint64_t m_active_position = 0;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::shared_ptr<const BTree> m_immutable;
+    uint64_t m_immutable_position = 0;
+    std::shared_ptr<const Version> m_version;
+    uint64_t m_next_file = 1;
+    bool m_flushing = false;
+    bool m_compacting = false;
+    std::unique_ptr<Compaction> m_compaction;
+    // Largest key compacted out of each level, so compactions rotate through it
+    std::array<std::string, kLevels> m_compact_pointer;
+    std::exception_ptr m_error;
+    Metrics m_metrics;
+    // Log position of the newest write in a table, as in the MANIFEST
+    std::atomic<uint64_t> m_durable_position{0};
+
+    std::atomic<uint64_t> m_metrics_user_bytes{0};
+    mutable std::atomic<uint64_t> m_table_probes{0};
+    mutable std::atomic<uint64_t> m_bloom_rejections{0};
+
+    std::shared_ptr<Lifetime> m_lifetime = std::make_shared<Lifetime>();
+};
+
+#endif //FLOWDB_LSM_H
@@ -0,0 +1,84 @@
+#ifndef FLOWDB_MAILBOX_H
+#define FLOWDB_MAILBOX_H
+
+#include <atomic>
+#include <cstddef>
+
+// Intrusive link embedded in every message queued on a Mailbox.
+struct MailboxNode {
+    MailboxNode *next = nullptr;
+};
+
+// Lock-free multi-producer/single-consumer mailbox.
+//
+// Producers push onto an atomic LIFO stack with a single CAS. The consumer takes
+// the whole stack with one exchange and reverses it into FIFO order, so draining
+// a batch costs one atomic operation regardless of its size. When the consumer
+// runs out of messages it parks the mailbox in the idle state; the push that
+// takes it out of that state is the only one that reports a wakeup.
+class Mailbox {
+public:
+    Mailbox() : m_head(idle()) {}
+
+    Mailbox(const Mailbox &) = delete;
+
+    Mailbox &operator=(const Mailbox &) = delete;
+
+    // Enqueues a node. Returns true if the mailbox was idle, in which case the
+    // caller is responsible for waking the consumer.
+    bool push(MailboxNode *node) {
+        MailboxNode *head = m_head.load(std::memory_order_relaxed);
+        do {
+            node->next = head == idle() ? nullptr : head;
+        } while (!m_head.compare_exchange_weak(head, node, std::memory_order_acq_rel, std::memory_order_relaxed));
+        return head == idle();
+    }
+
+    // Takes every pending node in FIFO order, or nullptr if there are none.
+    // Only the consumer may call this, and only while the mailbox is not idle.
+    MailboxNode *take_all() {
+        size_t count = 0;
+        return take_all(count);
+    }
+
+    // As take_all(), and adds the number of nodes taken to count, which the
+    // reversal learns for free.
+    MailboxNode *take_all(size_t &count) {
+        MailboxNode *head = m_head.exchange(nullptr, std::memory_order_acq_rel);
+        MailboxNode *reversed = nullptr;
+        while (head != nullptr) {
+            count++;
+            MailboxNode *next = head->next;
+            head->next = reversed;
+            reversed = head;
+            head = next;
+        }
+        return reversed;
+    }
+
+    // Marks the mailbox idle. Fails if a message arrived since the last
+    // take_all(), in which case the consumer must keep draining.
+    bool try_idle() {
+        MailboxNode *expected = nullptr;
+        return m_head.compare_exchange_strong(expected, idle(), std::memory_order_acq_rel,
+                                              std::memory_order_relaxed);
+    }
+
+    // Returns true if nothing is pending. Approximate unless called by the consumer.
+    [[nodiscard]] bool empty() const {
+        MailboxNode *head = m_head.load(std::memory_order_acquire);
+        return head == nullptr || head == idle();
+    }
+
+private:
+    // Sentinel stored in m_head while the consumer is idle
+    static MailboxNode *idle() {
+        static MailboxNode sentinel;
+        return &sentinel;
+    }
+
+    // Most recently pushed node, nullptr when empty, or idle() when parked
+    alignas(64) std::atomic<MailboxNode *> m_head;
+};
+
+#endif //FLOWDB_MAILBOX_H
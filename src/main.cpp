@@ -1,22 +1,15 @@
 #include "connection_pool.h"
+#include "health_checker.h"
+#include "storage_client.h"
 #include <boost/asio.hpp>
 #include <iostream>
+#include <thread>
 
 using boost::asio::ip::tcp;
 
-void
-timer_handler(const boost::system::error_code &ec, boost::asio::steady_timer &timer, ConnectionPool &connection_pool) {
-    if (!ec) {
-        connection_pool.detect_failures();
-        timer.expires_at(timer.expiry() + boost::asio::chrono::seconds(5));
-        timer.async_wait([&](const boost::system::error_code &ec) {
-            timer_handler(ec, timer, connection_pool);
-        });
-    }
-}
-
 int main() {
     boost::asio::io_context io_context;
+    auto work = boost::asio::make_work_guard(io_context);
     // Define the endpoints for the network layer
     std::vector<tcp::endpoint> endpoints = {
             tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 8000),
@@ -24,33 +17,43 @@ int main() {
             tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 8002)
     };
 
-    // Create a connection pool with 10 connections
-    ConnectionPool connection_pool(io_context, endpoints, 5);
-    connection_pool.resize(10);
-
-    // Start a timer to call detect_failures every 5 seconds
-    boost::asio::steady_timer timer(io_context, boost::asio::chrono::seconds(5));
-    timer.async_wait([&](const boost::system::error_code &ec) {
-        timer_handler(ec, timer, connection_pool);
-    });
+    // Keep 2 warm connections per endpoint, and never more than 10
+    ConnectionPool connection_pool(io_context, endpoints, 2, 10);
 
-    try {
-        tcp::endpoint local_endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0);
-        std::unique_ptr<tcp::socket> socket_ptr = std::make_unique<tcp::socket>(io_context);
-        *socket_ptr = std::move(connection_pool.get_connection(local_endpoint));
-
-        std::string message = "Hello, world!";
-        boost::asio::write(*socket_ptr, boost::asio::buffer(message));
+    // Ping every endpoint every 5 seconds and take unresponsive ones out of rotation
+    HealthChecker health_checker(io_context, connection_pool);
+    health_checker.start();
 
-        char buffer[1024];
-        size_t bytes_transferred = socket_ptr->read_some(boost::asio::buffer(buffer));
-        std::cout << "Received " << bytes_transferred << " bytes: " << buffer << std::endl;
+    // The pool connects and hands out sockets on the io_context
+    std::thread io_thread([&io_context] { io_context.run(); });
 
-        connection_pool.return_connection(std::move(socket_ptr));
-        socket_ptr.reset();
+    // Requests go straight to the server that owns their key; the client
+    // learns the shard map from the first server that points it elsewhere
+    StorageClient client(connection_pool);
+    try {
+        std::vector<Future<Void>> writes;
+        for (int i = 0; i < 3; i++) {
+            std::string key = "hello/" + std::to_string(i);
+            writes.push_back(client.set(key, "world #" + std::to_string(i)));
+        }
+        when_all(writes).get();
+
+        auto value = client.get("hello/1").get();
+        std::cout << "hello/1 = " << value.value_or("<not set>") << std::endl;
+        auto range = client.get_range("hello/", "hello0", 10).get();
+        for (const auto &entry: range) {
+            std::cout << entry.key << " = " << entry.value << std::endl;
+        }
+        std::cout << "Shard map version " << client.shard_map()->version() << " with "
+                  << client.shard_map()->size() << " shards" << std::endl;
     } catch (const std::exception &e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }
+    client.close().get();
 
+    health_checker.stop();
+    work.reset();
+    io_context.stop();
+    io_thread.join();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,168 @@
+#include "message.h"
+
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include "codec.h"
+#include "recycling_allocator.h"
+
+Message::Message(std::string bytes) {
+    auto body = std::allocate_shared<Body>(RecyclingStdAllocator<Body>());
+    body->size = bytes.size();
+    body->append(body->owned.emplace_back(std::move(bytes)));
+    m_body = std::move(body);
+}
+
+std::span<const std::string_view> Message::Body::segments() const {
+    if (segment_count <= inline_segments.size()) {
+        return {inline_segments.data(), segment_count};
+    }
+    return more_segments;
+}
+
+/**
+ * @brief Consecutive arena copies continue each other, so a short message
+ * usually ends up as a single segment. Segments move to the heap once the
+ * inline slots are full.
+ */
+void Message::Body::append(std::string_view segment) {
+    if (segment.empty()) {
+        return;
+    }
+    std::string_view *last = nullptr;
+    if (segment_count > 0) {
+        last = segment_count <= inline_segments.size() ? &inline_segments[segment_count - 1] : &more_segments.back();
+    }
+    if (last && last->data() + last->size() == segment.data()) {
+        *last = std::string_view(last->data(), last->size() + segment.size());
+        return;
+    }
+    if (segment_count < inline_segments.size()) {
+        inline_segments[segment_count] = segment;
+    } else {
+        if (segment_count == inline_segments.size()) {
+            more_segments.assign(inline_segments.begin(), inline_segments.end());
+        }
+        more_segments.push_back(segment);
+    }
+    segment_count++;
+}
+
+std::string Message::flatten() const {
+    std::string result;
+    result.reserve(size());
+    for (std::string_view segment: segments()) {
+        result.append(segment);
+    }
+    return result;
+}
+
+MessageBuilder &MessageBuilder::add(std::string_view bytes) {
+    append_field(body().arena.copy(bytes));
+    return *this;
+}
+
+MessageBuilder &MessageBuilder::add(std::string &&bytes) {
+    if (bytes.size() < kReferenceSize) {
+        return add(std::string_view(bytes));
+    }
+    append_field(body().owned.emplace_back(std::move(bytes)));
+    return *this;
+}
+
+/**
+ * @brief Segments shorter than kReferenceSize are copied into the arena, where
+ * they join the fields around them; longer ones are sent from where they are.
+ */
+MessageBuilder &MessageBuilder::add(const Message &message) {
+    Message::Body &target = body();
+    end_field(message.size());
+    bool referenced = false;
+    for (std::string_view segment: message.segments()) {
+        if (segment.size() < kReferenceSize) {
+            target.append(target.arena.copy(segment));
+        } else {
+            target.append(segment);
+            referenced = true;
+        }
+    }
+    if (referenced) {
+        target.nested.push_back(message);
+    }
+    return *this;
+}
+
+MessageBuilder &MessageBuilder::add_u64(uint64_t value) {
+    char *out = body().arena.allocate(sizeof(value));
+    detail::store_le(out, value);
+    append_field({out, sizeof(value)});
+    return *this;
+}
+
+/**
+ * @brief Writes the table after the fields, where it usually continues the
+ * last arena segment, and hands the body over to the message.
+ */
+Message MessageBuilder::finish() {
+    size_t table_size = sizeof(uint32_t) * (m_fields + 1);
+    char *table = body().arena.allocate(table_size);
+    for (size_t i = 0; i < m_fields; i++) {
+        uint32_t end = i < kInlineFields ? m_inline_ends[i] : m_more_ends[i - kInlineFields];
+        detail::store_le(table + sizeof(uint32_t) * i, end);
+    }
+    detail::store_le(table + sizeof(uint32_t) * m_fields, static_cast<uint32_t>(m_fields));
+    m_body->append({table, table_size});
+    m_body->size = m_data_size + table_size;
+
+    Message message;
+    message.m_body = std::move(m_body);
+    m_more_ends.clear();
+    m_fields = 0;
+    m_data_size = 0;
+    return message;
+}
+
+Message::Body &MessageBuilder::body() {
+    if (!m_body) {
+        m_body = std::allocate_shared<Message::Body>(RecyclingStdAllocator<Message::Body>());
+    }
+    return *m_body;
+}
+
+void MessageBuilder::append_field(std::string_view bytes) {
+    end_field(bytes.size());
+    m_body->append(bytes);
+}
+
+/**
+ * @brief Records where the field ends, before its bytes are appended.
+ *
+ * @throws std::length_error if the message would exceed 4 GiB.
+ */
+void MessageBuilder::end_field(size_t size) {
+    if (size > std::numeric_limits<uint32_t>::max() - m_data_size) {
+        throw std::length_error("Message too large");
+    }
+    m_data_size += size;
+    auto end = static_cast<uint32_t>(m_data_size);
+    if (m_fields < kInlineFields) {
+        m_inline_ends[m_fields] = end;
+    } else {
+        m_more_ends.push_back(end);
+    }
+    m_fields++;
+}
+
+MessageView::MessageView(std::string_view bytes) : m_bytes(bytes) {
+    if (bytes.empty()) {
+        return;
+    }
+    if (bytes.size() < sizeof(uint32_t)) {
+        throw std::invalid_argument("Truncated message");
+    }
+    m_count = detail::load_le<uint32_t>(bytes.data() + bytes.size() - sizeof(uint32_t));
+    if (m_count > (bytes.size() - sizeof(uint32_t)) / sizeof(uint32_t)) {
+        throw std::invalid_argument("Truncated message field table");
+    }
+    m_data_size = bytes.size() - sizeof(uint32_t) * (m_count + 1);
+}
@@ -0,0 +1,170 @@
+#ifndef FLOWDB_MESSAGE_H
+#define FLOWDB_MESSAGE_H
+
+#include <cstddef>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "buffer_pool.h"
+#include "codec.h"
+
+// Flat format for request and response payloads. A message is a list of byte
+// string fields, laid out so that any field can be read where it lies, such
+// as in a receive buffer, without a decoding pass or a copy:
+//
+//     data                 the fields, back to back
+//     uint32 end[count]    where each field ends, relative to the data
+//     uint32 count         number of fields
+//
+// Field i spans [end[i - 1], end[i]) of the data, with end[-1] = 0. Integers
+// are 8-byte little-endian fields. An empty payload is a message without
+// fields. The table trails the data so that a builder can write the fields as
+// they come and a short message ends up in one piece. Nothing is validated up
+// front; a MessageView checks the bounds of each field it is asked for.
+
+// A finished message, as the list of segments that make up its bytes, for a
+// gathered write. Copies share the segments, so a message can be sent to
+// several replicas or retried without being built again.
+class Message {
+public:
+    // The empty message
+    Message() = default;
+
+    // A message whose bytes were encoded elsewhere.
+    explicit Message(std::string bytes);
+
+    [[nodiscard]] size_t size() const {
+        return m_body ? m_body->size : 0;
+    }
+
+    [[nodiscard]] std::span<const std::string_view> segments() const {
+        return m_body ? m_body->segments() : std::span<const std::string_view>();
+    }
+
+    // Bytes written into the message's arena while it was built: the field
+    // table and the short fields, as opposed to the strings it took over
+    [[nodiscard]] size_t copied() const {
+        return m_body ? m_body->arena.used() : 0;
+    }
+
+    // The message's bytes in one string, for tests and logging.
+    [[nodiscard]] std::string flatten() const;
+
+private:
+    friend class MessageBuilder;
+
+    struct Body {
+        Arena arena;
+        // Taken over from the builder's caller. Only strings too long for the
+        // small-string buffer are taken over, so their bytes stay put when
+        // the vector grows.
+        std::vector<std::string> owned;
+        // Messages added as fields whose long segments are referenced
+        std::vector<Message> nested;
+        // The segments, in place while there are few of them
+        std::array<std::string_view, 4> inline_segments;
+        std::vector<std::string_view> more_segments;
+        size_t segment_count = 0;
+        size_t size = 0;
+
+        [[nodiscard]] std::span<const std::string_view> segments() const;
+
+        // Appends segment, or extends the last segment if segment continues
+        // it in memory.
+        void append(std::string_view segment);
+    };
+
+    std::shared_ptr<const Body> m_body;
+};
+
+// Builds a Message field by field. Short fields are copied into an arena next
+// to each other; fields of at least kReferenceSize bytes passed as rvalue
+// strings are taken over and sent from where they are, so a value read from
+// the store reaches the socket without being copied.
+class MessageBuilder {
+public:
+    static constexpr size_t kReferenceSize = 256;
+
+    // Appends a copy of bytes.
+    MessageBuilder &add(std::string_view bytes);
+
+    // Appends bytes, taking the string over if it is large.
+    MessageBuilder &add(std::string &&bytes);
+
+    // Appends message as a field, so messages can nest. Its short segments
+    // are copied and the others referenced, keeping message alive.
+    MessageBuilder &add(const Message &message);
+
+    MessageBuilder &add_u64(uint64_t value);
+
+    // Writes the field table and returns the message. The builder is empty
+    // afterwards.
+    Message finish();
+
+private:
+    // Field ends kept without a heap allocation; most messages have few fields
+    static constexpr size_t kInlineFields = 8;
+
+    Message::Body &body();
+
+    void append_field(std::string_view bytes);
+
+    // Records that a field of size bytes has been appended.
+    void end_field(size_t size);
+
+    std::shared_ptr<Message::Body> m_body;
+    uint32_t m_inline_ends[kInlineFields]{};
+    std::vector<uint32_t> m_more_ends;
+    size_t m_fields = 0;
+    size_t m_data_size = 0;
+};
+
+// Reads the fields of a message in place. The bytes must outlive the view.
+class MessageView {
+public:
+    // @throws std::invalid_argument if bytes is too short for its field table.
+    explicit MessageView(std::string_view bytes);
+
+    // Number of fields
+    [[nodiscard]] size_t size() const {
+        return m_count;
+    }
+
+    // @throws std::invalid_argument if index is out of range or the field
+    // lies outside the message.
+    [[nodiscard]] std::string_view bytes(size_t index) const {
+        if (index >= m_count) {
+            throw std::invalid_argument("Message field out of range");
+        }
+        const char *ends = m_bytes.data() + m_data_size;
+        size_t begin = index == 0 ? 0 : detail::load_le<uint32_t>(ends + sizeof(uint32_t) * (index - 1));
+        size_t end = detail::load_le<uint32_t>(ends + sizeof(uint32_t) * index);
+        if (begin > end || end > m_data_size) {
+            throw std::invalid_argument("Message field out of bounds");
+        }
+        return m_bytes.substr(begin, end - begin);
+    }
+
+    // @throws std::invalid_argument as bytes(), or if the field is not 8
+    // bytes long.
+    [[nodiscard]] uint64_t u64(size_t index) const {
+        std::string_view field = bytes(index);
+        if (field.size() != sizeof(uint64_t)) {
+            throw std::invalid_argument("Message field is not an integer");
+        }
+        return detail::load_le<uint64_t>(field.data());
+    }
+
+private:
+    std::string_view m_bytes;
+    size_t m_count = 0;
+    // Size of the data, which the table follows
+    size_t m_data_size = 0;
+};
+
+#endif //FLOWDB_MESSAGE_H
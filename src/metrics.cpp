@@ -0,0 +1,209 @@
+#include "metrics.h"
+
+#include <cstdlib>
+#include <cxxabi.h>
+#include <memory>
+#include "format.h"
+
+namespace {
+
+// Counters measured in nanoseconds, which are rendered in seconds
+bool is_nanos(Metrics::Counter counter) {
+    return counter == Metrics::Counter::PoolBusyNanos || counter == Metrics::Counter::PoolIdleNanos;
+}
+
+// prefix is "" for the totals and "thread_" for a thread's own series
+void append_counter(std::string &out, const char *prefix, Metrics::Counter counter, uint64_t value,
+                    const std::string &labels) {
+    if (is_nanos(counter)) {
+        append_format(out, "flowdb_%s%s_seconds_total%s %.9f\n", prefix, Metrics::name(counter), labels.c_str(),
+                      static_cast<double>(value) / 1e9);
+    } else {
+        append_format(out, "flowdb_%s%s_total%s %llu\n", prefix, Metrics::name(counter), labels.c_str(),
+                      static_cast<unsigned long long>(value));
+    }
+}
+
+// Label values are type and thread names, which never need more than quote escaping
+std::string escape(const std::string &value) {
+    std::string escaped;
+    for (char c: value) {
+        if (c == '"' || c == '\\') {
+            escaped.push_back('\\');
+        }
+        escaped.push_back(c);
+    }
+    return escaped;
+}
+
+} // namespace
+
+const char *Metrics::name(Counter counter) {
+    switch (counter) {
+        case Counter::ActorMessagesSent:
+            return "actor_messages_sent";
+        case Counter::ActorMessagesProcessed:
+            return "actor_messages_processed";
+        case Counter::ActorMessagesDropped:
+            return "actor_messages_dropped";
+        case Counter::ActorRuns:
+            return "actor_runs";
+        case Counter::ActorMailboxFull:
+            return "actor_mailbox_full";
+        case Counter::PoolTasksRun:
+            return "pool_tasks_run";
+        case Counter::PoolTasksStolen:
+            return "pool_tasks_stolen";
+        case Counter::PoolParks:
+            return "pool_parks";
+        case Counter::PoolSubmitsRejected:
+            return "pool_submits_rejected";
+        case Counter::PoolBusyNanos:
+            return "pool_busy";
+        case Counter::PoolIdleNanos:
+            return "pool_idle";
+        case Counter::CoreTasksRun:
+            return "core_tasks_run";
+        case Counter::CoreSleeps:
+            return "core_sleeps";
+        case Counter::CoreHandoffs:
+            return "core_handoffs";
+        case Counter::CoreLaneOverflows:
+            return "core_lane_overflows";
+        case Counter::FuturesFulfilled:
+            return "futures_fulfilled";
+        case Counter::FutureCallbacksDeferred:
+            return "future_callbacks_deferred";
+        case Counter::FutureBlockingWaits:
+            return "future_blocking_waits";
+        case Counter::ConnectionCheckoutWaits:
+            return "connection_checkout_waits";
+        case Counter::ConnectionsOpened:
+            return "connections_opened";
+        case Counter::ConnectionFailures:
+            return "connection_failures";
+        case Counter::SessionReadPauses:
+            return "session_read_pauses";
+    }
+    return "unknown";
+}
+
+const char *Metrics::name(Latency latency) {
+    switch (latency) {
+        case Latency::ActorQueue:
+            return "actor_queue";
+        case Latency::PoolTask:
+            return "pool_task";
+        case Latency::FutureWait:
+            return "future_wait";
+        case Latency::ConnectionCheckout:
+            return "connection_checkout";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Reads every live shard and the retired totals under the registry
+ * lock. Latencies are rebuilt from bucket counts, so their min, max and mean
+ * carry the same <1% error as their percentiles.
+ */
+MetricsSnapshot Metrics::snapshot() {
+    MetricsSnapshot snapshot;
+    snapshot.latencies.resize(kLatencies);
+    Registry &all = registry();
+    std::unique_lock<std::mutex> lock(all.mutex);
+    snapshot.counters = all.retired_counters;
+    for (size_t i = 0; i < kLatencies; i++) {
+        const auto &sums = all.retired_latencies[i];
+        for (size_t b = 0; b < sums.size(); b++) {
+            snapshot.latencies[i].record_bucket(b, sums[b]);
+        }
+    }
+    snapshot.threads.reserve(all.live.size());
+    for (Shard *shard: all.live) {
+        auto &thread = snapshot.threads.emplace_back();
+        thread.name = shard->name;
+        for (size_t i = 0; i < kCounters; i++) {
+            thread.counters[i] = shard->counters[i].load(std::memory_order_relaxed);
+            snapshot.counters[i] += thread.counters[i];
+        }
+        for (size_t i = 0; i < kLatencies; i++) {
+            std::atomic<uint64_t> *buckets = shard->latencies[i].load(std::memory_order_acquire);
+            if (buckets == nullptr) {
+                continue;
+            }
+            for (size_t b = 0; b < Histogram::kBuckets; b++) {
+                snapshot.latencies[i].record_bucket(b, buckets[b].load(std::memory_order_relaxed));
+            }
+        }
+    }
+    return snapshot;
+}
+
+/**
+ * @brief Falls back to the mangled name if the ABI cannot demangle it.
+ */
+std::string demangle(const char *name) {
+    int status = 0;
+    std::unique_ptr<char, decltype(&std::free)> demangled(abi::__cxa_demangle(name, nullptr, nullptr, &status),
+                                                          &std::free);
+    return status == 0 && demangled ? std::string(demangled.get()) : std::string(name);
+}
+
+/**
+ * @brief Totals first, then the latency summaries, then one series per thread
+ * for every counter it moved, then one series per actor. Pool utilization is
+ * busy / (busy + idle) over each worker's lifetime.
+ */
+std::string render_metrics(const MetricsSnapshot &snapshot, const std::vector<ActorStats> &actors) {
+    std::string out;
+    for (size_t i = 0; i < Metrics::kCounters; i++) {
+        append_counter(out, "", static_cast<Metrics::Counter>(i), snapshot.counters[i], "");
+    }
+    append_format(out, "flowdb_actor_mailbox_depth %llu\n", static_cast<unsigned long long>(snapshot.mailbox_depth()));
+
+    for (size_t i = 0; i < Metrics::kLatencies; i++) {
+        const char *name = Metrics::name(static_cast<Metrics::Latency>(i));
+        const Histogram &latency = snapshot.latencies[i];
+        for (double quantile: {0.5, 0.9, 0.99, 0.999, 1.0}) {
+            append_format(out, "flowdb_%s_seconds{quantile=\"%g\"} %.9f\n", name, quantile,
+                          static_cast<double>(latency.percentile(quantile * 100)) / 1e9);
+        }
+        append_format(out, "flowdb_%s_seconds_sum %.9f\n", name,
+                      latency.mean() * static_cast<double>(latency.count()) / 1e9);
+        append_format(out, "flowdb_%s_seconds_count %llu\n", name, static_cast<unsigned long long>(latency.count()));
+    }
+
+    for (const auto &thread: snapshot.threads) {
+        std::string labels = "{thread=\"" + escape(thread.name) + "\"}";
+        for (size_t i = 0; i < Metrics::kCounters; i++) {
+            if (thread.counters[i] != 0) {
+                append_counter(out, "thread_", static_cast<Metrics::Counter>(i), thread.counters[i], labels);
+            }
+        }
+        uint64_t busy = thread.counters[static_cast<size_t>(Metrics::Counter::PoolBusyNanos)];
+        uint64_t idle = thread.counters[static_cast<size_t>(Metrics::Counter::PoolIdleNanos)];
+        if (busy + idle != 0) {
+            append_format(out, "flowdb_thread_pool_utilization%s %.4f\n", labels.c_str(),
+                          static_cast<double>(busy) / static_cast<double>(busy + idle));
+        }
+    }
+
+    for (const auto &actor: actors) {
+        std::string labels = "{actor=\"" + escape(actor.type) + "\",id=\"" + std::to_string(actor.id) + "\"}";
+        const char *series = labels.c_str();
+        append_format(out, "flowdb_actor_stats_processed_total%s %llu\n", series,
+                      static_cast<unsigned long long>(actor.processed));
+        append_format(out, "flowdb_actor_stats_runs_total%s %llu\n", series,
+                      static_cast<unsigned long long>(actor.runs));
+        append_format(out, "flowdb_actor_stats_queue_seconds_sum%s %.9f\n", series,
+                      static_cast<double>(actor.queue_nanos) / 1e9);
+        append_format(out, "flowdb_actor_stats_queue_seconds_count%s %llu\n", series,
+                      static_cast<unsigned long long>(actor.queue_samples));
+        append_format(out, "flowdb_actor_stats_backlog%s %llu\n", series,
+                      static_cast<unsigned long long>(actor.backlog));
+        append_format(out, "flowdb_actor_stats_peak_backlog%s %llu\n", series,
+                      static_cast<unsigned long long>(actor.peak_backlog));
+    }
+    return out;
+}
@@ -0,0 +1,292 @@
+#ifndef FLOWDB_METRICS_H
+#define FLOWDB_METRICS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "histogram.h"
+
+struct MetricsSnapshot;
+
+// Process-wide counters and latency histograms, updated on the hot paths of
+// the actors, the thread pool, the futures and the connection pool. A clock
+// read costs more than the rest of an update, so the per-message and per-task
+// latencies are sampled rather than read around every event.
+//
+// Every thread records into its own shard, registered on its first update, so
+// recording is a thread_local lookup and a relaxed load and store: no
+// read-modify-write and no cache line that another thread writes. snapshot()
+// adds the shards up under the registry lock, which is otherwise only taken
+// when a thread registers, is named or exits. The shards of threads that have
+// exited are folded into a retired total, so counters never go backwards.
+class Metrics {
+public:
+    enum class Counter : size_t {
+        ActorMessagesSent,
+        ActorMessagesProcessed,
+        // Messages, and coroutine resumptions, freed unhandled by a stopped actor
+        ActorMessagesDropped,
+        ActorRuns,
+        // Sends refused, or made to wait, because the actor's mailbox was full
+        ActorMailboxFull,
+        PoolTasksRun,
+        PoolTasksStolen,
+        PoolParks,
+        // Submissions from outside the pool refused by a full injection queue
+        PoolSubmitsRejected,
+        // Time workers spent running tasks, and looking for or waiting for them
+        PoolBusyNanos,
+        PoolIdleNanos,
+        // Runnables and io handlers run by thread-per-core cores (core_set.h),
+        // and the times a core blocked for lack of them
+        CoreTasksRun,
+        CoreSleeps,
+        // Runnables handed from one core to another through their lane, and
+        // those that found the lane full
+        CoreHandoffs,
+        CoreLaneOverflows,
+        FuturesFulfilled,
+        // Continuations attached before their future was ready
+        FutureCallbacksDeferred,
+        FutureBlockingWaits,
+        // Checkouts that found no idle socket and had to wait for one
+        ConnectionCheckoutWaits,
+        ConnectionsOpened,
+        ConnectionFailures,
+        // Times a server connection stopped reading its socket because too
+        // many of its requests were in flight, its responses were unread or
+        // the actor its next request was for was full
+        SessionReadPauses,
+    };
+
+    static constexpr size_t kCounters = static_cast<size_t>(Counter::SessionReadPauses) + 1;
+
+    enum class Latency : size_t {
+        // From tell() to the message being handled, sampled
+        ActorQueue,
+        // One task or actor batch on a pool worker, sampled
+        PoolTask,
+        // A thread blocked in Future::get() or wait()
+        FutureWait,
+        // From checkout() to the lease being handed out
+        ConnectionCheckout,
+    };
+
+    static constexpr size_t kLatencies = static_cast<size_t>(Latency::ConnectionCheckout) + 1;
+
+    // Names used in the text rendering
+    static const char *name(Counter counter);
+
+    static const char *name(Latency latency);
+
+    // Events too frequent to read the clock for each of them, such as
+    // messages, have their latency measured once every kSampleInterval
+    // events on each thread
+    static constexpr uint32_t kSampleInterval = 16;
+
+    // Whether the calling thread should time its current event.
+    static bool sample() {
+        return (++t_sample_tick & (kSampleInterval - 1)) == 0;
+    }
+
+    // Nanoseconds on the steady clock, the unit of every latency
+    static uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static void add(Counter counter, uint64_t amount = 1) {
+        auto &value = shard().counters[static_cast<size_t>(counter)];
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    static void record(Latency latency, uint64_t nanos) {
+        std::atomic<uint64_t> *buckets = shard().latencies[static_cast<size_t>(latency)].load(
+                std::memory_order_relaxed);
+        if (buckets == nullptr) {
+            buckets = allocate(latency);
+        }
+        auto &bucket = buckets[Histogram::bucket_of(nanos)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // Names the calling thread in the per-thread breakdown of snapshots.
+    // Threads that are never named are listed as "thread-<n>".
+    static void set_thread_name(std::string name) {
+        Shard &current = shard();
+        std::unique_lock<std::mutex> lock(registry().mutex);
+        current.name = std::move(name);
+    }
+
+    // The calling thread's name, as set_thread_name() left it.
+    static std::string thread_name() {
+        Shard &current = shard();
+        std::unique_lock<std::mutex> lock(registry().mutex);
+        return current.name;
+    }
+
+    // Adds up the shards of every thread, live or exited.
+    static MetricsSnapshot snapshot();
+
+private:
+    // One thread's metrics. Written only by that thread; read under the
+    // registry mutex by snapshot().
+    struct alignas(64) Shard {
+        std::string name;
+        std::array<std::atomic<uint64_t>, kCounters> counters{};
+        // Bucket counts laid out as in Histogram, allocated on first use
+        std::array<std::atomic<std::atomic<uint64_t> *>, kLatencies> latencies{};
+    };
+
+    // Every live shard, and the sums of the shards of exited threads
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Shard *> live;
+        size_t registered = 0;
+        std::array<uint64_t, kCounters> retired_counters{};
+        // Bucket counts, empty until a retired thread recorded the latency
+        std::array<std::vector<uint64_t>, kLatencies> retired_latencies;
+    };
+
+    // Retires the calling thread's shard when the thread exits.
+    struct Registration {
+        Shard *shard = nullptr;
+
+        ~Registration() {
+            if (shard != nullptr) {
+                retire(shard);
+            }
+        }
+    };
+
+    // Never destroyed, so threads that outlive static destruction can still
+    // retire their shards
+    static Registry &registry() {
+        static auto *registry = new Registry();
+        return *registry;
+    }
+
+    static Shard &shard() {
+        if (t_shard == nullptr) [[unlikely]] {
+            register_thread();
+        }
+        return *t_shard;
+    }
+
+    static void register_thread() {
+        thread_local Registration registration;
+        auto *created = new Shard();
+        {
+            Registry &all = registry();
+            std::unique_lock<std::mutex> lock(all.mutex);
+            created->name = "thread-" + std::to_string(all.registered++);
+            all.live.push_back(created);
+        }
+        registration.shard = created;
+        t_shard = created;
+    }
+
+    // Metrics recorded by thread_local destructors that run after the
+    // thread's shard was retired land here and are never read
+    static Shard &discarded() {
+        static auto *shard = new Shard();
+        return *shard;
+    }
+
+    static void retire(Shard *retired) {
+        t_shard = &discarded();
+        Registry &all = registry();
+        std::unique_lock<std::mutex> lock(all.mutex);
+        std::erase(all.live, retired);
+        for (size_t i = 0; i < kCounters; i++) {
+            all.retired_counters[i] += retired->counters[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < kLatencies; i++) {
+            std::atomic<uint64_t> *buckets = retired->latencies[i].load(std::memory_order_relaxed);
+            if (buckets == nullptr) {
+                continue;
+            }
+            auto &sums = all.retired_latencies[i];
+            sums.resize(Histogram::kBuckets);
+            for (size_t b = 0; b < Histogram::kBuckets; b++) {
+                sums[b] += buckets[b].load(std::memory_order_relaxed);
+            }
+            delete[] buckets;
+        }
+        delete retired;
+    }
+
+    // Publishes the calling thread's buckets for a latency it records for the
+    // first time.
+    static std::atomic<uint64_t> *allocate(Latency latency) {
+        auto *buckets = new std::atomic<uint64_t>[Histogram::kBuckets]();
+        shard().latencies[static_cast<size_t>(latency)].store(buckets, std::memory_order_release);
+        return buckets;
+    }
+
+    static inline thread_local Shard *t_shard = nullptr;
+    static inline thread_local uint32_t t_sample_tick = 0;
+};
+
+// Sums of every thread's metrics at one point in time. Each metric is exact up
+// to the updates that were in flight while it was read.
+struct MetricsSnapshot {
+    struct Thread {
+        std::string name;
+        std::array<uint64_t, Metrics::kCounters> counters{};
+    };
+
+    [[nodiscard]] uint64_t counter(Metrics::Counter counter) const {
+        return counters[static_cast<size_t>(counter)];
+    }
+
+    [[nodiscard]] const Histogram &latency(Metrics::Latency latency) const {
+        return latencies[static_cast<size_t>(latency)];
+    }
+
+    // Messages sent to actors and neither handled nor dropped yet, across all
+    // actors
+    [[nodiscard]] uint64_t mailbox_depth() const {
+        uint64_t sent = counter(Metrics::Counter::ActorMessagesSent);
+        uint64_t done = counter(Metrics::Counter::ActorMessagesProcessed) +
+                        counter(Metrics::Counter::ActorMessagesDropped);
+        return sent > done ? sent - done : 0;
+    }
+
+    std::array<uint64_t, Metrics::kCounters> counters{};
+    // Indexed by Metrics::Latency; kept on the heap, as each is ~60 KB
+    std::vector<Histogram> latencies;
+    // Live threads, in the order they first recorded
+    std::vector<Thread> threads;
+};
+
+// One actor's counters, kept by the actor itself and read by Runtime::actor_stats().
+struct ActorStats {
+    // Demangled type of the actor and its position among the runtime's actors
+    std::string type;
+    size_t id = 0;
+    uint64_t processed = 0;
+    uint64_t runs = 0;
+    // Total time its sampled messages waited to be handled, and their number
+    uint64_t queue_nanos = 0;
+    uint64_t queue_samples = 0;
+    // Messages taken from the mailbox but not handled at the end of its last
+    // run, and the most it has ever had
+    uint64_t backlog = 0;
+    uint64_t peak_backlog = 0;
+};
+
+// Readable form of a std::type_info name, for ActorStats::type.
+std::string demangle(const char *name);
+
+// Renders a snapshot and per-actor counters in the Prometheus text format.
+std::string render_metrics(const MetricsSnapshot &snapshot, const std::vector<ActorStats> &actors);
+
+#endif //FLOWDB_METRICS_H
@@ -0,0 +1,214 @@
+#include "multiplexed_connection.h"
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "trace.h"
+
+namespace {
+
+// The span a request is sent under: the caller's, or a new one for a call
+// made outside of any span. 0 while tracing is off, which sends no span.
+uint64_t request_span(Opcode opcode) {
+    if (!Trace::enabled()) [[likely]] {
+        return 0;
+    }
+    uint64_t span = Trace::current() != 0 ? Trace::current() : Trace::new_span();
+    Trace::emit(Trace::Event::RequestSent, nullptr, span, static_cast<uint64_t>(opcode));
+    return span;
+}
+
+} // namespace
+
+/**
+ * @brief Constructor for MultiplexedConnection class.
+ *
+ * @param lease A checked-out socket. The checkout itself is not timed, since
+ * it is held across many requests; the requests are timed instead.
+ */
+MultiplexedConnection::MultiplexedConnection(ConnectionPool::Lease lease)
+        : m_lease(std::move(lease)), m_endpoint(m_lease.endpoint()), m_selector(m_lease.selector()),
+          m_endpoint_index(m_lease.endpoint_index()),
+          m_strand(boost::asio::make_strand(m_lease.socket().get_executor())) {
+    m_lease.untimed();
+}
+
+void MultiplexedConnection::start() {
+    boost::asio::post(m_strand, [self = shared_from_this()] { self->read(); });
+}
+
+Future<BufferSlice> MultiplexedConnection::request(Opcode opcode, const Message &payload) {
+    return enqueue([opcode, &payload, span = request_span(opcode)](FrameQueue &queue, uint64_t id) {
+        queue.push(opcode, 0, id, payload, span);
+    });
+}
+
+Future<BufferSlice> MultiplexedConnection::request(Opcode opcode, std::string_view payload) {
+    return enqueue([opcode, payload, span = request_span(opcode)](FrameQueue &queue, uint64_t id) {
+        queue.push(opcode, 0, id, payload, span);
+    });
+}
+
+/**
+ * @brief Queues a request frame and returns the future for its response.
+ *
+ * Only the request that finds no write scheduled posts a flush; requests that
+ * arrive before it runs ride along in the same write.
+ */
+template<typename Push>
+Future<BufferSlice> MultiplexedConnection::enqueue(Push push) {
+    Promise<BufferSlice> promise;
+    auto future = promise.get_future();
+    bool schedule;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_error) {
+            lock.unlock();
+            promise.set_exception(m_error);
+            return future;
+        }
+        uint64_t id = m_next_id++;
+        push(m_queued, id);
+        m_pending.emplace(id, Pending{std::move(promise), std::chrono::steady_clock::now()});
+        m_selector.on_start(m_endpoint_index);
+        schedule = !std::exchange(m_write_scheduled, true);
+    }
+    if (schedule) {
+        boost::asio::post(m_strand, [self = shared_from_this()] { self->flush(); });
+    }
+    return future;
+}
+
+void MultiplexedConnection::flush() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_queued.empty() || m_error) {
+            m_write_scheduled = false;
+            return;
+        }
+        m_writing.clear();
+        m_writing.swap(m_queued);
+    }
+    boost::asio::async_write(m_lease.socket(), m_writing.buffers(),
+                             boost::asio::bind_executor(m_strand, [self = shared_from_this()](
+                                     const boost::system::error_code &ec, size_t bytes) {
+                                 if (Trace::enabled()) [[unlikely]] {
+                                     Trace::emit(Trace::Event::SocketWrite, nullptr, 0, bytes);
+                                 }
+                                 if (self->m_closed) {
+                                     return;
+                                 }
+                                 if (ec) {
+                                     self->fail(std::make_exception_ptr(boost::system::system_error(ec)));
+                                     return;
+                                 }
+                                 // Pick up whatever was queued while this write was in flight
+                                 self->flush();
+                             }));
+}
+
+void MultiplexedConnection::read() {
+    auto [data, size] = m_reader.prepare();
+    m_lease.socket().async_read_some(boost::asio::buffer(data, size),
+                                     boost::asio::bind_executor(m_strand, [self = shared_from_this()](
+                                             const boost::system::error_code &ec, size_t bytes) {
+                                         self->on_read(ec, bytes);
+                                     }));
+}
+
+/**
+ * @brief Completes every response contained in one read. Promises are looked
+ * up under the lock but fulfilled after it is released, so continuations never
+ * run with the connection locked.
+ */
+void MultiplexedConnection::on_read(const boost::system::error_code &ec, size_t bytes) {
+    if (m_closed) {
+        return;
+    }
+    if (ec) {
+        fail(std::make_exception_ptr(boost::system::system_error(ec)));
+        return;
+    }
+    if (Trace::enabled()) [[unlikely]] {
+        Trace::emit(Trace::Event::SocketRead, nullptr, 0, bytes);
+    }
+    m_reader.commit(bytes);
+    std::vector<std::pair<Promise<BufferSlice>, Frame>> completed;
+    try {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Frame frame;
+        auto now = std::chrono::steady_clock::now();
+        while (m_reader.next(frame)) {
+            auto it = m_pending.find(frame.header.request_id);
+            if (it == m_pending.end()) {
+                throw std::runtime_error("Response to an unknown request");
+            }
+            m_selector.on_success(m_endpoint_index, now - it->second.sent);
+            completed.emplace_back(std::move(it->second.promise), frame);
+            m_pending.erase(it);
+        }
+    } catch (const std::exception &) {
+        fail(std::current_exception());
+        return;
+    }
+    for (auto &[promise, frame]: completed) {
+        if (frame.header.flags & FrameHeader::kWrongShard) {
+            promise.set_exception(std::make_exception_ptr(WrongShard(std::string(frame.payload))));
+        } else if (frame.header.flags & FrameHeader::kError) {
+            promise.set_exception(std::make_exception_ptr(std::runtime_error(std::string(frame.payload))));
+        } else {
+            promise.set_value(m_reader.retain(frame));
+        }
+    }
+    read();
+}
+
+Future<Void> MultiplexedConnection::close() {
+    Promise<Void> closed;
+    auto future = closed.get_future();
+    boost::asio::post(m_strand, [self = shared_from_this(), closed = std::move(closed)]() mutable {
+        self->fail(std::make_exception_ptr(std::runtime_error("Connection closed")));
+        closed.set_value();
+    });
+    return future;
+}
+
+bool MultiplexedConnection::closed() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_error != nullptr;
+}
+
+size_t MultiplexedConnection::in_flight() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_pending.size();
+}
+
+/**
+ * @brief Fails every outstanding request, closes the socket and releases the
+ * lease. The lease is invalidated, since the byte stream may stop in the
+ * middle of a frame. Handlers that complete afterwards see m_closed and leave
+ * the socket alone.
+ */
+void MultiplexedConnection::fail(std::exception_ptr error) {
+    if (m_closed) {
+        return;
+    }
+    m_closed = true;
+    std::unordered_map<uint64_t, Pending> pending;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_error = error;
+        pending.swap(m_pending);
+        m_queued.clear();
+    }
+    for (size_t i = 0; i < pending.size(); i++) {
+        m_selector.on_abandon(m_endpoint_index);
+    }
+    boost::system::error_code ec;
+    m_lease.socket().close(ec);
+    m_lease.invalidate();
+    m_lease.release();
+    for (auto &[id, request]: pending) {
+        request.promise.set_exception(error);
+    }
+}
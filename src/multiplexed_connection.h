@@ -0,0 +1,120 @@
+#ifndef FLOWDB_MULTIPLEXED_CONNECTION_H
+#define FLOWDB_MULTIPLEXED_CONNECTION_H
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "connection_pool.h"
+#include "buffer_pool.h"
+#include "frame.h"
+#include "frame_queue.h"
+#include "future.h"
+#include "message.h"
+
+using boost::asio::ip::tcp;
+
+// Client end of a framed connection. Any number of requests can be in flight
+// at once: each gets a request id and a promise, requests issued while a write
+// is in progress are coalesced into the next write, and responses are matched
+// to their promises by id in whatever order the server sends them. A handful
+// of these per endpoint is enough to keep a server busy.
+//
+// Request messages are written by a gathered write from where they were
+// built, and responses are handed out as slices of the pooled receive buffer,
+// so neither direction copies a payload.
+//
+// Every request is reported to the pool's EndpointSelector as it is sent and
+// answered, with its latency, so latency-aware selection sees the traffic of
+// long-lived connections as well. Error responses count as answers: the
+// endpoint served them. Requests failed by a broken or closed connection are
+// only taken off the endpoint's load; the broken socket itself is reported
+// once, as a failure, when the lease goes away.
+//
+// Holds a pooled socket until it is closed or fails. Create it with
+// make_shared and call start() before issuing requests; all socket work runs
+// on a strand of the pool's io_context. When the connection fails or is
+// closed, every outstanding request fails and the socket is handed back to
+// the pool to be discarded.
+class MultiplexedConnection : public std::enable_shared_from_this<MultiplexedConnection> {
+public:
+    explicit MultiplexedConnection(ConnectionPool::Lease lease);
+
+    MultiplexedConnection(const MultiplexedConnection &) = delete;
+
+    MultiplexedConnection &operator=(const MultiplexedConnection &) = delete;
+
+    // Starts reading responses.
+    void start();
+
+    // Sends a request. The future holds the response payload, or a
+    // std::runtime_error carrying the server's message for error responses,
+    // or WrongShard if the server does not serve the request's key.
+    Future<BufferSlice> request(Opcode opcode, const Message &payload);
+
+    // Sends a request with a copy of payload.
+    Future<BufferSlice> request(Opcode opcode, std::string_view payload);
+
+    // Fails outstanding requests and gives the socket back. The future is
+    // ready once the connection no longer refers to the pool.
+    Future<Void> close();
+
+    // True once the connection has failed or been closed; requests then fail
+    // at once
+    [[nodiscard]] bool closed() const;
+
+    // Number of requests waiting for a response
+    [[nodiscard]] size_t in_flight() const;
+
+    [[nodiscard]] const tcp::endpoint &endpoint() const {
+        return m_endpoint;
+    }
+
+private:
+    // Writes everything queued so far in one go. Runs on the strand.
+    void flush();
+
+    void read();
+
+    void on_read(const boost::system::error_code &ec, size_t bytes);
+
+    // Fails outstanding requests and releases the lease. Runs on the strand.
+    void fail(std::exception_ptr error);
+
+    struct Pending {
+        Promise<BufferSlice> promise;
+        std::chrono::steady_clock::time_point sent;
+    };
+
+    // Queues a frame built by push(m_queued, id).
+    template<typename Push>
+    Future<BufferSlice> enqueue(Push push);
+
+    ConnectionPool::Lease m_lease;
+    tcp::endpoint m_endpoint;
+    // Where requests are reported; only used while the lease is held
+    EndpointSelector &m_selector;
+    size_t m_endpoint_index;
+    boost::asio::strand<boost::asio::any_io_executor> m_strand;
+    FrameReader m_reader;
+
+    mutable std::mutex m_mutex;
+    // Frames not yet handed to the socket
+    FrameQueue m_queued;
+    // Frames in the write in progress; only touched on the strand
+    FrameQueue m_writing;
+    // Set by fail(); only touched on the strand
+    bool m_closed = false;
+    bool m_write_scheduled = false;
+    uint64_t m_next_id = 1;
+    std::unordered_map<uint64_t, Pending> m_pending;
+    // Set once the connection has failed or been closed
+    std::exception_ptr m_error;
+};
+
+#endif //FLOWDB_MULTIPLEXED_CONNECTION_H
@@ -0,0 +1,76 @@
+#ifndef FLOWDB_MVCC_H
+#define FLOWDB_MVCC_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Vocabulary shared by the pieces of optimistic transactions: the resolver,
+// the multi-version store and the client-side Transaction.
+//
+// Versions order commits. They advance with time, about kVersionsPerSecond a
+// second, and every commit batch gets a fresh one, so a version is also a
+// rough timestamp: the MVCC window, the span of old versions the store keeps
+// and the resolver can check against, is a number of versions.
+using Version = int64_t;
+
+constexpr Version kVersionsPerSecond = 1'000'000;
+
+// Versions kept readable behind the newest one by default (five seconds)
+constexpr Version kDefaultMvccWindow = 5 * kVersionsPerSecond;
+
+// Half-open range of keys [begin, end)
+struct KeyRange {
+    std::string begin;
+    std::string end;
+};
+
+// The range holding only key: key followed by a zero byte is the next key.
+inline KeyRange single_key_range(std::string_view key) {
+    std::string end;
+    end.reserve(key.size() + 1);
+    end.append(key);
+    end.push_back('\0');
+    return KeyRange{std::string(key), std::move(end)};
+}
+
+// A buffered write. first is the key, or the beginning of the range for
+// ClearRange; second is the value for Set and the end of the range for
+// ClearRange.
+struct Mutation {
+    enum class Type : uint8_t {
+        Set = 1,
+        Clear = 2,
+        ClearRange = 3,
+    };
+
+    Type type;
+    std::string first;
+    std::string second;
+};
+
+enum class TransactionError {
+    // A transaction committed since the read version wrote something this
+    // one read; retrying with a new read version may succeed
+    NotCommitted,
+    // The read version fell out of the MVCC window
+    TooOld,
+};
+
+class TransactionFailed : public std::runtime_error {
+public:
+    explicit TransactionFailed(TransactionError code)
+            : std::runtime_error(code == TransactionError::NotCommitted ? "Transaction not committed due to conflict"
+                                                                        : "Transaction is too old"),
+              m_code(code) {}
+
+    [[nodiscard]] TransactionError code() const {
+        return m_code;
+    }
+
+private:
+    TransactionError m_code;
+};
+
+#endif //FLOWDB_MVCC_H
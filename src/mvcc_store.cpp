@@ -0,0 +1,112 @@
+#include "mvcc_store.h"
+
+void MultiVersionStore::apply(Version version, const std::vector<Mutation> &mutations) {
+    for (const auto &mutation: mutations) {
+        switch (mutation.type) {
+            case Mutation::Type::Set:
+                write(mutation.first, version, mutation.second);
+                break;
+            case Mutation::Type::Clear: {
+                auto it = m_keys.find(mutation.first);
+                if (it != m_keys.end() && it->second.back().value) {
+                    write(mutation.first, version, std::nullopt);
+                }
+                break;
+            }
+            case Mutation::Type::ClearRange:
+                for (auto it = m_keys.lower_bound(mutation.first);
+                     it != m_keys.end() && it->first < mutation.second; ++it) {
+                    if (it->second.back().value) {
+                        write(it->first, version, std::nullopt);
+                    }
+                }
+                break;
+        }
+    }
+    m_version = version;
+    collect(oldest_version());
+}
+
+std::optional<std::string> MultiVersionStore::get(std::string_view key, Version version) const {
+    check_version(version);
+    auto it = m_keys.find(key);
+    if (it == m_keys.end()) {
+        return std::nullopt;
+    }
+    const Entry *entry = visible(it->second, version);
+    return entry != nullptr ? entry->value : std::nullopt;
+}
+
+size_t MultiVersionStore::range(std::string_view begin, std::string_view end, Version version, size_t limit,
+                                std::vector<KeyValue> &out) const {
+    check_version(version);
+    size_t count = 0;
+    for (auto it = m_keys.lower_bound(begin); it != m_keys.end() && it->first < end && count < limit; ++it) {
+        const Entry *entry = visible(it->second, version);
+        if (entry != nullptr && entry->value) {
+            out.push_back(KeyValue{it->first, *entry->value});
+            count++;
+        }
+    }
+    return count;
+}
+
+void MultiVersionStore::write(std::string_view key, Version version, std::optional<std::string> value) {
+    auto it = m_keys.find(key);
+    if (it == m_keys.end()) {
+        it = m_keys.emplace(std::string(key), Chain()).first;
+    }
+    Chain &chain = it->second;
+    if (!chain.empty() && chain.back().version == version) {
+        chain.back().value = std::move(value);
+        return;
+    }
+    chain.push_back(Entry{version, std::move(value)});
+    m_versions++;
+    m_writes.emplace_back(version, it->first);
+}
+
+/**
+ * @brief Trims the chains of the keys written at or before oldest.
+ *
+ * Reads happen at oldest or later, so of the versions not newer than oldest
+ * only the last is visible. A key whose only remaining version is such a
+ * clear is removed altogether.
+ */
+void MultiVersionStore::collect(Version oldest) {
+    while (!m_writes.empty() && m_writes.front().first <= oldest) {
+        auto it = m_keys.find(m_writes.front().second);
+        m_writes.pop_front();
+        if (it == m_keys.end()) {
+            continue;
+        }
+        Chain &chain = it->second;
+        size_t keep = 0;
+        while (keep + 1 < chain.size() && chain[keep + 1].version <= oldest) {
+            keep++;
+        }
+        chain.erase(chain.begin(), chain.begin() + static_cast<std::ptrdiff_t>(keep));
+        m_versions -= keep;
+        if (chain.size() == 1 && !chain.front().value && chain.front().version <= oldest) {
+            m_keys.erase(it);
+            m_versions--;
+        }
+    }
+}
+
+void MultiVersionStore::check_version(Version version) const {
+    if (version < oldest_version()) {
+        throw TransactionFailed(TransactionError::TooOld);
+    }
+}
+
+const MultiVersionStore::Entry *MultiVersionStore::visible(const Chain &chain, Version version) {
+    // Chains are short and reads are mostly of recent versions, so search
+    // from the newest end
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        if (it->version <= version) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,99 @@
+#ifndef FLOWDB_MVCC_STORE_H
+#define FLOWDB_MVCC_STORE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "mvcc.h"
+#include "ordered_store.h"
+
+// In-memory store that keeps every version of a key written within the MVCC
+// window, so a transaction reads a consistent snapshot at its read version
+// while newer commits are applied. It is not thread-safe; the actor that owns
+// it serialises access.
+//
+// Each key maps to its versions in ascending order, a cleared key ending in an
+// empty version. Versions that no read inside the window can see any more are
+// dropped as the window moves: every write is also queued in version order,
+// and once it falls out of the window the chain of its key is trimmed, so
+// garbage collection costs time in proportion to the writes rather than to the
+// size of the store.
+class MultiVersionStore {
+public:
+    explicit MultiVersionStore(Version window = kDefaultMvccWindow) : m_window(window) {}
+
+    // Applies the mutations of one commit batch at version, which must be
+    // newer than every version applied before.
+    void apply(Version version, const std::vector<Mutation> &mutations);
+
+    // The value of key as of version.
+    //
+    // @throws TransactionFailed if version is older than oldest_version().
+    [[nodiscard]] std::optional<std::string> get(std::string_view key, Version version) const;
+
+    // Appends up to limit key-value pairs in [begin, end) as of version to
+    // out, in key order, and returns how many were appended.
+    //
+    // @throws TransactionFailed if version is older than oldest_version().
+    size_t range(std::string_view begin, std::string_view end, Version version, size_t limit,
+                 std::vector<KeyValue> &out) const;
+
+    // The newest version applied
+    [[nodiscard]] Version version() const {
+        return m_version;
+    }
+
+    // The oldest version that can still be read
+    [[nodiscard]] Version oldest_version() const {
+        return std::max<Version>(m_version - m_window, 0);
+    }
+
+    // Number of keys with at least one version kept
+    [[nodiscard]] size_t size() const {
+        return m_keys.size();
+    }
+
+    // Number of versions kept, of all keys
+    [[nodiscard]] size_t versions() const {
+        return m_versions;
+    }
+
+private:
+    struct Entry {
+        Version version;
+        // Empty if the key was cleared at version
+        std::optional<std::string> value;
+    };
+
+    using Chain = std::vector<Entry>;
+
+    // Appends a version to key's chain, replacing one at the same version.
+    void write(std::string_view key, Version version, std::optional<std::string> value);
+
+    // Drops the versions of every key written before oldest that no read at
+    // oldest or later can see.
+    void collect(Version oldest);
+
+    void check_version(Version version) const;
+
+    // The entry of chain visible at version, or nullptr
+    static const Entry *visible(const Chain &chain, Version version);
+
+    std::map<std::string, Chain, std::less<>> m_keys;
+
+    // Keys in the order they were written, with the version of the write
+    std::deque<std::pair<Version, std::string>> m_writes;
+
+    Version m_window;
+    Version m_version = 0;
+    size_t m_versions = 0;
+};
+
+#endif //FLOWDB_MVCC_STORE_H
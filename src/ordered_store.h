@@ -0,0 +1,62 @@
+#ifndef FLOWDB_ORDERED_STORE_H
+#define FLOWDB_ORDERED_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct KeyValue {
+    std::string key;
+    std::string value;
+};
+
+// Ordered map from byte-string keys to byte-string values: the interface the
+// storage actor serves requests from, implemented in memory by BTree and on
+// disk by LsmTree. Implementations need not be thread-safe.
+class OrderedStore {
+public:
+    virtual ~OrderedStore() = default;
+
+    // Looks up a key, copying its value into value if it is present.
+    virtual bool get(std::string_view key, std::string &value) const = 0;
+
+    std::optional<std::string> get(std::string_view key) const {
+        std::string value;
+        if (!get(key, value)) {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    // Inserts the key or overwrites its value.
+    virtual void set(std::string_view key, std::string_view value) = 0;
+
+    // Removes a key. Returns false if it was not present.
+    virtual bool clear(std::string_view key) = 0;
+
+    // Removes every key in [begin, end) and returns how many there were.
+    virtual size_t clear_range(std::string_view begin, std::string_view end) = 0;
+
+    // Appends up to limit entries with begin <= key < end to out, in key
+    // order, and returns how many were appended.
+    virtual size_t range(std::string_view begin, std::string_view end, size_t limit,
+                         std::vector<KeyValue> &out) const = 0;
+
+    // Tags the writes that follow with the position in a write-ahead log of
+    // the record that carries them. Positions only grow.
+    virtual void set_log_position(uint64_t) {
+    }
+
+    // The newest log position whose writes the store has made durable on its
+    // own, so the log up to it can be dropped and replay can start after it;
+    // 0 for a store, like BTree, that keeps nothing durable. Safe to call from
+    // any thread.
+    [[nodiscard]] virtual uint64_t durable_log_position() const {
+        return 0;
+    }
+};
+
+#endif //FLOWDB_ORDERED_STORE_H
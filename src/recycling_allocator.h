@@ -0,0 +1,189 @@
+#ifndef FLOWDB_RECYCLING_ALLOCATOR_H
+#define FLOWDB_RECYCLING_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Per-thread slab pools for short-lived, similarly sized objects: coroutine
+// frames, promise/future shared states, continuations, mailbox nodes and pool
+// tasks. Requests are bucketed into 64-byte size classes; each thread keeps a
+// free list per class and refills it by carving a fresh slab, so steady-state
+// allocation and release never reach malloc.
+//
+// Objects are often allocated on one thread and released on another (a sender
+// allocates a message, the actor's worker frees it). A thread whose free list
+// grows past kMaxCachedPerClass hands a batch to a global depot, and a thread
+// that runs dry takes a batch from the depot before carving a new slab. Slabs
+// are never returned to the system.
+class RecyclingAllocator {
+public:
+    static void *allocate(size_t size) {
+        size_t size_class = class_of(size);
+        if (size_class >= kNumClasses) {
+            return ::operator new(size);
+        }
+        FreeList &list = t_cache.lists[size_class];
+        if (list.head == nullptr) {
+            refill(size_class, list);
+        }
+        FreeBlock *block = list.head;
+        list.head = block->next;
+        list.count--;
+        return block;
+    }
+
+    static void deallocate(void *ptr, size_t size) {
+        size_t size_class = class_of(size);
+        if (size_class >= kNumClasses) {
+            ::operator delete(ptr);
+            return;
+        }
+        FreeList &list = t_cache.lists[size_class];
+        auto *block = static_cast<FreeBlock *>(ptr);
+        block->next = list.head;
+        list.head = block;
+        list.count++;
+        if (list.count >= kMaxCachedPerClass) {
+            release_batch(size_class, list);
+        }
+    }
+
+private:
+    static constexpr size_t kGranularity = 64;
+    static constexpr size_t kNumClasses = 32;
+    static constexpr size_t kSlabSize = 64 * 1024;
+    static constexpr uint32_t kTransferBatch = 256;
+    static constexpr uint32_t kMaxCachedPerClass = 2 * kTransferBatch;
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    struct FreeList {
+        FreeBlock *head;
+        uint32_t count;
+    };
+
+    // Trivially destructible so the fast paths need no TLS initialisation
+    // guard; Flusher hands the lists back to the depot at thread exit.
+    struct Cache {
+        FreeList lists[kNumClasses];
+    };
+
+    struct Flusher {
+        ~Flusher() {
+            for (size_t size_class = 0; size_class < kNumClasses; size_class++) {
+                FreeList &list = t_cache.lists[size_class];
+                if (list.head != nullptr) {
+                    std::unique_lock<std::mutex> lock(depot().mutex);
+                    depot().batches[size_class].push_back(list);
+                }
+                list = FreeList{nullptr, 0};
+            }
+        }
+    };
+
+    struct Depot {
+        std::mutex mutex;
+        std::vector<FreeList> batches[kNumClasses];
+    };
+
+    static size_t class_of(size_t size) {
+        return size == 0 ? 0 : (size - 1) / kGranularity;
+    }
+
+    static size_t class_size(size_t size_class) {
+        return (size_class + 1) * kGranularity;
+    }
+
+    // Intentionally leaked: blocks may be released during static destruction.
+    static Depot &depot() {
+        static Depot *depot = new Depot();
+        return *depot;
+    }
+
+    static void register_flusher() {
+        static thread_local Flusher flusher;
+        (void) flusher;
+    }
+
+    static void refill(size_t size_class, FreeList &list) {
+        register_flusher();
+        {
+            std::unique_lock<std::mutex> lock(depot().mutex);
+            auto &batches = depot().batches[size_class];
+            if (!batches.empty()) {
+                list = batches.back();
+                batches.pop_back();
+                return;
+            }
+        }
+        size_t block_size = class_size(size_class);
+        size_t blocks = kSlabSize / block_size;
+        auto *slab = static_cast<char *>(::operator new(blocks * block_size));
+        for (size_t i = blocks; i-- > 0;) {
+            auto *block = reinterpret_cast<FreeBlock *>(slab + i * block_size);
+            block->next = list.head;
+            list.head = block;
+        }
+        list.count += static_cast<uint32_t>(blocks);
+    }
+
+    static void release_batch(size_t size_class, FreeList &list) {
+        register_flusher();
+        FreeList batch{list.head, 0};
+        FreeBlock *tail = list.head;
+        for (uint32_t i = 1; i < kTransferBatch; i++) {
+            tail = tail->next;
+        }
+        list.head = tail->next;
+        list.count -= kTransferBatch;
+        tail->next = nullptr;
+        batch.count = kTransferBatch;
+        std::unique_lock<std::mutex> lock(depot().mutex);
+        depot().batches[size_class].push_back(batch);
+    }
+
+    static inline thread_local constinit Cache t_cache{};
+};
+
+// Routes a class's operator new/delete through RecyclingAllocator.
+struct Recycled {
+    static void *operator new(size_t size) {
+        return RecyclingAllocator::allocate(size);
+    }
+
+    static void operator delete(void *ptr, size_t size) {
+        RecyclingAllocator::deallocate(ptr, size);
+    }
+};
+
+// Standard allocator over RecyclingAllocator, e.g. for std::allocate_shared.
+template<typename T>
+class RecyclingStdAllocator {
+public:
+    using value_type = T;
+
+    RecyclingStdAllocator() noexcept = default;
+
+    template<typename U>
+    RecyclingStdAllocator(const RecyclingStdAllocator<U> &) noexcept {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(RecyclingAllocator::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *ptr, size_t n) noexcept {
+        RecyclingAllocator::deallocate(ptr, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const RecyclingStdAllocator<U> &) const noexcept {
+        return true;
+    }
+};
+
+#endif //FLOWDB_RECYCLING_ALLOCATOR_H
@@ -0,0 +1,166 @@
+#include "request_batcher.h"
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Requests gathered for one endpoint. Closed once it is handed to send(),
+// after which the requests belong to the sender.
+struct RequestBatcher::Batch {
+    tcp::endpoint endpoint;
+    std::vector<Opcode> opcodes;
+    std::vector<Message> payloads;
+    std::vector<Promise<BufferSlice>> promises;
+    size_t bytes = 0;
+    bool closed = false;
+};
+
+namespace {
+
+// Completes each request's promise with its part of a batch response. The
+// response is checked as a whole first; if it is malformed, or the batch
+// failed, every request fails with that error.
+void fan_out(const Future<BufferSlice> &response, std::vector<Promise<BufferSlice>> &promises) {
+    std::vector<std::pair<uint64_t, std::string_view>> parts;
+    BufferSlice slice;
+    try {
+        slice = response.get();
+        MessageView batch(slice.view());
+        if (batch.size() != 2 * promises.size()) {
+            throw std::invalid_argument("Malformed batch response");
+        }
+        parts.reserve(promises.size());
+        for (size_t i = 0; i < batch.size(); i += 2) {
+            parts.emplace_back(batch.u64(i), batch.bytes(i + 1));
+        }
+    } catch (...) {
+        for (auto &promise: promises) {
+            promise.set_exception(std::current_exception());
+        }
+        return;
+    }
+    for (size_t i = 0; i < promises.size(); i++) {
+        auto [flags, bytes] = parts[i];
+        if (flags & FrameHeader::kWrongShard) {
+            promises[i].set_exception(std::make_exception_ptr(WrongShard(std::string(bytes))));
+        } else if (flags & FrameHeader::kError) {
+            promises[i].set_exception(std::make_exception_ptr(std::runtime_error(std::string(bytes))));
+        } else {
+            promises[i].set_value(slice.slice(bytes));
+        }
+    }
+}
+
+} // namespace
+
+/**
+ * @brief Constructor for RequestBatcher class.
+ *
+ * @param send Sends a frame to an endpoint; called for every closed batch,
+ * from whichever thread closed it.
+ * @param options The window and the size limits of a batch.
+ */
+RequestBatcher::RequestBatcher(Send send, Options options)
+        : m_send(std::move(send)), m_options(options),
+          m_windows([this](std::vector<std::shared_ptr<Batch>> &due) { expire(due); }) {}
+
+RequestBatcher::~RequestBatcher() {
+    m_windows.stop();
+    flush();
+}
+
+/**
+ * @brief Appends the request to the endpoint's open batch, opening one and
+ * arming its window if there is none, and sends the batch at once if the
+ * request filled it.
+ */
+Future<BufferSlice> RequestBatcher::request(const tcp::endpoint &endpoint, Opcode opcode, Message payload) {
+    Future<BufferSlice> result;
+    std::shared_ptr<Batch> full;
+    std::shared_ptr<Batch> opened;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto &batch = m_open[endpoint];
+        if (!batch) {
+            batch = std::make_shared<Batch>();
+            batch->endpoint = endpoint;
+            opened = batch;
+        }
+        batch->bytes += payload.size();
+        batch->opcodes.push_back(opcode);
+        batch->payloads.push_back(std::move(payload));
+        result = batch->promises.emplace_back().get_future();
+        if (batch->promises.size() >= m_options.max_requests || batch->bytes >= m_options.max_bytes) {
+            batch->closed = true;
+            full = std::move(batch);
+            m_open.erase(endpoint);
+        }
+    }
+    if (opened) {
+        m_windows.push(std::chrono::steady_clock::now() + m_options.window, std::move(opened));
+    }
+    if (full) {
+        send(*full);
+    }
+    return result;
+}
+
+void RequestBatcher::flush() {
+    std::vector<std::shared_ptr<Batch>> batches;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (auto &[endpoint, batch]: m_open) {
+            batch->closed = true;
+            batches.push_back(std::move(batch));
+        }
+        m_open.clear();
+    }
+    for (auto &batch: batches) {
+        send(*batch);
+    }
+}
+
+/**
+ * @brief Sends a lone request as it is, and anything more as a Batch frame
+ * whose response is fanned out to the requests' promises.
+ */
+void RequestBatcher::send(Batch &batch) {
+    m_frames.fetch_add(1, std::memory_order_relaxed);
+    m_requests.fetch_add(batch.promises.size(), std::memory_order_relaxed);
+    if (batch.promises.size() == 1) {
+        m_send(batch.endpoint, batch.opcodes[0], std::move(batch.payloads[0])).forward_to(
+                std::move(batch.promises[0]));
+        return;
+    }
+    MessageBuilder builder;
+    for (size_t i = 0; i < batch.promises.size(); i++) {
+        builder.add_u64(static_cast<uint64_t>(batch.opcodes[i])).add(batch.payloads[i]);
+    }
+    Future<BufferSlice> response = m_send(batch.endpoint, Opcode::Batch, builder.finish());
+    response.on_ready([response, promises = std::move(batch.promises)]() mutable {
+        fan_out(response, promises);
+    });
+}
+
+/**
+ * @brief Sends every batch that was not sent early for being full. Batches
+ * are sent without the lock held.
+ */
+void RequestBatcher::expire(std::vector<std::shared_ptr<Batch>> &due) {
+    std::vector<std::shared_ptr<Batch>> batches;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (auto &batch: due) {
+            if (!batch->closed) {
+                batch->closed = true;
+                m_open.erase(batch->endpoint);
+                batches.push_back(std::move(batch));
+            }
+        }
+    }
+    for (auto &batch: batches) {
+        send(*batch);
+    }
+}
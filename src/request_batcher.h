@@ -0,0 +1,106 @@
+#ifndef FLOWDB_REQUEST_BATCHER_H
+#define FLOWDB_REQUEST_BATCHER_H
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "buffer_pool.h"
+#include "deadline_queue.h"
+#include "frame.h"
+#include "future.h"
+#include "message.h"
+
+using boost::asio::ip::tcp;
+
+// Coalesces requests bound for the same endpoint into Batch frames (frame.h).
+// The first request to an endpoint opens a batch; the batch is sent when it
+// reaches max_requests requests or max_bytes of payload, or when the window
+// has passed since it was opened, whichever comes first. Its response is
+// split back into one response per request, each a slice of the batch's
+// receive buffer, with the error a frame of its own would have produced.
+//
+// One batch costs the server one frame to parse and answer and the client one
+// request id, instead of one per request, which is what a connection runs out
+// of when many callers issue small requests at once. The window is the price:
+// a request waits up to that long for company. A batch that closes with a
+// single request is sent as a plain frame.
+//
+// Windows are timed by a DeadlineQueue. Every batch gets the same window, so
+// batches expire in the order they were opened, and arming one costs no more
+// than a lock.
+class RequestBatcher {
+public:
+    struct Options {
+        // How long a batch waits for more requests after the first
+        std::chrono::microseconds window{100};
+        // A batch is sent at once when it holds this many requests...
+        size_t max_requests = 64;
+        // ...or this many bytes of request payload
+        size_t max_bytes = 64 * 1024;
+    };
+
+    // Sends one frame to an endpoint and returns the response payload, as
+    // MultiplexedConnection::request does.
+    using Send = std::function<Future<BufferSlice>(const tcp::endpoint &endpoint, Opcode opcode, Message payload)>;
+
+    RequestBatcher(Send send, Options options);
+
+    explicit RequestBatcher(Send send) : RequestBatcher(std::move(send), Options()) {}
+
+    RequestBatcher(const RequestBatcher &) = delete;
+
+    RequestBatcher &operator=(const RequestBatcher &) = delete;
+
+    // Stops timing windows and sends the open batches.
+    ~RequestBatcher();
+
+    // Adds a request to the endpoint's open batch. The future holds the
+    // request's own response, or its own error.
+    Future<BufferSlice> request(const tcp::endpoint &endpoint, Opcode opcode, Message payload);
+
+    // Sends every open batch now, without waiting for its window; for callers
+    // that know no more requests are coming.
+    void flush();
+
+    // Number of frames sent, batches and single requests alike
+    [[nodiscard]] uint64_t frames() const {
+        return m_frames.load(std::memory_order_relaxed);
+    }
+
+    // Number of requests sent
+    [[nodiscard]] uint64_t requests() const {
+        return m_requests.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Batch;
+
+    // Sends a batch that has been closed.
+    void send(Batch &batch);
+
+    // Sends the batches whose window has passed, unless they were sent early.
+    void expire(std::vector<std::shared_ptr<Batch>> &due);
+
+    Send m_send;
+    Options m_options;
+
+    std::mutex m_mutex;
+    // The batch being filled for each endpoint
+    std::map<tcp::endpoint, std::shared_ptr<Batch>> m_open;
+
+    std::atomic<uint64_t> m_frames{0};
+    std::atomic<uint64_t> m_requests{0};
+
+    // Open batches by deadline; last, so its thread starts after the rest
+    DeadlineQueue<std::shared_ptr<Batch>> m_windows;
+};
+
+#endif //FLOWDB_REQUEST_BATCHER_H
@@ -0,0 +1,116 @@
+#include "resolver.h"
+
+#include <algorithm>
+#include <exception>
+#include <iterator>
+#include <utility>
+
+/**
+ * @brief Constructor for Resolver class.
+ *
+ * @param storage The storage actor that committed mutations are applied to.
+ * @param options The MVCC window.
+ */
+Resolver::Resolver(std::shared_ptr<VersionedStorage> storage, Options options)
+        : m_storage(std::move(storage)), m_options(options), m_start(std::chrono::steady_clock::now()) {}
+
+Resolver::Stats Resolver::stats() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void Resolver::handle(CommitRequest &request) {
+    m_batch.push_back(std::move(request));
+}
+
+void Resolver::handle(ReadVersionRequest &request) {
+    m_read_versions.push_back(std::move(request.reply));
+}
+
+/**
+ * @brief Resolves the queued commit requests as one batch at a new version.
+ *
+ * Transactions are checked in arrival order, and the writes of each one that
+ * commits are recorded before the next is checked, so a later transaction in
+ * the batch that read those keys conflicts with it. Conflicting and too old
+ * transactions are failed right away; the rest are acknowledged once storage
+ * has applied the batch's mutations. Read version requests are answered with
+ * the batch version at the same time, so storage is sent the batch even if
+ * nothing in it committed.
+ */
+void Resolver::end_batch() {
+    if (m_batch.empty() && m_read_versions.empty()) {
+        return;
+    }
+    Version version = next_version();
+    Version oldest = std::max<Version>(version - m_options.window, 0);
+
+    std::vector<Mutation> mutations;
+    std::vector<Promise<Version>> committed;
+    uint64_t conflicts = 0;
+    uint64_t too_old = 0;
+    for (auto &request: m_batch) {
+        if (request.read_version < oldest) {
+            too_old++;
+            request.reply.set_exception(std::make_exception_ptr(TransactionFailed(TransactionError::TooOld)));
+            continue;
+        }
+        bool conflict = std::any_of(request.read_ranges.begin(), request.read_ranges.end(),
+                                    [&](const KeyRange &range) {
+                                        return m_history.max_version(range.begin, range.end) > request.read_version;
+                                    });
+        if (conflict) {
+            conflicts++;
+            request.reply.set_exception(std::make_exception_ptr(TransactionFailed(TransactionError::NotCommitted)));
+            continue;
+        }
+        for (const auto &range: request.write_ranges) {
+            m_history.insert(range.begin, range.end, version);
+        }
+        std::move(request.mutations.begin(), request.mutations.end(), std::back_inserter(mutations));
+        committed.push_back(std::move(request.reply));
+    }
+    m_batch.clear();
+
+    // Forgetting walks the whole history, so only do it once a tenth of the
+    // window has passed
+    if (oldest - m_forgotten >= m_options.window / 10) {
+        m_history.forget_before(oldest);
+        m_forgotten = oldest;
+    }
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stats.batches++;
+        m_stats.committed += committed.size();
+        m_stats.conflicts += conflicts;
+        m_stats.too_old += too_old;
+        m_stats.history_size = m_history.size();
+    }
+    if (committed.empty() && m_read_versions.empty()) {
+        return;
+    }
+
+    std::move(m_read_versions.begin(), m_read_versions.end(), std::back_inserter(committed));
+    m_read_versions.clear();
+    Future<Void> applied = m_storage->apply(version, std::move(mutations));
+    applied.on_ready([applied, replies = std::move(committed), version]() mutable {
+        try {
+            applied.get();
+        } catch (...) {
+            for (auto &reply: replies) {
+                reply.set_exception(std::current_exception());
+            }
+            return;
+        }
+        for (auto &reply: replies) {
+            reply.set_value(version);
+        }
+    });
+}
+
+Version Resolver::next_version() {
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start);
+    static_assert(kVersionsPerSecond == 1'000'000, "Versions are counted in microseconds");
+    m_version = std::max<Version>(m_version + 1, elapsed.count());
+    return m_version;
+}
@@ -0,0 +1,108 @@
+#ifndef FLOWDB_RESOLVER_H
+#define FLOWDB_RESOLVER_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "actor.h"
+#include "conflict_set.h"
+#include "future.h"
+#include "mvcc.h"
+#include "versioned_storage.h"
+
+// Asks to commit a transaction that read at read_version. The reply carries
+// the commit version, or fails with TransactionFailed.
+struct CommitRequest {
+    Version read_version;
+    // Every range the transaction read
+    std::vector<KeyRange> read_ranges;
+    // Every range the transaction wrote
+    std::vector<KeyRange> write_ranges;
+    std::vector<Mutation> mutations;
+    Promise<Version> reply;
+};
+
+// Decides which transactions commit, a whole batch at a time, and hands out
+// the read versions they start from.
+//
+// Commit and read version requests are only queued as they arrive. Once the actor has drained
+// its mailbox (end_batch()), the batch gets one new commit version and its
+// transactions are checked in arrival order against the recent write history:
+// a transaction conflicts if any key it read was written by a transaction that
+// committed after its read version, including one earlier in the same batch.
+// The write ranges of every transaction that passes are recorded at the batch
+// version, their mutations are sent to the storage actor together, and the
+// commits are acknowledged once storage has applied them, so a read version
+// taken after an acknowledgement always sees the commit.
+//
+// Read versions come from the same clock: a batch with read version requests
+// sends storage its mutations even when there are none, and the requests are
+// answered with the batch version once storage has applied it. A read version
+// is therefore always recent, however long storage has gone without a commit,
+// and reading at it sees every commit acknowledged before it was asked for.
+//
+// A transaction whose read version is older than the MVCC window cannot be
+// checked, because the history it needs has been forgotten, and fails as too
+// old.
+class Resolver : public Actor<Resolver, CommitRequest, ReadVersionRequest> {
+public:
+    struct Options {
+        // Versions of write history kept, which should match the storage's window
+        Version window = kDefaultMvccWindow;
+    };
+
+    struct Stats {
+        uint64_t batches = 0;
+        uint64_t committed = 0;
+        uint64_t conflicts = 0;
+        uint64_t too_old = 0;
+        // Steps in the write history after the last batch
+        uint64_t history_size = 0;
+    };
+
+    Resolver(std::shared_ptr<VersionedStorage> storage, Options options);
+
+    explicit Resolver(std::shared_ptr<VersionedStorage> storage) : Resolver(std::move(storage), Options()) {}
+
+    Future<Version> commit(Version read_version, std::vector<KeyRange> read_ranges,
+                           std::vector<KeyRange> write_ranges, std::vector<Mutation> mutations) {
+        return ask(CommitRequest{read_version, std::move(read_ranges), std::move(write_ranges),
+                                 std::move(mutations), {}});
+    }
+
+    // A version to read at, newer than every commit acknowledged so far
+    Future<Version> read_version() {
+        return ask(ReadVersionRequest{{}});
+    }
+
+    [[nodiscard]] Stats stats() const;
+
+    void handle(CommitRequest &request);
+
+    void handle(ReadVersionRequest &request);
+
+    void end_batch();
+
+private:
+    // The next commit version: the time since the resolver started, in
+    // versions, but always past the previous one
+    Version next_version();
+
+    std::shared_ptr<VersionedStorage> m_storage;
+    Options m_options;
+    std::chrono::steady_clock::time_point m_start;
+
+    // Owned by the actor
+    std::vector<CommitRequest> m_batch;
+    std::vector<Promise<Version>> m_read_versions;
+    ConflictSet m_history;
+    Version m_version = 0;
+    Version m_forgotten = 0;
+
+    mutable std::mutex m_mutex;
+    Stats m_stats;
+};
+
+#endif //FLOWDB_RESOLVER_H
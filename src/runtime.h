@@ -1,83 +1,113 @@
 #ifndef FLOWDB_RUNTIME_H
 #define FLOWDB_RUNTIME_H
 
-
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include <thread>
 #include <atomic>
 #include <functional>
+#include <stdexcept>
+#include <typeinfo>
+#include <utility>
 #include "actor.h"
-
-class ThreadPool {
+#include "core_set.h"
+#include "metrics.h"
+#include "thread_pool.h"
+
+// Runs actors either on a work-stealing ThreadPool, where any worker may run
+// any actor, or in thread-per-core mode on a CoreSet, where every actor is
+// placed on one pinned core and only ever runs there. Thread-per-core mode
+// also keeps a one-worker ThreadPool, for background tasks such as
+// compaction that are not actors. Requires core_set.cpp.
+class Runtime {
 public:
-    explicit ThreadPool(size_t num_threads) {
-        for (size_t i = 0; i < num_threads; i++) {
-            m_threads.emplace_back([this] {
-                while (true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(m_mutex);
-                        m_cv.wait(lock, [this] { return !m_tasks.empty() || m_done; });
-                        if (m_done && m_tasks.empty()) {
-                            return;
-                        }
-                        task = std::move(m_tasks.front());
-                        m_tasks.pop();
-                    }
-                    task();
-                }
-            });
+    struct Options {
+        // Pool workers, or cores in thread-per-core mode (0 is one per CPU)
+        size_t threads = 0;
+        bool thread_per_core = false;
+        // In thread-per-core mode, whether cores are pinned to CPUs
+        bool pin = true;
+        // Tasks from outside the pool that ThreadPool::try_submit() lets
+        // wait in its injection queue (0 is unbounded)
+        size_t max_injected = 0;
+    };
+
+    explicit Runtime(size_t num_threads) : Runtime(Options{num_threads}) {}
+
+    explicit Runtime(Options options)
+            : m_done(false), m_thread_pool(pool_threads(options), options.max_injected) {
+        if (options.thread_per_core) {
+            m_cores = std::make_unique<CoreSet>(CoreSet::Options{options.threads, options.pin});
         }
     }
 
-    ~ThreadPool() {
-        {
-            std::unique_lock<std::mutex> lock(m_mutex);
-            m_done = true;
+    virtual ~Runtime() = default;
+
+    // Template function to create an actor of type T from its constructor
+    // arguments. In thread-per-core mode it is placed on the calling core, or
+    // when called from elsewhere on the cores in turn.
+    template<typename T, typename... Args>
+    std::shared_ptr<T> create_actor(Args &&... args) {
+        if (!m_cores) {
+            return place<T>(m_thread_pool, std::forward<Args>(args)...);
         }
-        m_cv.notify_all();
-        for (auto &thread: m_threads) {
-            thread.join();
+        size_t core = m_cores->current();
+        if (core == CoreSet::kNoCore) {
+            core = m_next_core.fetch_add(1, std::memory_order_relaxed) % m_cores->size();
         }
+        return place<T>(m_cores->executor(core), std::forward<Args>(args)...);
     }
 
-    template<typename F>
-    void submit(F &&f) {
-        {
-            std::unique_lock<std::mutex> lock(m_mutex);
-            m_tasks.emplace(std::forward<F>(f));
+    // Creates an actor on the given core, such as the one whose io_context
+    // serves its connections. Without thread-per-core mode the actor goes to
+    // the pool like any other.
+    //
+    // @throws std::out_of_range if core is not a core of the runtime.
+    template<typename T, typename... Args>
+    std::shared_ptr<T> create_actor_on(size_t core, Args &&... args) {
+        if (!m_cores) {
+            return place<T>(m_thread_pool, std::forward<Args>(args)...);
         }
-        m_cv.notify_one();
+        if (core >= m_cores->size()) {
+            throw std::out_of_range("No such core");
+        }
+        return place<T>(m_cores->executor(core), std::forward<Args>(args)...);
     }
 
-private:
-    std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
-    std::mutex m_mutex;
-    std::condition_variable m_cv;
-    bool m_done = false;
-};
-
-class Runtime {
-public:
-    explicit Runtime(size_t num_threads) : m_thread_pool(num_threads), m_done(false) {}
+    // Counters of every actor, identified by type and creation order, for
+    // finding the one whose mailbox is backing up. Requires metrics.cpp.
+    std::vector<ActorStats> actor_stats() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        std::vector<ActorStats> stats;
+        stats.reserve(m_actors.size());
+        for (size_t i = 0; i < m_actors.size(); i++) {
+            const ActorBase &base = *m_actors[i];
+            ActorStats &actor = stats.emplace_back(base.stats());
+            actor.type = demangle(typeid(base).name());
+            actor.id = i;
+        }
+        return stats;
+    }
 
-    virtual ~Runtime() = default;
+    // The pool that runs actors, for submitting tasks that are not actors;
+    // in thread-per-core mode, the background worker
+    ThreadPool &thread_pool() {
+        return m_thread_pool;
+    }
 
-    // Template function to create an actor of type T
-    template<typename T>
-    std::shared_ptr<T> create_actor() {
-        std::shared_ptr<T> actor = std::make_shared<T>();
-        m_actors.push_back(actor);
-        m_thread_pool.submit([actor] { actor->run(); });
-        return actor;
+    // The cores in thread-per-core mode, otherwise null
+    CoreSet *cores() {
+        return m_cores.get();
     }
 
     // Stop all actors
     void stop() {
-        for (const auto &actor: m_actors) {
-            actor->stop();
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            for (const auto &actor: m_actors) {
+                actor->stop();
+            }
         }
         m_done.store(true);
         m_cv.notify_one();
@@ -90,6 +120,23 @@ public:
     }
 
 private:
+    // Workers of the pool: only the background one in thread-per-core mode
+    static size_t pool_threads(const Options &options) {
+        if (options.thread_per_core) {
+            return 1;
+        }
+        return options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    template<typename T, typename... Args>
+    std::shared_ptr<T> place(Executor &executor, Args &&... args) {
+        std::shared_ptr<T> actor = std::make_shared<T>(std::forward<Args>(args)...);
+        actor->attach(executor);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_actors.push_back(actor);
+        return actor;
+    }
+
     // Vector to hold all actors
     std::vector<std::shared_ptr<ActorBase>> m_actors;
 
@@ -103,6 +150,12 @@ private:
     std::atomic<bool> m_done;
 
     ThreadPool m_thread_pool;
+
+    // Set in thread-per-core mode; stopped before the pool and the actors go
+    std::unique_ptr<CoreSet> m_cores;
+
+    // The core that create_actor() places the next actor on, modulo the cores
+    std::atomic<size_t> m_next_core{0};
 };
 
 #endif //FLOWDB_RUNTIME_H
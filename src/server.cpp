@@ -0,0 +1,135 @@
+#include "server.h"
+
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+#include "metrics.h"
+
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+/**
+ * @brief Constructor for Server class.
+ *
+ * @param endpoints The endpoints to listen on.
+ * @param num_shards Number of shards, usually one per core.
+ * @param handler_factory Called once per shard to build its request handler.
+ * @param session_options Credits and unsent bytes of every connection.
+ */
+Server::Server(std::vector<tcp::endpoint> endpoints, size_t num_shards, HandlerFactory handler_factory,
+               FrameSession::Options session_options)
+        : m_endpoints(std::move(endpoints)), m_handler_factory(std::move(handler_factory)),
+          m_session_options(session_options) {
+    for (size_t i = 0; i < std::max<size_t>(num_shards, 1); i++) {
+        auto shard = std::make_unique<Shard>();
+        shard->owned = std::make_unique<boost::asio::io_context>(1);
+        shard->io_context = shard->owned.get();
+        m_shards.push_back(std::move(shard));
+    }
+}
+
+/**
+ * @brief Constructor for Server class in thread-per-core mode.
+ *
+ * @param endpoints The endpoints to listen on.
+ * @param cores The cores whose io_contexts the shards run on, one shard each.
+ * @param handler_factory Called once per shard to build its request handler.
+ * @param session_options Credits and unsent bytes of every connection.
+ */
+Server::Server(std::vector<tcp::endpoint> endpoints, CoreSet &cores, HandlerFactory handler_factory,
+               FrameSession::Options session_options)
+        : m_endpoints(std::move(endpoints)), m_handler_factory(std::move(handler_factory)),
+          m_session_options(session_options), m_cores(&cores) {
+    for (size_t i = 0; i < cores.size(); i++) {
+        auto shard = std::make_unique<Shard>();
+        shard->io_context = &cores.io_context(i);
+        m_shards.push_back(std::move(shard));
+    }
+}
+
+Server::~Server() {
+    stop();
+}
+
+/**
+ * @brief Opens one listener per endpoint in every shard and starts accepting.
+ *
+ * The first shard binds first, so an endpoint with port 0 gets a port assigned
+ * that the other shards then share.
+ */
+void Server::start() {
+    for (size_t i = 0; i < m_shards.size(); i++) {
+        Shard &shard = *m_shards[i];
+        shard.handler = m_handler_factory(i);
+        for (auto &endpoint: m_endpoints) {
+            tcp::acceptor acceptor(*shard.io_context);
+            acceptor.open(endpoint.protocol());
+            acceptor.set_option(tcp::acceptor::reuse_address(true));
+            acceptor.set_option(reuse_port(true));
+            acceptor.bind(endpoint);
+            acceptor.listen();
+            endpoint = acceptor.local_endpoint();
+            shard.acceptors.push_back(std::move(acceptor));
+        }
+    }
+    m_started = true;
+    for (size_t i = 0; i < m_shards.size(); i++) {
+        auto &shard = m_shards[i];
+        for (auto &acceptor: shard->acceptors) {
+            accept(*shard, acceptor);
+        }
+        if (m_cores == nullptr) {
+            shard->thread = std::thread([&io_context = *shard->io_context, i] {
+                Metrics::set_thread_name("server-io-" + std::to_string(i));
+                io_context.run();
+            });
+        }
+    }
+}
+
+/**
+ * @brief On cores, the listeners are closed by the cores that own them, and
+ * stop() waits for all of them to have done so.
+ */
+void Server::stop() {
+    if (m_cores != nullptr) {
+        if (!std::exchange(m_started, false)) {
+            return;
+        }
+        std::vector<Future<Void>> closed;
+        for (size_t i = 0; i < m_shards.size(); i++) {
+            Promise<Void> done;
+            closed.push_back(done.get_future());
+            m_cores->submit(i, [&shard = *m_shards[i], done = std::move(done)]() mutable {
+                shard.acceptors.clear();
+                done.set_value();
+            });
+        }
+        when_all(std::move(closed)).get();
+        return;
+    }
+    for (auto &shard: m_shards) {
+        shard->io_context->stop();
+    }
+    for (auto &shard: m_shards) {
+        if (shard->thread.joinable()) {
+            shard->thread.join();
+        }
+        shard->acceptors.clear();
+    }
+}
+
+void Server::accept(Shard &shard, tcp::acceptor &acceptor) {
+    acceptor.async_accept([this, &shard, &acceptor](const boost::system::error_code &ec, tcp::socket socket) {
+        if (ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        if (ec) {
+            // Typically running out of descriptors; keep serving existing connections
+            std::cerr << "Accept failed: " << ec.message() << std::endl;
+        } else {
+            std::make_shared<FrameSession>(std::move(socket), shard.handler, m_session_options)->start();
+        }
+        accept(shard, acceptor);
+    });
+}
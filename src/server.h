@@ -0,0 +1,84 @@
+#ifndef FLOWDB_SERVER_H
+#define FLOWDB_SERVER_H
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "core_set.h"
+#include "frame_session.h"
+
+using boost::asio::ip::tcp;
+
+// Frame server that scales with cores. The server is split into shards, each
+// with its own single-threaded io_context and thread. Every shard opens its
+// own SO_REUSEPORT acceptor on every listening endpoint, so the kernel spreads
+// incoming connections across shards. A connection is then served entirely by
+// the thread that accepted it, with no locks or cross-thread handoffs on the
+// network path. Connections are persistent and framed (see FrameSession).
+//
+// In thread-per-core mode the shards are the cores of a CoreSet: shard i
+// listens on core i's io_context and starts no thread of its own, so its
+// connections are served on the same pinned thread as the actors placed on
+// that core.
+class Server {
+public:
+    // Builds the request handler for a shard; typically one that dispatches
+    // to an actor owned by that shard.
+    using HandlerFactory = std::function<FrameSession::Handler(size_t shard)>;
+
+    // session_options sets the flow control of every connection.
+    Server(std::vector<tcp::endpoint> endpoints, size_t num_shards, HandlerFactory handler_factory,
+           FrameSession::Options session_options = {});
+
+    // One shard per core. The cores must outlive the server, and stop() must
+    // be called while they run, from a thread that is not one of them.
+    Server(std::vector<tcp::endpoint> endpoints, CoreSet &cores, HandlerFactory handler_factory,
+           FrameSession::Options session_options = {});
+
+    Server(const Server &) = delete;
+
+    Server &operator=(const Server &) = delete;
+
+    ~Server();
+
+    // Binds every endpoint and starts the shard threads.
+    //
+    // @throws boost::system::system_error if an endpoint cannot be bound.
+    void start();
+
+    // Closes the listeners and connections and joins the shard threads. On
+    // cores it only closes the listeners; connections end with the cores.
+    void stop();
+
+    // Bound endpoints; a requested port of 0 is replaced by the one assigned.
+    [[nodiscard]] const std::vector<tcp::endpoint> &endpoints() const {
+        return m_endpoints;
+    }
+
+    [[nodiscard]] size_t shards() const {
+        return m_shards.size();
+    }
+
+private:
+    struct Shard {
+        // Null when the shard runs on a core
+        std::unique_ptr<boost::asio::io_context> owned;
+        boost::asio::io_context *io_context = nullptr;
+        std::vector<tcp::acceptor> acceptors;
+        FrameSession::Handler handler;
+        std::thread thread;
+    };
+
+    void accept(Shard &shard, tcp::acceptor &acceptor);
+
+    std::vector<tcp::endpoint> m_endpoints;
+    HandlerFactory m_handler_factory;
+    FrameSession::Options m_session_options;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    CoreSet *m_cores = nullptr;
+    bool m_started = false;
+};
+
+#endif //FLOWDB_SERVER_H
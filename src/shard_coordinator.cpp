@@ -0,0 +1,200 @@
+#include "shard_coordinator.h"
+
+#include <algorithm>
+#include <utility>
+#include "storage_protocol.h"
+
+namespace {
+
+// Every endpoint named by map, once each
+std::vector<tcp::endpoint> servers(const ShardMap &map) {
+    std::vector<tcp::endpoint> result;
+    for (size_t i = 0; i < map.size(); i++) {
+        result.insert(result.end(), map[i].team.begin(), map[i].team.end());
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+// The endpoints named by either map
+std::vector<tcp::endpoint> servers(const ShardMap &before, const ShardMap &after) {
+    std::vector<tcp::endpoint> result = servers(before);
+    std::vector<tcp::endpoint> added = servers(after);
+    result.insert(result.end(), added.begin(), added.end());
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+} // namespace
+
+/**
+ * @brief Constructor for ShardCoordinator class.
+ *
+ * @param io_context The io_context the window timer runs on.
+ * @param client Sends requests to the servers; its pool must include every
+ * endpoint of every map.
+ * @param map The cluster's current map.
+ * @param options How often split keys are collected.
+ */
+ShardCoordinator::ShardCoordinator(boost::asio::io_context &io_context, StorageClient &client, ShardMap map,
+                                   Options options)
+        : m_client(client), m_options(options), m_timer(io_context),
+          m_map(std::make_shared<const ShardMap>(std::move(map))) {}
+
+void ShardCoordinator::start() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stopped = false;
+    schedule();
+}
+
+void ShardCoordinator::stop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stopped = true;
+    m_timer.cancel();
+}
+
+std::shared_ptr<const ShardMap> ShardCoordinator::map() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_map;
+}
+
+Future<std::shared_ptr<const ShardMap>> ShardCoordinator::split(std::string key) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto map = std::make_shared<ShardMap>(*m_map);
+    if (!map->split(key)) {
+        return make_ready_future(m_map);
+    }
+    std::shared_ptr<const ShardMap> before = std::exchange(m_map, std::move(map));
+    auto after = m_map;
+    lock.unlock();
+    return publish(after, servers(*before, *after));
+}
+
+Future<std::shared_ptr<const ShardMap>> ShardCoordinator::move(std::string key, std::vector<tcp::endpoint> team) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto map = std::make_shared<ShardMap>(*m_map);
+    if (!map->assign(map->locate(key), std::move(team))) {
+        return make_ready_future(m_map);
+    }
+    std::shared_ptr<const ShardMap> before = std::exchange(m_map, std::move(map));
+    auto after = m_map;
+    lock.unlock();
+    return publish(after, servers(*before, *after));
+}
+
+/**
+ * @brief Asks every server for its split keys and the version of its map.
+ * Servers that did not answer are left for the next round. If a server holds
+ * a newer map than the coordinator, which a coordinator that restarted would
+ * find, that map is adopted instead of splitting, so the versions the
+ * coordinator hands out keep growing. Otherwise the map is split at every key
+ * and sent to the servers that are behind, which after a split is all of them.
+ */
+Future<Void> ShardCoordinator::rebalance() {
+    std::vector<tcp::endpoint> endpoints = servers(*map());
+    std::vector<Future<BufferSlice>> requests;
+    requests.reserve(endpoints.size());
+    for (const auto &endpoint: endpoints) {
+        requests.push_back(m_client.request(endpoint, Opcode::GetSplitKeys, MessageBuilder().finish()));
+    }
+    return when_settled(std::move(requests)).then(
+            [this, endpoints](const std::vector<Future<BufferSlice>> &responses) -> Future<Void> {
+                std::vector<std::pair<tcp::endpoint, uint64_t>> versions;
+                std::vector<std::string> keys;
+                for (size_t i = 0; i < responses.size(); i++) {
+                    try {
+                        auto [version, split_keys] = decode_split_keys_response(responses[i].value().view());
+                        versions.emplace_back(endpoints[i], version);
+                        keys.insert(keys.end(), split_keys.begin(), split_keys.end());
+                    } catch (const std::exception &) {
+                        // Down or not sharded; asked again next round
+                    }
+                }
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+                auto newest = std::max_element(versions.begin(), versions.end(), [](auto &a, auto &b) {
+                    return a.second < b.second;
+                });
+                if (newest != versions.end() && newest->second > m_map->version()) {
+                    lock.unlock();
+                    return m_client.request(newest->first, Opcode::GetShardMap, MessageBuilder().finish()).then(
+                            [this](const BufferSlice &response) {
+                                auto map = std::make_shared<const ShardMap>(
+                                        ShardMap::decode(decode_shard_map_response(response.view())));
+                                std::unique_lock<std::mutex> lock(m_mutex);
+                                if (map->version() > m_map->version()) {
+                                    m_map = std::move(map);
+                                }
+                            });
+                }
+                auto map = std::make_shared<ShardMap>(*m_map);
+                size_t splits = 0;
+                for (const auto &key: keys) {
+                    if (map->split(key)) {
+                        splits++;
+                    }
+                }
+                std::vector<tcp::endpoint> behind;
+                if (splits > 0) {
+                    m_load_splits += splits;
+                    m_map = std::move(map);
+                    behind = servers(*m_map);
+                } else {
+                    for (const auto &[endpoint, version]: versions) {
+                        if (version < m_map->version()) {
+                            behind.push_back(endpoint);
+                        }
+                    }
+                }
+                auto current = m_map;
+                lock.unlock();
+                if (behind.empty()) {
+                    return make_ready_future(Void());
+                }
+                return publish(std::move(current), std::move(behind)).then(
+                        [](const std::shared_ptr<const ShardMap> &) {});
+            });
+}
+
+uint64_t ShardCoordinator::load_splits() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_load_splits;
+}
+
+/**
+ * @brief Sends map to every endpoint at once. Fails if any of them could not
+ * be reached, though the others keep the map; rebalance() catches the rest up.
+ */
+Future<std::shared_ptr<const ShardMap>> ShardCoordinator::publish(std::shared_ptr<const ShardMap> map,
+                                                                  std::vector<tcp::endpoint> endpoints) {
+    std::string encoded = map->encode();
+    std::vector<Future<BufferSlice>> installed;
+    installed.reserve(endpoints.size());
+    for (const auto &endpoint: endpoints) {
+        installed.push_back(m_client.request(endpoint, Opcode::InstallShardMap, encode_install_shard_map(encoded)));
+    }
+    return when_all(std::move(installed)).then([map = std::move(map)](const std::vector<BufferSlice> &) {
+        return map;
+    });
+}
+
+/**
+ * @brief Arms the timer for the next round, which arms it again when it is
+ * done, so rounds never overlap. Called with m_mutex held.
+ */
+void ShardCoordinator::schedule() {
+    m_timer.expires_after(m_options.window);
+    m_timer.async_wait([this](const boost::system::error_code &ec) {
+        if (ec) {
+            return;
+        }
+        rebalance().on_ready([this] {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (!m_stopped) {
+                schedule();
+            }
+        });
+    });
+}
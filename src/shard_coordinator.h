@@ -0,0 +1,94 @@
+#ifndef FLOWDB_SHARD_COORDINATOR_H
+#define FLOWDB_SHARD_COORDINATOR_H
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "future.h"
+#include "shard_map.h"
+#include "storage_client.h"
+
+// The one owner of a cluster's shard map. Every split and move is made here,
+// each gives the map the next version, and the result is installed on every
+// server the map names, which keep it only if it is newer than their own. As
+// no other place makes maps, versions are never reused, and servers and
+// clients can tell an old map from a new one by version alone.
+//
+// Servers find out which of their shards are busy (see LocalShards); every
+// window the coordinator collects their split keys, splits the map at them and
+// publishes it once. A server whose map is behind, because it was down or
+// missed a publish, is sent the current map on the next round.
+//
+// A move hands a shard to another team without copying its data: the new
+// team must hold the range already, or the caller copies it first. Load
+// splits therefore keep the shard's team, which has the data.
+//
+// Requests go through client, whose pool must include every endpoint of every
+// map, and the window timer runs on io_context, which the owner must keep
+// running. Both must outlive the coordinator.
+class ShardCoordinator {
+public:
+    struct Options {
+        // How often servers are asked for split keys
+        std::chrono::milliseconds window{1'000};
+    };
+
+    // map is the cluster's current map, typically the one every server
+    // started with.
+    ShardCoordinator(boost::asio::io_context &io_context, StorageClient &client, ShardMap map, Options options);
+
+    ShardCoordinator(boost::asio::io_context &io_context, StorageClient &client, ShardMap map)
+            : ShardCoordinator(io_context, client, std::move(map), Options()) {}
+
+    ShardCoordinator(const ShardCoordinator &) = delete;
+
+    ShardCoordinator &operator=(const ShardCoordinator &) = delete;
+
+    // Starts collecting split keys every window.
+    void start();
+
+    // Cancels the timer. A round in progress still completes, so the
+    // coordinator must outlive it (or the io_context must be stopped) before
+    // it is destroyed.
+    void stop();
+
+    [[nodiscard]] std::shared_ptr<const ShardMap> map() const;
+
+    // Splits the shard holding key at key and publishes the map. The future
+    // holds the new map once every server has it, and fails if one could not
+    // be reached; if key already starts a shard, it holds the current map.
+    Future<std::shared_ptr<const ShardMap>> split(std::string key);
+
+    // Hands the shard holding key to team and publishes the map, as split().
+    Future<std::shared_ptr<const ShardMap>> move(std::string key, std::vector<tcp::endpoint> team);
+
+    // Collects split keys from every server, splits the map at them and
+    // publishes it to the servers that do not have it.
+    Future<Void> rebalance();
+
+    // Number of splits made because of load
+    [[nodiscard]] uint64_t load_splits() const;
+
+private:
+    // Installs map on every one of endpoints.
+    Future<std::shared_ptr<const ShardMap>> publish(std::shared_ptr<const ShardMap> map,
+                                                    std::vector<tcp::endpoint> endpoints);
+
+    void schedule();
+
+    StorageClient &m_client;
+    Options m_options;
+    boost::asio::steady_timer m_timer;
+
+    mutable std::mutex m_mutex;
+    // Replaced rather than modified, so a copy taken under the lock stays valid
+    std::shared_ptr<const ShardMap> m_map;
+    uint64_t m_load_splits = 0;
+    bool m_stopped = false;
+};
+
+#endif //FLOWDB_SHARD_COORDINATOR_H
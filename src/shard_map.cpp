@@ -0,0 +1,130 @@
+#include "shard_map.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include "codec.h"
+
+ShardMap::ShardMap(std::vector<tcp::endpoint> team) {
+    m_shards.push_back(Shard{{}, {}, std::move(team)});
+}
+
+ShardMap ShardMap::uniform(const std::vector<std::vector<tcp::endpoint>> &teams) {
+    if (teams.empty() || teams.size() > 256) {
+        throw std::invalid_argument("A uniform shard map needs between 1 and 256 teams");
+    }
+    ShardMap map;
+    map.m_shards.clear();
+    for (size_t i = 0; i < teams.size(); i++) {
+        std::string begin = i == 0 ? std::string() : std::string(1, static_cast<char>(256 * i / teams.size()));
+        if (!map.m_shards.empty()) {
+            map.m_shards.back().end = begin;
+        }
+        map.m_shards.push_back(Shard{std::move(begin), {}, teams[i]});
+    }
+    return map;
+}
+
+/**
+ * @brief Decodes a map received from a server, checking that its shards are
+ * contiguous and cover the whole key space.
+ */
+ShardMap ShardMap::decode(std::string_view encoded) {
+    Decoder decoder(encoded);
+    ShardMap map;
+    map.m_shards.clear();
+    map.m_version = decoder.varint();
+    uint64_t count = decoder.varint();
+    if (count == 0 || count > encoded.size()) {
+        throw std::invalid_argument("Malformed shard map");
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        Shard shard;
+        shard.begin = decoder.bytes();
+        shard.end = decoder.bytes();
+        uint64_t team_size = decoder.varint();
+        if (team_size > encoded.size()) {
+            throw std::invalid_argument("Malformed shard map");
+        }
+        for (uint64_t j = 0; j < team_size; j++) {
+            boost::system::error_code ec;
+            auto address = boost::asio::ip::make_address(std::string(decoder.bytes()), ec);
+            uint64_t port = decoder.varint();
+            if (ec || port > 65535) {
+                throw std::invalid_argument("Malformed endpoint in shard map");
+            }
+            shard.team.emplace_back(address, static_cast<uint16_t>(port));
+        }
+        bool contiguous = i == 0 ? shard.begin.empty() : shard.begin == map.m_shards.back().end;
+        bool last = i + 1 == count;
+        if (!contiguous || (last != shard.end.empty()) || (!last && shard.end <= shard.begin)) {
+            throw std::invalid_argument("Shard map does not cover the key space");
+        }
+        map.m_shards.push_back(std::move(shard));
+    }
+    if (!decoder.empty()) {
+        throw std::invalid_argument("Trailing bytes after shard map");
+    }
+    return map;
+}
+
+std::string ShardMap::encode() const {
+    std::string out;
+    put_varint(out, m_version);
+    put_varint(out, m_shards.size());
+    for (const auto &shard: m_shards) {
+        put_bytes(out, shard.begin);
+        put_bytes(out, shard.end);
+        put_varint(out, shard.team.size());
+        for (const auto &endpoint: shard.team) {
+            put_bytes(out, endpoint.address().to_string());
+            put_varint(out, endpoint.port());
+        }
+    }
+    return out;
+}
+
+size_t ShardMap::locate(std::string_view key) const {
+    // The last shard whose begin is not greater than key; the first begins
+    // at the empty key, so there always is one
+    auto it = std::upper_bound(m_shards.begin(), m_shards.end(), key,
+                               [](std::string_view key, const Shard &shard) { return key < shard.begin; });
+    return static_cast<size_t>(it - m_shards.begin()) - 1;
+}
+
+std::vector<size_t> ShardMap::overlapping(std::string_view begin, std::string_view end) const {
+    std::vector<size_t> result;
+    if (begin >= end) {
+        return result;
+    }
+    for (size_t i = locate(begin); i < m_shards.size() && m_shards[i].begin < end; i++) {
+        result.push_back(i);
+    }
+    return result;
+}
+
+bool ShardMap::contains(size_t index, std::string_view key) const {
+    const Shard &shard = m_shards[index];
+    return shard.begin <= key && (shard.end.empty() || key < shard.end);
+}
+
+bool ShardMap::split(std::string_view key) {
+    size_t index = locate(key);
+    if (m_shards[index].begin == key) {
+        return false;
+    }
+    Shard upper{std::string(key), m_shards[index].end, m_shards[index].team};
+    m_shards[index].end = key;
+    m_shards.insert(m_shards.begin() + static_cast<std::ptrdiff_t>(index) + 1, std::move(upper));
+    m_version++;
+    return true;
+}
+
+bool ShardMap::assign(size_t index, std::vector<tcp::endpoint> team) {
+    if (m_shards[index].team == team) {
+        return false;
+    }
+    m_shards[index].team = std::move(team);
+    m_version++;
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef FLOWDB_SHARD_MAP_H
+#define FLOWDB_SHARD_MAP_H
+
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using boost::asio::ip::tcp;
+
+// A contiguous range of keys and the team of endpoints that serves it. The
+// last shard has an empty end and extends to the end of the key space.
+struct Shard {
+    std::string begin;
+    std::string end;
+    // Any member can serve any request for the range: the endpoints of one
+    // server, or of servers that replicate it
+    std::vector<tcp::endpoint> team;
+};
+
+// Range partitioning of the key space: an ordered list of shards that
+// together cover every key exactly once. Servers check requests against their
+// copy and clients cache one to route requests. Every change increments the
+// version, so of two maps derived from one another, the one with the higher
+// version is newer; a cluster keeps that true by changing its map in one place
+// only (see ShardCoordinator).
+//
+// Encoded on the wire as
+//
+//     varint version, varint shard count, then for every shard:
+//     bytes begin, bytes end, varint team size, then for every endpoint:
+//     bytes address, varint port
+class ShardMap {
+public:
+    // One shard holding every key, served by team
+    explicit ShardMap(std::vector<tcp::endpoint> team = {});
+
+    // Splits the key space into one shard per team, at evenly spaced first
+    // bytes.
+    //
+    // @throws std::invalid_argument if there are no teams or more than 256.
+    static ShardMap uniform(const std::vector<std::vector<tcp::endpoint>> &teams);
+
+    // @throws std::invalid_argument if the map is malformed.
+    static ShardMap decode(std::string_view encoded);
+
+    [[nodiscard]] std::string encode() const;
+
+    // Index of the shard holding key
+    [[nodiscard]] size_t locate(std::string_view key) const;
+
+    // Indices of the shards overlapping [begin, end), in key order
+    [[nodiscard]] std::vector<size_t> overlapping(std::string_view begin, std::string_view end) const;
+
+    // Whether key lies in the shard at index
+    [[nodiscard]] bool contains(size_t index, std::string_view key) const;
+
+    // Splits the shard holding key at key; the new shard from key onwards
+    // keeps the team. Returns false if key already starts a shard.
+    bool split(std::string_view key);
+
+    // Hands the shard at index to team. Returns false if it has that team
+    // already.
+    bool assign(size_t index, std::vector<tcp::endpoint> team);
+
+    [[nodiscard]] const Shard &operator[](size_t index) const {
+        return m_shards[index];
+    }
+
+    [[nodiscard]] size_t size() const {
+        return m_shards.size();
+    }
+
+    [[nodiscard]] uint64_t version() const {
+        return m_version;
+    }
+
+private:
+    std::vector<Shard> m_shards;
+    uint64_t m_version = 1;
+};
+
+#endif //FLOWDB_SHARD_MAP_H
@@ -0,0 +1,77 @@
+#ifndef FLOWDB_SPSC_QUEUE_H
+#define FLOWDB_SPSC_QUEUE_H
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+// Bounded single-producer, single-consumer ring. One thread pushes and one
+// other thread pops, each with a relaxed load and a release store of its own
+// index; the other side's index is cached and only reloaded, with acquire,
+// when the cached value says the ring is full or empty. The indices live on
+// separate cache lines, so a steady stream of pushes and pops shares nothing
+// but the slots themselves.
+template<typename T>
+class SpscQueue {
+    static_assert(std::is_trivially_copyable_v<T>, "SpscQueue stores trivially copyable values");
+
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity)
+            : m_capacity(std::bit_ceil(std::max<size_t>(capacity, 2))), m_mask(m_capacity - 1),
+              m_slots(std::make_unique<T[]>(m_capacity)) {}
+
+    SpscQueue(const SpscQueue &) = delete;
+
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // Appends value unless the ring is full. Only the producer may call this.
+    bool try_push(T value) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head_cache == m_capacity) {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if (tail - m_head_cache == m_capacity) {
+                return false;
+            }
+        }
+        m_slots[tail & m_mask] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Takes the oldest value, if there is one. Only the consumer may call this.
+    bool try_pop(T &out) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail_cache) {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tail_cache) {
+                return false;
+            }
+        }
+        out = m_slots[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Whether a pop would fail. Only the consumer may call this.
+    [[nodiscard]] bool empty() const {
+        return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire);
+    }
+
+private:
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<T[]> m_slots;
+
+    // Written by the consumer
+    alignas(64) std::atomic<size_t> m_head{0};
+    size_t m_tail_cache = 0;
+
+    // Written by the producer
+    alignas(64) std::atomic<size_t> m_tail{0};
+    size_t m_head_cache = 0;
+};
+
+#endif //FLOWDB_SPSC_QUEUE_H
@@ -0,0 +1,368 @@
+#include "sstable.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <optional>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include "bloom_filter.h"
+#include "codec.h"
+
+namespace {
+
+constexpr size_t kFooterSize = 48;
+constexpr uint64_t kTableMagic = 0x31305442534f4c46ull;  // "FLOSBT01"
+
+std::system_error os_error(const std::string &what) {
+    return {errno, std::generic_category(), what};
+}
+
+// Decodes the entries of one data block, starting from a restart point.
+// Blocks were written by this process or an earlier one and synced before
+// they were referenced, so they are decoded without bounds checks.
+class BlockReader {
+public:
+    explicit BlockReader(std::string_view block) {
+        m_restart_count = detail::load_le<uint32_t>(block.data() + block.size() - 4);
+        m_restarts = block.data() + block.size() - 4 - 4 * static_cast<size_t>(m_restart_count);
+        m_begin = block.data();
+        m_p = m_begin;
+    }
+
+    // Decodes the next entry into key and value; false at the end of the block.
+    bool next(std::string &key, std::string_view &value) {
+        if (m_p >= m_restarts) {
+            return false;
+        }
+        uint64_t shared, unshared, value_size;
+        m_p = get_varint(m_p, shared);
+        m_p = get_varint(m_p, unshared);
+        m_p = get_varint(m_p, value_size);
+        key.resize(shared);
+        key.append(m_p, unshared);
+        value = std::string_view(m_p + unshared, value_size);
+        m_p += unshared + value_size;
+        return true;
+    }
+
+    // Moves to the first entry not less than target, leaving it in key and
+    // value; false if every entry of the block is smaller.
+    bool seek(std::string_view target, std::string &key, std::string_view &value) {
+        // Last restart point whose key is smaller than target
+        size_t low = 0;
+        size_t high = m_restart_count - 1;
+        while (low < high) {
+            size_t mid = (low + high + 1) / 2;
+            if (restart_key(mid) < target) {
+                low = mid;
+            } else {
+                high = mid - 1;
+            }
+        }
+        m_p = m_begin + restart(low);
+        key.clear();
+        while (next(key, value)) {
+            if (std::string_view(key) >= target) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    [[nodiscard]] uint32_t restart(size_t i) const {
+        return detail::load_le<uint32_t>(m_restarts + 4 * i);
+    }
+
+    // A restart entry shares nothing with its predecessor, so its key is
+    // stored whole
+    [[nodiscard]] std::string_view restart_key(size_t i) const {
+        uint64_t shared, unshared, value_size;
+        const char *p = get_varint(m_begin + restart(i), shared);
+        p = get_varint(p, unshared);
+        p = get_varint(p, value_size);
+        return {p, unshared};
+    }
+
+    const char *m_begin;
+    const char *m_p;
+    const char *m_restarts;
+    uint32_t m_restart_count;
+};
+
+} // namespace
+
+class SSTable::Iterator : public EntryIterator {
+public:
+    explicit Iterator(const SSTable &table) : m_table(table), m_block_index(table.m_index.size()) {}
+
+    void seek(std::string_view key) override {
+        m_block_index = m_table.find_block(key);
+        if (m_block_index == m_table.m_index.size()) {
+            return;
+        }
+        m_reader.emplace(m_table.block(m_block_index));
+        if (!m_reader->seek(key, m_key, m_value)) {
+            next_block();
+        }
+    }
+
+    [[nodiscard]] bool valid() const override {
+        return m_block_index < m_table.m_index.size();
+    }
+
+    void next() override {
+        if (!m_reader->next(m_key, m_value)) {
+            next_block();
+        }
+    }
+
+    [[nodiscard]] std::string_view key() const override {
+        return m_key;
+    }
+
+    [[nodiscard]] std::string_view value() const override {
+        return m_value;
+    }
+
+private:
+    void next_block() {
+        while (++m_block_index < m_table.m_index.size()) {
+            m_reader.emplace(m_table.block(m_block_index));
+            m_key.clear();
+            if (m_reader->next(m_key, m_value)) {
+                return;
+            }
+        }
+    }
+
+    const SSTable &m_table;
+    size_t m_block_index;
+    std::optional<BlockReader> m_reader;
+    std::string m_key;
+    std::string_view m_value;
+};
+
+/**
+ * @brief Maps a table file and decodes its footer and index.
+ *
+ * @param path The table file.
+ * @param number The file number, which orders flushed tables by age.
+ */
+std::shared_ptr<SSTable> SSTable::open(const std::string &path, uint64_t number) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw os_error("Cannot open table " + path);
+    }
+    struct stat status{};
+    if (::fstat(fd, &status) != 0) {
+        ::close(fd);
+        throw os_error("Cannot stat table " + path);
+    }
+    auto size = static_cast<uint64_t>(status.st_size);
+    if (size < kFooterSize) {
+        ::close(fd);
+        throw std::runtime_error("Table " + path + " is truncated");
+    }
+    void *data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw os_error("Cannot map table " + path);
+    }
+
+    std::shared_ptr<SSTable> table(new SSTable());
+    table->m_number = number;
+    table->m_data = static_cast<const char *>(data);
+    table->m_size = size;
+
+    const char *footer = table->m_data + size - kFooterSize;
+    auto index_offset = detail::load_le<uint64_t>(footer);
+    auto index_size = detail::load_le<uint64_t>(footer + 8);
+    auto filter_offset = detail::load_le<uint64_t>(footer + 16);
+    auto filter_size = detail::load_le<uint64_t>(footer + 24);
+    table->m_entries = detail::load_le<uint64_t>(footer + 32);
+    uint64_t data_end = size - kFooterSize;
+    if (detail::load_le<uint64_t>(footer + 40) != kTableMagic || index_offset > data_end ||
+        index_size > data_end - index_offset || filter_offset > data_end || filter_size > data_end - filter_offset) {
+        throw std::runtime_error("Table " + path + " has a corrupt footer");
+    }
+    table->m_filter = std::string_view(table->m_data + filter_offset, filter_size);
+
+    Decoder index(std::string_view(table->m_data + index_offset, index_size));
+    while (!index.empty()) {
+        IndexEntry entry;
+        entry.last_key = std::string(index.bytes());
+        entry.offset = index.varint();
+        entry.size = index.varint();
+        if (entry.offset > data_end || entry.size > data_end - entry.offset || entry.size < 8) {
+            throw std::runtime_error("Table " + path + " has a corrupt index");
+        }
+        table->m_index.push_back(std::move(entry));
+    }
+    if (table->m_index.empty()) {
+        throw std::runtime_error("Table " + path + " is empty");
+    }
+    std::string_view value;
+    BlockReader(table->block(0)).next(table->m_smallest, value);
+    table->m_largest = table->m_index.back().last_key;
+    return table;
+}
+
+SSTable::~SSTable() {
+    if (m_data != nullptr) {
+        ::munmap(const_cast<char *>(m_data), m_size);
+    }
+}
+
+bool SSTable::may_contain(uint64_t hash) const {
+    return bloom_may_contain(m_filter, hash);
+}
+
+/**
+ * @brief Point lookup: a binary search of the index, then of the block's
+ * restart points, then a short scan.
+ */
+bool SSTable::get(std::string_view key, std::string &value) const {
+    size_t index = find_block(key);
+    if (index == m_index.size()) {
+        return false;
+    }
+    thread_local std::string found_key;
+    std::string_view found_value;
+    BlockReader reader(block(index));
+    if (!reader.seek(key, found_key, found_value) || found_key != key) {
+        return false;
+    }
+    value.assign(found_value);
+    return true;
+}
+
+std::unique_ptr<EntryIterator> SSTable::iterator() const {
+    return std::make_unique<Iterator>(*this);
+}
+
+size_t SSTable::find_block(std::string_view key) const {
+    auto it = std::lower_bound(m_index.begin(), m_index.end(), key, [](const IndexEntry &entry, std::string_view k) {
+        return std::string_view(entry.last_key) < k;
+    });
+    return it - m_index.begin();
+}
+
+std::string_view SSTable::block(size_t index) const {
+    return {m_data + m_index[index].offset, m_index[index].size};
+}
+
+SSTableWriter::SSTableWriter(std::string path, TableOptions options)
+        : m_path(std::move(path)), m_options(options) {
+    m_fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        throw os_error("Cannot create table " + m_path);
+    }
+    m_options.restart_interval = std::max<size_t>(m_options.restart_interval, 1);
+}
+
+SSTableWriter::~SSTableWriter() {
+    if (!m_finished) {
+        ::close(m_fd);
+        ::unlink(m_path.c_str());
+    }
+}
+
+void SSTableWriter::add(std::string_view key, std::string_view value) {
+    if (!m_block.empty() && m_block.size() >= m_options.block_bytes) {
+        finish_block();
+    }
+    size_t shared = 0;
+    if (m_block_entries % m_options.restart_interval == 0) {
+        m_restarts.push_back(static_cast<uint32_t>(m_block.size()));
+    } else {
+        size_t limit = std::min(key.size(), m_last_key.size());
+        while (shared < limit && key[shared] == m_last_key[shared]) {
+            shared++;
+        }
+    }
+    put_varint(m_block, shared);
+    put_varint(m_block, key.size() - shared);
+    put_varint(m_block, value.size());
+    m_block.append(key.substr(shared));
+    m_block.append(value);
+    m_last_key.assign(key);
+    m_hashes.push_back(hash64(key));
+    m_block_entries++;
+    m_entries++;
+}
+
+void SSTableWriter::finish() {
+    if (!m_block.empty()) {
+        finish_block();
+    }
+    std::string filter = build_bloom_filter(m_hashes, m_options.bloom_bits_per_key);
+    uint64_t filter_offset = size();
+    write(filter);
+    uint64_t index_offset = size();
+    write(m_index);
+
+    char footer[kFooterSize];
+    detail::store_le(footer, index_offset);
+    detail::store_le(footer + 8, static_cast<uint64_t>(m_index.size()));
+    detail::store_le(footer + 16, filter_offset);
+    detail::store_le(footer + 24, static_cast<uint64_t>(filter.size()));
+    detail::store_le(footer + 32, m_entries);
+    detail::store_le(footer + 40, kTableMagic);
+    write(std::string_view(footer, kFooterSize));
+    flush_buffer();
+    if (::fdatasync(m_fd) != 0) {
+        throw os_error("Cannot sync table " + m_path);
+    }
+    ::close(m_fd);
+    m_finished = true;
+}
+
+void SSTableWriter::finish_block() {
+    for (uint32_t restart: m_restarts) {
+        char bytes[4];
+        detail::store_le(bytes, restart);
+        m_block.append(bytes, 4);
+    }
+    char count[4];
+    detail::store_le(count, static_cast<uint32_t>(m_restarts.size()));
+    m_block.append(count, 4);
+
+    put_bytes(m_index, m_last_key);
+    put_varint(m_index, m_offset + m_buffer.size());
+    put_varint(m_index, m_block.size());
+    write(m_block);
+    m_block.clear();
+    m_restarts.clear();
+    m_block_entries = 0;
+}
+
+void SSTableWriter::write(std::string_view data) {
+    m_buffer.append(data);
+    if (m_buffer.size() >= 256 << 10) {
+        flush_buffer();
+    }
+}
+
+void SSTableWriter::flush_buffer() {
+    const char *data = m_buffer.data();
+    size_t remaining = m_buffer.size();
+    while (remaining > 0) {
+        ssize_t n = ::write(m_fd, data, remaining);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw os_error("Cannot write table " + m_path);
+        }
+        data += n;
+        remaining -= static_cast<size_t>(n);
+    }
+    m_offset += m_buffer.size();
+    m_buffer.clear();
+}
@@ -0,0 +1,181 @@
+#ifndef FLOWDB_SSTABLE_H
+#define FLOWDB_SSTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Entries of the log-structured engine carry their kind in the first byte of
+// the stored value: a value is kValue followed by the user's bytes, and a
+// deletion is a lone kTombstone that hides older values of the key.
+constexpr char kTombstone = 0;
+constexpr char kValue = 1;
+
+// Sorted stream of entries with tagged values. Views returned by key() and
+// value() stay valid until the iterator moves.
+class EntryIterator {
+public:
+    virtual ~EntryIterator() = default;
+
+    // Positions the iterator at the first entry not less than key.
+    virtual void seek(std::string_view key) = 0;
+
+    [[nodiscard]] virtual bool valid() const = 0;
+
+    virtual void next() = 0;
+
+    [[nodiscard]] virtual std::string_view key() const = 0;
+
+    [[nodiscard]] virtual std::string_view value() const = 0;
+};
+
+struct TableOptions {
+    // Uncompressed size at which a data block is closed
+    size_t block_bytes = 4096;
+    // Every this many entries a key is stored whole, so a block can be
+    // binary searched; the keys in between only store what differs from the
+    // previous key
+    size_t restart_interval = 16;
+    size_t bloom_bits_per_key = 10;
+};
+
+// Immutable sorted table file:
+//
+//     data blocks   entries, then uint32 restart offsets, then uint32 count
+//     filter        bloom filter over every key (see bloom_filter.h)
+//     index         per data block: its last key, offset and size
+//     footer        uint64 index offset, index size, filter offset,
+//                   filter size, entry count, magic
+//
+// Each entry in a data block is varint shared key bytes, varint unshared key
+// bytes, varint value size, the unshared key bytes and the tagged value.
+//
+// The file is mapped into memory, so reads are served from the page cache
+// without copying or a block cache of our own. The index is decoded into
+// memory on open; the filter is read in place.
+class SSTable {
+public:
+    // @throws std::system_error if the file cannot be read, and
+    // std::runtime_error if it is not a valid table.
+    static std::shared_ptr<SSTable> open(const std::string &path, uint64_t number);
+
+    SSTable(const SSTable &) = delete;
+
+    SSTable &operator=(const SSTable &) = delete;
+
+    ~SSTable();
+
+    // False if the bloom filter rules the key out. hash is hash64(key),
+    // computed once per lookup and shared by every table probed.
+    [[nodiscard]] bool may_contain(uint64_t hash) const;
+
+    // Looks up key in the table; on success value holds the tagged value.
+    // Does not consult the bloom filter, so callers check may_contain() first.
+    bool get(std::string_view key, std::string &value) const;
+
+    [[nodiscard]] std::unique_ptr<EntryIterator> iterator() const;
+
+    [[nodiscard]] uint64_t number() const {
+        return m_number;
+    }
+
+    [[nodiscard]] uint64_t file_size() const {
+        return m_size;
+    }
+
+    [[nodiscard]] uint64_t entries() const {
+        return m_entries;
+    }
+
+    [[nodiscard]] const std::string &smallest() const {
+        return m_smallest;
+    }
+
+    [[nodiscard]] const std::string &largest() const {
+        return m_largest;
+    }
+
+private:
+    struct IndexEntry {
+        std::string last_key;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    class Iterator;
+
+    SSTable() = default;
+
+    // Index of the first block whose last key is not less than key
+    [[nodiscard]] size_t find_block(std::string_view key) const;
+
+    [[nodiscard]] std::string_view block(size_t index) const;
+
+    uint64_t m_number = 0;
+    const char *m_data = nullptr;
+    uint64_t m_size = 0;
+    uint64_t m_entries = 0;
+    std::vector<IndexEntry> m_index;
+    std::string_view m_filter;
+    std::string m_smallest;
+    std::string m_largest;
+};
+
+// Writes a table from entries added in strictly increasing key order.
+class SSTableWriter {
+public:
+    // @throws std::system_error if the file cannot be created.
+    SSTableWriter(std::string path, TableOptions options);
+
+    SSTableWriter(const SSTableWriter &) = delete;
+
+    SSTableWriter &operator=(const SSTableWriter &) = delete;
+
+    // Closes and removes the file if it was not finished.
+    ~SSTableWriter();
+
+    void add(std::string_view key, std::string_view value);
+
+    // Writes the filter, index and footer and syncs the file.
+    //
+    // @throws std::system_error on I/O errors.
+    void finish();
+
+    // Bytes written so far, a lower bound of the final file size
+    [[nodiscard]] uint64_t size() const {
+        return m_offset + m_buffer.size() + m_block.size();
+    }
+
+    [[nodiscard]] uint64_t entries() const {
+        return m_entries;
+    }
+
+private:
+    void finish_block();
+
+    void write(std::string_view data);
+
+    void flush_buffer();
+
+    std::string m_path;
+    TableOptions m_options;
+    int m_fd = -1;
+    bool m_finished = false;
+
+    // Bytes already written to the file, and bytes waiting to be
+    uint64_t m_offset = 0;
+    std::string m_buffer;
+
+    std::string m_block;
+    std::vector<uint32_t> m_restarts;
+    size_t m_block_entries = 0;
+    std::string m_last_key;
+    std::string m_index;
+    std::vector<uint64_t> m_hashes;
+    uint64_t m_entries = 0;
+};
+
+#endif //FLOWDB_SSTABLE_H
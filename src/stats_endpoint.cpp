@@ -0,0 +1,99 @@
+#include "stats_endpoint.h"
+
+#include <exception>
+#include <istream>
+#include <memory>
+#include <utility>
+
+namespace {
+
+// Largest request head read before the page is sent anyway
+constexpr size_t kMaxRequestSize = 16 * 1024;
+
+// One connection: reads the request head, writes the page and closes.
+class StatsSession : public std::enable_shared_from_this<StatsSession> {
+public:
+    StatsSession(tcp::socket socket, const StatsEndpoint::Render &render)
+            : m_socket(std::move(socket)), m_request(kMaxRequestSize), m_render(render) {}
+
+    void start() {
+        auto self = shared_from_this();
+        boost::asio::async_read_until(m_socket, m_request, "\r\n\r\n",
+                                      [this, self](const boost::system::error_code &ec, size_t) {
+                                          // A head that overflowed the limit is answered all the same
+                                          if (!ec || ec == boost::asio::error::not_found) {
+                                              respond();
+                                          }
+                                      });
+    }
+
+private:
+    // The path of the request line, "GET /path HTTP/1.0"
+    std::string path() {
+        std::istream request(&m_request);
+        std::string method;
+        std::string target;
+        request >> method >> target;
+        target = target.substr(0, target.find('?'));
+        return target.empty() ? "/" : target;
+    }
+
+    void respond() {
+        std::string body;
+        std::string status = "200 OK";
+        try {
+            body = m_render(path());
+        } catch (const std::exception &e) {
+            status = "500 Internal Server Error";
+            body = std::string(e.what()) + "\n";
+        }
+        m_response = "HTTP/1.0 " + status + "\r\n"
+                     "Content-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                     "Connection: close\r\n\r\n" + body;
+        auto self = shared_from_this();
+        boost::asio::async_write(m_socket, boost::asio::buffer(m_response),
+                                 [this, self](const boost::system::error_code &, size_t) {
+                                     boost::system::error_code ignored;
+                                     m_socket.shutdown(tcp::socket::shutdown_both, ignored);
+                                 });
+    }
+
+    tcp::socket m_socket;
+    boost::asio::streambuf m_request;
+    std::string m_response;
+    const StatsEndpoint::Render &m_render;
+};
+
+} // namespace
+
+/**
+ * @brief Constructor for StatsEndpoint class. Binds the listening socket and
+ * starts the thread that serves it.
+ *
+ * @param endpoint The address to listen on.
+ * @param render Produces the page for a path; called on the endpoint's thread for every request.
+ * @throws boost::system::system_error if the endpoint cannot be bound.
+ */
+StatsEndpoint::StatsEndpoint(const tcp::endpoint &endpoint, Render render)
+        : m_render(std::move(render)), m_acceptor(m_io_context, endpoint), m_work(m_io_context.get_executor()) {
+    accept();
+    m_thread = std::thread([this] { m_io_context.run(); });
+}
+
+StatsEndpoint::~StatsEndpoint() {
+    m_work.reset();
+    m_io_context.stop();
+    m_thread.join();
+}
+
+void StatsEndpoint::accept() {
+    m_acceptor.async_accept([this](const boost::system::error_code &ec, tcp::socket socket) {
+        if (!ec) {
+            std::make_shared<StatsSession>(std::move(socket), m_render)->start();
+        }
+        if (ec != boost::asio::error::operation_aborted) {
+            accept();
+        }
+    });
+}
@@ -0,0 +1,50 @@
+#ifndef FLOWDB_STATS_ENDPOINT_H
+#define FLOWDB_STATS_ENDPOINT_H
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+using boost::asio::ip::tcp;
+
+// Serves plaintext pages over HTTP/1.0, such as the output of
+// render_metrics(), for `curl http://host:port/` or a Prometheus scraper.
+// Every request gets a fresh rendering of the page for its path. Connections are
+// handled one request each on the endpoint's own thread, so scraping never
+// takes time from the server's network threads.
+class StatsEndpoint {
+public:
+    // Produces the page for a request path such as "/trace", without the
+    // query string
+    using Render = std::function<std::string(std::string_view path)>;
+
+    // Listens on endpoint (port 0 picks a free one) and starts the thread.
+    //
+    // @throws boost::system::system_error if it cannot listen on endpoint.
+    StatsEndpoint(const tcp::endpoint &endpoint, Render render);
+
+    StatsEndpoint(const StatsEndpoint &) = delete;
+
+    StatsEndpoint &operator=(const StatsEndpoint &) = delete;
+
+    // Stops listening and drops requests in progress.
+    ~StatsEndpoint();
+
+    [[nodiscard]] tcp::endpoint endpoint() const {
+        return m_acceptor.local_endpoint();
+    }
+
+private:
+    void accept();
+
+    Render m_render;
+    boost::asio::io_context m_io_context;
+    tcp::acceptor m_acceptor;
+    std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> m_work;
+    std::thread m_thread;
+};
+
+#endif //FLOWDB_STATS_ENDPOINT_H
@@ -0,0 +1,250 @@
+#ifndef FLOWDB_STORAGE_H
+#define FLOWDB_STORAGE_H
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "actor.h"
+#include "btree.h"
+#include "ordered_store.h"
+#include "codec.h"
+#include "future.h"
+#include "message.h"
+#include "storage_protocol.h"
+#include "wal.h"
+
+// Reads the value of a key; the reply is empty if the key is not set.
+struct GetRequest {
+    std::string key;
+    Promise<std::optional<std::string>> reply;
+};
+
+struct SetRequest {
+    std::string key;
+    std::string value;
+    Promise<Void> reply;
+};
+
+struct ClearRequest {
+    std::string key;
+    Promise<Void> reply;
+};
+
+// Clears every key in [begin, end).
+struct ClearRangeRequest {
+    std::string begin;
+    std::string end;
+    Promise<Void> reply;
+};
+
+// Reads up to limit key-value pairs in [begin, end), in key order.
+struct GetRangeRequest {
+    std::string begin;
+    std::string end;
+    size_t limit;
+    Promise<std::vector<KeyValue>> reply;
+};
+
+// Like GetRequest and GetRangeRequest, but the reply is the encoded response
+// (storage_protocol.h), built on the actor so that what it read from the
+// store reaches the socket without being copied again.
+struct EncodedGetRequest {
+    std::string key;
+    Promise<Message> reply;
+};
+
+struct EncodedGetRangeRequest {
+    std::string begin;
+    std::string end;
+    size_t limit;
+    Promise<Message> reply;
+};
+
+// Storage server: owns an ordered store, in memory (BTree) or on disk
+// (LsmTree), and serves reads and writes to it. Like every actor it handles
+// one message at a time, so the store needs no locking; writes are applied,
+// and visible to later reads, in the order they arrive.
+//
+// With a write-ahead log, every write is also appended to the log and only
+// acknowledged once the log has made it durable, and the log is replayed into
+// the store on construction. A read may observe a write whose commit has not
+// been acknowledged yet, but every acknowledged write survives a crash. The
+// actor is the log's only writer, so it knows the sequence number each write
+// will get and tags the store with it; once a store that is durable on its
+// own, like LsmTree, has made writes durable, the log is checkpointed past
+// them, and replay skips what the store already holds. The store may hold
+// writes past the end of the log, flushed before the log synced them, so the
+// log is numbered on from whichever of the two is further.
+class StorageActor
+        : public Actor<StorageActor, GetRequest, SetRequest, ClearRequest, ClearRangeRequest, GetRangeRequest,
+                EncodedGetRequest, EncodedGetRangeRequest> {
+public:
+    StorageActor() : m_store(std::make_unique<BTree>()) {}
+
+    // Replays the records of the log, if there is one, that the store does
+    // not hold yet before any request is served.
+    //
+    // @throws std::invalid_argument if an intact log record is malformed.
+    explicit StorageActor(std::unique_ptr<OrderedStore> store, std::shared_ptr<WriteAheadLog> log = nullptr)
+            : m_store(std::move(store)), m_log(std::move(log)) {
+        if (m_log) {
+            uint64_t durable = m_store->durable_log_position();
+            m_log->replay([this, durable](uint64_t lsn, std::string_view record) {
+                if (lsn > durable) {
+                    m_store->set_log_position(lsn);
+                    replay(record);
+                }
+            });
+            // A store that flushed writes the log then lost must not see their
+            // numbers again, or replay would skip the writes that reuse them
+            uint64_t last = std::max(m_log->durable_lsn(), durable);
+            m_log->start_after(last);
+            m_next_lsn = last + 1;
+            checkpoint();
+        }
+    }
+
+    explicit StorageActor(std::shared_ptr<WriteAheadLog> log)
+            : StorageActor(std::make_unique<BTree>(), std::move(log)) {}
+
+    Future<std::optional<std::string>> get(std::string key) {
+        return ask(GetRequest{std::move(key), {}});
+    }
+
+    Future<Void> set(std::string key, std::string value) {
+        return ask(SetRequest{std::move(key), std::move(value), {}});
+    }
+
+    Future<Void> clear(std::string key) {
+        return ask(ClearRequest{std::move(key), {}});
+    }
+
+    Future<Void> clear_range(std::string begin, std::string end) {
+        return ask(ClearRangeRequest{std::move(begin), std::move(end), {}});
+    }
+
+    Future<std::vector<KeyValue>> get_range(std::string begin, std::string end, size_t limit) {
+        return ask(GetRangeRequest{std::move(begin), std::move(end), limit, {}});
+    }
+
+    Future<::Message> get_encoded(std::string key) {
+        return ask(EncodedGetRequest{std::move(key), {}});
+    }
+
+    Future<::Message> get_range_encoded(std::string begin, std::string end, size_t limit) {
+        return ask(EncodedGetRangeRequest{std::move(begin), std::move(end), limit, {}});
+    }
+
+    void handle(GetRequest &request) {
+        request.reply.set_value(m_store->get(request.key));
+    }
+
+    void handle(SetRequest &request) {
+        write(Mutation::Set, request.key, request.value, request.reply);
+    }
+
+    void handle(ClearRequest &request) {
+        write(Mutation::Clear, request.key, {}, request.reply);
+    }
+
+    void handle(ClearRangeRequest &request) {
+        write(Mutation::ClearRange, request.begin, request.end, request.reply);
+    }
+
+    void handle(GetRangeRequest &request) {
+        std::vector<KeyValue> result;
+        m_store->range(request.begin, request.end, request.limit, result);
+        request.reply.set_value(std::move(result));
+    }
+
+    void handle(EncodedGetRequest &request) {
+        request.reply.set_value(encode_get_response(m_store->get(request.key)));
+    }
+
+    void handle(EncodedGetRangeRequest &request) {
+        std::vector<KeyValue> result;
+        m_store->range(request.begin, request.end, request.limit, result);
+        request.reply.set_value(encode_get_range_response(std::move(result)));
+    }
+
+private:
+    // Log records are a mutation type followed by its two byte-string operands
+    enum class Mutation : uint8_t {
+        Set = 1,
+        Clear = 2,
+        ClearRange = 3,
+    };
+
+    void apply(Mutation mutation, std::string_view first, std::string_view second) {
+        switch (mutation) {
+            case Mutation::Set:
+                m_store->set(first, second);
+                break;
+            case Mutation::Clear:
+                m_store->clear(first);
+                break;
+            case Mutation::ClearRange:
+                m_store->clear_range(first, second);
+                break;
+            default:
+                throw std::invalid_argument("Unknown mutation");
+        }
+    }
+
+    // Applies a write and acknowledges it, once it is durable if there is a
+    // log. A store that fails the write, such as a disk-backed one after an
+    // I/O error, fails the reply instead.
+    void write(Mutation mutation, std::string_view first, std::string_view second, Promise<Void> &reply) {
+        try {
+            if (m_log) {
+                m_store->set_log_position(m_next_lsn);
+            }
+            apply(mutation, first, second);
+        } catch (...) {
+            reply.set_exception(std::current_exception());
+            return;
+        }
+        if (!m_log) {
+            reply.set_value();
+            return;
+        }
+        std::string record(1, static_cast<char>(mutation));
+        put_bytes(record, first);
+        put_bytes(record, second);
+        m_next_lsn++;
+        m_log->append(std::move(record)).then([](const uint64_t &) {}).forward_to(std::move(reply));
+        checkpoint();
+    }
+
+    // Lets the log drop what the store has made durable since the last call.
+    void checkpoint() {
+        uint64_t durable = m_store->durable_log_position();
+        if (durable > m_checkpoint) {
+            m_checkpoint = durable;
+            m_log->checkpoint(durable);
+        }
+    }
+
+    void replay(std::string_view record) {
+        if (record.empty()) {
+            throw std::invalid_argument("Empty log record");
+        }
+        Decoder decoder(record.substr(1));
+        std::string_view first = decoder.bytes();
+        std::string_view second = decoder.bytes();
+        apply(static_cast<Mutation>(record.front()), first, second);
+    }
+
+    std::unique_ptr<OrderedStore> m_store;
+    std::shared_ptr<WriteAheadLog> m_log;
+    // Sequence number the log will give the next write, and the last
+    // checkpoint it was given
+    uint64_t m_next_lsn = 1;
+    uint64_t m_checkpoint = 0;
+};
+
+#endif //FLOWDB_STORAGE_H
@@ -0,0 +1,463 @@
+#include "storage_client.h"
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include "storage_protocol.h"
+
+// State of one hedged read, shared by the requests sent for it and its
+// hedging deadline
+struct StorageClient::HedgedRead {
+    Promise<BufferSlice> promise;
+    // Replicas in the order they are tried
+    std::vector<tcp::endpoint> replicas;
+    Opcode opcode;
+    Message payload;
+    std::chrono::steady_clock::time_point start;
+
+    std::mutex mutex;
+    size_t sent = 0;
+    size_t outstanding = 0;
+    bool done = false;
+};
+
+/**
+ * @brief Constructor for StorageClient class.
+ *
+ * @param pool The pool connections are checked out from; it must include
+ * every endpoint the cluster's shard maps name.
+ * @param options Retries after WrongShard, the write quorum, read hedging and
+ * request batching.
+ */
+StorageClient::StorageClient(ConnectionPool &pool, Options options)
+        : m_pool(pool), m_options(options), m_map(std::make_shared<const ShardMap>(pool.endpoints())),
+          m_hedge_delay(options.initial_hedge_delay.count()) {
+    m_latencies.reserve(kLatencySamples);
+    if (m_options.hedge_reads) {
+        m_hedges = std::make_unique<DeadlineQueue<std::shared_ptr<HedgedRead>>>(
+                [this](std::vector<std::shared_ptr<HedgedRead>> &due) { hedge(due); });
+    }
+    if (m_options.batch_window.count() > 0) {
+        RequestBatcher::Options batching;
+        batching.window = m_options.batch_window;
+        batching.max_requests = m_options.max_batch_requests;
+        batching.max_bytes = m_options.max_batch_bytes;
+        m_batcher = std::make_unique<RequestBatcher>(
+                [this](const tcp::endpoint &endpoint, Opcode opcode, Message payload) {
+                    return send_frame(endpoint, opcode, std::move(payload));
+                }, batching);
+    }
+}
+
+StorageClient::~StorageClient() {
+    if (m_hedges) {
+        m_hedges->stop();
+    }
+}
+
+Future<std::optional<std::string>> StorageClient::get(std::string key) {
+    Message request = encode_get(key);
+    return get(std::move(key), std::move(request), 0);
+}
+
+Future<Void> StorageClient::set(std::string key, std::string value) {
+    Message request = encode_set(key, std::move(value));
+    return update(std::move(key), Opcode::Set, std::move(request), 0);
+}
+
+Future<Void> StorageClient::clear(std::string key) {
+    Message request = encode_clear(key);
+    return update(std::move(key), Opcode::Clear, std::move(request), 0);
+}
+
+/**
+ * @brief Issues a get per key, then sends the batches they joined without
+ * waiting out the window, since the caller has nothing more to add.
+ */
+Future<std::vector<std::optional<std::string>>> StorageClient::multi_get(std::vector<std::string> keys) {
+    std::vector<Future<std::optional<std::string>>> values;
+    values.reserve(keys.size());
+    for (auto &key: keys) {
+        values.push_back(get(std::move(key)));
+    }
+    if (m_batcher) {
+        m_batcher->flush();
+    }
+    return when_all(std::move(values));
+}
+
+Future<Void> StorageClient::multi_set(std::vector<KeyValue> entries) {
+    std::vector<Future<Void>> written;
+    written.reserve(entries.size());
+    for (auto &entry: entries) {
+        written.push_back(set(std::move(entry.key), std::move(entry.value)));
+    }
+    if (m_batcher) {
+        m_batcher->flush();
+    }
+    return when_all(std::move(written)).then([](const std::vector<Void> &) {});
+}
+
+Future<Void> StorageClient::clear_range(std::string begin, std::string end) {
+    return clear_range(std::move(begin), std::move(end), 0);
+}
+
+Future<std::vector<KeyValue>> StorageClient::get_range(std::string begin, std::string end, size_t limit) {
+    return get_range(std::move(begin), std::move(end), limit, 0);
+}
+
+Future<Void> StorageClient::refresh() {
+    auto map = shard_map();
+    return read((*map)[0].team, Opcode::GetShardMap, MessageBuilder().finish()).then(
+            [this](const BufferSlice &response) {
+                install(decode_shard_map_response(response.view()));
+            });
+}
+
+Future<BufferSlice> StorageClient::request(const tcp::endpoint &endpoint, Opcode opcode, Message payload) {
+    return send(endpoint, opcode, std::move(payload));
+}
+
+/**
+ * @brief Closes every connection that is established and still open.
+ * Connections that are still being set up are left to fail on their own.
+ */
+Future<Void> StorageClient::close() {
+    std::vector<Future<Void>> closed;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (auto &[endpoint, connection]: m_connections) {
+            if (!connection.is_ready()) {
+                continue;
+            }
+            try {
+                closed.push_back(connection.get()->close());
+            } catch (const std::exception &) {
+                // The connection was never established
+            }
+        }
+        m_connections.clear();
+    }
+    return when_all(std::move(closed)).then([](const std::vector<Void> &) {});
+}
+
+std::shared_ptr<const ShardMap> StorageClient::shard_map() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_map;
+}
+
+Future<std::optional<std::string>> StorageClient::get(std::string key, Message request, size_t attempt) {
+    auto response = read(key, Opcode::Get, request).then([](const BufferSlice &response) {
+        return decode_get_response(response.view());
+    });
+    return retry_on_wrong_shard(std::move(response), attempt,
+                                [this, key = std::move(key), request = std::move(request)](size_t next) {
+                                    return get(key, request, next);
+                                });
+}
+
+Future<Void> StorageClient::update(std::string key, Opcode opcode, Message request, size_t attempt) {
+    auto response = write(key, opcode, request);
+    return retry_on_wrong_shard(std::move(response), attempt,
+                                [this, key = std::move(key), opcode, request = std::move(request)](size_t next) {
+                                    return update(key, opcode, request, next);
+                                });
+}
+
+/**
+ * @brief Clears the part of the range in every shard at once. A part that a
+ * server rejects is split again with the server's map and retried on its own.
+ */
+Future<Void> StorageClient::clear_range(std::string begin, std::string end, size_t attempt) {
+    auto map = shard_map();
+    std::vector<Future<Void>> parts;
+    for (size_t index: map->overlapping(begin, end)) {
+        const Shard &shard = (*map)[index];
+        std::string part_begin = std::max(begin, shard.begin);
+        std::string part_end = shard.end.empty() ? end : std::min(end, shard.end);
+        auto response = write(shard.team, Opcode::ClearRange, encode_clear_range(part_begin, part_end));
+        parts.push_back(retry_on_wrong_shard(std::move(response), attempt,
+                                             [this, part_begin, part_end](size_t next) {
+                                                 return clear_range(part_begin, part_end, next);
+                                             }));
+    }
+    return when_all(std::move(parts)).then([](const std::vector<Void> &) {});
+}
+
+/**
+ * @brief Reads the part of the range in the first shard, then continues in
+ * the following shards until the limit is reached or the range is exhausted.
+ */
+Future<std::vector<KeyValue>> StorageClient::get_range(std::string begin, std::string end, size_t limit,
+                                                       size_t attempt) {
+    if (begin >= end || limit == 0) {
+        return make_ready_future(std::vector<KeyValue>());
+    }
+    auto map = shard_map();
+    const Shard &shard = (*map)[map->locate(begin)];
+    std::string part_end = shard.end.empty() ? end : std::min(end, shard.end);
+    auto response = read(shard.team, Opcode::GetRange, encode_get_range(begin, part_end, limit))
+            .then([](const BufferSlice &response) { return decode_get_range_response(response.view()); });
+    auto part = retry_on_wrong_shard(std::move(response), attempt, [this, begin, part_end, limit](size_t next) {
+        return get_range(begin, part_end, limit, next);
+    });
+    if (part_end == end) {
+        return part;
+    }
+    return part.then([this, part_end, end = std::move(end), limit](const std::vector<KeyValue> &entries) {
+        if (entries.size() >= limit) {
+            return make_ready_future(entries);
+        }
+        return get_range(part_end, end, limit - entries.size(), 0).then(
+                [entries](const std::vector<KeyValue> &rest) {
+                    std::vector<KeyValue> result = entries;
+                    result.insert(result.end(), rest.begin(), rest.end());
+                    return result;
+                });
+    });
+}
+
+Future<BufferSlice> StorageClient::read(std::string_view key, Opcode opcode, Message payload) {
+    auto map = shard_map();
+    return read((*map)[map->locate(key)].team, opcode, std::move(payload));
+}
+
+/**
+ * @brief Sends a read to the replica the pool's selector prefers, by the
+ * latency and load it has seen, and arms the hedging timer if the team has
+ * another replica to try. Backups go to the others in team order.
+ */
+Future<BufferSlice> StorageClient::read(const std::vector<tcp::endpoint> &team, Opcode opcode, Message payload) {
+    if (team.empty()) {
+        Promise<BufferSlice> failed;
+        failed.set_exception(std::make_exception_ptr(std::runtime_error("Shard has no endpoints")));
+        return failed.get_future();
+    }
+    size_t first = 0;
+    try {
+        first = team.size() > 1 ? m_pool.select(team) : 0;
+    } catch (...) {
+        Promise<BufferSlice> failed;
+        failed.set_exception(std::current_exception());
+        return failed.get_future();
+    }
+    auto state = std::make_shared<HedgedRead>();
+    auto result = state->promise.get_future();
+    for (size_t i = 0; i < team.size(); i++) {
+        state->replicas.push_back(team[(first + i) % team.size()]);
+    }
+    state->opcode = opcode;
+    state->payload = std::move(payload);
+    state->start = std::chrono::steady_clock::now();
+    launch(state);
+
+    if (m_hedges && team.size() > 1 && !result.is_ready()) {
+        m_hedges->push(state->start + hedge_delay(), state);
+    }
+    return result;
+}
+
+/**
+ * @brief The first successful response completes the read and is timed for
+ * the hedging delay. A failure moves on to the next replica, except for
+ * WrongShard, which every replica would repeat; once every replica has
+ * failed, so does the read.
+ */
+void StorageClient::launch(const std::shared_ptr<HedgedRead> &state) {
+    size_t index;
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        if (state->done || state->sent == state->replicas.size()) {
+            return;
+        }
+        index = state->sent++;
+        state->outstanding++;
+    }
+    Future<BufferSlice> response = send(state->replicas[index], state->opcode, state->payload);
+    response.on_ready([this, state, response] {
+        std::exception_ptr error;
+        bool wrong_shard = false;
+        try {
+            response.value();
+        } catch (const WrongShard &) {
+            error = std::current_exception();
+            wrong_shard = true;
+        } catch (...) {
+            error = std::current_exception();
+        }
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->outstanding--;
+        if (state->done) {
+            return;
+        }
+        if (!error) {
+            state->done = true;
+            lock.unlock();
+            record_read_latency(std::chrono::steady_clock::now() - state->start);
+            response.forward_to(std::move(state->promise));
+            return;
+        }
+        if (wrong_shard || (state->sent == state->replicas.size() && state->outstanding == 0)) {
+            state->done = true;
+            lock.unlock();
+            state->promise.set_exception(error);
+            return;
+        }
+        lock.unlock();
+        launch(state);
+    });
+}
+
+Future<Void> StorageClient::write(std::string_view key, Opcode opcode, const Message &payload) {
+    auto map = shard_map();
+    return write((*map)[map->locate(key)].team, opcode, payload);
+}
+
+Future<Void> StorageClient::write(const std::vector<tcp::endpoint> &team, Opcode opcode, const Message &payload) {
+    if (team.empty()) {
+        Promise<Void> failed;
+        failed.set_exception(std::make_exception_ptr(std::runtime_error("Shard has no endpoints")));
+        return failed.get_future();
+    }
+    std::vector<Future<BufferSlice>> acknowledgements;
+    for (const auto &endpoint: team) {
+        acknowledgements.push_back(send(endpoint, opcode, payload));
+    }
+    size_t quorum = m_options.write_quorum == 0 ? team.size() / 2 + 1 : std::min(m_options.write_quorum, team.size());
+    return when_quorum(std::move(acknowledgements), quorum).then([](const std::vector<BufferSlice> &) {});
+}
+
+Future<BufferSlice> StorageClient::send(const tcp::endpoint &endpoint, Opcode opcode, Message payload) {
+    if (m_batcher) {
+        return m_batcher->request(endpoint, opcode, std::move(payload));
+    }
+    return send_frame(endpoint, opcode, std::move(payload));
+}
+
+Future<BufferSlice> StorageClient::send_frame(const tcp::endpoint &endpoint, Opcode opcode, Message payload) {
+    return connection(endpoint).then(
+            [opcode, payload = std::move(payload)](const std::shared_ptr<MultiplexedConnection> &connection) {
+                return connection->request(opcode, payload);
+            });
+}
+
+/**
+ * @brief Reuses the connection to endpoint unless its setup failed or it has
+ * been closed since, in which case a new socket is checked out.
+ */
+Future<std::shared_ptr<MultiplexedConnection>> StorageClient::connection(const tcp::endpoint &endpoint) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_connections.find(endpoint);
+    if (it != m_connections.end()) {
+        if (!it->second.is_ready()) {
+            return it->second;
+        }
+        try {
+            if (!it->second.get()->closed()) {
+                return it->second;
+            }
+        } catch (const std::exception &) {
+            // Setting up the connection failed; try again
+        }
+    }
+    Future<std::shared_ptr<MultiplexedConnection>> connection;
+    try {
+        connection = m_pool.checkout(endpoint).then([](const ConnectionPool::Lease &lease) {
+            auto connection = std::make_shared<MultiplexedConnection>(lease);
+            connection->start();
+            return connection;
+        });
+    } catch (...) {
+        Promise<std::shared_ptr<MultiplexedConnection>> failed;
+        failed.set_exception(std::current_exception());
+        return failed.get_future();
+    }
+    m_connections.insert_or_assign(endpoint, connection);
+    return connection;
+}
+
+template<typename T, typename F>
+Future<T> StorageClient::retry_on_wrong_shard(Future<T> response, size_t attempt, F retry) {
+    Promise<T> promise;
+    auto result = promise.get_future();
+    response.on_ready([this, response, attempt, retry = std::move(retry), promise = std::move(promise)]() mutable {
+        try {
+            response.value();
+        } catch (const WrongShard &wrong_shard) {
+            m_wrong_shards.fetch_add(1, std::memory_order_relaxed);
+            if (attempt + 1 < m_options.max_attempts) {
+                try {
+                    install(wrong_shard.shard_map());
+                } catch (...) {
+                    promise.set_exception(std::current_exception());
+                    return;
+                }
+                retry(attempt + 1).forward_to(std::move(promise));
+                return;
+            }
+        } catch (...) {
+        }
+        response.forward_to(std::move(promise));
+    });
+    return result;
+}
+
+/**
+ * @brief Replaces the cached map with one received from a server, unless the
+ * server is behind: versions are assigned by the cluster's coordinator alone,
+ * so a lower one is an older map. The cached map is then kept, and the retry
+ * goes to the same team, where another replica may be up to date.
+ *
+ * @throws std::invalid_argument if the map is malformed.
+ */
+void StorageClient::install(std::string_view encoded) {
+    auto map = std::make_shared<const ShardMap>(ShardMap::decode(encoded));
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (map->version() >= m_map->version()) {
+        m_map = std::move(map);
+    }
+}
+
+/**
+ * @brief Adds a latency to the ring of recent reads and, every
+ * kLatencyUpdateInterval samples, sets the hedging delay to the configured
+ * percentile of the ring.
+ */
+void StorageClient::record_read_latency(std::chrono::nanoseconds latency) {
+    int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    std::unique_lock<std::mutex> lock(m_latency_mutex);
+    if (m_latencies.size() < kLatencySamples) {
+        m_latencies.push_back(micros);
+    } else {
+        m_latencies[m_latency_count % kLatencySamples] = micros;
+    }
+    m_latency_count++;
+    if (m_latency_count % kLatencyUpdateInterval != 0 || m_latencies.size() < kLatencyUpdateInterval) {
+        return;
+    }
+    std::vector<int64_t> sorted = m_latencies;
+    lock.unlock();
+    auto rank = static_cast<size_t>(m_options.hedge_percentile * static_cast<double>(sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(rank), sorted.end());
+    m_hedge_delay.store(std::max<int64_t>(sorted[rank], m_options.min_hedge_delay.count()),
+                        std::memory_order_relaxed);
+}
+
+/**
+ * @brief Sends a backup for every read that neither completed nor ran out of
+ * replicas.
+ */
+void StorageClient::hedge(std::vector<std::shared_ptr<HedgedRead>> &due) {
+    for (auto &state: due) {
+        bool pending;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            pending = !state->done && state->sent < state->replicas.size();
+        }
+        if (pending) {
+            m_hedged_reads.fetch_add(1, std::memory_order_relaxed);
+            launch(state);
+        }
+    }
+}
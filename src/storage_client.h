@@ -0,0 +1,236 @@
+#ifndef FLOWDB_STORAGE_CLIENT_H
+#define FLOWDB_STORAGE_CLIENT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "buffer_pool.h"
+#include "connection_pool.h"
+#include "deadline_queue.h"
+#include "frame.h"
+#include "future.h"
+#include "message.h"
+#include "multiplexed_connection.h"
+#include "ordered_store.h"
+#include "request_batcher.h"
+#include "shard_map.h"
+
+// Client for a sharded, replicated storage cluster. It caches a shard map and
+// sends every request straight to the team that serves the key, over one
+// multiplexed connection per endpoint. Range requests are split at shard
+// boundaries: clears go to every shard at once, reads visit the shards in key
+// order until the limit is reached.
+//
+// The members of a team are replicas. A write goes to all of them and is
+// acknowledged once a quorum (by default a majority) has applied it. A read
+// goes to the replica the pool's selection strategy picks, fed by the latency
+// and load of every request; if it has not answered after the hedging delay, a
+// backup request goes to another, and whichever answers first wins. The delay
+// tracks a high percentile of recent read latencies, so only the slowest few
+// percent of reads are duplicated, and a stalled replica costs a read the
+// delay rather than the stall. Deadlines are kept by a DeadlineQueue, so
+// arming a read's deadline takes no more than a lock. A replica that
+// fails a read is replaced by the next one at once.
+//
+// Replicas are only eventually consistent. They keep no versions and apply
+// writes independently, in whatever order they arrive, and a read is answered
+// by a single replica. So a read may miss a write that has already been
+// acknowledged, because the replica it went to is not in that write's quorum,
+// and two reads in a row may go back in time. Concurrent writes to one key
+// may leave the replicas with different values for good. The write quorum
+// bounds how many replicas can fail before an acknowledged write is lost; it
+// is not a read-after-write guarantee.
+//
+// A request is encoded once, taking over the caller's value, and the same
+// message goes to every replica and into every retry.
+//
+// With a batch window, requests for the same endpoint, from any number of
+// callers, are coalesced into Batch frames by a RequestBatcher, and a
+// multi_get or multi_set sends its batches as soon as it has issued them.
+//
+// The cache starts out as a single shard served by every endpoint of the
+// pool, and is only corrected when a server answers WrongShard: the server's
+// map replaces the cached one, unless it is older, and the request is retried,
+// up to max_attempts times. So a client learns the layout lazily, from the
+// requests that needed it, and a split or move costs each client one extra
+// round trip. A server that has not yet been sent the newest map cannot take
+// the client back to an older one.
+//
+// Every endpoint named by a shard map must be part of the pool. The client
+// must outlive the futures it returns.
+class StorageClient {
+public:
+    struct Options {
+        // Attempts per request (or per shard of a range request) before a
+        // WrongShard error is passed to the caller
+        size_t max_attempts = 4;
+        // Replicas that must acknowledge a write; 0 means a majority. Reads do
+        // not wait for a matching quorum, so this buys durability, not
+        // consistency.
+        size_t write_quorum = 0;
+        // Whether slow reads are hedged with a backup request
+        bool hedge_reads = true;
+        // Percentile of recent read latencies after which a backup is sent
+        double hedge_percentile = 0.95;
+        // Delay used until enough reads have been timed
+        std::chrono::microseconds initial_hedge_delay{10'000};
+        // Lower bound of the delay, so fast replicas are not flooded with backups
+        std::chrono::microseconds min_hedge_delay{100};
+        // How long a request waits for others to the same endpoint to share a
+        // Batch frame with; 0 sends every request in a frame of its own
+        std::chrono::microseconds batch_window{0};
+        // A batch is sent before its window has passed once it holds this
+        // many requests or bytes of request payload
+        size_t max_batch_requests = 64;
+        size_t max_batch_bytes = 64 * 1024;
+    };
+
+    StorageClient(ConnectionPool &pool, Options options);
+
+    explicit StorageClient(ConnectionPool &pool) : StorageClient(pool, Options()) {}
+
+    StorageClient(const StorageClient &) = delete;
+
+    StorageClient &operator=(const StorageClient &) = delete;
+
+    // Stops the hedging thread; reads still waiting for it get no backup.
+    ~StorageClient();
+
+    Future<std::optional<std::string>> get(std::string key);
+
+    Future<Void> set(std::string key, std::string value);
+
+    Future<Void> clear(std::string key);
+
+    // Reads several keys; the values come in the order of keys.
+    Future<std::vector<std::optional<std::string>>> multi_get(std::vector<std::string> keys);
+
+    // Sets several keys, each as set() would; fails if any of them fails.
+    Future<Void> multi_set(std::vector<KeyValue> entries);
+
+    // Clears every key in [begin, end).
+    Future<Void> clear_range(std::string begin, std::string end);
+
+    // Reads up to limit key-value pairs in [begin, end), in key order.
+    Future<std::vector<KeyValue>> get_range(std::string begin, std::string end, size_t limit);
+
+    // Replaces the cached map with the one of an endpoint that serves the
+    // first shard, instead of waiting for a WrongShard.
+    Future<Void> refresh();
+
+    // Sends a request to endpoint itself, whatever the shard map says, for
+    // managing the cluster rather than reading or writing keys.
+    Future<BufferSlice> request(const tcp::endpoint &endpoint, Opcode opcode, Message payload);
+
+    // Closes the established connections.
+    Future<Void> close();
+
+    [[nodiscard]] std::shared_ptr<const ShardMap> shard_map() const;
+
+    // Number of WrongShard responses received
+    [[nodiscard]] uint64_t wrong_shards() const {
+        return m_wrong_shards.load(std::memory_order_relaxed);
+    }
+
+    // Number of backup requests sent for slow reads
+    [[nodiscard]] uint64_t hedged_reads() const {
+        return m_hedged_reads.load(std::memory_order_relaxed);
+    }
+
+    // The current hedging delay
+    [[nodiscard]] std::chrono::microseconds hedge_delay() const {
+        return std::chrono::microseconds(m_hedge_delay.load(std::memory_order_relaxed));
+    }
+
+    // The batcher, for its counters; null without a batch window
+    [[nodiscard]] const RequestBatcher *batcher() const {
+        return m_batcher.get();
+    }
+
+private:
+    // Read latencies kept for the hedging delay
+    static constexpr size_t kLatencySamples = 1024;
+    // The delay is recomputed after this many new samples
+    static constexpr size_t kLatencyUpdateInterval = 64;
+
+    struct HedgedRead;
+
+    Future<std::optional<std::string>> get(std::string key, Message request, size_t attempt);
+
+    // Sends a Set or Clear request for key.
+    Future<Void> update(std::string key, Opcode opcode, Message request, size_t attempt);
+
+    Future<Void> clear_range(std::string begin, std::string end, size_t attempt);
+
+    Future<std::vector<KeyValue>> get_range(std::string begin, std::string end, size_t limit, size_t attempt);
+
+    // Reads from one replica of the team serving key, hedged if it is slow.
+    Future<BufferSlice> read(std::string_view key, Opcode opcode, Message payload);
+
+    Future<BufferSlice> read(const std::vector<tcp::endpoint> &team, Opcode opcode, Message payload);
+
+    // Sends a write to every replica of the team serving key and waits for
+    // the write quorum.
+    Future<Void> write(std::string_view key, Opcode opcode, const Message &payload);
+
+    Future<Void> write(const std::vector<tcp::endpoint> &team, Opcode opcode, const Message &payload);
+
+    // Sends the hedged read to its next replica, if any is left.
+    void launch(const std::shared_ptr<HedgedRead> &state);
+
+    // Sends a request through the batcher, if there is one.
+    Future<BufferSlice> send(const tcp::endpoint &endpoint, Opcode opcode, Message payload);
+
+    Future<BufferSlice> send_frame(const tcp::endpoint &endpoint, Opcode opcode, Message payload);
+
+    // The connection to endpoint, established on first use and again after it
+    // failed.
+    Future<std::shared_ptr<MultiplexedConnection>> connection(const tcp::endpoint &endpoint);
+
+    // Passes response through, unless it failed with WrongShard and attempts
+    // remain: then the server's map is installed and retry(attempt + 1)
+    // takes its place.
+    template<typename T, typename F>
+    Future<T> retry_on_wrong_shard(Future<T> response, size_t attempt, F retry);
+
+    // Replaces the cached map with encoded, unless that is older.
+    void install(std::string_view encoded);
+
+    void record_read_latency(std::chrono::nanoseconds latency);
+
+    // Sends a backup for every read still unanswered at its deadline.
+    void hedge(std::vector<std::shared_ptr<HedgedRead>> &due);
+
+    ConnectionPool &m_pool;
+    Options m_options;
+
+    mutable std::mutex m_mutex;
+    std::shared_ptr<const ShardMap> m_map;
+    std::map<tcp::endpoint, Future<std::shared_ptr<MultiplexedConnection>>> m_connections;
+
+    std::mutex m_latency_mutex;
+    // Ring buffer of recent read latencies in microseconds
+    std::vector<int64_t> m_latencies;
+    size_t m_latency_count = 0;
+    std::atomic<int64_t> m_hedge_delay;
+
+    // Reads waiting for their hedging deadline, if reads are hedged. Every
+    // read gets the same delay, so a read is late by at most a change of it.
+    std::unique_ptr<DeadlineQueue<std::shared_ptr<HedgedRead>>> m_hedges;
+
+    std::atomic<uint64_t> m_wrong_shards{0};
+    std::atomic<uint64_t> m_hedged_reads{0};
+
+    // Last, so open batches are sent while the connections are still there
+    std::unique_ptr<RequestBatcher> m_batcher;
+};
+
+#endif //FLOWDB_STORAGE_CLIENT_H
@@ -0,0 +1,135 @@
+#ifndef FLOWDB_STORAGE_PROTOCOL_H
+#define FLOWDB_STORAGE_PROTOCOL_H
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "message.h"
+#include "ordered_store.h"
+
+// Frame payloads of the storage opcodes, as flat messages (message.h) whose
+// fields are listed here; limits and versions are integer fields:
+//
+//     Get             [key]               -> [] if the key is not set, else [value]
+//     Set             [key, value]        -> []
+//     Clear           [key]               -> []
+//     ClearRange      [begin, end]        -> []
+//     GetRange        [begin, end, limit] -> [key, value, key, value, ...]
+//     GetShardMap     []                  -> [shard map (shard_map.h)]
+//     InstallShardMap [shard map]         -> [the shard map after]
+//     GetSplitKeys    []                  -> [map version, key, key, ...]
+//
+// A server that does not serve a request's key answers with a kWrongShard
+// error response whose payload is its shard map, as is.
+//
+// Encoders take the strings they may keep by value: a large key or value is
+// taken over by the message rather than copied.
+
+inline Message encode_get(std::string key) {
+    return MessageBuilder().add(std::move(key)).finish();
+}
+
+inline Message encode_set(std::string key, std::string value) {
+    return MessageBuilder().add(std::move(key)).add(std::move(value)).finish();
+}
+
+inline Message encode_clear(std::string key) {
+    return encode_get(std::move(key));
+}
+
+inline Message encode_clear_range(std::string begin, std::string end) {
+    return encode_set(std::move(begin), std::move(end));
+}
+
+inline Message encode_get_range(std::string begin, std::string end, size_t limit) {
+    return MessageBuilder().add(std::move(begin)).add(std::move(end)).add_u64(limit).finish();
+}
+
+inline Message encode_install_shard_map(std::string shard_map) {
+    return encode_get(std::move(shard_map));
+}
+
+inline Message encode_get_response(std::optional<std::string> value) {
+    MessageBuilder builder;
+    if (value) {
+        builder.add(std::move(*value));
+    }
+    return builder.finish();
+}
+
+inline Message encode_get_range_response(std::vector<KeyValue> entries) {
+    MessageBuilder builder;
+    for (auto &entry: entries) {
+        builder.add(std::move(entry.key)).add(std::move(entry.value));
+    }
+    return builder.finish();
+}
+
+inline Message encode_shard_map_response(std::string shard_map) {
+    return MessageBuilder().add(std::move(shard_map)).finish();
+}
+
+inline Message encode_split_keys_response(uint64_t version, std::vector<std::string> keys) {
+    MessageBuilder builder;
+    builder.add_u64(version);
+    for (auto &key: keys) {
+        builder.add(std::move(key));
+    }
+    return builder.finish();
+}
+
+// @throws std::invalid_argument if the payload is malformed.
+inline std::optional<std::string> decode_get_response(std::string_view payload) {
+    MessageView message(payload);
+    if (message.size() > 1) {
+        throw std::invalid_argument("Malformed get response");
+    }
+    if (message.size() == 0) {
+        return std::nullopt;
+    }
+    return std::string(message.bytes(0));
+}
+
+// @throws std::invalid_argument if the payload is malformed.
+inline std::vector<KeyValue> decode_get_range_response(std::string_view payload) {
+    MessageView message(payload);
+    if (message.size() % 2 != 0) {
+        throw std::invalid_argument("Malformed get range response");
+    }
+    std::vector<KeyValue> result;
+    result.reserve(message.size() / 2);
+    for (size_t i = 0; i < message.size(); i += 2) {
+        result.push_back(KeyValue{std::string(message.bytes(i)), std::string(message.bytes(i + 1))});
+    }
+    return result;
+}
+
+// @throws std::invalid_argument if the payload is malformed.
+inline std::string_view decode_shard_map_response(std::string_view payload) {
+    MessageView message(payload);
+    if (message.size() != 1) {
+        throw std::invalid_argument("Malformed shard map response");
+    }
+    return message.bytes(0);
+}
+
+// The version of the server's map, and its split keys.
+//
+// @throws std::invalid_argument if the payload is malformed.
+inline std::pair<uint64_t, std::vector<std::string>> decode_split_keys_response(std::string_view payload) {
+    MessageView message(payload);
+    if (message.size() == 0) {
+        throw std::invalid_argument("Malformed split keys response");
+    }
+    std::vector<std::string> keys;
+    keys.reserve(message.size() - 1);
+    for (size_t i = 1; i < message.size(); i++) {
+        keys.emplace_back(message.bytes(i));
+    }
+    return {message.u64(0), std::move(keys)};
+}
+
+#endif //FLOWDB_STORAGE_PROTOCOL_H
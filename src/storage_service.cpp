@@ -0,0 +1,215 @@
+#include "storage_service.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include "message.h"
+#include "storage_protocol.h"
+
+namespace {
+
+Message empty_response(const Void &) {
+    return {};
+}
+
+Message empty_responses(const std::vector<Void> &) {
+    return {};
+}
+
+// A part of a range request that falls in one partition
+struct Slice {
+    StorageActor *owner;
+    std::string begin;
+    std::string end;
+};
+
+// Sends to actor with send(). If its mailbox is full, nothing was sent, and
+// the session is told to wait for room and try again.
+template<typename Send>
+auto send_or_wait(StorageActor *actor, Send send) -> decltype(send()) {
+    try {
+        return send();
+    } catch (const MailboxFull &) {
+        throw Overloaded(actor->ready());
+    }
+}
+
+// Sends to actor with send() once its mailbox has room, however many tries
+// that takes. For the slices of a range request after the first, which is on
+// its way already, so the request can no longer be handed back.
+template<typename Send>
+auto send_when_ready(StorageActor *actor, Send send) -> decltype(send()) {
+    try {
+        return send();
+    } catch (const MailboxFull &) {
+    }
+    return actor->ready().then([actor, send](const Void &) { return send_when_ready(actor, send); });
+}
+
+} // namespace
+
+/**
+ * @brief Handler for the storage opcodes.
+ *
+ * Requests are read in place from the receive buffer before they reach the
+ * actor, so malformed payloads are rejected on the connection's thread and the
+ * actor only sees typed messages; keys and values are copied once, into the
+ * actor's message. Read responses are encoded by the actor itself. A request
+ * for an actor whose mailbox is full throws Overloaded, so the session stops
+ * reading until there is room rather than fail it.
+ */
+FrameSession::Handler make_storage_handler(std::shared_ptr<StorageActor> storage,
+                                           std::shared_ptr<LocalShards> shards) {
+    std::vector<std::shared_ptr<StorageActor>> actors;
+    actors.push_back(std::move(storage));
+    return make_storage_handler(std::move(actors), ShardMap(), std::move(shards));
+}
+
+/**
+ * @brief Handler for the storage opcodes over partitioned storage.
+ *
+ * A request that falls in one partition takes the same path as with a single
+ * actor, including the encoded replies. A range that spans several is sent to
+ * each owner as its own request, with the full limit, since any one of them
+ * may hold every entry; the replies are concatenated in partition order and
+ * cut to the limit. Only the first slice can make the session wait; the later
+ * ones wait for room on their own.
+ */
+FrameSession::Handler make_storage_handler(std::vector<std::shared_ptr<StorageActor>> storage, ShardMap partitions,
+                                           std::shared_ptr<LocalShards> shards) {
+    if (storage.empty()) {
+        throw std::invalid_argument("Storage needs at least one actor");
+    }
+    auto owners = std::make_shared<const std::vector<std::shared_ptr<StorageActor>>>(std::move(storage));
+    auto map = std::make_shared<const ShardMap>(std::move(partitions));
+    auto owner = [owners, map](std::string_view key) {
+        return (*owners)[map->locate(key) % owners->size()].get();
+    };
+    auto slices = [owners, map](std::string_view begin, std::string_view end) {
+        std::vector<Slice> result;
+        for (size_t index: map->overlapping(begin, end)) {
+            const Shard &partition = (*map)[index];
+            std::string_view slice_end = end;
+            if (!partition.end.empty() && std::string_view(partition.end) < end) {
+                slice_end = partition.end;
+            }
+            result.push_back(Slice{(*owners)[index % owners->size()].get(),
+                                   std::string(std::max(begin, std::string_view(partition.begin))),
+                                   std::string(slice_end)});
+        }
+        return result;
+    };
+    auto admit = [shards](std::string_view key) {
+        if (shards) {
+            shards->admit(key);
+        }
+    };
+    auto admit_range = [shards](std::string_view begin, std::string_view end) {
+        if (shards) {
+            shards->admit_range(begin, end);
+        }
+    };
+    return [owner, slices, shards, admit, admit_range](
+            Opcode opcode, std::string_view payload) -> Future<Message> {
+        // Echo payloads are arbitrary bytes; every other request is a message
+        if (opcode == Opcode::Echo) {
+            return make_ready_future(Message(std::string(payload)));
+        }
+        MessageView request(payload);
+        switch (opcode) {
+            case Opcode::GetShardMap:
+                if (!shards) {
+                    throw std::invalid_argument("Server is not sharded");
+                }
+                return make_ready_future(encode_shard_map_response(shards->map()->encode()));
+            case Opcode::InstallShardMap:
+                if (!shards) {
+                    throw std::invalid_argument("Server is not sharded");
+                }
+                shards->install(ShardMap::decode(request.bytes(0)));
+                return make_ready_future(encode_shard_map_response(shards->map()->encode()));
+            case Opcode::GetSplitKeys: {
+                if (!shards) {
+                    throw std::invalid_argument("Server is not sharded");
+                }
+                std::vector<std::string> keys = shards->split_keys();
+                return make_ready_future(encode_split_keys_response(shards->map()->version(), std::move(keys)));
+            }
+            case Opcode::Get: {
+                std::string_view key = request.bytes(0);
+                admit(key);
+                StorageActor *actor = owner(key);
+                return send_or_wait(actor, [&] { return actor->get_encoded(std::string(key)); });
+            }
+            case Opcode::Set: {
+                std::string_view key = request.bytes(0);
+                admit(key);
+                StorageActor *actor = owner(key);
+                return send_or_wait(actor, [&] {
+                    return actor->set(std::string(key), std::string(request.bytes(1)));
+                }).then(empty_response);
+            }
+            case Opcode::Clear: {
+                std::string_view key = request.bytes(0);
+                admit(key);
+                StorageActor *actor = owner(key);
+                return send_or_wait(actor, [&] { return actor->clear(std::string(key)); }).then(empty_response);
+            }
+            case Opcode::ClearRange: {
+                std::string_view begin = request.bytes(0);
+                std::string_view end = request.bytes(1);
+                admit_range(begin, end);
+                std::vector<Slice> parts = slices(begin, end);
+                if (parts.size() <= 1) {
+                    StorageActor *actor = owner(begin);
+                    return send_or_wait(actor, [&] {
+                        return actor->clear_range(std::string(begin), std::string(end));
+                    }).then(empty_response);
+                }
+                std::vector<Future<Void>> cleared;
+                cleared.reserve(parts.size());
+                for (auto &part: parts) {
+                    auto send = [actor = part.owner, begin = std::move(part.begin), end = std::move(part.end)] {
+                        return actor->clear_range(begin, end);
+                    };
+                    cleared.push_back(cleared.empty() ? send_or_wait(part.owner, send)
+                                                      : send_when_ready(part.owner, send));
+                }
+                return when_all(std::move(cleared)).then(empty_responses);
+            }
+            case Opcode::GetRange: {
+                std::string_view begin = request.bytes(0);
+                std::string_view end = request.bytes(1);
+                uint64_t limit = request.u64(2);
+                admit_range(begin, end);
+                std::vector<Slice> parts = slices(begin, end);
+                if (parts.size() <= 1) {
+                    StorageActor *actor = owner(begin);
+                    return send_or_wait(actor, [&] {
+                        return actor->get_range_encoded(std::string(begin), std::string(end), limit);
+                    });
+                }
+                std::vector<Future<std::vector<KeyValue>>> ranges;
+                ranges.reserve(parts.size());
+                for (auto &part: parts) {
+                    auto send = [actor = part.owner, begin = std::move(part.begin), end = std::move(part.end), limit] {
+                        return actor->get_range(begin, end, limit);
+                    };
+                    ranges.push_back(ranges.empty() ? send_or_wait(part.owner, send)
+                                                    : send_when_ready(part.owner, send));
+                }
+                return when_all(std::move(ranges)).then([limit](const std::vector<std::vector<KeyValue>> &parts) {
+                    std::vector<KeyValue> entries;
+                    for (const auto &part: parts) {
+                        for (auto it = part.begin(); it != part.end() && entries.size() < limit; ++it) {
+                            entries.push_back(*it);
+                        }
+                    }
+                    return encode_get_range_response(std::move(entries));
+                });
+            }
+            default:
+                throw std::invalid_argument("Unsupported opcode");
+        }
+    };
+}
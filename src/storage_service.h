@@ -0,0 +1,32 @@
+#ifndef FLOWDB_STORAGE_SERVICE_H
+#define FLOWDB_STORAGE_SERVICE_H
+
+#include <memory>
+#include <vector>
+#include "frame_session.h"
+#include "local_shards.h"
+#include "shard_map.h"
+#include "storage.h"
+#include "storage_protocol.h"
+
+// Builds a FrameSession handler that decodes storage requests on the network
+// thread and forwards them to the storage actor. Echo is answered directly.
+//
+// With shards, requests for keys the server does not serve are rejected with
+// WrongShard, and the GetShardMap, InstallShardMap and GetSplitKeys opcodes
+// are served. A request for a storage actor whose mailbox is full throws
+// Overloaded, so the session waits for room instead of failing it.
+FrameSession::Handler make_storage_handler(std::shared_ptr<StorageActor> storage,
+                                           std::shared_ptr<LocalShards> shards = nullptr);
+
+// Like make_storage_handler(), for data split by key range between several
+// storage actors, such as one per core in thread-per-core mode. Shard i of
+// partitions is owned by storage[i % storage.size()], whatever its team, so a
+// map with more shards than actors deals each one several slices of the key
+// space. A request is forwarded to the actor that owns its key; a range
+// request to every owner of part of the range, with the range cut to fit, and
+// their replies are put back together in key order.
+FrameSession::Handler make_storage_handler(std::vector<std::shared_ptr<StorageActor>> storage, ShardMap partitions,
+                                           std::shared_ptr<LocalShards> shards = nullptr);
+
+#endif //FLOWDB_STORAGE_SERVICE_H
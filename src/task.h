@@ -0,0 +1,116 @@
+#ifndef FLOWDB_TASK_H
+#define FLOWDB_TASK_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "recycling_allocator.h"
+
+// Move-only type-erased void() callable. Unlike std::function it never copies,
+// and callables up to kInlineSize bytes are stored inside the task itself;
+// larger ones are placed in RecyclingAllocator memory rather than on the heap.
+class Task {
+public:
+    static constexpr size_t kInlineSize = 64;
+
+    Task() noexcept = default;
+
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+    Task(F &&f) {
+        using Callable = std::decay_t<F>;
+        if constexpr (fits_inline<Callable>()) {
+            ::new(static_cast<void *>(m_storage)) Callable(std::forward<F>(f));
+            m_vtable = &kInlineVTable<Callable>;
+        } else {
+            void *memory = RecyclingAllocator::allocate(sizeof(Callable));
+            *reinterpret_cast<Callable **>(m_storage) = ::new(memory) Callable(std::forward<F>(f));
+            m_vtable = &kOutOfLineVTable<Callable>;
+        }
+    }
+
+    Task(const Task &) = delete;
+
+    Task(Task &&other) noexcept: m_vtable(other.m_vtable) {
+        if (m_vtable) {
+            m_vtable->relocate(m_storage, other.m_storage);
+            other.m_vtable = nullptr;
+        }
+    }
+
+    ~Task() {
+        reset();
+    }
+
+    Task &operator=(const Task &) = delete;
+
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            reset();
+            m_vtable = other.m_vtable;
+            if (m_vtable) {
+                m_vtable->relocate(m_storage, other.m_storage);
+                other.m_vtable = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    explicit operator bool() const {
+        return m_vtable != nullptr;
+    }
+
+    void operator()() {
+        m_vtable->invoke(m_storage);
+    }
+
+private:
+    struct VTable {
+        void (*invoke)(void *storage);
+
+        // Moves the callable from src into dst and destroys the source
+        void (*relocate)(void *dst, void *src);
+
+        void (*destroy)(void *storage);
+    };
+
+    template<typename F>
+    static constexpr bool fits_inline() {
+        return sizeof(F) <= kInlineSize && alignof(F) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible_v<F>;
+    }
+
+    template<typename F>
+    static constexpr VTable kInlineVTable = {
+            [](void *storage) { (*std::launder(reinterpret_cast<F *>(storage)))(); },
+            [](void *dst, void *src) {
+                F *source = std::launder(reinterpret_cast<F *>(src));
+                ::new(dst) F(std::move(*source));
+                source->~F();
+            },
+            [](void *storage) { std::launder(reinterpret_cast<F *>(storage))->~F(); },
+    };
+
+    template<typename F>
+    static constexpr VTable kOutOfLineVTable = {
+            [](void *storage) { (**reinterpret_cast<F **>(storage))(); },
+            [](void *dst, void *src) { *reinterpret_cast<F **>(dst) = *reinterpret_cast<F **>(src); },
+            [](void *storage) {
+                F *callable = *reinterpret_cast<F **>(storage);
+                callable->~F();
+                RecyclingAllocator::deallocate(callable, sizeof(F));
+            },
+    };
+
+    void reset() {
+        if (m_vtable) {
+            m_vtable->destroy(m_storage);
+            m_vtable = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char m_storage[kInlineSize];
+    const VTable *m_vtable = nullptr;
+};
+
+#endif //FLOWDB_TASK_H
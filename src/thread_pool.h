@@ -0,0 +1,323 @@
+#ifndef FLOWDB_THREAD_POOL_H
+#define FLOWDB_THREAD_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "metrics.h"
+#include "recycling_allocator.h"
+#include "task.h"
+#include "work_stealing_deque.h"
+
+// A unit of work that can be scheduled on a ThreadPool.
+class Runnable {
+public:
+    virtual ~Runnable() = default;
+
+    virtual void run() = 0;
+};
+
+// Something that runs Runnables: a ThreadPool, or one core of a CoreSet
+// (core_set.h).
+class Executor {
+public:
+    virtual ~Executor() = default;
+
+    // Schedules a runnable. The executor does not take ownership of it.
+    virtual void schedule(Runnable *task) = 0;
+};
+
+// Lets idle workers sleep without a shared mutex. A waiter announces itself with
+// prepare_wait(), re-checks for work and only then blocks; notifiers skip the
+// wakeup entirely when nobody is waiting.
+class EventCount {
+public:
+    uint32_t prepare_wait() {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_seq_cst);
+    }
+
+    void cancel_wait() {
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void wait(uint32_t key) {
+        m_epoch.wait(key, std::memory_order_seq_cst);
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void notify_one() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_seq_cst) != 0) {
+            m_epoch.fetch_add(1, std::memory_order_seq_cst);
+            m_epoch.notify_one();
+        }
+    }
+
+    void notify_all() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_seq_cst) != 0) {
+            m_epoch.fetch_add(1, std::memory_order_seq_cst);
+            m_epoch.notify_all();
+        }
+    }
+
+private:
+    std::atomic<uint32_t> m_epoch{0};
+    std::atomic<uint32_t> m_waiters{0};
+};
+
+// Work-stealing thread pool. Each worker owns a Chase-Lev deque; tasks submitted
+// from a worker go to its own deque, tasks submitted from outside go to a shared
+// injection queue, and idle workers steal from each other before parking.
+class ThreadPool : public Executor {
+public:
+    // max_injected bounds the injection queue for try_submit(); 0 leaves it
+    // unbounded.
+    explicit ThreadPool(size_t num_threads, size_t max_injected = 0) : m_max_injected(max_injected) {
+        if (num_threads == 0) {
+            num_threads = 1;
+        }
+        m_workers.reserve(num_threads);
+        for (size_t i = 0; i < num_threads; i++) {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+        m_threads.reserve(num_threads);
+        for (size_t i = 0; i < num_threads; i++) {
+            m_threads.emplace_back([this, i] { worker_loop(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() override {
+        m_done.store(true, std::memory_order_seq_cst);
+        m_event.notify_all();
+        for (auto &thread: m_threads) {
+            thread.join();
+        }
+    }
+
+    // Submits a callable to be run on one of the workers. Callables that fit
+    // in Task's inline buffer are submitted without touching the heap.
+    void submit(Task task) {
+        schedule(new TaskNode(std::move(task)));
+    }
+
+    // Submits a callable unless it comes from outside the pool while the
+    // injection queue holds max_injected tasks, so threads feeding the pool
+    // can be turned away rather than queue without limit. The bound is not
+    // exact under concurrent submissions. Workers are never refused, since
+    // what they submit continues work the pool has already taken on.
+    bool try_submit(Task task) {
+        if (m_max_injected != 0 && t_pool != this &&
+            m_injection_size.load(std::memory_order_relaxed) >= m_max_injected) {
+            Metrics::add(Metrics::Counter::PoolSubmitsRejected);
+            return false;
+        }
+        submit(std::move(task));
+        return true;
+    }
+
+    // Submits a callable that only runs when a worker finds nothing else to
+    // do, for background work such as compaction. It runs on a worker like any
+    // task, so long jobs should be split into steps that resubmit themselves,
+    // which lets foreground work in between the steps.
+    void submit_background(Task task) {
+        {
+            std::unique_lock<std::mutex> lock(m_background_mutex);
+            m_background.push_back(new TaskNode(std::move(task)));
+            m_background_size.store(m_background.size(), std::memory_order_release);
+        }
+        m_event.notify_one();
+    }
+
+    // Schedules a runnable. The pool does not take ownership of it.
+    void schedule(Runnable *task) override {
+        if (t_pool == this) {
+            m_workers[t_index]->deque.push(task);
+        } else {
+            std::unique_lock<std::mutex> lock(m_injection_mutex);
+            m_injection.push_back(task);
+            m_injection_size.store(m_injection.size() - m_injection_head, std::memory_order_release);
+        }
+        m_event.notify_one();
+    }
+
+    [[nodiscard]] size_t size() const {
+        return m_workers.size();
+    }
+
+    // Returns true if the calling thread is one of this pool's workers.
+    [[nodiscard]] bool on_worker_thread() const {
+        return t_pool == this;
+    }
+
+    // Returns true if the calling thread is a worker of any pool.
+    static bool on_worker() {
+        return t_pool != nullptr;
+    }
+
+private:
+    class TaskNode : public Runnable, public Recycled {
+    public:
+        explicit TaskNode(Task task) : m_task(std::move(task)) {}
+
+        void run() override {
+            m_task();
+            delete this;
+        }
+
+    private:
+        Task m_task;
+    };
+
+    struct alignas(64) Worker {
+        WorkStealingDeque<Runnable *> deque;
+    };
+
+    // Number of polling rounds before a worker parks
+    static constexpr int kSpinRounds = 64;
+
+    // Workers split their time into busy and idle stretches. The clock is read
+    // when a worker runs out of work and when it finds some again, which costs
+    // nothing while it would be idle anyway, and around one task in every
+    // Metrics::kSampleInterval, which times that task and brings the busy
+    // time up to date on a worker that never runs dry.
+    void worker_loop(size_t index) {
+        t_pool = this;
+        t_index = index;
+        Metrics::set_thread_name("pool-worker-" + std::to_string(index));
+        uint64_t seed = 0x9E3779B97F4A7C15ull * (index + 1);
+        uint64_t since = Metrics::now();
+        bool idle = false;
+        while (true) {
+            Runnable *task = find_task(index, seed);
+            if (task == nullptr && !idle) {
+                since = account(Metrics::Counter::PoolBusyNanos, since);
+                idle = true;
+            }
+            for (int i = 0; task == nullptr && i < kSpinRounds; i++) {
+                std::this_thread::yield();
+                task = find_task(index, seed);
+            }
+            if (task == nullptr) {
+                uint32_t key = m_event.prepare_wait();
+                task = find_task(index, seed);
+                if (task == nullptr) {
+                    if (m_done.load(std::memory_order_seq_cst)) {
+                        m_event.cancel_wait();
+                        break;
+                    }
+                    Metrics::add(Metrics::Counter::PoolParks);
+                    m_event.wait(key);
+                    continue;
+                }
+                m_event.cancel_wait();
+            }
+            if (idle) {
+                since = account(Metrics::Counter::PoolIdleNanos, since);
+                idle = false;
+            }
+            if (Metrics::sample()) {
+                uint64_t started = account(Metrics::Counter::PoolBusyNanos, since);
+                task->run();
+                since = account(Metrics::Counter::PoolBusyNanos, started);
+                Metrics::record(Metrics::Latency::PoolTask, since - started);
+            } else {
+                task->run();
+            }
+            Metrics::add(Metrics::Counter::PoolTasksRun);
+        }
+        account(Metrics::Counter::PoolIdleNanos, since);
+        t_pool = nullptr;
+    }
+
+    // Adds the time from since to now to counter and returns now.
+    static uint64_t account(Metrics::Counter counter, uint64_t since) {
+        uint64_t now = Metrics::now();
+        Metrics::add(counter, now - since);
+        return now;
+    }
+
+    // Looks for work in the local deque, then the injection queue, then
+    // steals, and only then takes a background task.
+    Runnable *find_task(size_t index, uint64_t &seed) {
+        Runnable *task = nullptr;
+        if (m_workers[index]->deque.pop(task)) {
+            return task;
+        }
+        if (m_injection_size.load(std::memory_order_acquire) != 0) {
+            std::unique_lock<std::mutex> lock(m_injection_mutex);
+            if (m_injection_head != m_injection.size()) {
+                task = m_injection[m_injection_head++];
+                if (m_injection_head == m_injection.size()) {
+                    m_injection.clear();
+                    m_injection_head = 0;
+                } else if (m_injection_head >= 1024 && m_injection_head * 2 >= m_injection.size()) {
+                    m_injection.erase(m_injection.begin(), m_injection.begin() + m_injection_head);
+                    m_injection_head = 0;
+                }
+                m_injection_size.store(m_injection.size() - m_injection_head, std::memory_order_release);
+                return task;
+            }
+        }
+        size_t n = m_workers.size();
+        if (n > 1) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            size_t start = seed % n;
+            for (size_t i = 0; i < n; i++) {
+                size_t victim = (start + i) % n;
+                if (victim != index && m_workers[victim]->deque.steal(task)) {
+                    Metrics::add(Metrics::Counter::PoolTasksStolen);
+                    return task;
+                }
+            }
+        }
+        if (m_background_size.load(std::memory_order_acquire) != 0) {
+            std::unique_lock<std::mutex> lock(m_background_mutex);
+            if (!m_background.empty()) {
+                task = m_background.front();
+                m_background.pop_front();
+                m_background_size.store(m_background.size(), std::memory_order_release);
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    // Pool and worker index of the calling thread, if it is a worker
+    static inline thread_local ThreadPool *t_pool = nullptr;
+    static inline thread_local size_t t_index = 0;
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+
+    // Tasks submitted from threads outside the pool. Consumed from
+    // m_injection_head so the buffer is reused rather than reallocated.
+    std::vector<Runnable *> m_injection;
+    size_t m_injection_head = 0;
+    std::mutex m_injection_mutex;
+    std::atomic<size_t> m_injection_size{0};
+    size_t m_max_injected;
+
+    // Low-priority tasks, taken only when there is nothing else to run
+    std::deque<Runnable *> m_background;
+    std::mutex m_background_mutex;
+    std::atomic<size_t> m_background_size{0};
+
+    EventCount m_event;
+    std::atomic<bool> m_done{false};
+};
+
+#endif //FLOWDB_THREAD_POOL_H
@@ -0,0 +1,204 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include "format.h"
+
+namespace {
+
+// Mailbox nodes and shared states are both identified by their address, so
+// the flows that link them get a tag in the top bits to keep them apart
+constexpr uint64_t kMailboxFlow = uint64_t{1} << 62;
+constexpr uint64_t kFutureFlow = uint64_t{2} << 62;
+
+struct Copied {
+    uint64_t time;
+    Trace::Event event;
+    const char *name;
+    uint64_t span;
+    uint64_t arg;
+};
+
+std::string quoted(std::string_view text) {
+    std::string out = "\"";
+    for (char c: text) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            append_format(out, "\\u%04x", static_cast<unsigned>(c));
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+    return out;
+}
+
+// Writes Chrome trace events for the records of one thread.
+class Writer {
+public:
+    // woken holds the shared states some thread woke on; only their
+    // fulfilment starts a flow, since most futures are never waited on
+    Writer(std::string &out, int pid, std::unordered_set<uint64_t> woken)
+            : m_out(out), m_pid(pid), m_woken(std::move(woken)) {}
+
+    void thread(uint64_t tid, const std::string &name) {
+        m_tid = tid;
+        m_depth = 0;
+        separate();
+        append_format(m_out, R"({"name":"thread_name","ph":"M","pid":%d,"tid":%llu,"args":{"name":%s}})", m_pid,
+                      static_cast<unsigned long long>(m_tid), quoted(name).c_str());
+    }
+
+    void record(const Copied &record) {
+        switch (record.event) {
+            case Trace::Event::Send:
+                instant("tell " + readable(record.name), record);
+                flow("s", kMailboxFlow | record.arg, record);
+                break;
+            case Trace::Event::Dequeue:
+                instant("dequeue " + readable(record.name), record, "count");
+                break;
+            case Trace::Event::HandlerBegin:
+                event("B", readable(record.name), record, "");
+                flow("f", kMailboxFlow | record.arg, record);
+                m_depth++;
+                break;
+            case Trace::Event::HandlerEnd:
+                // The begin may have been overwritten
+                if (m_depth > 0) {
+                    m_depth--;
+                    event("E", readable(record.name), record, "");
+                }
+                break;
+            case Trace::Event::Fulfil:
+                instant("set_value", record);
+                if (m_woken.contains(record.arg)) {
+                    flow("s", kFutureFlow | record.arg, record);
+                }
+                break;
+            case Trace::Event::Wake:
+                instant("wake", record);
+                flow("f", kFutureFlow | record.arg, record);
+                break;
+            case Trace::Event::SocketRead:
+                instant("read", record, "bytes");
+                break;
+            case Trace::Event::SocketWrite:
+                instant("write", record, "bytes");
+                break;
+            case Trace::Event::RequestSent:
+                instant("send request", record, "opcode");
+                break;
+            case Trace::Event::RequestReceived:
+                instant("serve request", record, "opcode");
+                break;
+        }
+    }
+
+private:
+    // Demangles type names once per dump
+    const std::string &readable(const char *name) {
+        auto [it, inserted] = m_names.try_emplace(name);
+        if (inserted) {
+            it->second = name == nullptr ? "resume" : demangle(name);
+        }
+        return it->second;
+    }
+
+    void separate() {
+        if (m_first) {
+            m_first = false;
+        } else {
+            m_out += ",\n";
+        }
+    }
+
+    // A zero-length slice, named argument arg_name holding the record's arg
+    void instant(const std::string &name, const Copied &record, const char *arg_name = nullptr) {
+        std::string args;
+        if (arg_name != nullptr) {
+            append_format(args, R"(,"%s":%llu)", arg_name, static_cast<unsigned long long>(record.arg));
+        }
+        event("X", name, record, R"(,"dur":0)", args);
+    }
+
+    void event(const char *phase, const std::string &name, const Copied &record, const char *extra,
+               const std::string &args = "") {
+        separate();
+        append_format(m_out, R"({"name":%s,"cat":"flowdb","ph":"%s","ts":%.3f,"pid":%d,"tid":%llu%s,"args":{"span":"%llx"%s}})",
+                      quoted(name).c_str(), phase, static_cast<double>(record.time) / 1000.0, m_pid,
+                      static_cast<unsigned long long>(m_tid), extra, static_cast<unsigned long long>(record.span),
+                      args.c_str());
+    }
+
+    // Flow arrows bind to the slice enclosing them on their thread
+    void flow(const char *phase, uint64_t id, const Copied &record) {
+        separate();
+        append_format(m_out, R"({"name":"flow","cat":"flowdb","ph":"%s","bp":"e","id":"0x%llx","ts":%.3f,"pid":%d,"tid":%llu})",
+                      phase, static_cast<unsigned long long>(id), static_cast<double>(record.time) / 1000.0, m_pid,
+                      static_cast<unsigned long long>(m_tid));
+    }
+
+    std::string &m_out;
+    int m_pid;
+    uint64_t m_tid = 0;
+    bool m_first = true;
+    // Open handler slices on the current thread
+    size_t m_depth = 0;
+    std::unordered_set<uint64_t> m_woken;
+    std::unordered_map<const char *, std::string> m_names;
+};
+
+} // namespace
+
+/**
+ * @brief Copies each ring between its last start() and its head, then drops
+ * the records the thread may have been overwriting meanwhile: a record at
+ * index i is intact if the head had not reached i + kCapacity after the copy.
+ */
+std::string Trace::chrome_json() {
+    std::vector<std::pair<const Ring *, std::vector<Copied>>> copies;
+    std::unordered_set<uint64_t> woken;
+    Registry &all = registry();
+    std::unique_lock<std::mutex> lock(all.mutex);
+    for (const auto &ring: all.rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = std::max(ring->cleared.load(std::memory_order_relaxed),
+                                  head > kCapacity ? head - kCapacity : 0);
+        std::vector<Copied> copied;
+        copied.reserve(head - first);
+        for (uint64_t i = first; i < head; i++) {
+            const Record &record = ring->records[i & (kCapacity - 1)];
+            uint64_t time = record.time.load(std::memory_order_relaxed);
+            copied.push_back(Copied{time >> 8, static_cast<Event>(time & 0xFF),
+                                    record.name.load(std::memory_order_relaxed),
+                                    record.span.load(std::memory_order_relaxed),
+                                    record.arg.load(std::memory_order_relaxed)});
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = ring->head.load(std::memory_order_relaxed);
+        size_t overwritten = after >= first + kCapacity ? after - kCapacity - first + 1 : 0;
+        copied.erase(copied.begin(), copied.begin() + static_cast<ptrdiff_t>(std::min(overwritten, copied.size())));
+        for (const Copied &record: copied) {
+            if (record.event == Event::Wake) {
+                woken.insert(record.arg);
+            }
+        }
+        copies.emplace_back(ring.get(), std::move(copied));
+    }
+
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    Writer writer(out, static_cast<int>(::getpid()), std::move(woken));
+    for (const auto &[ring, copied]: copies) {
+        writer.thread(ring->index, ring->thread);
+        for (const Copied &record: copied) {
+            writer.record(record);
+        }
+    }
+    out += "\n]}\n";
+    return out;
+}
@@ -0,0 +1,214 @@
+#ifndef FLOWDB_TRACE_H
+#define FLOWDB_TRACE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include "metrics.h"
+
+// Event tracing for following one request across threads, actors and
+// servers: which hop cost the time, from a tell() through the mailbox and the
+// handler to the set_value() that wakes the caller.
+//
+// Each thread appends timestamped events to its own ring buffer, overwriting
+// the oldest, with relaxed stores and one release store of the ring's head;
+// nothing is shared between writers. Instrumented code guards every event
+// with enabled(), a relaxed load of one flag, so a disabled tracer costs a
+// single well-predicted branch per site, and building with FLOWDB_NO_TRACING
+// removes even that. chrome_json() collects the rings into the Chrome trace
+// format, which chrome://tracing and Perfetto open.
+//
+// Events carry a span id: the id of the request or operation they belong to.
+// A thread's current span is set by Scope; actors hand the sender's span to
+// the handler of each message, and request frames carry it to the server
+// (FrameHeader::kTraced), so one span links a client call to the actor
+// handlers it caused on another machine.
+class Trace {
+public:
+    enum class Event : uint8_t {
+        // A message was told to an actor (name: actor type, arg: mailbox node)
+        Send,
+        // An actor took a batch from its mailbox (name: actor type, arg: count)
+        Dequeue,
+        // An actor's handler started and ended (name: message type, or null
+        // for a resumed coroutine; arg: node)
+        HandlerBegin,
+        HandlerEnd,
+        // A promise was fulfilled, and a thread blocked on its future woke
+        // (arg: shared state)
+        Fulfil,
+        Wake,
+        // A socket read or write completed (arg: bytes)
+        SocketRead,
+        SocketWrite,
+        // A client queued a request frame, and a server parsed one (arg: opcode)
+        RequestSent,
+        RequestReceived,
+    };
+
+    // Events kept per thread; about 1 MB of records
+    static constexpr size_t kCapacity = size_t{1} << 15;
+
+    static bool enabled() {
+#ifdef FLOWDB_NO_TRACING
+        return false;
+#else
+        return s_enabled.load(std::memory_order_relaxed);
+#endif
+    }
+
+    // Drops the events recorded so far and starts recording.
+    static void start() {
+        {
+            Registry &all = registry();
+            std::unique_lock<std::mutex> lock(all.mutex);
+            std::erase_if(all.rings, [](const std::unique_ptr<Ring> &ring) {
+                return ring->retired.load(std::memory_order_acquire);
+            });
+            for (auto &ring: all.rings) {
+                ring->cleared.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+            }
+        }
+        s_enabled.store(true, std::memory_order_relaxed);
+    }
+
+    // Stops recording; the events stay until the next start().
+    static void stop() {
+        s_enabled.store(false, std::memory_order_relaxed);
+    }
+
+    // The calling thread's span, or 0 outside of any
+    static uint64_t current() {
+        return t_span;
+    }
+
+    // A span id unique to this process and unlikely to repeat across the
+    // processes of a cluster: the pid, the thread's ring and a counter.
+    static uint64_t new_span() {
+        static const uint64_t process = static_cast<uint64_t>(::getpid()) & 0xFFFF;
+        return process << 48 | (ring().index & 0xFFF) << 36 | (++t_spans & 0xFFFFFFFFF);
+    }
+
+    // Makes span the calling thread's current span for the scope's lifetime.
+    class Scope {
+    public:
+        explicit Scope(uint64_t span) : m_previous(std::exchange(t_span, span)) {}
+
+        Scope(const Scope &) = delete;
+
+        Scope &operator=(const Scope &) = delete;
+
+        ~Scope() {
+            t_span = m_previous;
+        }
+
+    private:
+        uint64_t m_previous;
+    };
+
+    // Records an event. Callers check enabled() first. name must be null or
+    // have static storage duration, such as a std::type_info name.
+    static void emit(Event event, const char *name, uint64_t span, uint64_t arg) {
+        Ring &own = ring();
+        uint64_t head = own.head.load(std::memory_order_relaxed);
+        Record &record = own.records[head & (kCapacity - 1)];
+        record.time.store(Metrics::now() << 8 | static_cast<uint64_t>(event), std::memory_order_relaxed);
+        record.name.store(name, std::memory_order_relaxed);
+        record.span.store(span, std::memory_order_relaxed);
+        record.arg.store(arg, std::memory_order_relaxed);
+        own.head.store(head + 1, std::memory_order_release);
+    }
+
+    // The events of every thread since the last start(), as a Chrome trace
+    // JSON document. Safe to call while threads record; events overwritten
+    // during the copy are left out.
+    static std::string chrome_json();
+
+private:
+    // Fields are atomics so the dumper can read a record that is being
+    // overwritten; such records are detected by the ring's head and dropped.
+    struct Record {
+        // Metrics::now() << 8 | Event
+        std::atomic<uint64_t> time{0};
+        std::atomic<const char *> name{nullptr};
+        std::atomic<uint64_t> span{0};
+        std::atomic<uint64_t> arg{0};
+    };
+
+    struct Ring {
+        uint64_t index = 0;
+        std::string thread;
+        // Events ever written, and the value it had at the last start()
+        alignas(64) std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> cleared{0};
+        // Set when the thread exits; the events are kept until the next start()
+        std::atomic<bool> retired{false};
+        std::array<Record, kCapacity> records;
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Ring>> rings;
+        uint64_t registered = 0;
+    };
+
+    // Marks the calling thread's ring retired when the thread exits.
+    struct Registration {
+        Ring *ring = nullptr;
+
+        ~Registration() {
+            if (ring != nullptr) {
+                ring->retired.store(true, std::memory_order_release);
+                t_ring = &discarded();
+            }
+        }
+    };
+
+    static Registry &registry() {
+        static auto *registry = new Registry();
+        return *registry;
+    }
+
+    // Events emitted by thread_local destructors after the thread's ring was
+    // retired land here and are never read
+    static Ring &discarded() {
+        static auto *ring = new Ring();
+        return *ring;
+    }
+
+    static Ring &ring() {
+        if (t_ring == nullptr) [[unlikely]] {
+            register_thread();
+        }
+        return *t_ring;
+    }
+
+    static void register_thread() {
+        thread_local Registration registration;
+        auto created = std::make_unique<Ring>();
+        created->thread = Metrics::thread_name();
+        Ring *ring = created.get();
+        {
+            Registry &all = registry();
+            std::unique_lock<std::mutex> lock(all.mutex);
+            ring->index = all.registered++;
+            all.rings.push_back(std::move(created));
+        }
+        registration.ring = ring;
+        t_ring = ring;
+    }
+
+    static inline std::atomic<bool> s_enabled{false};
+    static inline thread_local Ring *t_ring = nullptr;
+    static inline thread_local uint64_t t_span = 0;
+    static inline thread_local uint64_t t_spans = 0;
+};
+
+#endif //FLOWDB_TRACE_H
@@ -0,0 +1,152 @@
+#include "transaction.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+/**
+ * @brief Constructor for Transaction class.
+ *
+ * @param storage The storage actor reads are served by.
+ * @param resolver The resolver that decides whether the transaction commits.
+ */
+Transaction::Transaction(std::shared_ptr<VersionedStorage> storage, std::shared_ptr<Resolver> resolver)
+        : m_storage(std::move(storage)), m_resolver(std::move(resolver)) {}
+
+/**
+ * @brief Fetches a read version from the resolver on first use, and returns
+ * the same version afterwards.
+ */
+Future<Version> Transaction::read_version() {
+    if (!m_read_version.valid()) {
+        m_read_version = m_resolver->read_version();
+    }
+    return m_read_version;
+}
+
+/**
+ * @brief Reads a key, from the buffered writes if the transaction wrote or
+ * cleared it, otherwise from storage at the read version. Only a read that
+ * goes to storage is recorded for the conflict check.
+ */
+Future<std::optional<std::string>> Transaction::get(std::string key) {
+    auto it = m_writes.find(key);
+    if (it != m_writes.end()) {
+        return make_ready_future(it->second);
+    }
+    if (cleared(key)) {
+        return make_ready_future(std::optional<std::string>());
+    }
+    m_read_ranges.push_back(single_key_range(key));
+    return read_version().then([storage = m_storage, key = std::move(key)](const Version &version) {
+        return storage->get(key, version);
+    });
+}
+
+/**
+ * @brief Reads a range from storage at the read version and overlays the
+ * transaction's own writes to it.
+ *
+ * Storage is asked for enough extra entries to make up for the buffered writes
+ * that may replace or hide some of them, or for the whole range if a buffered
+ * clear_range() overlaps it.
+ */
+Future<std::vector<KeyValue>> Transaction::get_range(std::string begin, std::string end, size_t limit) {
+    m_read_ranges.push_back(KeyRange{begin, end});
+
+    std::vector<std::pair<std::string, std::optional<std::string>>> writes;
+    for (auto it = m_writes.lower_bound(begin); it != m_writes.end() && it->first < end; ++it) {
+        writes.emplace_back(*it);
+    }
+    std::vector<KeyRange> clears;
+    for (const auto &range: m_cleared) {
+        if (range.begin < end && begin < range.end) {
+            clears.push_back(range);
+        }
+    }
+    size_t fetch = limit;
+    if (!clears.empty() || limit > std::numeric_limits<size_t>::max() - writes.size()) {
+        fetch = std::numeric_limits<size_t>::max();
+    } else {
+        fetch += writes.size();
+    }
+
+    return read_version().then(
+            [storage = m_storage, begin = std::move(begin), end = std::move(end), fetch](const Version &version) {
+                return storage->get_range(begin, end, version, fetch);
+            }).then([writes = std::move(writes), clears = std::move(clears), limit](
+            const std::vector<KeyValue> &stored) {
+        auto hidden = [&](const std::string &key) {
+            return std::any_of(clears.begin(), clears.end(), [&](const KeyRange &range) {
+                return range.begin <= key && key < range.end;
+            });
+        };
+        std::vector<KeyValue> result;
+        auto write = writes.begin();
+        for (auto entry = stored.begin(); result.size() < limit && (entry != stored.end() || write != writes.end());) {
+            if (write != writes.end() && (entry == stored.end() || write->first <= entry->key)) {
+                if (entry != stored.end() && write->first == entry->key) {
+                    ++entry;
+                }
+                if (write->second) {
+                    result.push_back(KeyValue{write->first, *write->second});
+                }
+                ++write;
+            } else {
+                if (!hidden(entry->key)) {
+                    result.push_back(*entry);
+                }
+                ++entry;
+            }
+        }
+        return result;
+    });
+}
+
+void Transaction::set(std::string key, std::string value) {
+    m_write_ranges.push_back(single_key_range(key));
+    m_writes.insert_or_assign(key, value);
+    m_mutations.push_back(Mutation{Mutation::Type::Set, std::move(key), std::move(value)});
+}
+
+void Transaction::clear(std::string key) {
+    m_write_ranges.push_back(single_key_range(key));
+    m_writes.insert_or_assign(key, std::nullopt);
+    m_mutations.push_back(Mutation{Mutation::Type::Clear, std::move(key), {}});
+}
+
+void Transaction::clear_range(std::string begin, std::string end) {
+    if (begin >= end) {
+        return;
+    }
+    m_writes.erase(m_writes.lower_bound(begin), m_writes.lower_bound(end));
+    m_cleared.push_back(KeyRange{begin, end});
+    m_write_ranges.push_back(KeyRange{begin, end});
+    m_mutations.push_back(Mutation{Mutation::Type::ClearRange, std::move(begin), std::move(end)});
+}
+
+Future<Version> Transaction::commit() {
+    if (m_mutations.empty()) {
+        return read_version();
+    }
+    return read_version().then(
+            [resolver = m_resolver, reads = std::move(m_read_ranges), writes = std::move(m_write_ranges),
+                    mutations = std::move(m_mutations)](const Version &version) mutable {
+                return resolver->commit(version, std::move(reads), std::move(writes), std::move(mutations));
+            });
+}
+
+void Transaction::reset() {
+    m_read_version = Future<Version>();
+    m_writes.clear();
+    m_cleared.clear();
+    m_read_ranges.clear();
+    m_write_ranges.clear();
+    m_mutations.clear();
+}
+
+bool Transaction::cleared(std::string_view key) const {
+    return std::any_of(m_cleared.begin(), m_cleared.end(), [&](const KeyRange &range) {
+        return range.begin <= key && key < range.end;
+    });
+}
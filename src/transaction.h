@@ -0,0 +1,90 @@
+#ifndef FLOWDB_TRANSACTION_H
+#define FLOWDB_TRANSACTION_H
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "future.h"
+#include "mvcc.h"
+#include "ordered_store.h"
+#include "resolver.h"
+#include "versioned_storage.h"
+
+// Client side of an optimistic transaction.
+//
+// Reads go to storage at the read version, which is fetched from the resolver
+// on first use, so they all see one consistent snapshot. Writes are buffered,
+// and reads see the transaction's own writes. Every read and write also records its key range
+// for the conflict check; commit() then sends the ranges and the buffered
+// mutations to the resolver, which commits the transaction only if nothing it
+// read was written by another transaction since its read version. Nothing is
+// locked, so a failed commit is retried from scratch:
+//
+//     for (;;) {
+//         Transaction transaction(storage, resolver);
+//         auto value = transaction.get("counter").get();
+//         transaction.set("counter", increment(value));
+//         try {
+//             transaction.commit().get();
+//             break;
+//         } catch (const TransactionFailed &) {
+//         }
+//     }
+//
+// A Transaction is not thread-safe; the futures it returns do not refer to it
+// and may outlive it.
+class Transaction {
+public:
+    Transaction(std::shared_ptr<VersionedStorage> storage, std::shared_ptr<Resolver> resolver);
+
+    // The version every read of this transaction is served at.
+    Future<Version> read_version();
+
+    // Reads a key; the result is empty if the key is not set.
+    Future<std::optional<std::string>> get(std::string key);
+
+    // Reads up to limit key-value pairs in [begin, end), in key order. The
+    // whole range is recorded as read, even when the limit cuts it short.
+    Future<std::vector<KeyValue>> get_range(std::string begin, std::string end, size_t limit);
+
+    void set(std::string key, std::string value);
+
+    void clear(std::string key);
+
+    // Clears every key in [begin, end).
+    void clear_range(std::string begin, std::string end);
+
+    // Submits the transaction to the resolver. The reply carries the commit
+    // version, or fails with TransactionFailed if the transaction conflicted
+    // or its read version became too old. A transaction without writes
+    // commits at its read version without being resolved. The transaction
+    // must be reset() before it is used again.
+    Future<Version> commit();
+
+    // Discards the read version, the buffered writes and the conflict ranges.
+    void reset();
+
+private:
+    // Whether a clear_range() of this transaction covers key
+    [[nodiscard]] bool cleared(std::string_view key) const;
+
+    std::shared_ptr<VersionedStorage> m_storage;
+    std::shared_ptr<Resolver> m_resolver;
+    Future<Version> m_read_version;
+
+    // Buffered writes by key; empty for a cleared key. Keys cleared by a
+    // clear_range() and not written since are in m_cleared instead.
+    std::map<std::string, std::optional<std::string>, std::less<>> m_writes;
+    std::vector<KeyRange> m_cleared;
+
+    std::vector<KeyRange> m_read_ranges;
+    std::vector<KeyRange> m_write_ranges;
+    std::vector<Mutation> m_mutations;
+};
+
+#endif //FLOWDB_TRANSACTION_H
@@ -0,0 +1,102 @@
+#ifndef FLOWDB_VERSIONED_STORAGE_H
+#define FLOWDB_VERSIONED_STORAGE_H
+
+#include <optional>
+#include <string>
+#include <vector>
+#include "actor.h"
+#include "future.h"
+#include "mvcc.h"
+#include "mvcc_store.h"
+#include "ordered_store.h"
+
+// Replies with a version that every commit acknowledged so far is visible at:
+// from storage, the newest version applied; from the resolver, a fresh one.
+struct ReadVersionRequest {
+    Promise<Version> reply;
+};
+
+// Reads the value of a key as of version.
+struct VersionedGetRequest {
+    std::string key;
+    Version version;
+    Promise<std::optional<std::string>> reply;
+};
+
+// Reads up to limit key-value pairs in [begin, end) as of version.
+struct VersionedGetRangeRequest {
+    std::string begin;
+    std::string end;
+    Version version;
+    size_t limit;
+    Promise<std::vector<KeyValue>> reply;
+};
+
+// Applies the mutations of the transactions committed in one resolver batch.
+struct ApplyRequest {
+    Version version;
+    std::vector<Mutation> mutations;
+    Promise<Void> reply;
+};
+
+// Storage server for transactions: owns a MultiVersionStore, applies commit
+// batches in version order as the resolver sends them, and serves snapshot
+// reads. Reads older than the MVCC window fail with TransactionFailed.
+class VersionedStorage
+        : public Actor<VersionedStorage, ReadVersionRequest, VersionedGetRequest, VersionedGetRangeRequest,
+                ApplyRequest> {
+public:
+    explicit VersionedStorage(Version window = kDefaultMvccWindow) : m_store(window) {}
+
+    Future<Version> read_version() {
+        return ask(ReadVersionRequest{{}});
+    }
+
+    Future<std::optional<std::string>> get(std::string key, Version version) {
+        return ask(VersionedGetRequest{std::move(key), version, {}});
+    }
+
+    Future<std::vector<KeyValue>> get_range(std::string begin, std::string end, Version version, size_t limit) {
+        return ask(VersionedGetRangeRequest{std::move(begin), std::move(end), version, limit, {}});
+    }
+
+    Future<Void> apply(Version version, std::vector<Mutation> mutations) {
+        return ask(ApplyRequest{version, std::move(mutations), {}});
+    }
+
+    void handle(ReadVersionRequest &request) {
+        request.reply.set_value(m_store.version());
+    }
+
+    void handle(VersionedGetRequest &request) {
+        std::optional<std::string> value;
+        try {
+            value = m_store.get(request.key, request.version);
+        } catch (...) {
+            request.reply.set_exception(std::current_exception());
+            return;
+        }
+        request.reply.set_value(std::move(value));
+    }
+
+    void handle(VersionedGetRangeRequest &request) {
+        std::vector<KeyValue> result;
+        try {
+            m_store.range(request.begin, request.end, request.version, request.limit, result);
+        } catch (...) {
+            request.reply.set_exception(std::current_exception());
+            return;
+        }
+        request.reply.set_value(std::move(result));
+    }
+
+    void handle(ApplyRequest &request) {
+        m_store.apply(request.version, request.mutations);
+        request.reply.set_value();
+    }
+
+private:
+    MultiVersionStore m_store;
+};
+
+#endif //FLOWDB_VERSIONED_STORAGE_H
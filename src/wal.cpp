@@ -0,0 +1,449 @@
+#include "wal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include "codec.h"
+#include "crc32c.h"
+
+namespace {
+
+std::system_error os_error(const std::string &what) {
+    return {errno, std::generic_category(), what};
+}
+
+uint32_t record_checksum(const char *header, std::string_view record) {
+    return crc32c(record, crc32c(std::string_view(header + 4, 12)));
+}
+
+// Makes the directory entries of the directory holding path durable; returns
+// whether that succeeded.
+bool sync_directory(const std::string &path) {
+    std::string directory = std::filesystem::absolute(path).parent_path().string();
+    int directory_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory_fd < 0) {
+        return false;
+    }
+    bool synced = ::fsync(directory_fd) == 0;
+    ::close(directory_fd);
+    return synced;
+}
+
+} // namespace
+
+/**
+ * @brief Opens the log, cuts off a torn tail left by a crash and starts the
+ * sync thread.
+ *
+ * @param path The log file; created if it does not exist.
+ * @param options Batching window and group size limits.
+ */
+WriteAheadLog::WriteAheadLog(std::string path, Options options)
+        : m_path(std::move(path)), m_options(options) {
+    m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        throw os_error("Cannot open log " + m_path);
+    }
+    try {
+        Extent extent = scan(m_fd, {});
+        struct stat status{};
+        if (::fstat(m_fd, &status) != 0) {
+            throw os_error("Cannot stat log " + m_path);
+        }
+        if (static_cast<uint64_t>(status.st_size) > extent.size) {
+            if (::ftruncate(m_fd, static_cast<off_t>(extent.size)) != 0 || ::fdatasync(m_fd) != 0) {
+                throw os_error("Cannot truncate the torn tail of log " + m_path);
+            }
+        }
+        if (::lseek(m_fd, static_cast<off_t>(extent.size), SEEK_SET) < 0) {
+            throw os_error("Cannot seek in log " + m_path);
+        }
+        // Make the file's directory entry durable too, in case it was just created
+        sync_directory(m_path);
+        m_next_lsn = extent.last_lsn + 1;
+        m_first_lsn = extent.first_lsn;
+        m_durable_lsn.store(extent.last_lsn, std::memory_order_relaxed);
+    } catch (...) {
+        ::close(m_fd);
+        throw;
+    }
+    m_sync_thread = std::thread([this] { sync_loop(); });
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_one();
+    m_sync_thread.join();
+    ::close(m_fd);
+}
+
+/**
+ * @brief Frames the record and adds it to the pending group.
+ *
+ * The checksum is computed before taking the lock, which is then only held to
+ * copy the record into the group, so the sync thread is never kept waiting
+ * behind a slow encode.
+ */
+void WriteAheadLog::handle(LogAppend &append) {
+    char header[kRecordHeaderSize];
+    detail::store_le(header + 4, static_cast<uint32_t>(append.record.size()));
+    detail::store_le(header + 8, m_next_lsn);
+    detail::store_le(header, record_checksum(header, append.record));
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_error) {
+        // A failed sync leaves the file in an unknown state; accept nothing more
+        std::exception_ptr error = m_error;
+        lock.unlock();
+        append.reply.set_exception(error);
+        return;
+    }
+    bool was_empty = m_pending.waiters.empty();
+    m_pending.buffer.append(header, kRecordHeaderSize);
+    m_pending.buffer.append(append.record);
+    m_pending.waiters.push_back(std::move(append.reply));
+    m_pending.last_lsn = m_next_lsn++;
+    bool full = m_pending.buffer.size() >= m_options.max_group_bytes;
+    lock.unlock();
+    if (was_empty || full) {
+        m_cv.notify_one();
+    }
+}
+
+void WriteAheadLog::replay(const std::function<void(uint64_t, std::string_view)> &f) const {
+    scan(m_fd, f);
+}
+
+/**
+ * @brief Empties the file, so the next record, whatever its number, is the
+ * first of an intact log. A crash before or after leaves the records or none,
+ * and either way the caller's own position says where numbering goes on.
+ */
+void WriteAheadLog::start_after(uint64_t lsn) {
+    if (lsn < m_next_lsn) {
+        return;
+    }
+    if (::ftruncate(m_fd, 0) != 0 || ::fdatasync(m_fd) != 0 || ::lseek(m_fd, 0, SEEK_SET) < 0) {
+        throw os_error("Cannot empty log " + m_path);
+    }
+    m_next_lsn = lsn + 1;
+    m_durable_lsn.store(lsn, std::memory_order_release);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_first_lsn = 0;
+}
+
+void WriteAheadLog::checkpoint(uint64_t lsn) {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (lsn <= m_checkpoint) {
+            return;
+        }
+        m_checkpoint = lsn;
+    }
+    m_cv.notify_one();
+}
+
+WriteAheadLog::Stats WriteAheadLog::stats() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+/**
+ * @brief Reads the log from the start and returns the extent of its intact
+ * records, passing each of them to f if it is set.
+ */
+WriteAheadLog::Extent WriteAheadLog::scan(int fd, const std::function<void(uint64_t, std::string_view)> &f) {
+    struct stat status{};
+    if (::fstat(fd, &status) != 0) {
+        throw os_error("Cannot stat log");
+    }
+    auto file_size = static_cast<uint64_t>(status.st_size);
+
+    // buffer holds the file from buffer_offset on, and pos is the next record
+    std::string buffer;
+    uint64_t buffer_offset = 0;
+    size_t pos = 0;
+    auto fill = [&](size_t size) {
+        if (buffer_offset + pos + size > file_size) {
+            return false;
+        }
+        if (buffer.size() - pos >= size) {
+            return true;
+        }
+        buffer.erase(0, pos);
+        buffer_offset += pos;
+        pos = 0;
+        size_t have = buffer.size();
+        buffer.resize(std::max<size_t>(size, 1 << 20));
+        while (have < size) {
+            ssize_t n = ::pread(fd, buffer.data() + have, buffer.size() - have,
+                                static_cast<off_t>(buffer_offset + have));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                throw os_error("Cannot read log");
+            }
+            if (n == 0) {
+                break;
+            }
+            have += static_cast<size_t>(n);
+        }
+        buffer.resize(have);
+        return have >= size;
+    };
+
+    Extent extent;
+    while (fill(kRecordHeaderSize)) {
+        const char *header = buffer.data() + pos;
+        auto length = detail::load_le<uint32_t>(header + 4);
+        auto lsn = detail::load_le<uint64_t>(header + 8);
+        // A checkpoint may have dropped the records before the first one
+        bool in_sequence = extent.last_lsn == 0 ? lsn != 0 : lsn == extent.last_lsn + 1;
+        if (!in_sequence || !fill(kRecordHeaderSize + length)) {
+            break;
+        }
+        header = buffer.data() + pos;
+        std::string_view record(header + kRecordHeaderSize, length);
+        if (record_checksum(header, record) != detail::load_le<uint32_t>(header)) {
+            break;
+        }
+        if (f) {
+            f(lsn, record);
+        }
+        pos += kRecordHeaderSize + length;
+        if (extent.first_lsn == 0) {
+            extent.first_lsn = lsn;
+        }
+        extent.last_lsn = lsn;
+        extent.size = buffer_offset + pos;
+    }
+    return extent;
+}
+
+/**
+ * @brief Body of the sync thread: takes the pending group, optionally after
+ * the batching window, writes and syncs it, and fulfils its promises. Between
+ * groups it cuts the log at a new checkpoint, short of the last record. Only
+ * a failure once the new file has replaced the old one stops the log; before
+ * that, the old one is still whole.
+ *
+ * Promises are fulfilled on this thread, outside the lock, so their
+ * continuations run while the next group fills up.
+ */
+void WriteAheadLog::sync_loop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_cv.wait(lock, [this] {
+            return m_stopping || !m_pending.waiters.empty() || (!m_error && checkpoint_due());
+        });
+        if (!m_error && checkpoint_due()) {
+            uint64_t asked = m_checkpoint;
+            uint64_t checkpoint = std::min(asked, m_durable_lsn.load(std::memory_order_relaxed) - 1);
+            lock.unlock();
+            Rewrite rewritten;
+            std::exception_ptr failed;
+            std::exception_ptr error;
+            try {
+                rewritten = rewrite(checkpoint);
+            } catch (...) {
+                failed = std::current_exception();
+            }
+            if (!failed) {
+                try {
+                    replace(rewritten.fd);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            lock.lock();
+            if (failed) {
+                m_failed_checkpoint = asked;
+                m_stats.failed_checkpoints++;
+            } else if (error) {
+                m_error = error;
+            } else {
+                m_first_lsn = checkpoint + 1;
+                m_stats.truncated_bytes += rewritten.dropped;
+            }
+        }
+        if (m_pending.waiters.empty()) {
+            if (m_stopping) {
+                return;
+            }
+            continue;
+        }
+        size_t waiting = m_pending.waiters.size();
+        if (m_window.count() > 0 && !m_stopping && !m_error) {
+            m_cv.wait_for(lock, m_window, [this] {
+                return m_stopping || m_pending.buffer.size() >= m_options.max_group_bytes;
+            });
+        }
+        size_t joined = m_pending.waiters.size() - waiting;
+
+        Group group = std::move(m_pending);
+        m_pending = Group();
+        m_pending.buffer.swap(m_spare);
+        std::exception_ptr error = m_error;
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        if (!error) {
+            error = write_group(group);
+        }
+        if (!error) {
+            m_durable_lsn.store(group.last_lsn, std::memory_order_release);
+            adapt_window(group.waiters.size(), joined, std::chrono::steady_clock::now() - start);
+        }
+        uint64_t lsn = group.last_lsn - group.waiters.size();
+        for (auto &waiter: group.waiters) {
+            if (error) {
+                waiter.set_exception(error);
+            } else {
+                waiter.set_value(++lsn);
+            }
+        }
+
+        lock.lock();
+        if (error) {
+            m_error = error;
+        } else {
+            if (m_first_lsn == 0) {
+                m_first_lsn = group.last_lsn - group.waiters.size() + 1;
+            }
+            m_stats.groups++;
+            m_stats.records += group.waiters.size();
+            m_stats.bytes += group.buffer.size();
+            m_stats.window = m_window;
+        }
+        group.buffer.clear();
+        m_spare = std::move(group.buffer);
+    }
+}
+
+bool WriteAheadLog::checkpoint_due() const {
+    return m_checkpoint > m_failed_checkpoint && m_first_lsn != 0 && m_first_lsn <= m_checkpoint &&
+           m_first_lsn < m_durable_lsn.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Copies the records to keep to a new file, syncs it and renames it
+ * over the log. The log only holds durable records here, since groups are
+ * written by this same thread, so the intact extent is the whole file.
+ */
+WriteAheadLog::Rewrite WriteAheadLog::rewrite(uint64_t lsn) {
+    uint64_t end = 0;
+    uint64_t keep_from = 0;
+    Extent extent = scan(m_fd, [&](uint64_t record_lsn, std::string_view record) {
+        end += kRecordHeaderSize + record.size();
+        if (record_lsn <= lsn) {
+            keep_from = end;
+        }
+    });
+
+    std::string temporary = m_path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw os_error("Cannot create log " + temporary);
+    }
+    try {
+        std::string buffer(1 << 20, '\0');
+        for (uint64_t offset = keep_from; offset < extent.size;) {
+            size_t size = static_cast<size_t>(std::min<uint64_t>(buffer.size(), extent.size - offset));
+            ssize_t n = ::pread(m_fd, buffer.data(), size, static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                throw os_error("Cannot read log " + m_path);
+            }
+            for (ssize_t written = 0; written < n;) {
+                ssize_t w = ::write(fd, buffer.data() + written, static_cast<size_t>(n - written));
+                if (w < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (w < 0) {
+                    throw os_error("Cannot write log " + temporary);
+                }
+                written += w;
+            }
+            offset += static_cast<uint64_t>(n);
+        }
+        if (::fdatasync(fd) != 0 || ::rename(temporary.c_str(), m_path.c_str()) != 0) {
+            throw os_error("Cannot replace log " + m_path);
+        }
+    } catch (...) {
+        ::close(fd);
+        ::unlink(temporary.c_str());
+        throw;
+    }
+    return {fd, keep_from};
+}
+
+void WriteAheadLog::replace(int fd) {
+    ::close(m_fd);
+    m_fd = fd;
+    if (!sync_directory(m_path)) {
+        throw os_error("Cannot sync the directory of log " + m_path);
+    }
+    if (::lseek(m_fd, 0, SEEK_END) < 0) {
+        throw os_error("Cannot seek in log " + m_path);
+    }
+}
+
+std::exception_ptr WriteAheadLog::write_group(const Group &group) {
+    const char *data = group.buffer.data();
+    size_t remaining = group.buffer.size();
+    while (remaining > 0) {
+        ssize_t n = ::write(m_fd, data, remaining);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return std::make_exception_ptr(os_error("Cannot write log " + m_path));
+        }
+        data += n;
+        remaining -= static_cast<size_t>(n);
+    }
+    if (m_options.sync && ::fdatasync(m_fd) != 0) {
+        return std::make_exception_ptr(os_error("Cannot sync log " + m_path));
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Grows the batching window while waiting gathers more commits and
+ * shrinks it while it does not.
+ *
+ * With no window, a group holding several commits means writers are queueing
+ * behind the sync, so a small window is opened. An open window grows by a
+ * quarter each time commits join during it and halves each time none do. It is
+ * capped at half the smoothed sync time: waiting longer than that would cost
+ * more latency than the syncs it saves.
+ */
+void WriteAheadLog::adapt_window(size_t records, size_t joined_while_waiting, std::chrono::nanoseconds sync_time) {
+    using std::chrono::nanoseconds;
+    m_sync_time = m_sync_time.count() == 0 ? sync_time : (m_sync_time * 7 + sync_time) / 8;
+    nanoseconds cap = std::min<nanoseconds>(m_options.max_window, m_sync_time / 2);
+    if (m_window.count() == 0) {
+        if (records > 1) {
+            m_window = cap / 8;
+        }
+    } else if (joined_while_waiting > 0) {
+        m_window += m_window / 4;
+    } else {
+        m_window /= 2;
+    }
+    m_window = std::min(m_window, cap);
+    if (m_window < std::chrono::microseconds(1)) {
+        m_window = nanoseconds(0);
+    }
+}
@@ -0,0 +1,204 @@
+#ifndef FLOWDB_WAL_H
+#define FLOWDB_WAL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "actor.h"
+#include "future.h"
+
+// Appends a record to the log. The reply carries the record's log sequence
+// number and is only fulfilled once the record is durable.
+struct LogAppend {
+    std::string record;
+    Promise<uint64_t> reply;
+};
+
+// Append-only write-ahead log with group commit.
+//
+// The actor numbers and frames records as they arrive and appends them to the
+// pending group. A dedicated sync thread takes the whole group, writes it with
+// one write() and makes it durable with one fdatasync(), then fulfils every
+// promise in it. Commits that arrive while a group is being synced form the
+// next group, so under load the cost of a sync is shared by all the writers
+// that were waiting on it, and a lone writer still pays just one sync.
+//
+// On top of that, the sync thread can hold a group open for a short batching
+// window before writing it. The window adapts: it grows while commits keep
+// joining groups during the wait, and shrinks (down to zero) when waiting
+// gathers nothing, so light load is not delayed. It never exceeds max_window
+// or half of a typical sync.
+//
+// Each record is framed as
+//
+//     uint32 crc       CRC-32C of everything after it
+//     uint32 length    record bytes
+//     uint64 lsn       consecutive, starting at 1
+//     record
+//
+// Replay stops at the first record that is truncated, fails its checksum or
+// is out of sequence, which is where a crash tore the tail of the log. Opening
+// the log truncates that tail so new records follow the last intact one.
+//
+// Records that the store has made durable on its own are dropped at a
+// checkpoint: the sync thread copies the records after it to a new file,
+// between groups, and renames it over the log, so a crash leaves one whole
+// log or the other. The last record is always kept, so numbering carries on
+// from it, and the first record of the log need not be number 1. A checkpoint
+// that cannot be written, say because the disk is full, leaves the log as it
+// was; it is retried at the next one, and appends carry on meanwhile.
+//
+// A store may hold writes the log lost: it can flush a write before the
+// group holding it is synced, and the group may then never be. Such a store
+// numbers the log past its own position with start_after(), so the numbers of
+// the writes it holds are not given out again.
+class WriteAheadLog : public Actor<WriteAheadLog, LogAppend> {
+public:
+    struct Options {
+        // Upper bound of the adaptive batching window
+        std::chrono::microseconds max_window{2'000};
+        // A group is written without waiting out the window once it is this large
+        size_t max_group_bytes = 1 << 20;
+        // Whether to fdatasync() every group; off only for measuring batching
+        bool sync = true;
+    };
+
+    struct Stats {
+        uint64_t groups = 0;
+        uint64_t records = 0;
+        uint64_t bytes = 0;
+        std::chrono::nanoseconds window{0};
+        // Bytes dropped by checkpoints
+        uint64_t truncated_bytes = 0;
+        // Checkpoints that could not be written, leaving the log as it was
+        uint64_t failed_checkpoints = 0;
+    };
+
+    // Opens or creates the log at path.
+    //
+    // @throws std::system_error if the file cannot be opened or repaired.
+    WriteAheadLog(std::string path, Options options);
+
+    explicit WriteAheadLog(std::string path) : WriteAheadLog(std::move(path), Options()) {}
+
+    // Writes and syncs whatever is pending, then closes the log.
+    ~WriteAheadLog() override;
+
+    Future<uint64_t> append(std::string record) {
+        return ask(LogAppend{std::move(record), {}});
+    }
+
+    // Calls f with the sequence number and contents of every intact record, in
+    // order. Must not run concurrently with appends or checkpoints.
+    //
+    // @throws std::system_error if the log cannot be read.
+    void replay(const std::function<void(uint64_t, std::string_view)> &f) const;
+
+    // Sequence number of the last durable record
+    [[nodiscard]] uint64_t durable_lsn() const {
+        return m_durable_lsn.load(std::memory_order_acquire);
+    }
+
+    // Numbers the next record lsn + 1 if the log is behind that, dropping
+    // every record it holds, which the caller must hold durably already. Must
+    // not run concurrently with appends or checkpoints.
+    //
+    // @throws std::system_error if the log cannot be emptied.
+    void start_after(uint64_t lsn);
+
+    // Lets the log drop every record up to lsn, which the caller has made
+    // durable elsewhere. The records are dropped in the background; until
+    // then, and after a crash, replay still passes them to its callback.
+    // Safe to call from any thread.
+    void checkpoint(uint64_t lsn);
+
+    [[nodiscard]] Stats stats() const;
+
+    void handle(LogAppend &append);
+
+private:
+    static constexpr size_t kRecordHeaderSize = 16;
+
+    struct Group {
+        std::string buffer;
+        std::vector<Promise<uint64_t>> waiters;
+        uint64_t last_lsn = 0;
+    };
+
+    // Intact prefix of a log file
+    struct Extent {
+        uint64_t size = 0;
+        uint64_t first_lsn = 0;
+        uint64_t last_lsn = 0;
+    };
+
+    static Extent scan(int fd, const std::function<void(uint64_t, std::string_view)> &f);
+
+    void sync_loop();
+
+    // Whether the file holds records up to the newest checkpoint besides its
+    // last one, and that checkpoint has not failed. Called with m_mutex held.
+    [[nodiscard]] bool checkpoint_due() const;
+
+    // A copy of the log without its first dropped bytes, renamed over it
+    struct Rewrite {
+        int fd = -1;
+        uint64_t dropped = 0;
+    };
+
+    // Copies the records after lsn, which must be before the last record, to
+    // a new file and renames it over the log. Called on the sync thread.
+    //
+    // @throws std::system_error if the new log cannot be written; the log is
+    // left as it was.
+    Rewrite rewrite(uint64_t lsn);
+
+    // Makes the rename durable and appends to fd from now on.
+    //
+    // @throws std::system_error if that fails, leaving the log unusable.
+    void replace(int fd);
+
+    // Writes and syncs one group; returns the error that failed it, if any.
+    std::exception_ptr write_group(const Group &group);
+
+    // Adjusts the batching window after a group; see the class comment.
+    void adapt_window(size_t records, size_t joined_while_waiting, std::chrono::nanoseconds sync_time);
+
+    std::string m_path;
+    Options m_options;
+    int m_fd = -1;
+
+    // Owned by the actor
+    uint64_t m_next_lsn = 1;
+
+    // Shared between the actor and the sync thread
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    Group m_pending;
+    std::exception_ptr m_error;
+    Stats m_stats;
+    bool m_stopping = false;
+    // Newest checkpoint asked for, and the newest that could not be written
+    uint64_t m_checkpoint = 0;
+    uint64_t m_failed_checkpoint = 0;
+    // Sequence number of the first record in the file, 0 if it is empty
+    uint64_t m_first_lsn = 0;
+
+    // Owned by the sync thread
+    std::chrono::nanoseconds m_window{0};
+    std::chrono::nanoseconds m_sync_time{0};
+    std::string m_spare;
+
+    std::atomic<uint64_t> m_durable_lsn{0};
+    std::thread m_sync_thread;
+};
+
+#endif //FLOWDB_WAL_H
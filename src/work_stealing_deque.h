@@ -0,0 +1,144 @@
+#ifndef FLOWDB_WORK_STEALING_DEQUE_H
+#define FLOWDB_WORK_STEALING_DEQUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Chase-Lev work-stealing deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13).
+// The owning thread pushes and pops at the bottom; any other thread may steal
+// from the top. Elements must be trivially copyable (the pool stores pointers).
+template<typename T>
+class WorkStealingDeque {
+    static_assert(std::is_trivially_copyable_v<T>, "WorkStealingDeque stores trivially copyable values");
+
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256) : m_top(0), m_bottom(0) {
+        auto array = std::make_unique<Array>(capacity);
+        m_array.store(array.get(), std::memory_order_relaxed);
+        m_arrays.push_back(std::move(array));
+    }
+
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    // Pushes an element at the bottom. Only the owning thread may call this.
+    void push(T value) {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        int64_t top = m_top.load(std::memory_order_acquire);
+        Array *array = m_array.load(std::memory_order_relaxed);
+        if (bottom - top > array->capacity() - 1) {
+            array = grow(array, bottom, top);
+        }
+        array->put(bottom, value);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    // Pops an element from the bottom. Only the owning thread may call this.
+    bool pop(T &out) {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        Array *array = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = m_top.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            // Deque was empty
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+        out = array->get(bottom);
+        if (top == bottom) {
+            // Last element: race against concurrent thieves for it
+            bool won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                                     std::memory_order_relaxed);
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Steals an element from the top. Any thread may call this.
+    bool steal(T &out) {
+        int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = m_bottom.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return false;
+        }
+        Array *array = m_array.load(std::memory_order_acquire);
+        T value = array->get(top);
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            // Lost the race against the owner or another thief
+            return false;
+        }
+        out = value;
+        return true;
+    }
+
+    // Approximate number of queued elements; exact only when called by the owner.
+    [[nodiscard]] int64_t size() const {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        int64_t top = m_top.load(std::memory_order_relaxed);
+        return bottom > top ? bottom - top : 0;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return size() == 0;
+    }
+
+private:
+    class Array {
+    public:
+        explicit Array(int64_t capacity) : m_capacity(capacity), m_mask(capacity - 1),
+                                           m_slots(new std::atomic<T>[capacity]) {}
+
+        [[nodiscard]] int64_t capacity() const {
+            return m_capacity;
+        }
+
+        void put(int64_t index, T value) {
+            m_slots[index & m_mask].store(value, std::memory_order_relaxed);
+        }
+
+        T get(int64_t index) const {
+            return m_slots[index & m_mask].load(std::memory_order_relaxed);
+        }
+
+    private:
+        int64_t m_capacity;
+        int64_t m_mask;
+        std::unique_ptr<std::atomic<T>[]> m_slots;
+    };
+
+    // Doubles the ring buffer. Old buffers are kept alive until the deque is
+    // destroyed because a concurrent thief may still be reading from them.
+    Array *grow(Array *old_array, int64_t bottom, int64_t top) {
+        auto array = std::make_unique<Array>(old_array->capacity() * 2);
+        for (int64_t i = top; i != bottom; ++i) {
+            array->put(i, old_array->get(i));
+        }
+        Array *raw = array.get();
+        m_arrays.push_back(std::move(array));
+        m_array.store(raw, std::memory_order_release);
+        return raw;
+    }
+
+    // Index of the oldest element, advanced by thieves
+    alignas(64) std::atomic<int64_t> m_top;
+
+    // Index one past the newest element, owned by the pushing thread
+    alignas(64) std::atomic<int64_t> m_bottom;
+
+    // Current ring buffer
+    std::atomic<Array *> m_array;
+
+    // Every ring buffer ever allocated, including retired ones
+    std::vector<std::unique_ptr<Array>> m_arrays;
+};
+
+#endif //FLOWDB_WORK_STEALING_DEQUE_H
@@ -0,0 +1,18 @@
+#ifndef FLOWDB_CHECK_H
+#define FLOWDB_CHECK_H
+
+#include <cstdio>
+#include <cstdlib>
+
+// Fails the test with the condition and where it was checked. Unlike assert()
+// it is not compiled out by NDEBUG, so the tests check the same things in
+// every build type.
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::exit(1); \
+        } \
+    } while (false)
+
+#endif //FLOWDB_CHECK_H
@@ -0,0 +1,78 @@
+// Checks that the conflict set answers like a per-key history while keeping
+// the fewest steps that describe it.
+
+#include "check.h"
+#include "conflict_set.h"
+#include <algorithm>
+#include <array>
+#include <random>
+#include <string>
+
+namespace {
+
+// Writes of ranges that meet or nest merge into the steps they share a
+// version with.
+void adjacent_writes_merge() {
+    ConflictSet set;
+    set.insert("a", "c", 1);
+    set.insert("c", "e", 1);
+    // [a, e) at 1, and 0 from e
+    CHECK(set.size() == 2);
+    set.insert("b", "d", 2);
+    CHECK(set.size() == 4);
+    CHECK(set.max_version("a", "b") == 1);
+    CHECK(set.max_version("a", "bb") == 2);
+    CHECK(set.max_version("d", "z") == 1);
+    set.insert("a", "e", 3);
+    CHECK(set.size() == 2);
+    set.insert("e", "g", 3);
+    CHECK(set.size() == 2);
+    CHECK(set.max_version("", "a") == 0);
+    CHECK(set.max_version("f", "z") == 3);
+    CHECK(set.max_version("g", "z") == 0);
+
+    set.forget_before(4);
+    CHECK(set.size() == 0);
+    CHECK(set.max_version("", "z") == 0);
+}
+
+// Random writes over single-letter ranges, against a version per letter:
+// every query agrees, and there is a step exactly where the version changes.
+void matches_per_key_history() {
+    constexpr size_t kLetters = 26;
+    std::minstd_rand random(7);
+    ConflictSet set;
+    std::array<Version, kLetters> history{};
+    auto letter = [](size_t i) { return std::string(1, static_cast<char>('a' + i)); };
+    for (Version version = 1; version <= 2000; version++) {
+        size_t begin = random() % kLetters;
+        size_t end = begin + 1 + random() % std::min<size_t>(4, kLetters - begin);
+        // Rewriting at the newest version makes equal neighbours common
+        Version written = random() % 3 == 0 ? version - 1 : version;
+        written = std::max(written, *std::max_element(history.begin(), history.end()));
+        set.insert(letter(begin), letter(end), written);
+        std::fill(history.begin() + static_cast<std::ptrdiff_t>(begin),
+                  history.begin() + static_cast<std::ptrdiff_t>(end), written);
+
+        size_t steps = 0;
+        for (size_t i = 0; i < kLetters; i++) {
+            steps += history[i] != (i == 0 ? 0 : history[i - 1]);
+        }
+        steps += history[kLetters - 1] != 0;
+        CHECK(set.size() == steps);
+        size_t from = random() % kLetters;
+        size_t to = from + 1 + random() % (kLetters - from);
+        Version expected = *std::max_element(history.begin() + static_cast<std::ptrdiff_t>(from),
+                                             history.begin() + static_cast<std::ptrdiff_t>(to));
+        CHECK(set.max_version(letter(from), letter(to)) == expected);
+    }
+}
+
+} // namespace
+
+int main() {
+    adjacent_writes_merge();
+    matches_per_key_history();
+    std::printf("conflict_set_test passed\n");
+    return 0;
+}
@@ -0,0 +1,147 @@
+// Checks the flow control of server sessions against a storage actor whose
+// mailbox is much smaller than what one connection sends it.
+
+#include "check.h"
+#include "frame.h"
+#include "frame_session.h"
+#include "message.h"
+#include "runtime.h"
+#include "server.h"
+#include "storage.h"
+#include "storage_protocol.h"
+#include "storage_service.h"
+#include <boost/asio.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t kMaxBatch = 16;
+
+struct Response {
+    FrameHeader header;
+    std::string payload;
+};
+
+// A storage server on a loopback port whose actor takes two messages at a time
+class Fixture {
+public:
+    Fixture()
+            : m_server({tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)}, 1,
+                       [this](size_t) { return make_storage_handler(m_storage); }, options()),
+              m_runtime(1) {
+        m_storage = m_runtime.create_actor<StorageActor>();
+        m_storage->set_mailbox_capacity(2, ActorBase::Overflow::Fail);
+        m_server.start();
+        m_socket.connect(m_server.endpoints().front());
+    }
+
+    ~Fixture() {
+        m_socket.close();
+        m_server.stop();
+        m_runtime.stop();
+    }
+
+    void send(const std::string &frames) {
+        boost::asio::write(m_socket, boost::asio::buffer(frames));
+    }
+
+    Response receive() {
+        char header[kFrameHeaderSize];
+        boost::asio::read(m_socket, boost::asio::buffer(header));
+        Response response{decode_header(header), {}};
+        response.payload.resize(response.header.length);
+        boost::asio::read(m_socket, boost::asio::buffer(response.payload));
+        return response;
+    }
+
+private:
+    static FrameSession::Options options() {
+        FrameSession::Options options;
+        options.max_in_flight = 64;
+        options.max_batch = kMaxBatch;
+        return options;
+    }
+
+    Server m_server;
+    Runtime m_runtime;
+    std::shared_ptr<StorageActor> m_storage;
+    boost::asio::io_context m_io_context;
+    tcp::socket m_socket{m_io_context};
+};
+
+std::string batch_of_sets(size_t first, size_t count) {
+    MessageBuilder builder;
+    for (size_t i = first; i < first + count; i++) {
+        builder.add_u64(static_cast<uint64_t>(Opcode::Set))
+                .add(encode_set("key" + std::to_string(i), "value").flatten());
+    }
+    return builder.finish().flatten();
+}
+
+// Requests that find the mailbox full wait for room rather than fail, single
+// or batched, and none is served twice.
+void full_mailbox_slows_down() {
+    Fixture fixture;
+    constexpr size_t kFrames = 400;
+    constexpr size_t kBatches = 40;
+    std::string frames;
+    for (size_t i = 0; i < kFrames; i++) {
+        append_frame(frames, Opcode::Set, 0, i, encode_set("key" + std::to_string(i), "value").flatten());
+    }
+    for (size_t i = 0; i < kBatches; i++) {
+        append_frame(frames, Opcode::Batch, 0, kFrames + i, batch_of_sets(kFrames + i * kMaxBatch, kMaxBatch));
+    }
+    fixture.send(frames);
+
+    std::vector<bool> answered(kFrames + kBatches);
+    for (size_t i = 0; i < kFrames + kBatches; i++) {
+        Response response = fixture.receive();
+        CHECK(response.header.flags == FrameHeader::kResponse);
+        CHECK(response.header.request_id < answered.size() && !answered[response.header.request_id]);
+        answered[response.header.request_id] = true;
+        if (response.header.opcode == Opcode::Batch) {
+            MessageView parts(response.payload);
+            CHECK(parts.size() == 2 * kMaxBatch);
+            for (size_t j = 0; j < parts.size(); j += 2) {
+                CHECK(parts.u64(j) == 0);
+            }
+        }
+    }
+
+    std::string range;
+    append_frame(range, Opcode::GetRange, 0, 0, encode_get_range("key", "kez", 100'000).flatten());
+    fixture.send(range);
+    Response response = fixture.receive();
+    CHECK(response.header.flags == FrameHeader::kResponse);
+    CHECK(decode_get_range_response(response.payload).size() == kFrames + kBatches * kMaxBatch);
+}
+
+// A batch carrying more requests than the limit fails whole, and the
+// connection goes on.
+void oversized_batch_fails() {
+    Fixture fixture;
+    std::string frames;
+    append_frame(frames, Opcode::Batch, 0, 1, batch_of_sets(0, kMaxBatch + 1));
+    append_frame(frames, Opcode::Get, 0, 2, encode_get("key0").flatten());
+    fixture.send(frames);
+
+    Response rejected = fixture.receive();
+    CHECK(rejected.header.request_id == 1);
+    CHECK(rejected.header.flags & FrameHeader::kError);
+    CHECK(rejected.payload == "Batch too large");
+    Response get = fixture.receive();
+    CHECK(get.header.request_id == 2);
+    CHECK(get.header.flags == FrameHeader::kResponse);
+    CHECK(!decode_get_response(get.payload));
+}
+
+} // namespace
+
+int main() {
+    full_mailbox_slows_down();
+    oversized_batch_fails();
+    std::printf("frame_session_test passed\n");
+    return 0;
+}
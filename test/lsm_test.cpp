@@ -0,0 +1,123 @@
+// Checks the LSM tree's behaviour across flushes, compactions and reopening.
+
+#include "check.h"
+#include "lsm.h"
+#include "scratch_directory.h"
+#include "thread_pool.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace {
+
+std::string key(int i) {
+    char buffer[16];
+    std::snprintf(buffer, sizeof(buffer), "key%06d", i);
+    return buffer;
+}
+
+size_t tables(const LsmTree::Metrics &metrics) {
+    size_t total = 0;
+    for (size_t count: metrics.level_tables) {
+        total += count;
+    }
+    return total;
+}
+
+// Every level above the last is over budget as soon as it holds a byte, so
+// all data sinks to the bottom level
+LsmTree::Options sinking() {
+    LsmTree::Options options;
+    options.memtable_bytes = 4 << 10;
+    options.table_bytes = 8 << 10;
+    options.l0_compaction_trigger = 1;
+    options.level1_bytes = 1;
+    options.level_multiplier = 1;
+    return options;
+}
+
+// Tombstones are carried down while a deeper level may still hold the key,
+// and dropped, with what they cleared, once they reach the bottom.
+void tombstones_dropped_at_bottom() {
+    ScratchDirectory directory("lsm_tombstones");
+    ThreadPool pool(1);
+    LsmTree tree(directory.path("data"), pool, sinking());
+    constexpr int kKeys = 1000;
+    for (int i = 0; i < kKeys; i++) {
+        tree.set(key(i), "value");
+    }
+    tree.flush();
+    tree.wait_for_background();
+    LsmTree::Metrics metrics = tree.metrics();
+    CHECK(metrics.level_tables[LsmTree::kLevels - 1] > 0);
+    CHECK(tables(metrics) == metrics.level_tables[LsmTree::kLevels - 1]);
+
+    CHECK(tree.clear_range(key(0), key(kKeys)) == kKeys);
+    tree.flush();
+    // Wherever they are on their way down, the tombstones hide the values
+    CHECK(!tree.get(key(0)) && !tree.get(key(kKeys - 1)));
+    tree.wait_for_background();
+    std::vector<KeyValue> rest;
+    CHECK(tree.range(key(0), key(kKeys), kKeys, rest) == 0);
+    CHECK(tables(tree.metrics()) == 0);
+}
+
+// A reopened tree finds the tables of every level, the values and clears in
+// them, and the log position of the last flush, and removes tables the
+// MANIFEST does not list.
+void manifest_reload() {
+    ScratchDirectory directory("lsm_manifest");
+    std::string path = directory.path("data");
+    LsmTree::Options options;
+    options.memtable_bytes = 4 << 10;
+    options.table_bytes = 8 << 10;
+    options.l0_compaction_trigger = 2;
+    options.level1_bytes = 16 << 10;
+    options.level_multiplier = 2;
+    constexpr int kKeys = 3000;
+    LsmTree::Metrics before;
+    {
+        ThreadPool pool(1);
+        LsmTree tree(path, pool, options);
+        for (int i = 0; i < kKeys; i++) {
+            tree.set_log_position(static_cast<uint64_t>(i + 1));
+            tree.set(key(i), "value " + std::to_string(i));
+        }
+        for (int i = 0; i < kKeys; i += 3) {
+            tree.set_log_position(static_cast<uint64_t>(kKeys + i + 1));
+            tree.clear(key(i));
+        }
+        tree.flush();
+        tree.wait_for_background();
+        before = tree.metrics();
+        CHECK(tree.durable_log_position() == kKeys + kKeys - 2);
+    }
+    size_t levels_used = 0;
+    for (size_t count: before.level_tables) {
+        levels_used += count > 0;
+    }
+    CHECK(levels_used > 1);
+
+    // Left behind by a flush that crashed before the MANIFEST was written
+    std::ofstream(path + "/999999.sst") << "partial";
+
+    ThreadPool pool(1);
+    LsmTree tree(path, pool, options);
+    CHECK(tree.durable_log_position() == kKeys + kKeys - 2);
+    CHECK(tree.metrics().level_tables == before.level_tables);
+    CHECK(!std::filesystem::exists(path + "/999999.sst"));
+    for (int i = 0; i < kKeys; i++) {
+        auto value = tree.get(key(i));
+        CHECK(i % 3 == 0 ? !value : value == "value " + std::to_string(i));
+    }
+}
+
+} // namespace
+
+int main() {
+    tombstones_dropped_at_bottom();
+    manifest_reload();
+    std::printf("lsm_test passed\n");
+    return 0;
+}
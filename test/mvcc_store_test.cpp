@@ -0,0 +1,64 @@
+// Checks that the multi-version store drops the versions no read inside the
+// MVCC window can see, and only those.
+
+#include "check.h"
+#include "mvcc.h"
+#include "mvcc_store.h"
+#include <string>
+#include <vector>
+
+namespace {
+
+bool too_old(const MultiVersionStore &store, std::string_view key, Version version) {
+    try {
+        (void) store.get(key, version);
+    } catch (const TransactionFailed &e) {
+        return e.code() == TransactionError::TooOld;
+    }
+    return false;
+}
+
+void versions_outside_the_window_are_collected() {
+    MultiVersionStore store(10);
+    for (Version version = 1; version <= 100; version++) {
+        std::vector<Mutation> mutations{{Mutation::Type::Set, "hot", std::to_string(version)}};
+        if (version == 1) {
+            mutations.push_back({Mutation::Type::Set, "cold", "c"});
+        } else if (version == 5) {
+            mutations.push_back({Mutation::Type::Set, "gone", "x"});
+        } else if (version == 6) {
+            mutations.push_back({Mutation::Type::Clear, "gone", {}});
+        }
+        store.apply(version, mutations);
+    }
+    CHECK(store.oldest_version() == 90);
+    // "hot" keeps the version visible at 90 and the ten after it, "cold" its
+    // only version, and "gone", cleared long ago, nothing
+    CHECK(store.size() == 2);
+    CHECK(store.versions() == 12);
+    CHECK(store.get("hot", 90) == "90");
+    CHECK(store.get("hot", 95) == "95");
+    CHECK(store.get("cold", 90) == "c");
+    CHECK(!store.get("gone", 90));
+    CHECK(too_old(store, "hot", 89));
+
+    // Cleared keys stay readable until the clear leaves the window
+    store.apply(101, {{Mutation::Type::ClearRange, "", "\xff"}});
+    CHECK(store.size() == 2);
+    CHECK(store.get("cold", 100) == "c");
+    CHECK(!store.get("cold", 101));
+    store.apply(110, {});
+    CHECK(store.size() == 2);
+    CHECK(store.get("cold", 100) == "c");
+    store.apply(111, {});
+    CHECK(store.size() == 0);
+    CHECK(store.versions() == 0);
+}
+
+} // namespace
+
+int main() {
+    versions_outside_the_window_are_collected();
+    std::printf("mvcc_store_test passed\n");
+    return 0;
+}
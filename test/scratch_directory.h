@@ -0,0 +1,36 @@
+#ifndef FLOWDB_SCRATCH_DIRECTORY_H
+#define FLOWDB_SCRATCH_DIRECTORY_H
+
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+// A fresh, empty directory under the system's temporary directory, removed
+// with everything in it when the object goes.
+class ScratchDirectory {
+public:
+    explicit ScratchDirectory(const std::string &name)
+            : m_path(std::filesystem::temp_directory_path() /
+                     ("flowdb_" + name + "_" + std::to_string(::getpid()))) {
+        std::filesystem::remove_all(m_path);
+        std::filesystem::create_directories(m_path);
+    }
+
+    ScratchDirectory(const ScratchDirectory &) = delete;
+
+    ScratchDirectory &operator=(const ScratchDirectory &) = delete;
+
+    ~ScratchDirectory() {
+        std::error_code ec;
+        std::filesystem::remove_all(m_path, ec);
+    }
+
+    [[nodiscard]] std::string path(const std::string &name) const {
+        return (m_path / name).string();
+    }
+
+private:
+    std::filesystem::path m_path;
+};
+
+#endif //FLOWDB_SCRATCH_DIRECTORY_H
@@ -0,0 +1,174 @@
+// Checks that shard maps change in one place only: servers take the maps the
+// coordinator installs, never an older one, and split where it tells them.
+
+#include "check.h"
+#include "connection_pool.h"
+#include "local_shards.h"
+#include "runtime.h"
+#include "server.h"
+#include "shard_coordinator.h"
+#include "shard_map.h"
+#include "storage.h"
+#include "storage_client.h"
+#include "storage_service.h"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+tcp::endpoint loopback(uint16_t port) {
+    return {boost::asio::ip::address_v4::loopback(), port};
+}
+
+// Loopback ports the OS picks, held by bound sockets so nothing else takes
+// them. A server binds the same port next to its socket, as both allow port
+// reuse; the socket never listens, so it takes no connections.
+std::vector<tcp::acceptor> reserve_ports(boost::asio::io_context &io_context, size_t count) {
+    std::vector<tcp::acceptor> reserved;
+    for (size_t i = 0; i < count; i++) {
+        tcp::acceptor acceptor(io_context);
+        acceptor.open(tcp::v4());
+        acceptor.set_option(tcp::acceptor::reuse_address(true));
+        acceptor.set_option(reuse_port(true));
+        acceptor.bind(loopback(0));
+        reserved.push_back(std::move(acceptor));
+    }
+    return reserved;
+}
+
+std::vector<tcp::endpoint> endpoints_of(const std::vector<tcp::acceptor> &acceptors) {
+    std::vector<tcp::endpoint> endpoints;
+    for (const auto &acceptor: acceptors) {
+        endpoints.push_back(acceptor.local_endpoint());
+    }
+    return endpoints;
+}
+
+// A storage server on a loopback port, sharded with the cluster's map
+struct StorageServer {
+    StorageServer(Runtime &runtime, const ShardMap &map, const tcp::endpoint &endpoint,
+                  LocalShards::Options options)
+            : storage(runtime.create_actor<StorageActor>()),
+              shards(std::make_shared<LocalShards>(map, std::vector<tcp::endpoint>{endpoint}, options)),
+              server({endpoint}, 1, [this](size_t) { return make_storage_handler(storage, shards); }) {
+        server.start();
+    }
+
+    ~StorageServer() {
+        server.stop();
+    }
+
+    std::shared_ptr<StorageActor> storage;
+    std::shared_ptr<LocalShards> shards;
+    Server server;
+};
+
+// Two servers, the first serving every key, a coordinator and a client. The
+// map names the servers before they listen, so their ports are reserved first.
+struct Fixture {
+    explicit Fixture(LocalShards::Options options)
+            : runtime(1), work(boost::asio::make_work_guard(io_context)), ports(reserve_ports(io_context, 2)),
+              endpoints(endpoints_of(ports)), map({endpoints[0]}) {
+        for (const auto &endpoint: endpoints) {
+            servers.push_back(std::make_unique<StorageServer>(runtime, map, endpoint, options));
+        }
+        pool.emplace(io_context, endpoints, 0, 2);
+        StorageClient::Options client_options;
+        client_options.hedge_reads = false;
+        client.emplace(*pool, client_options);
+        coordinator.emplace(io_context, *client, map, ShardCoordinator::Options{std::chrono::milliseconds(20)});
+        io_thread = std::thread([this] { io_context.run(); });
+    }
+
+    ~Fixture() {
+        coordinator->stop();
+        client->close().get();
+        io_context.stop();
+        io_thread.join();
+        coordinator.reset();
+        client.reset();
+        pool.reset();
+        servers.clear();
+        runtime.stop();
+    }
+
+    Runtime runtime;
+    boost::asio::io_context io_context;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+    std::vector<tcp::acceptor> ports;
+    std::vector<tcp::endpoint> endpoints;
+    ShardMap map;
+    std::vector<std::unique_ptr<StorageServer>> servers;
+    std::optional<ConnectionPool> pool;
+    std::optional<StorageClient> client;
+    std::optional<ShardCoordinator> coordinator;
+    std::thread io_thread;
+};
+
+LocalShards::Options no_load_splits() {
+    LocalShards::Options options;
+    options.split_requests_per_second = 0;
+    return options;
+}
+
+// Splits and moves reach every server with the next version, and the client
+// follows the move.
+void splits_and_moves_are_installed() {
+    Fixture fixture(no_load_splits());
+    auto map = fixture.coordinator->split("m").get();
+    CHECK(map->size() == 2 && map->version() == 2);
+    map = fixture.coordinator->move("m", {fixture.endpoints[1]}).get();
+    CHECK(map->version() == 3 && (*map)[1].team == std::vector<tcp::endpoint>{fixture.endpoints[1]});
+    for (const auto &server: fixture.servers) {
+        CHECK(server->shards->map()->version() == 3);
+    }
+
+    fixture.client->set("a", "first").get();
+    fixture.client->set("z", "second").get();
+    CHECK(fixture.client->shard_map()->version() == 3);
+    CHECK(fixture.client->get("z").get() == "second");
+    CHECK(fixture.client->get("a").get() == "first");
+
+    // An older map is ignored
+    CHECK(!fixture.servers[1]->shards->install(ShardMap({fixture.endpoints[0]})));
+    CHECK(fixture.servers[1]->shards->map()->version() == 3);
+}
+
+// A busy shard is split where its server says, by the coordinator only.
+void busy_shards_are_split() {
+    LocalShards::Options options;
+    options.split_requests_per_second = 1;
+    options.sample_interval = 1;
+    options.window = std::chrono::milliseconds(10);
+    Fixture fixture(options);
+    fixture.coordinator->start();
+    for (int i = 0; i < 2000 && fixture.coordinator->load_splits() == 0; i++) {
+        fixture.client->set("key" + std::to_string(i % 100), "value").get();
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    CHECK(fixture.coordinator->load_splits() > 0);
+    auto map = fixture.coordinator->map();
+    CHECK(map->size() > 1);
+    // The servers have the map once its publish has landed
+    for (int i = 0; i < 1000 && fixture.servers[0]->shards->map()->version() < map->version(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(fixture.servers[0]->shards->map()->version() >= map->version());
+    CHECK(fixture.servers[0]->shards->map()->size() > 1);
+}
+
+} // namespace
+
+int main() {
+    splits_and_moves_are_installed();
+    busy_shards_are_split();
+    std::printf("shard_coordinator_test passed\n");
+    return 0;
+}
@@ -0,0 +1,66 @@
+// Checks optimistic transactions end to end through the resolver and the
+// versioned storage actor.
+
+#include "check.h"
+#include "resolver.h"
+#include "runtime.h"
+#include "transaction.h"
+#include "versioned_storage.h"
+#include <chrono>
+#include <memory>
+#include <thread>
+
+namespace {
+
+// A transaction started after storage has gone a whole MVCC window without a
+// commit still gets a read version inside the window, so it commits the first
+// time.
+void commits_after_idle() {
+    Runtime runtime(2);
+    auto storage = runtime.create_actor<VersionedStorage>(1000);
+    auto resolver = runtime.create_actor<Resolver>(storage, Resolver::Options{1000});
+    for (int round = 0; round < 3; round++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        Transaction transaction(storage, resolver);
+        transaction.set("k", "v" + std::to_string(round));
+        Version committed = transaction.commit().get();
+
+        Transaction reader(storage, resolver);
+        CHECK(reader.read_version().get() >= committed);
+        CHECK(reader.get("k").get() == "v" + std::to_string(round));
+    }
+    CHECK(resolver->stats().too_old == 0);
+    runtime.stop();
+}
+
+// Of two transactions that read the same key at one read version, only the
+// first to commit a write succeeds.
+void conflicting_writes() {
+    Runtime runtime(2);
+    auto storage = runtime.create_actor<VersionedStorage>();
+    auto resolver = runtime.create_actor<Resolver>(storage);
+    Transaction first(storage, resolver);
+    Transaction second(storage, resolver);
+    CHECK(!first.get("counter").get());
+    CHECK(!second.get("counter").get());
+    first.set("counter", "1");
+    second.set("counter", "1");
+    first.commit().get();
+    bool conflicted = false;
+    try {
+        second.commit().get();
+    } catch (const TransactionFailed &e) {
+        conflicted = e.code() == TransactionError::NotCommitted;
+    }
+    CHECK(conflicted);
+    runtime.stop();
+}
+
+} // namespace
+
+int main() {
+    commits_after_idle();
+    conflicting_writes();
+    std::printf("transaction_test passed\n");
+    return 0;
+}
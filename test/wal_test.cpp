@@ -0,0 +1,234 @@
+// Checks recovery from the write-ahead log: a torn tail, checkpoints, and
+// replay into a storage actor whose store already holds part of the log.
+
+#include "check.h"
+#include "lsm.h"
+#include "runtime.h"
+#include "scratch_directory.h"
+#include "storage.h"
+#include "wal.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// The sequence numbers replay yields
+std::vector<uint64_t> replayed(const std::string &path) {
+    Runtime runtime(1);
+    auto log = runtime.create_actor<WriteAheadLog>(path);
+    std::vector<uint64_t> lsns;
+    log->replay([&](uint64_t lsn, std::string_view) { lsns.push_back(lsn); });
+    runtime.stop();
+    return lsns;
+}
+
+void wait_for_truncation(const WriteAheadLog &log) {
+    for (int i = 0; i < 1000 && log.stats().truncated_bytes == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(log.stats().truncated_bytes > 0);
+}
+
+// A crash in the middle of a write leaves a partial record, and one caught
+// before its data reached the disk a record whose bytes do not match its
+// checksum. Replay stops before either, and the next record takes its place.
+void torn_tail_replay() {
+    ScratchDirectory directory("wal_torn");
+    std::string path = directory.path("log");
+    auto append = [&](int count) {
+        Runtime runtime(1);
+        auto log = runtime.create_actor<WriteAheadLog>(path);
+        uint64_t lsn = 0;
+        for (int i = 0; i < count; i++) {
+            lsn = log->append("record " + std::to_string(i)).get();
+        }
+        runtime.stop();
+        return lsn;
+    };
+    CHECK(append(10) == 10);
+
+    // A partial header and record
+    std::ofstream(path, std::ios::binary | std::ios::app) << std::string("\x12\x34\x56\x78\x0a\x00", 6);
+    CHECK(replayed(path).size() == 10);
+    CHECK(append(1) == 11);
+    CHECK(replayed(path).back() == 11);
+
+    // The last byte of record 12, flipped
+    CHECK(append(1) == 12);
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekg(-1, std::ios::end);
+        char last = static_cast<char>(file.get());
+        file.seekp(-1, std::ios::end);
+        file.put(static_cast<char>(last ^ 1));
+    }
+    std::vector<uint64_t> lsns = replayed(path);
+    CHECK(lsns.size() == 11 && lsns.back() == 11);
+    CHECK(append(1) == 12);
+    lsns = replayed(path);
+    CHECK(lsns.size() == 12 && lsns.front() == 1 && lsns.back() == 12);
+}
+
+// A checkpoint drops the records up to it, and numbering carries on after the
+// log is reopened.
+void checkpoint_drops_records() {
+    ScratchDirectory directory("wal_checkpoint");
+    std::string path = directory.path("log");
+    {
+        Runtime runtime(1);
+        auto log = runtime.create_actor<WriteAheadLog>(path);
+        for (int i = 0; i < 100; i++) {
+            log->append("record " + std::to_string(i)).get();
+        }
+        log->checkpoint(60);
+        wait_for_truncation(*log);
+        CHECK(log->append("after").get() == 101);
+        runtime.stop();
+    }
+    std::vector<uint64_t> lsns = replayed(path);
+    CHECK(lsns.size() == 41);
+    CHECK(lsns.front() == 61 && lsns.back() == 101);
+
+    // Past the end, the last record is kept until the next one follows it
+    {
+        Runtime runtime(1);
+        auto log = runtime.create_actor<WriteAheadLog>(path);
+        log->checkpoint(1000);
+        wait_for_truncation(*log);
+        CHECK(replayed(path) == std::vector<uint64_t>{101});
+        CHECK(log->append("next").get() == 102);
+        runtime.stop();
+    }
+    CHECK(replayed(path) == std::vector<uint64_t>{102});
+}
+
+// A checkpoint that cannot be written leaves the log whole and taking
+// appends, and the next checkpoint is written.
+void failed_checkpoint_keeps_log() {
+    ScratchDirectory directory("wal_failed_checkpoint");
+    std::string path = directory.path("log");
+    Runtime runtime(1);
+    auto log = runtime.create_actor<WriteAheadLog>(path);
+    for (int i = 0; i < 10; i++) {
+        log->append("record " + std::to_string(i)).get();
+    }
+    // The copy cannot be created where a directory is in the way
+    std::filesystem::create_directory(path + ".tmp");
+    log->checkpoint(5);
+    for (int i = 0; i < 1000 && log->stats().failed_checkpoints == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(log->stats().failed_checkpoints == 1);
+    CHECK(log->append("after").get() == 11);
+    CHECK(log->stats().truncated_bytes == 0);
+
+    std::filesystem::remove(path + ".tmp");
+    log->checkpoint(6);
+    wait_for_truncation(*log);
+    CHECK(log->append("next").get() == 12);
+    runtime.stop();
+    std::vector<uint64_t> lsns = replayed(path);
+    CHECK(lsns.size() == 6 && lsns.front() == 7 && lsns.back() == 12);
+}
+
+// With an LSM tree, the log shrinks as memtables are flushed, and reopening
+// replays only the writes the tables do not hold, into the right values.
+void storage_replays_after_flush() {
+    ScratchDirectory directory("wal_storage");
+    std::string path = directory.path("log");
+    std::string data = directory.path("data");
+    LsmTree::Options options;
+    options.memtable_bytes = 16 << 10;
+    constexpr int kKeys = 2000;
+    {
+        Runtime runtime(1);
+        ThreadPool background(1);
+        auto log = runtime.create_actor<WriteAheadLog>(path);
+        auto storage = runtime.create_actor<StorageActor>(std::make_unique<LsmTree>(data, background, options), log);
+        for (int round = 0; round < 2; round++) {
+            for (int i = 0; i < kKeys; i++) {
+                storage->set("key" + std::to_string(i), "value " + std::to_string(round)).get();
+            }
+        }
+        storage->clear("key0").get();
+        wait_for_truncation(*log);
+        runtime.stop();
+    }
+    CHECK(replayed(path).size() < 2 * kKeys);
+
+    Runtime runtime(1);
+    ThreadPool background(1);
+    auto log = runtime.create_actor<WriteAheadLog>(path);
+    auto storage = runtime.create_actor<StorageActor>(std::make_unique<LsmTree>(data, background, options), log);
+    CHECK(!storage->get("key0").get());
+    for (int i = 1; i < kKeys; i++) {
+        CHECK(storage->get("key" + std::to_string(i)).get() == "value 1");
+    }
+    runtime.stop();
+}
+
+// A memtable flushed before the log synced its writes leaves the store ahead
+// of the log. The writes after the crash are numbered past the store, so they
+// are replayed after the next one too.
+void store_ahead_of_log() {
+    ScratchDirectory directory("wal_store_ahead");
+    ScratchDirectory image("wal_store_ahead_image");
+    std::string path = directory.path("log");
+    std::string data = directory.path("data");
+    LsmTree::Options options;
+    options.memtable_bytes = 16 << 10;
+    constexpr int kKeys = 100;
+    {
+        Runtime runtime(1);
+        ThreadPool background(1);
+        auto log = runtime.create_actor<WriteAheadLog>(path);
+        auto storage = runtime.create_actor<StorageActor>(std::make_unique<LsmTree>(data, background, options), log);
+        for (int i = 0; i < kKeys; i++) {
+            storage->set("key" + std::to_string(i), "before").get();
+        }
+        runtime.stop();
+    }
+    // Closing flushed the memtable; the groups it held never reached the log
+    std::filesystem::remove(path);
+
+    {
+        Runtime runtime(1);
+        ThreadPool background(1);
+        auto log = runtime.create_actor<WriteAheadLog>(path);
+        auto storage = runtime.create_actor<StorageActor>(std::make_unique<LsmTree>(data, background, options), log);
+        for (int i = 0; i < kKeys / 2; i++) {
+            storage->set("key" + std::to_string(i), "after").get();
+        }
+        // What a crash would leave: the writes are in the log, not the tables
+        std::filesystem::copy(data, image.path("data"), std::filesystem::copy_options::recursive);
+        std::filesystem::copy_file(path, image.path("log"));
+        runtime.stop();
+    }
+
+    Runtime runtime(1);
+    ThreadPool background(1);
+    auto log = runtime.create_actor<WriteAheadLog>(image.path("log"));
+    auto storage = runtime.create_actor<StorageActor>(
+            std::make_unique<LsmTree>(image.path("data"), background, options), log);
+    for (int i = 0; i < kKeys; i++) {
+        CHECK(storage->get("key" + std::to_string(i)).get() == (i < kKeys / 2 ? "after" : "before"));
+    }
+    runtime.stop();
+}
+
+} // namespace
+
+int main() {
+    torn_tail_replay();
+    checkpoint_drops_records();
+    failed_checkpoint_keeps_log();
+    storage_replays_after_flush();
+    store_ahead_of_log();
+    std::printf("wal_test passed\n");
+    return 0;
+}